@@ -51,6 +51,9 @@ if system != 'Windows':
 sim_libraries = ['sundials_cvodes', 'sundials_nvecserial']
 if system != 'Windows':
     sim_libraries.append('m')
+if system == 'Linux':
+    # Shared memory functions (shm_open) are in librt on glibc < 2.34
+    sim_libraries.append('rt')
 cvodes_sim = Extension(
     'myokit_beta._sim._cvodessim_ext',
     sources=['src/myokit_beta/_sim/_cvodessim.c'],
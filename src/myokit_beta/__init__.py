@@ -68,6 +68,16 @@ del os, inspect, platform
 
 from ._sim import (
     _cvodessim_ext,
+    AnalyticProtocol,
+    BeatIndex,
+    CompressedArray,
+    compress,
+    decompress,
+    MappedTimeSeriesProtocol,
+    Monitor,
+    numa_nodes,
+    Pyramid,
+    run_batch,
     Simulation,
 )
 
@@ -116,9 +126,12 @@ def sum(a=10.345, b=2):
         the host CPU.  The engine is reusable for an arbitrary number of
         modules.
         """
-        # Create a target machine representing the host
+        # Create a target machine representing the host, including its CPU
+        # features (so that e.g. AVX2 and FMA instructions can be used)
         target = llvm.Target.from_default_triple()
-        target_machine = target.create_target_machine()
+        target_machine = target.create_target_machine(
+            cpu=llvm.get_host_cpu_name(),
+            features=llvm.get_host_cpu_features().flatten())
 
         # And an execution engine with an empty backing module
         backing_mod = llvm.parse_assembly("")
@@ -3,4 +3,11 @@
 This is the simulation module.
 """
 
+from ._analytic import AnalyticProtocol
+from ._batch import numa_nodes, run_batch
+from ._beats import BeatIndex
+from ._codec import CompressedArray, compress, decompress
 from ._cvodessim import Simulation
+from ._monitor import Monitor
+from ._pyramid import Pyramid
+from ._timeseries import MappedTimeSeriesProtocol
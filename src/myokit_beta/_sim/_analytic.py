@@ -0,0 +1,119 @@
+#
+# Pacing protocols made up of analytic waveforms, evaluated in C (see ASys in
+# pacing.h).
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import math
+
+# Component types, must match the ASys_ constants in pacing.h
+_CONSTANT = 0
+_RAMP = 1
+_SINE = 2
+_EXPONENTIAL = 3
+_CHIRP = 4
+
+
+class AnalyticProtocol(object):
+    """
+    A pacing protocol given by a sum of analytic waveforms, such as sine
+    waves, ramps, exponentials, and chirps.
+
+    Each waveform (or "component") is active from its ``start`` time for the
+    given ``duration`` (or indefinitely, if ``duration`` is ``None``), and the
+    pacing level at any time is the sum of all active components. For
+    example, a sinusoidal voltage-clamp protocol around a holding potential
+    can be created with::
+
+        p = AnalyticProtocol()
+        p.add_constant(-80)
+        p.add_sine(20, 0.001, start=1000, duration=5000)
+
+    The waveforms are evaluated directly during simulation, instead of being
+    approximated by a time-series or by many short events. Because the level
+    can only be non-smooth where a component starts or ends, the solver is
+    stopped and restarted at those times only.
+
+    In the formulas below, ``tau`` is the time since the component started.
+    """
+    def __init__(self):
+        self._components = []
+
+    def _add(self, kind, start, duration, a, b=0, c=0, d=0):
+        start = float(start)
+        if duration is None:
+            duration = 0
+        else:
+            duration = float(duration)
+            if duration <= 0:
+                raise ValueError('The duration must be positive.')
+        self._components.append((
+            kind, start, duration, float(a), float(b), float(c), float(d)))
+
+    def add_chirp(self, amplitude, f0, rate, phase=0, start=0, duration=None):
+        """
+        Adds a linear chirp
+        ``amplitude * sin(2 * pi * (f0 * tau + rate * tau**2 / 2) + phase)``,
+        with a frequency increasing from ``f0`` by ``rate`` per time unit.
+        """
+        self._add(_CHIRP, start, duration, amplitude, f0, rate, phase)
+
+    def add_constant(self, level, start=0, duration=None):
+        """ Adds a constant ``level`` (a step, if a duration is given). """
+        self._add(_CONSTANT, start, duration, level)
+
+    def add_exponential(self, amplitude, tau, start=0, duration=None):
+        """
+        Adds an exponential ``amplitude * exp(-t / tau)``, which decays for
+        positive ``tau`` and grows for negative ``tau``.
+        """
+        if float(tau) == 0:
+            raise ValueError('The time constant cannot be zero.')
+        self._add(_EXPONENTIAL, start, duration, amplitude, tau)
+
+    def add_ramp(self, level, slope, start=0, duration=None):
+        """ Adds a ramp ``level + slope * tau``. """
+        self._add(_RAMP, start, duration, level, slope)
+
+    def add_sine(self, amplitude, frequency, phase=0, start=0, duration=None):
+        """
+        Adds a sine wave ``amplitude * sin(2 * pi * frequency * tau + phase)``.
+        """
+        self._add(_SINE, start, duration, amplitude, frequency, phase)
+
+    def clone(self):
+        """ Returns a copy of this protocol. """
+        p = AnalyticProtocol()
+        p._components = list(self._components)
+        return p
+
+    def components(self):
+        """
+        Returns a list of tuples ``(type, start, duration, a, b, c, d)``
+        describing each component, as used by the C extension.
+        """
+        return list(self._components)
+
+    def __len__(self):
+        return len(self._components)
+
+    def pace(self, t):
+        """ Returns the pacing level at time ``t``. """
+        level = 0
+        for kind, start, duration, a, b, c, d in self._components:
+            if t < start or (duration > 0 and t >= start + duration):
+                continue
+            tau = t - start
+            if kind == _CONSTANT:
+                level += a
+            elif kind == _RAMP:
+                level += a + b * tau
+            elif kind == _SINE:
+                level += a * math.sin(2 * math.pi * b * tau + c)
+            elif kind == _EXPONENTIAL:
+                level += a * math.exp(-tau / b)
+            else:
+                level += a * math.sin(
+                    2 * math.pi * tau * (b + 0.5 * c * tau) + d)
+        return level
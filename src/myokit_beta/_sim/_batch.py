@@ -0,0 +1,268 @@
+#
+# Runs batches of simulations in parallel threads, with results that do not
+# depend on the number of threads or on the order in which jobs are run.
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import array
+import concurrent.futures
+import functools
+import glob
+import os
+import pickle
+import struct
+import threading
+
+import numpy as np
+
+import myokit
+
+
+def run_batch(simulation, jobs, n_threads=None, combine=None, verify=False,
+              placement=None):
+    """
+    Runs a batch of jobs on copies of a :class:`Simulation`, in parallel
+    threads, and returns their results.
+
+    Each entry in ``jobs`` is a function ``job(sim)`` that is called with a
+    fresh copy of ``simulation`` (in its current state) and returns a result,
+    for example::
+
+        def job(sim):
+            sim.set_constant('ikr.gKr', 0.05)
+            return sim.run(1000, log=['engine.time', 'membrane.V'])
+
+        logs = run_batch(s, [job_1, job_2, job_3], n_threads=8)
+
+    The results are returned as a list, in the same order as ``jobs``. Because
+    every job runs on its own simulation, and every result is stored at the
+    index of its job, the output does not depend on ``n_threads`` or on the
+    order in which the threads happen to run the jobs: running the same batch
+    with 8 or 64 threads gives bitwise identical results. Jobs should only
+    modify the simulation they are given, and should not share state with
+    other jobs.
+
+    If a function ``combine(a, b)`` is given, the results are reduced to a
+    single value instead, by combining them in job order (``combine`` is
+    applied to the results of jobs ``0`` and ``1``, then to that outcome and
+    the result of job ``2``, and so on). This happens after all jobs have
+    finished, so that floating point sums (for example) are independent of
+    scheduling.
+
+    ``n_threads``
+        The number of threads to use, or ``None`` to use one per CPU.
+    ``combine``
+        An optional function to reduce the results with, in job order.
+    ``verify``
+        Set to ``True`` to check that the results are reproducible: the batch
+        is then run a second time, in a single thread, and an exception is
+        raised if any result differs in any bit from the parallel run.
+    ``placement``
+        How to pin the worker threads to CPUs, see below.
+
+    If any job raises an exception, the exception raised by the first such
+    job (in job order) is raised once all jobs have finished.
+
+    By default, the operating system is free to move worker threads between
+    CPUs. On machines with several NUMA nodes (e.g. dual-socket nodes) this
+    can mean a thread runs on one node while its memory was allocated on the
+    other. To avoid this, worker threads can be pinned, by setting
+    ``placement`` to one of:
+
+    ``'compact'``
+        Pins each thread to a single CPU, filling the CPUs of the first NUMA
+        node before moving on to the next.
+    ``'scatter'``
+        Pins each thread to a single CPU, spreading threads evenly over the
+        NUMA nodes (thread ``0`` to node ``0``, thread ``1`` to node ``1``,
+        and so on).
+    ``'node'``
+        Pins each thread to all CPUs of a single NUMA node, spreading threads
+        over the nodes as for ``'scatter'``.
+    A list of CPU sets
+        Pins thread ``i`` to the CPUs in the ``i``-th set (modulo the length
+        of the list), e.g. ``[{0, 1}, {2, 3}]``.
+
+    Each job's copy of the simulation is created by the thread that runs it,
+    after the thread has been pinned, and the model, solver, and log memory
+    is allocated by that thread when the run starts. On systems with a
+    first-touch allocation policy (such as Linux), pinned threads therefore
+    use memory on their local node. Placement only affects where jobs run,
+    never which result goes where, and is supported on Linux only.
+
+    The simulations release the GIL while the solver is stepping, so that jobs
+    run in parallel, but any Python code in a job (including logging to lists)
+    runs one thread at a time. Copies of the simulation don't publish their
+    output in shared memory (see :meth:`Simulation.set_monitor`). The realtime
+    variable, if bound, will differ from run to run and should not be used in
+    any results.
+    """
+    jobs = list(jobs)
+    if n_threads is None:
+        n_threads = os.cpu_count() or 1
+    n_threads = int(n_threads)
+    if n_threads < 1:
+        raise ValueError('The number of threads must be at least 1.')
+    cpus = _placement(placement, n_threads)
+
+    results = _run_jobs(simulation, jobs, n_threads, cpus)
+    if verify:
+        serial = _run_jobs(simulation, jobs, 1, None)
+        for i, (a, b) in enumerate(zip(results, serial)):
+            if not _identical(a, b):
+                raise myokit.SimulationError(
+                    'Batch verification failed: the result of job ' + str(i)
+                    + ' depends on the number of threads used.')
+
+    if combine is not None:
+        if len(results) == 0:
+            raise ValueError('Cannot combine the results of an empty batch.')
+        return functools.reduce(combine, results)
+    return results
+
+
+def numa_nodes():
+    """
+    Returns a list with, for each NUMA node, a list of the CPUs on that node
+    that this process is allowed to run on.
+
+    On systems without NUMA information, a single node containing all
+    available CPUs is returned.
+    """
+    try:
+        allowed = os.sched_getaffinity(0)
+    except AttributeError:
+        allowed = set(range(os.cpu_count() or 1))
+
+    nodes = []
+    paths = glob.glob('/sys/devices/system/node/node[0-9]*/cpulist')
+    for path in sorted(paths, key=lambda x: int(x.split('node')[-1][:-8])):
+        try:
+            with open(path, 'r') as f:
+                text = f.read().strip()
+        except OSError:
+            continue
+        cpus = set()
+        for part in text.split(','):
+            if '-' in part:
+                lo, hi = part.split('-')
+                cpus.update(range(int(lo), int(hi) + 1))
+            elif part:
+                cpus.add(int(part))
+        cpus &= allowed
+        if cpus:
+            nodes.append(sorted(cpus))
+    if not nodes:
+        nodes = [sorted(allowed)]
+    return nodes
+
+
+def _placement(placement, n_threads):
+    """
+    Returns a list of CPU sets for the worker threads, or ``None`` if threads
+    are not to be pinned.
+    """
+    if placement is None:
+        return None
+    if not hasattr(os, 'sched_setaffinity'):
+        raise ValueError(
+            'Pinning threads to CPUs is not supported on this platform.')
+
+    if placement in ('compact', 'scatter', 'node'):
+        nodes = numa_nodes()
+        if placement == 'compact':
+            flat = [cpu for node in nodes for cpu in node]
+            return [{flat[i % len(flat)]} for i in range(n_threads)]
+        cpus = []
+        for i in range(n_threads):
+            node = nodes[i % len(nodes)]
+            if placement == 'node':
+                cpus.append(set(node))
+            else:
+                cpus.append({node[(i // len(nodes)) % len(node)]})
+        return cpus
+
+    if isinstance(placement, str):
+        raise ValueError(
+            'Unknown placement: ' + placement + '. Expecting one of'
+            ' \'compact\', \'scatter\', \'node\', or a list of CPU sets.')
+    cpus = [set(int(c) for c in x) for x in placement]
+    if len(cpus) == 0 or not all(cpus):
+        raise ValueError('The placement must contain non-empty CPU sets.')
+    return [cpus[i % len(cpus)] for i in range(n_threads)]
+
+
+def _run_jobs(simulation, jobs, n_threads, cpus):
+    """
+    Runs every job on its own copy of ``simulation``, using ``n_threads``
+    threads pinned to the given CPU sets (if any), and returns the results in
+    job order.
+    """
+    # Each job's copy is unpickled by the thread that runs it, so that the
+    # work (and the memory allocated for it) is spread over the threads.
+    data = pickle.dumps(simulation)
+
+    def run(job):
+        return job(pickle.loads(data))
+
+    if n_threads == 1 and cpus is None:
+        outcomes = []
+        for job in jobs:
+            try:
+                outcomes.append((run(job), None))
+            except Exception as e:
+                outcomes.append((None, e))
+    else:
+        # Each worker thread pins itself when it starts, to the next set of
+        # CPUs in the list
+        initializer = None
+        if cpus is not None:
+            lock = threading.Lock()
+            slots = iter(cpus)
+
+            def initializer():
+                with lock:
+                    mine = next(slots)
+                os.sched_setaffinity(0, mine)
+
+        with concurrent.futures.ThreadPoolExecutor(
+                n_threads, initializer=initializer) as pool:
+            futures = [pool.submit(run, job) for job in jobs]
+        outcomes = [(f.result(), None) if f.exception() is None
+                    else (None, f.exception()) for f in futures]
+
+    for result, e in outcomes:
+        if e is not None:
+            raise e
+    return [result for result, e in outcomes]
+
+
+def _identical(a, b):
+    """
+    Checks if two job results are bitwise identical. Dicts (including
+    :class:`myokit.DataLog` objects), lists, and tuples are compared entry by
+    entry, and arrays and floats by their binary representation.
+    """
+    if isinstance(a, dict):
+        if not isinstance(b, dict) or list(a.keys()) != list(b.keys()):
+            return False
+        return all(_identical(a[k], b[k]) for k in a)
+    if isinstance(a, (list, tuple)):
+        if type(a) is not type(b) or len(a) != len(b):
+            return False
+        return all(_identical(x, y) for x, y in zip(a, b))
+    if isinstance(a, float):
+        return isinstance(b, float) and (
+            struct.pack('d', a) == struct.pack('d', b))
+    if isinstance(a, array.array):
+        return (isinstance(b, array.array) and a.typecode == b.typecode
+                and a.tobytes() == b.tobytes())
+    if isinstance(a, np.ndarray) or hasattr(a, '__array__'):
+        try:
+            a, b = np.asarray(a), np.asarray(b)
+        except Exception:
+            return False
+        return (a.dtype == b.dtype and a.shape == b.shape
+                and a.tobytes() == b.tobytes())
+    return a == b
@@ -0,0 +1,134 @@
+#
+# Index of beat start offsets in logged data.
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import numpy as np
+
+import myokit
+
+
+class BeatIndex(object):
+    """
+    An index of the beats (pacing events) in a :class:`myokit.DataLog`, that
+    can be used to select a single beat without searching the log's time
+    array.
+
+    Beat ``k`` starts at time ``starts()[k]``, and consists of the logged
+    points from ``offsets()[k]`` up to (but not including) the offset of the
+    next beat, or the end of the log.
+
+    Beat indices are created by :meth:`Simulation.run`, using the start times
+    of the events in the first event-based protocol, and can be stored with
+    :meth:`save` and read with :meth:`load`.
+    """
+    def __init__(self, starts=None, offsets=None, n_rows=0):
+        self._starts = [] if starts is None else [float(x) for x in starts]
+        self._offsets = [] if offsets is None else [int(x) for x in offsets]
+        if len(self._starts) != len(self._offsets):
+            raise ValueError(
+                'The number of start times and offsets must be equal.')
+        self._n_rows = int(n_rows)
+
+    def beat(self, log, k):
+        """
+        Returns a new :class:`myokit.DataLog` containing the ``k``-th beat
+        from ``log``.
+
+        The log entries can be lists, numpy arrays (including memory-mapped
+        arrays), or any other sequence that supports slicing.
+
+        Entries logged at their own interval (see
+        :meth:`Simulation.set_log_intervals`) have fewer points than the rest
+        of the log, so the offsets do not apply to them. Instead, these
+        entries and their ``time(key)`` entries are sliced using the times in
+        ``time(key)``.
+        """
+        i, j = self.range(k)
+        d = myokit.DataLog()
+        d.set_time_key(log.time_key())
+        for key, data in log.items():
+            if key.startswith('time(') and key[5:-1] in log:
+                times = data
+            else:
+                times = log.get('time(' + key + ')')
+            if times is None:
+                d[key] = data[i:j]
+            else:
+                a, b = self._time_range(times, k)
+                d[key] = data[a:b]
+        return d
+
+    def extend(self, beats, base, n_rows):
+        """
+        Adds beats found in a simulation run.
+
+        ``beats``
+            A list of tuples ``(start, row)``, where ``row`` is the number of
+            points logged in the run before the beat started.
+        ``base``
+            The number of points in the log before the run.
+        ``n_rows``
+            The number of points in the log after the run.
+
+        A beat with the same start time as the last beat in the index is
+        ignored, as beats starting exactly at the end of a run are reported
+        both at the end of that run and at the start of the next.
+        """
+        for start, row in beats:
+            if self._starts and myokit.float.eq(start, self._starts[-1]):
+                continue
+            self._starts.append(float(start))
+            self._offsets.append(int(base + row))
+        self._n_rows = int(n_rows)
+
+    def __len__(self):
+        return len(self._starts)
+
+    @staticmethod
+    def load(path):
+        """ Loads a beat index stored with :meth:`save`. """
+        with np.load(path) as data:
+            return BeatIndex(
+                data['starts'], data['offsets'], int(data['n_rows']))
+
+    def offsets(self):
+        """ Returns a numpy array with the offset of each beat in the log. """
+        return np.array(self._offsets, dtype=np.int64)
+
+    def range(self, k):
+        """
+        Returns a tuple ``(i, j)`` such that ``log[key][i:j]`` contains the
+        ``k``-th beat.
+        """
+        n = len(self._starts)
+        if k < 0:
+            k += n
+        if k < 0 or k >= n:
+            raise IndexError('Beat index out of range.')
+        j = self._offsets[k + 1] if k + 1 < n else self._n_rows
+        return self._offsets[k], j
+
+    def _time_range(self, times, k):
+        """
+        Returns a tuple ``(i, j)`` such that ``times[i:j]`` contains the times
+        in the ``k``-th beat.
+        """
+        if k < 0:
+            k += len(self._starts)
+        times = np.asarray(times)
+        i = int(np.searchsorted(times, self._starts[k]))
+        if k + 1 < len(self._starts):
+            return i, int(np.searchsorted(times, self._starts[k + 1]))
+        return i, len(times)
+
+    def save(self, path):
+        """ Stores this beat index in a numpy ``.npz`` file. """
+        np.savez(
+            path, starts=np.array(self._starts), offsets=self.offsets(),
+            n_rows=self._n_rows)
+
+    def starts(self):
+        """ Returns a numpy array with the start time of each beat. """
+        return np.array(self._starts)
@@ -0,0 +1,155 @@
+#
+# Chunked compression of logged data, using the delta and byte-shuffle
+# transform from the C extension (see codec.h) followed by zlib.
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import io
+import struct
+import zlib
+
+import numpy as np
+
+from . import _cvodessim_ext as _ext
+
+# Maximum number of values per chunk
+CHUNK_SIZE = 65536
+
+# Chunk header: number of values, tolerance, size of the compressed data
+_HEADER = struct.Struct('<IdI')
+
+# Compression level used by zlib
+_LEVEL = 6
+
+
+def write_chunks(f, data, tolerance=0):
+    """
+    Compresses the values in ``data`` and writes them to the binary file
+    object ``f``, as a sequence of independently decodable chunks.
+
+    With ``tolerance=0`` the values are stored exactly, for any positive
+    ``tolerance`` they are stored with an absolute error of at most
+    ``tolerance``.
+
+    Returns the number of values written.
+    """
+    tolerance = float(tolerance)
+    data = np.ascontiguousarray(data, dtype=float)
+    for i in range(0, len(data), CHUNK_SIZE):
+        chunk = data[i:i + CHUNK_SIZE]
+        z = zlib.compress(_ext.codec_encode(chunk, tolerance), _LEVEL)
+        f.write(_HEADER.pack(len(chunk), tolerance, len(z)))
+        f.write(z)
+    return len(data)
+
+
+def compress(data, tolerance=0):
+    """
+    Compresses a sequence of floats, and returns a ``bytes`` object that can be
+    read with :meth:`decompress` or :class:`CompressedArray`.
+
+    With ``tolerance=0`` the values are stored exactly, for any positive
+    ``tolerance`` they are stored with an absolute error of at most
+    ``tolerance``.
+    """
+    f = io.BytesIO()
+    write_chunks(f, data, tolerance)
+    return f.getvalue()
+
+
+def decompress(data):
+    """
+    Decompresses a ``bytes`` object created with :meth:`compress`, and returns
+    a numpy array.
+    """
+    return CompressedArray(data)[:]
+
+
+class CompressedArray(object):
+    """
+    Read-only, array-like access to data compressed with :meth:`compress` or
+    :meth:`write_chunks`.
+
+    ``source``
+        A ``bytes`` object, or a seekable binary file object. File objects are
+        kept open, and are read from when data is accessed.
+
+    Data is decompressed one chunk at a time, so that indexing and slicing
+    only decode the chunks needed. The most recently decoded chunk is cached.
+    Use ``numpy.asarray()`` to decompress all data at once.
+    """
+    def __init__(self, source):
+        if not hasattr(source, 'read'):
+            source = io.BytesIO(source)
+        self._f = source
+
+        # Scan chunk headers
+        self._offsets = []
+        self._counts = []
+        self._tolerances = []
+        self._sizes = []
+        source.seek(0, io.SEEK_END)
+        end = self._nbytes = source.tell()
+        offset = 0
+        while offset < end:
+            source.seek(offset)
+            n, tol, size = _HEADER.unpack(source.read(_HEADER.size))
+            self._offsets.append(offset + _HEADER.size)
+            self._counts.append(n)
+            self._tolerances.append(tol)
+            self._sizes.append(size)
+            offset += _HEADER.size + size
+        self._starts = np.cumsum([0] + self._counts)
+        self._cache = (None, None)
+
+    def __array__(self, dtype=None, copy=None):
+        x = self[:]
+        return x if dtype is None else x.astype(dtype)
+
+    def chunk(self, i):
+        """ Decompresses and returns the ``i``-th chunk. """
+        if self._cache[0] == i:
+            return self._cache[1]
+        self._f.seek(self._offsets[i])
+        x = np.frombuffer(_ext.codec_decode(
+            zlib.decompress(self._f.read(self._sizes[i])),
+            self._tolerances[i]))
+        self._cache = (i, x)
+        return x
+
+    def __getitem__(self, key):
+        n = len(self)
+        if isinstance(key, slice):
+            start, stop, step = key.indices(n)
+            if step != 1:
+                return self[:][key]
+            if start >= stop:
+                return np.zeros(0)
+            # Find first and last chunk
+            i = int(np.searchsorted(self._starts, start, 'right')) - 1
+            j = int(np.searchsorted(self._starts, stop, 'left')) - 1
+            parts = [self.chunk(k) for k in range(i, j + 1)]
+            x = parts[0] if len(parts) == 1 else np.concatenate(parts)
+            offset = self._starts[i]
+            return np.array(x[start - offset:stop - offset])
+
+        key = int(key)
+        if key < 0:
+            key += n
+        if key < 0 or key >= n:
+            raise IndexError('Index out of range.')
+        i = int(np.searchsorted(self._starts, key, 'right')) - 1
+        return float(self.chunk(i)[key - self._starts[i]])
+
+    def __iter__(self):
+        for i in range(len(self._counts)):
+            for x in self.chunk(i):
+                yield float(x)
+
+    def __len__(self):
+        return int(self._starts[-1])
+
+    def nbytes(self):
+        """ Returns the size of the compressed data, in bytes. """
+        return self._nbytes
@@ -16,11 +16,40 @@
 #else
     #include <cvodes/cvodes_dense.h>
 #endif
+#if SUNDIALS_VERSION_MAJOR >= 5
+    #include <cvodes/cvodes_ls.h>
+#elif SUNDIALS_VERSION_MAJOR >= 3
+    #include <sunmatrix/sunmatrix_band.h>
+    #include <sunlinsol/sunlinsol_band.h>
+#else
+    #include <cvodes/cvodes_band.h>
+#endif
 
 //#define MYOKIT_DEBUG_MESSAGES
 //#define MYOKIT_DEBUG_PROFILING
 
 #include "pacing.h"
+#include "erk.h"
+#include "rosenbrock.h"
+#include "codec.h"
+#include "monitor.h"
+#include "expr.h"
+#if SUNDIALS_VERSION_MAJOR >= 5
+#include "blocksolver.h"
+#include "networksolver.h"
+#endif
+
+/*
+ * Storage class for state that is kept separately for each thread (see the
+ * simulation state section below).
+ */
+#if defined(_MSC_VER)
+    #define Sim_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    #define Sim_LOCAL _Thread_local
+#else
+    #define Sim_LOCAL __thread
+#endif
 
 /*
 This file defines a plain C Model object and interface.
@@ -125,6 +154,10 @@ Model_EvaluateDerivatives(model)
     If the derivatives cache is set, does nothing. Otherwise calculates the new
     derivatives and sets the cache.
 
+Model_GetMemoryUsage(model, *variables, *sensitivities)
+    Returns the number of bytes allocated for the model and its variables, and
+    for its sensitivity arrays.
+
 Model_SetStateSensitivities(model, i, *s_states)
     Sets the values of the state sensitivities w.r.t. the i-th independent
     variable. If these are different from the previous values, the sensitivity
@@ -152,7 +185,20 @@ Model_InitializeLogging(Model model, PyObject* log_dict)
     correspond to model variables. The values in the dict should implement the
     sequence interface (and in particular, have an "append" method).
 
-Model_Log(model)
+Model_AddLoggedOutput(model, list, value)
+    Adds a value that is not a model variable (e.g. a quantity derived from
+    model variables) to the logged variables, so that it is logged to list.
+
+Model_GetVariable(model, name)
+    Returns a pointer to the state, derivative, bound, or intermediary variable
+    with the given fully qualified name, or NULL if not found.
+
+Model_SetLogInterval(model, list, interval, time_list, tmin)
+    Logs the variable whose values are stored in list at most once per
+    interval, starting at tmin, instead of at every logging point. The times
+    at which it is logged are stored in time_list.
+
+Model_Log(model, time)
     If logging has been set up, this will log the current values of variables
     to the sequences in the log dict.
 
@@ -204,6 +250,7 @@ typedef int Model_Flag;
 #define Model_LOGGING_NOT_INITIALIZED       -201
 #define Model_UNKNOWN_VARIABLES_IN_LOG      -202
 #define Model_LOG_APPEND_FAILED             -203
+#define Model_INVALID_LOG_INTERVAL          -204
 /* Logging sensitivities */
 #define Model_NO_SENSITIVITIES_TO_LOG       -300
 #define Model_SENSITIVITY_LOG_APPEND_FAILED -303
@@ -247,6 +294,9 @@ Model_SetPyErr(Model_Flag flag)
     case Model_LOG_APPEND_FAILED:
         PyErr_SetString(PyExc_Exception, "CModel error: Call to append() failed on logging list.");
         break;
+    case Model_INVALID_LOG_INTERVAL:
+        PyErr_SetString(PyExc_ValueError, "CModel error: Log interval must be positive and set for a logged variable.");
+        break;
     /* Logging sensitivities */
     case Model_NO_SENSITIVITIES_TO_LOG:
         PyErr_SetString(PyExc_Exception, "CModel error: Sensivity logging called, but sensitivity calculations were not enabled.");
@@ -347,6 +397,13 @@ struct Model_Memory {
     /* Array of pointers to realtype, each a variable to log */
     realtype** _log_vars;
 
+    /* Per-variable logging intervals (0 to log at every point), the next time
+       each variable is due to be logged, and the sequences to log the times
+       in (or NULL). Only allocated if any interval is set. */
+    realtype* _log_intervals;
+    realtype* _log_next;
+    PyObject** _log_time_lists;
+
     /* Caching */
     #ifdef Model_CACHING
     int valid_cache_derivatives;
@@ -411,6 +468,61 @@ typedef struct Model_Memory *Model;
 #define V_IK1 model->intermediary[25]
 #define V_Ib model->intermediary[26]
 
+/*
+ * Loggable variables, as lists of X(name, variable) entries for every state,
+ * derivative, bound, and intermediary variable. These are used both to set up
+ * logging and to find variables by name.
+ */
+#define Model_STATES(X) \
+    X("membrane.V", Y_V) \
+    X("ina.m", Y_m) \
+    X("ina.h", Y_h) \
+    X("ina.j", Y_j) \
+    X("ica.d", Y_d) \
+    X("ica.f", Y_f) \
+    X("ik.x", Y_x) \
+    X("ica.Ca_i", Y_Ca_i)
+#define Model_DERIVATIVES(X) \
+    X("dot(membrane.V)", D_V) \
+    X("dot(ina.m)", D_m) \
+    X("dot(ina.h)", D_h) \
+    X("dot(ina.j)", D_j) \
+    X("dot(ica.d)", D_d) \
+    X("dot(ica.f)", D_f) \
+    X("dot(ik.x)", D_x) \
+    X("dot(ica.Ca_i)", D_Ca_i)
+#define Model_BOUND(X) \
+    X("engine.time", B_time) \
+    X("engine.pace", B_pace)
+#define Model_INTERMEDIARY(X) \
+    X("membrane.i_ion", V_i_ion) \
+    X("membrane.i_stim", V_i_stim) \
+    X("ik.x.alpha", V_ik_x_alpha) \
+    X("ik.x.beta", V_ik_x_beta) \
+    X("ik.xi", V_xi) \
+    X("ik.IK", V_IK) \
+    X("ina.a", V_a) \
+    X("ina.m.alpha", V_ina_m_alpha) \
+    X("ina.m.beta", V_ina_m_beta) \
+    X("ina.h.alpha", V_ina_h_alpha) \
+    X("ina.h.beta", V_ina_h_beta) \
+    X("ina.j.alpha", V_ina_j_alpha) \
+    X("ina.j.beta", V_ina_j_beta) \
+    X("ina.INa", V_INa) \
+    X("ikp.Kp", V_Kp) \
+    X("ikp.IKp", V_IKp) \
+    X("ica.E", V_ica_E) \
+    X("ica.d.alpha", V_ica_d_alpha) \
+    X("ica.d.beta", V_ica_d_beta) \
+    X("ica.f.alpha", V_ica_f_alpha) \
+    X("ica.f.beta", V_ica_f_beta) \
+    X("ica.ICa", V_ICa) \
+    X("ik1.g", V_g) \
+    X("ik1.g.alpha", V_ik1_g_alpha) \
+    X("ik1.g.beta", V_ik1_g_beta) \
+    X("ik1.IK1", V_IK1) \
+    X("ib.Ib", V_Ib)
+
 /* Parameters */
 
 /* Parameter-derived */
@@ -1024,70 +1136,25 @@ Model_InitializeLogging(Model model, PyObject* log_dict)
     model->_log_lists = (PyObject**)malloc((size_t)model->n_logged_variables * sizeof(PyObject*));
     model->_log_vars = (realtype**)malloc((size_t)model->n_logged_variables * sizeof(realtype*));
 
-    /* Check states */
+    /* Check states, derivatives, bound variables, and intermediary
+       variables, in that order */
+    #define Model__ADD_TO_LOG(name, var) i += Model__AddVariableToLog(model, log_dict, i, name, &var);
     i = 0;
-    i += Model__AddVariableToLog(model, log_dict, i, "membrane.V", &Y_V);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.m", &Y_m);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.h", &Y_h);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.j", &Y_j);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.d", &Y_d);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.f", &Y_f);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik.x", &Y_x);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.Ca_i", &Y_Ca_i);
-
+    Model_STATES(Model__ADD_TO_LOG)
     model->logging_states = (i > 0);
 
-    /* Check derivatives */
     j = i;
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(membrane.V)", &D_V);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ina.m)", &D_m);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ina.h)", &D_h);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ina.j)", &D_j);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ica.d)", &D_d);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ica.f)", &D_f);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ik.x)", &D_x);
-    i += Model__AddVariableToLog(model, log_dict, i, "dot(ica.Ca_i)", &D_Ca_i);
-
+    Model_DERIVATIVES(Model__ADD_TO_LOG)
     model->logging_derivatives = (i != j);
 
-    /* Check bound variables */
     j = i;
-    i += Model__AddVariableToLog(model, log_dict, i, "engine.time", &B_time);
-    i += Model__AddVariableToLog(model, log_dict, i, "engine.pace", &B_pace);
-
+    Model_BOUND(Model__ADD_TO_LOG)
     model->logging_bound = (i != j);
 
-    /* Check intermediary variables */
     j = i;
-    i += Model__AddVariableToLog(model, log_dict, i, "membrane.i_ion", &V_i_ion);
-    i += Model__AddVariableToLog(model, log_dict, i, "membrane.i_stim", &V_i_stim);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik.x.alpha", &V_ik_x_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik.x.beta", &V_ik_x_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik.xi", &V_xi);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik.IK", &V_IK);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.a", &V_a);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.m.alpha", &V_ina_m_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.m.beta", &V_ina_m_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.h.alpha", &V_ina_h_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.h.beta", &V_ina_h_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.j.alpha", &V_ina_j_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.j.beta", &V_ina_j_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ina.INa", &V_INa);
-    i += Model__AddVariableToLog(model, log_dict, i, "ikp.Kp", &V_Kp);
-    i += Model__AddVariableToLog(model, log_dict, i, "ikp.IKp", &V_IKp);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.E", &V_ica_E);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.d.alpha", &V_ica_d_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.d.beta", &V_ica_d_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.f.alpha", &V_ica_f_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.f.beta", &V_ica_f_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ica.ICa", &V_ICa);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik1.g", &V_g);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik1.g.alpha", &V_ik1_g_alpha);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik1.g.beta", &V_ik1_g_beta);
-    i += Model__AddVariableToLog(model, log_dict, i, "ik1.IK1", &V_IK1);
-    i += Model__AddVariableToLog(model, log_dict, i, "ib.Ib", &V_Ib);
-
+    Model_INTERMEDIARY(Model__ADD_TO_LOG)
     model->logging_intermediary = (i != j);
+    #undef Model__ADD_TO_LOG
 
     /* Check if log contained extra variables */
     if (i != model->n_logged_variables) return Model_UNKNOWN_VARIABLES_IN_LOG;
@@ -1102,6 +1169,65 @@ Model_InitializeLogging(Model model, PyObject* log_dict)
     return Model_OK;
 }
 
+/*
+ * Adds a value that is not a model variable to the logged variables. Logging
+ * must be initialized, and this method must be called before any calls to
+ * Model_SetLogInterval.
+ *
+ * Arguments
+ *  model : The model whose logging to extend.
+ *  list : A sequence object to log the value in.
+ *  value : A pointer to the value to log.
+ *
+ * Returns a model flag.
+ */
+static Model_Flag
+Model_AddLoggedOutput(Model model, PyObject* list, realtype* value)
+{
+    PyObject** lists;
+    realtype** vars;
+    size_t n;
+
+    if (model == NULL) return Model_INVALID_MODEL;
+    if (!model->logging_initialized) return Model_LOGGING_NOT_INITIALIZED;
+    if (model->_log_intervals != NULL) return Model_LOGGING_ALREADY_INITIALIZED;
+
+    n = (size_t)model->n_logged_variables + 1;
+    lists = (PyObject**)realloc(model->_log_lists, n * sizeof(PyObject*));
+    if (lists == NULL) return Model_OUT_OF_MEMORY;
+    model->_log_lists = lists;
+    vars = (realtype**)realloc(model->_log_vars, n * sizeof(realtype*));
+    if (vars == NULL) return Model_OUT_OF_MEMORY;
+    model->_log_vars = vars;
+
+    model->_log_lists[n - 1] = list;
+    model->_log_vars[n - 1] = value;
+    model->n_logged_variables++;
+    return Model_OK;
+}
+
+/*
+ * Returns a pointer to a state, derivative, bound, or intermediary variable.
+ *
+ * Arguments
+ *  model : The model to find the variable in.
+ *  name : The variable's fully qualified name, or "dot(name)" for a
+ *         derivative.
+ *
+ * Returns a pointer to the variable, or NULL if not found.
+ */
+static realtype*
+Model_GetVariable(Model model, const char* name)
+{
+    #define Model__FIND(qname, var) if (strcmp(name, qname) == 0) return &var;
+    Model_STATES(Model__FIND)
+    Model_DERIVATIVES(Model__FIND)
+    Model_BOUND(Model__FIND)
+    Model_INTERMEDIARY(Model__FIND)
+    #undef Model__FIND
+    return NULL;
+}
+
 /*
  * De-initializes logging, undoing the effects of Model_InitializeLogging() and
  * allowing logging to be initialized again.
@@ -1126,6 +1252,9 @@ Model_DeInitializeLogging(Model model)
         free(model->_log_lists);
         model->_log_lists = NULL;
     }
+    free(model->_log_intervals); model->_log_intervals = NULL;
+    free(model->_log_next); model->_log_next = NULL;
+    free(model->_log_time_lists); model->_log_time_lists = NULL;
 
     /* Reset */
     model->logging_initialized = 0;
@@ -1138,6 +1267,49 @@ Model_DeInitializeLogging(Model model)
     return Model_OK;
 }
 
+/*
+ * Sets a logging interval for a single logged variable, so that it is logged
+ * at the first logging point on or after every multiple of the interval
+ * (counting from tmin), instead of at every point. The times at which the
+ * variable is logged are appended to a separate sequence.
+ *
+ * Arguments
+ *  model : The model to set the interval for (with logging initialized).
+ *  list : The sequence the variable is logged to, as found in the log dict.
+ *  interval : The interval, which must be positive.
+ *  time_list : A sequence to log the times at which the variable is logged.
+ *  tmin : The time of the first logging point.
+ *
+ * Returns a model flag.
+ */
+static Model_Flag
+Model_SetLogInterval(Model model, PyObject* list, realtype interval, PyObject* time_list, realtype tmin)
+{
+    int i;
+
+    if (model == NULL) return Model_INVALID_MODEL;
+    if (!model->logging_initialized) return Model_LOGGING_NOT_INITIALIZED;
+
+    for (i=0; i<model->n_logged_variables; i++) {
+        if (model->_log_lists[i] == list) break;
+    }
+    if (i == model->n_logged_variables || !(interval > 0)) return Model_INVALID_LOG_INTERVAL;
+
+    /* Allocate on first use, with all variables logged at every point */
+    if (model->_log_intervals == NULL) {
+        model->_log_intervals = (realtype*)calloc((size_t)model->n_logged_variables, sizeof(realtype));
+        model->_log_next = (realtype*)calloc((size_t)model->n_logged_variables, sizeof(realtype));
+        model->_log_time_lists = (PyObject**)calloc((size_t)model->n_logged_variables, sizeof(PyObject*));
+        if (model->_log_intervals == NULL || model->_log_next == NULL || model->_log_time_lists == NULL) {
+            return Model_OUT_OF_MEMORY;
+        }
+    }
+    model->_log_intervals[i] = interval;
+    model->_log_next[i] = tmin;
+    model->_log_time_lists[i] = time_list;
+    return Model_OK;
+}
+
 /*
  * Logs the current state of the model to the logging dict passed in to
  * Model_InitializeLogging.
@@ -1147,19 +1319,38 @@ Model_DeInitializeLogging(Model model)
  *
  * Arguments
  *  model : The model whose state to log
+ *  time : The time of the logged point, used for variables with their own
+ *         logging interval (see Model_SetLogInterval).
  *
  * Returns a model flag.
  */
 static Model_Flag
-Model_Log(Model model)
+Model_Log(Model model, realtype time)
 {
     int i;
+    realtype interval;
     PyObject *val, *ret;
 
     if (model == NULL) return Model_INVALID_MODEL;
     if (!model->logging_initialized) return Model_LOGGING_NOT_INITIALIZED;
 
     for (i=0; i<model->n_logged_variables; i++) {
+        if (model->_log_intervals != NULL && model->_log_intervals[i] > 0) {
+            /* Not due yet? Then skip. A small tolerance is used so that
+               intervals that are multiples of the periodic logging interval
+               are not thrown off by rounding errors. */
+            interval = model->_log_intervals[i];
+            if (time + 1e-9 * interval < model->_log_next[i]) continue;
+            model->_log_next[i] += interval * floor((time - model->_log_next[i]) / interval + 1e-9 + 1);
+
+            val = PyFloat_FromDouble(time);
+            ret = PyObject_CallMethodObjArgs(model->_log_time_lists[i], model->_list_update_string, val, NULL);
+            Py_DECREF(val);
+            Py_XDECREF(ret);
+            if (ret == NULL) {
+                return Model_LOG_APPEND_FAILED;
+            }
+        }
         val = PyFloat_FromDouble(*(model->_log_vars[i]));
         ret = PyObject_CallMethodObjArgs(model->_log_lists[i], model->_list_update_string, val, NULL);
         Py_DECREF(val);
@@ -1314,6 +1505,9 @@ static Model Model_Create(Model_Flag* flagp)
     /* Logging pointer lists */
     model->_log_lists = NULL;
     model->_log_vars = NULL;
+    model->_log_intervals = NULL;
+    model->_log_next = NULL;
+    model->_log_time_lists = NULL;
 
     /*
      * Default values
@@ -1419,6 +1613,9 @@ Model_Destroy(Model model)
     /* Logging */
     free(model->_log_vars); model->_log_vars = NULL;
     free(model->_log_lists); model->_log_lists = NULL;
+    free(model->_log_intervals); model->_log_intervals = NULL;
+    free(model->_log_next); model->_log_next = NULL;
+    free(model->_log_time_lists); model->_log_time_lists = NULL;
     Py_XDECREF(model->_list_update_string); model->_list_update_string = NULL;
 
     /* Model itself */
@@ -1426,6 +1623,39 @@ Model_Destroy(Model model)
     return Model_OK;
 }
 
+/*
+ * Calculates the memory allocated by a model.
+ *
+ * Arguments
+ *  model : The model to check.
+ *  variables : Set to the number of bytes used by the model and its variables
+ *              (including logging information).
+ *  sensitivities : Set to the number of bytes used for sensitivities.
+ *
+ * Returns a model flag.
+ */
+static Model_Flag
+Model_GetMemoryUsage(Model model, size_t* variables, size_t* sensitivities)
+{
+    if (model == NULL) return Model_INVALID_MODEL;
+
+    *variables = sizeof(struct Model_Memory) + sizeof(realtype) * (size_t)(
+        2 * model->n_states + model->n_intermediary
+        + model->n_parameters + model->n_parameter_derived
+        + model->n_literals + model->n_literal_derived + model->n_pace);
+    if (model->logging_initialized) {
+        *variables += (size_t)model->n_logged_variables * (sizeof(PyObject*) + sizeof(realtype*));
+        if (model->_log_intervals != NULL) {
+            *variables += (size_t)model->n_logged_variables * (2 * sizeof(realtype) + sizeof(PyObject*));
+        }
+    }
+
+    *sensitivities = (size_t)model->ns_independents * (sizeof(realtype*) + sizeof(int))
+        + sizeof(realtype) * (size_t)(model->n_states * model->ns_independents + model->ns_intermediary);
+
+    return Model_OK;
+}
+
 
 
 /*
@@ -1531,31 +1761,59 @@ check_cvode_flag(void *flagvalue, char *funcname, int opt)
 }
 
 /*
- * Error and warning message handler for CVODES.
- * Error messages are already set via check_cvode_flag, so this method
- * suppresses error messages.
- * Warnings are passed to Python's warning system, where they can be
- * caught or suppressed using the warnings module.
+ * Simulation state
+ *
+ * All simulation state below is thread-local, so that simulations can run in
+ * parallel in different threads or subinterpreters (each with its own GIL).
+ * A simulation must be initialised, stepped, and cleaned up from the same
+ * thread; solver settings are re-sent by the Python code before every run.
+ * (Sim_LOCAL is defined at the top of this file.)
  */
-static void
-ErrorHandler(int error_code, const char *module, const char *function,
-             char *msg, void *eh_data)
-{
-    if (error_code > 0) {
-        PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "CVODES: %s", msg);
-    }
-}
 
 /*
  * Initialisation status.
  * Proper sequence is init(), repeated step() calls till finished, then clean.
  */
-static int initialized = 0; /* Has the simulation been initialized */
+static Sim_LOCAL int initialized = 0; /* Has the simulation been initialized */
+
+/*
+ * The GIL is released while the solver takes a step, so that simulations in
+ * other threads can run at the same time. While it is released, the saved
+ * thread state is stored here, so that callbacks that need the GIL (e.g. to
+ * set an exception) can re-acquire it. It is NULL whenever the GIL is held.
+ */
+static Sim_LOCAL PyThreadState* sim_thread_state = NULL;
 
 /*
  * Model
+ *
+ * When simulating a population, the cells share a single pacing system and are
+ * integrated as one ODE system, with a state vector made up of each cell's
+ * states in turn. In this case `model` points to the first cell.
+ */
+static Sim_LOCAL Model model;        /* A model object */
+static Sim_LOCAL Model* models;      /* Model objects for each cell in the population */
+static Sim_LOCAL int n_cells;        /* The number of cells in the population */
+static Sim_LOCAL int n_y;            /* The total number of states (n_cells * model->n_states) */
+
+/*
+ * Coupling
+ *
+ * Cells in a population can be coupled by a graph of edges (i, j) with
+ * conductance g. Each cell then receives a diffusion current
+ *
+ *   I_diff,i = sum_j g_ij * (V_i - V_j)
+ *
+ * calculated from the membrane potential states, which is passed to the model
+ * through a literal variable (the variable bound to "diffusion_current").
  */
-static Model model;        /* A model object */
+static Sim_LOCAL int n_edges;         /* The number of coupling edges (0 if uncoupled) */
+static Sim_LOCAL int* edge_i;         /* The first cell of each edge */
+static Sim_LOCAL int* edge_j;         /* The second cell of each edge */
+static Sim_LOCAL double* edge_g;      /* The conductance of each edge */
+static Sim_LOCAL int coupling_state;  /* The index of the membrane potential in each cell's states */
+static Sim_LOCAL int coupling_literal;/* The index of the diffusion current in each cell's literals */
+static Sim_LOCAL double* diffusion;   /* The diffusion current into each cell */
 
 /*
  * Pacing
@@ -1563,117 +1821,199 @@ static Model model;        /* A model object */
 union PSys {
     ESys event;
     FSys fixed;
+    ASys analytic;
 };
 enum PSysType {
     EVENT,
-    FIXED
+    FIXED,
+    ANALYTIC
+};
+static Sim_LOCAL union PSys *pacing_systems;   /* Array of pacing system (event, fixed, or analytic) */
+static Sim_LOCAL enum PSysType *pacing_types;  /* Array of pacing system types */
+static Sim_LOCAL PyObject *protocols;          /* The protocols used to generate the pacing systems */
+static Sim_LOCAL double* pacing;               /* Pacing values, same size as pacing_systems and pacing_types */
+static Sim_LOCAL int n_pace;                   /* The number of pacing systems */
+static Sim_LOCAL MSys merged_pacing;           /* All event-based systems, merged into a single timeline */
+static Sim_LOCAL double* pacing_next;          /* Next time each fixed-form or analytic system needs a stop (or infinity) */
+static Sim_LOCAL double tnext_pacing;          /* The earliest time in pacing_next */
+
+/*
+ * Solver selection
+ */
+enum SolverType {
+    SOLVER_CVODES,
+    SOLVER_DOPRI5,
+    SOLVER_ROSENBROCK
 };
-union PSys *pacing_systems;   /* Array of pacing system (event or fixed) */
-enum PSysType *pacing_types;  /* Array of pacing system types */
-static PyObject *protocols;          /* The protocols used to generate the pacing systems */
-static double* pacing;               /* Pacing values, same size as pacing_systems and pacing_types */
-static int n_pace;                   /* The number of pacing systems */
+static Sim_LOCAL enum SolverType solver_type = SOLVER_CVODES; /* The solver to use */
+
+/*
+ * One-step solver memory (only used if solver_type is not SOLVER_CVODES)
+ */
+static Sim_LOCAL ERK erk;     /* Explicit Runge-Kutta solver */
+static Sim_LOCAL ROS ros;     /* Rosenbrock solver */
 
 /*
  * CVODE Memory
  */
-static void *cvode_mem;     /* The memory used by the solver */
+static Sim_LOCAL void *cvode_mem;     /* The memory used by the solver */
 #if SUNDIALS_VERSION_MAJOR >= 3
-static SUNMatrix sundense_matrix;          /* Dense matrix for linear solves */
-static SUNLinearSolver sundense_solver;    /* Linear solver object */
+static Sim_LOCAL SUNMatrix sundense_matrix;          /* Dense matrix for linear solves (or band matrix, or NULL for block-diagonal solves) */
+static Sim_LOCAL SUNLinearSolver sundense_solver;    /* Linear solver object */
 #endif
 #if SUNDIALS_VERSION_MAJOR >= 6
-static SUNContext sundials_context; /* A sundials context to run in (for profiling etc.) */
+static Sim_LOCAL SUNContext sundials_context; /* A sundials context to run in (for profiling etc.) */
 #endif
 
-static UserData udata;      /* UserData struct, used to pass in parameters */
-static realtype* pbar;      /* Vector of independents in user data */
+static Sim_LOCAL UserData udata;      /* UserData struct, used to pass in parameters */
+static Sim_LOCAL realtype* pbar;      /* Vector of independents in user data */
 
 /*
  * Solver settings
  */
-static double abs_tol = 1e-6;  /* The absolute tolerance */
-static double rel_tol = 1e-4;  /* The relative tolerance */
-static double dt_max = 0;      /* The maximum step size (0.0 for none) */
-static double dt_min = 0;      /* The minimum step size (0.0 for none) */
+static Sim_LOCAL double abs_tol = 1e-6;  /* The absolute tolerance */
+static Sim_LOCAL double rel_tol = 1e-4;  /* The relative tolerance */
+static Sim_LOCAL double dt_max = 0;      /* The maximum step size (0.0 for none) */
+static Sim_LOCAL double dt_min = 0;      /* The minimum step size (0.0 for none) */
 
 /*
  * Solver stats
  */
-static double realtime = 0;        /* Time since start */
-static long evaluations = 0;       /* Number of evaluations since sim init */
-static long steps = 0;             /* Number of steps since sim init */
+static Sim_LOCAL double realtime = 0;        /* Time since start */
+static Sim_LOCAL long evaluations = 0;       /* Number of evaluations since sim init */
+static Sim_LOCAL long steps = 0;             /* Number of steps since sim init */
 
 /*
  * Checking for repeated size-zero steps
  */
-static int zero_step_count;
+static Sim_LOCAL int zero_step_count;
 static const int max_zero_step_count = 500;
 
 /*
  * State vectors
  */
-static N_Vector y;     /* The current position y */
-static N_Vector* sy;   /* Current state sensitivities, 1 vector per independent */
+static Sim_LOCAL N_Vector y;     /* The current position y */
+static Sim_LOCAL N_Vector* sy;   /* Current state sensitivities, 1 vector per independent */
 
 /* Intermediary positions for logging: these will only be created if using
    interpolation to log. Otherwise they will simply point to y and sy */
-static N_Vector z;
-static N_Vector* sz;
+static Sim_LOCAL N_Vector z;
+static Sim_LOCAL N_Vector* sz;
 
 /* Previous position, used for error output, always created */
-static N_Vector ylast;
+static Sim_LOCAL N_Vector ylast;
+
+/*
+ * Quadratures: integrals of expressions of model variables, computed by
+ * CVODES alongside the state and reset at the start of every beat
+ */
+static Sim_LOCAL int n_quads;            /* The number of integrals (for all cells) */
+static Sim_LOCAL Expr* quads;            /* The compiled integrands, or NULL */
+static Sim_LOCAL N_Vector yq;            /* The integrals since the start of the run */
+static Sim_LOCAL N_Vector yq_start;      /* The integrals at the last reset */
+static Sim_LOCAL double quad_start;      /* The time of the last reset */
+static Sim_LOCAL PyObject* quad_list;    /* List to store (start, end, integrals) tuples in */
 
 /*
  * Customisable constants, passed in from Python
  */
-static PyObject* literals;     /* A list of literal constant values */
-static PyObject* parameters;   /* A list of parameter values */
+static Sim_LOCAL PyObject* literals;     /* A list of literal constant values */
+static Sim_LOCAL PyObject* parameters;   /* A list of parameter values */
 
 /*
  * State and bound variable communication
  */
-static PyObject* state_py;     /* List: The state passed from and to Python */
-static PyObject* s_state_py;   /* List: The state sensitivities passed from and to Python */
-static PyObject* bound_py;     /* List: The bound variables, passed to Python */
+static Sim_LOCAL PyObject* state_py;     /* List: The state passed from and to Python */
+static Sim_LOCAL PyObject* s_state_py;   /* List: The state sensitivities passed from and to Python */
+static Sim_LOCAL PyObject* bound_py;     /* List: The bound variables, passed to Python */
 
 /*
  * Timing
  */
-static double t;       /* Current simulation time */
-static double tlast;   /* Previous simulation time, for error and progress tracking */
-static double tnext;   /* Next simulation halting point */
-static double tmin;    /* The initial simulation time */
-static double tmax;    /* The final simulation time */
+static Sim_LOCAL double t;       /* Current simulation time */
+static Sim_LOCAL double tlast;   /* Previous simulation time, for error and progress tracking */
+static Sim_LOCAL double tnext;   /* Next simulation halting point */
+static Sim_LOCAL double tmin;    /* The initial simulation time */
+static Sim_LOCAL double tmax;    /* The final simulation time */
 
 /*
  * Logging
  */
-static int dynamic_logging;    /* True if logging every point. */
-static PyObject* log_dict;     /* The log dict (DataLog) */
-static PyObject* sens_list;    /* Sensitivity logging list */
+static Sim_LOCAL int dynamic_logging;    /* True if logging every point. */
+static Sim_LOCAL PyObject* log_dict;     /* The log dict (DataLog) */
+static Sim_LOCAL PyObject* cell_logs;    /* A list of log dicts, one per cell, or None if not a population */
+static Sim_LOCAL int logging_rhs;        /* True if any cell logs derivatives or intermediary variables */
+static Sim_LOCAL int logging_bound;      /* True if any cell logs bound variables */
+static Sim_LOCAL PyObject* sens_list;    /* Sensitivity logging list */
 
 /* Periodic and point-list logging */
-static double tlog;            /* Next time to log */
-static double log_interval;    /* The periodic logging interval */
-static Py_ssize_t ilog;        /* Index of next point in the point list */
-static PyObject* log_times;    /* The point list (or None if disabled) */
+static Sim_LOCAL double tlog;            /* Next time to log */
+static Sim_LOCAL double log_interval;    /* The periodic logging interval */
+static Sim_LOCAL Py_ssize_t ilog;        /* Index of next point in the point list */
+static Sim_LOCAL PyObject* log_times;    /* The point list (or None if disabled) */
+
+/* Fine logging windows (periodic logging only) */
+static Sim_LOCAL double fine_interval;   /* The logging interval inside a window, or 0 if disabled */
+static Sim_LOCAL double fine_duration;   /* The duration of each window */
+static Sim_LOCAL int fine_on_beat;       /* 1 if each beat opens a window */
+static Sim_LOCAL int fine_state;         /* Index of the state whose rate of change opens a window, or -1 */
+static Sim_LOCAL double fine_threshold;  /* Absolute rate of change above which a window opens */
+static Sim_LOCAL double fine_start;      /* Start of the current (or last) window */
+static Sim_LOCAL double fine_end;        /* End of the current (or last) window */
+static Sim_LOCAL Py_ssize_t fine_index;  /* Index of the next logging point in the current window */
 
 /*
  * Root finding
  */
-static int rf_index;          /* Index of state variable to use in root finding (ignored if not enabled) */
-static double rf_threshold;    /* Threshold to use for root finding (ignored if not enabled) */
-static PyObject* rf_list;      /* List to store found roots in (or None if not enabled) */
-static int* rf_direction;      /* Direction of root crossings: 1 for up, -1 for down, 0 for no crossing. */
+static Sim_LOCAL int rf_index;          /* Index of state variable to use in root finding (in the first cell; ignored if not enabled) */
+static Sim_LOCAL double rf_threshold;    /* Threshold to use for root finding (ignored if not enabled) */
+static Sim_LOCAL PyObject* rf_list;      /* List to store found roots in (or None if not enabled) */
+static Sim_LOCAL int* rf_direction;      /* Direction of root crossings: 1 for up, -1 for down, 0 for no crossing. */
+
+/*
+ * Memory usage, by category
+ */
+enum MemoryCategory {
+    MEM_MODEL,
+    MEM_SOLVER,
+    MEM_LINEAR_SOLVER,
+    MEM_PACING,
+    MEM_SENSITIVITIES,
+    MEM_LOGS,
+    MEM_N
+};
+static const char* memory_names[MEM_N] = {"model", "solver", "linear_solver", "pacing", "sensitivities", "logs"};
+static Sim_LOCAL size_t memory_last[MEM_N];   /* Memory used at the end of the last run */
+
+/*
+ * Live output to shared memory
+ */
+static Sim_LOCAL Monitor monitor;         /* Shared memory output, or NULL if disabled */
+static Sim_LOCAL double** monitor_vars;   /* Pointers to the values in each published row */
+
+/*
+ * Logged expressions
+ */
+static Sim_LOCAL int n_exprs;             /* The number of logged expressions */
+static Sim_LOCAL Expr* exprs;             /* The compiled expressions, or NULL */
+static Sim_LOCAL realtype* expr_values;   /* The value of each expression at the last logged point */
+
+/*
+ * Beat index
+ */
+static Sim_LOCAL PyObject* beat_list;     /* List to store (start time, row) tuples in, or None */
+static Sim_LOCAL int beat_system;         /* Index of the first event-based pacing system, or -1 */
+static Sim_LOCAL long beat_count;         /* Number of events started in that system since sim_init */
+static Sim_LOCAL Py_ssize_t log_rows;     /* Number of rows logged in this run */
+static Sim_LOCAL PyObject* snapshot_list; /* List to store (start time, state) tuples in, or None */
 
 /*
  * Logging realtime and profiling
  */
-static PyObject* benchmarker;      /* myokit.tools.Benchmarker object */
-static PyObject* benchmarker_time_str;
-static int log_realtime;           /* 1 iff we're logging real simulation time */
-static double realtime_start;      /* time when sim run started */
+static Sim_LOCAL PyObject* benchmarker;      /* myokit.tools.Benchmarker object */
+static Sim_LOCAL PyObject* benchmarker_time_str;
+static Sim_LOCAL int log_realtime;           /* 1 iff we're logging real simulation time */
+static Sim_LOCAL double realtime_start;      /* time when sim run started */
 
 /*
  * Returns the current time as given by the benchmarker.
@@ -1693,7 +2033,7 @@ benchmarker_realtime(void)
 }
 
 #ifdef MYOKIT_DEBUG_PROFILING
-static PyObject* benchmarker_print_str;
+static Sim_LOCAL PyObject* benchmarker_print_str;
 
 /*
  * Prints a message to screen, preceded by the time in ms as given by the benchmarker.
@@ -1708,54 +2048,147 @@ benchmarker_print(char* message)
 #endif
 
 /*
- * Right-hand-side function of the model ODE
+ * Releases the GIL, before taking a solver step.
+ */
+static void
+sim_release_gil(void)
+{
+    sim_thread_state = PyEval_SaveThread();
+}
+
+/*
+ * Re-acquires the GIL, after taking a solver step.
+ */
+static void
+sim_acquire_gil(void)
+{
+    PyEval_RestoreThread(sim_thread_state);
+    sim_thread_state = NULL;
+}
+
+/*
+ * For code called by the solvers: re-acquires the GIL if it was released, and
+ * returns the saved thread state (or NULL) to pass to sim_restore_gil().
+ */
+static PyThreadState*
+sim_ensure_gil(void)
+{
+    PyThreadState* saved = sim_thread_state;
+    if (saved != NULL) sim_acquire_gil();
+    return saved;
+}
+
+/*
+ * Releases the GIL again if it was re-acquired by sim_ensure_gil().
+ */
+static void
+sim_restore_gil(PyThreadState* saved)
+{
+    if (saved != NULL) sim_release_gil();
+}
+
+/*
+ * Error and warning message handler for CVODES.
+ * Error messages are already set via check_cvode_flag, so this method
+ * suppresses error messages.
+ * Warnings are passed to Python's warning system, where they can be
+ * caught or suppressed using the warnings module. As this is called from
+ * inside CVode(), the GIL is re-acquired first.
+ */
+static void
+ErrorHandler(int error_code, const char *module, const char *function,
+             char *msg, void *eh_data)
+{
+    PyThreadState* saved;
+    if (error_code > 0) {
+        saved = sim_ensure_gil();
+        PyErr_WarnFormat(PyExc_RuntimeWarning, 1, "CVODES: %s", msg);
+        sim_restore_gil(saved);
+    }
+}
+
+/*
+ * Updates every model to the given time and state, and calculates the
+ * derivatives, without counting this as an evaluation of the right-hand side.
  *
  *  realtype t      Current time
- *  N_Vector y      The current state values
- *  N_Vector ydot   Space to store the calculated derivatives in
+ *  realtype* y     The current state values
+ *  realtype* ydot  Space to store the calculated derivatives in, or NULL
  *  void* user_data Extra data (contains the sensitivity parameter values)
  *
  */
 static int
-rhs(realtype t, N_Vector y, N_Vector ydot, void *user_data)
+rhs_update(realtype t, realtype* y, realtype* ydot, void *user_data)
 {
     FSys_Flag flag_fpacing;
+    ASys_Flag flag_apacing;
+    PyThreadState* saved;
     UserData fdata;
-    int i;
+    int i, c;
+    double d;
 
-    /* Fixed-form pacing? Then look-up correct value of pacing variable */
+    /* Fixed-form or analytic pacing? Then look-up correct value of pacing variable */
     for (int i = 0; i < n_pace; i++) {
         if (pacing_types[i] == FIXED) {
             pacing[i] = FSys_GetLevel(pacing_systems[i].fixed, t, &flag_fpacing);
             if (flag_fpacing != FSys_OK) { /* This should never happen */
+                saved = sim_ensure_gil();
                 FSys_SetPyErr(flag_fpacing);
+                sim_restore_gil(saved);
                 return -1;  /* Negative value signals irrecoverable error to CVODE */
             }
+        } else if (pacing_types[i] == ANALYTIC) {
+            pacing[i] = ASys_GetLevel(pacing_systems[i].analytic, t, &flag_apacing);
+            if (flag_apacing != ASys_OK) { /* This should never happen */
+                saved = sim_ensure_gil();
+                ASys_SetPyErr(flag_apacing);
+                sim_restore_gil(saved);
+                return -1;
+            }
+        }
+    }
+
+    /* Calculate diffusion currents */
+    if (n_edges > 0) {
+        for (c=0; c<n_cells; c++) {
+            diffusion[c] = 0;
+        }
+        for (i=0; i<n_edges; i++) {
+            d = edge_g[i] * (y[edge_i[i] * model->n_states + coupling_state] - y[edge_j[i] * model->n_states + coupling_state]);
+            diffusion[edge_i[i]] += d;
+            diffusion[edge_j[i]] -= d;
         }
     }
 
     /* Update model state */
+    for (c=0; c<n_cells; c++) {
 
-    /* Set time, pace, evaluations and realtime */
-    evaluations++;
-    Model_SetBoundVariables(model, (realtype)t, (realtype*)pacing, (realtype)realtime, (realtype)evaluations);
+        /* Set diffusion current (not used by any other constants) */
+        if (n_edges > 0) {
+            models[c]->literals[coupling_literal] = diffusion[c];
+            Model_ClearCache(models[c]);
+        }
 
-    /* Set sensitivity parameters */
-    if (model->has_sensitivities) {
-        fdata = (UserData) user_data;
-        Model_SetParametersFromIndependents(model, fdata->p);
-    }
+        /* Set time, pace, evaluations and realtime */
+        Model_SetBoundVariables(models[c], (realtype)t, (realtype*)pacing, (realtype)realtime, (realtype)evaluations);
+
+        /* Set sensitivity parameters (single cell only) */
+        if (model->has_sensitivities) {
+            fdata = (UserData) user_data;
+            Model_SetParametersFromIndependents(model, fdata->p);
+        }
 
-    /* Set states */
-    Model_SetStates(model, N_VGetArrayPointer(y));
+        /* Set states */
+        Model_SetStates(models[c], y + c * model->n_states);
 
-    /* Calculate state derivatives */
-    Model_EvaluateDerivatives(model);
+        /* Calculate state derivatives */
+        Model_EvaluateDerivatives(models[c]);
 
-    /* Fill ydot and return */
-    if (ydot != NULL) {
-        for (i=0; i<model->n_states; i++) {
-            NV_Ith_S(ydot, i) = model->derivatives[i];
+        /* Fill ydot */
+        if (ydot != NULL) {
+            for (i=0; i<model->n_states; i++) {
+                ydot[c * model->n_states + i] = models[c]->derivatives[i];
+            }
         }
     }
 
@@ -1763,94 +2196,634 @@ rhs(realtype t, N_Vector y, N_Vector ydot, void *user_data)
 }
 
 /*
- * Utility function to set the state sensitivities and evaluate the sensitivity
- * outputs.
+ * Right-hand-side function of the model ODE, operating on plain arrays.
  *
- * Assumes the RHS has been evaluated.
+ * Arguments are as for rhs_update().
  */
-static void
-shs(N_Vector* sy)
+static int
+rhs_eval(realtype t, realtype* y, realtype* ydot, void *user_data)
 {
-    int i, j;
-
-    /* Unpack state sensitivities */
-    for (i=0; i<model->ns_independents; i++) {
-        for (j=0; j<model->n_states; j++) {
-            model->s_states[i * model->n_states + j] = NV_Ith_S(sy[i], j);
-        }
-    }
-
-    /* Calculate intermediary variable sensitivities */
-    Model_EvaluateSensitivityOutputs(model);
+    evaluations++;
+    return rhs_update(t, y, ydot, user_data);
 }
 
 /*
- * Root finding function. Can contain several functions for which a root is to
- * be found, but we only use one.
+ * Right-hand-side function of the model ODE, as used by CVODES
+ *
+ *  realtype t      Current time
+ *  N_Vector y      The current state values
+ *  N_Vector ydot   Space to store the calculated derivatives in, or NULL
+ *  void* user_data Extra data (contains the sensitivity parameter values)
+ *
  */
 static int
-rf_function(realtype t, N_Vector y, realtype *gout, void *user_data)
+rhs(realtype t, N_Vector y, N_Vector ydot, void *user_data)
 {
-    gout[0] = NV_Ith_S(y, rf_index) - rf_threshold;
-    return 0;
+    return rhs_eval(t, N_VGetArrayPointer(y), (ydot == NULL) ? NULL : N_VGetArrayPointer(ydot), user_data);
 }
 
+#if SUNDIALS_VERSION_MAJOR >= 5
 /*
- * Cleans up after a simulation
+ * Preconditioner setup and solve functions, used to drive the block-diagonal
+ * linear solver when simulating a population.
  */
-static PyObject*
-sim_clean(void)
+static int
+block_psetup(realtype t, N_Vector y, N_Vector fy, booleantype jok, booleantype *jcurPtr, realtype gamma, void *user_data)
 {
-    if (initialized) {
-        #ifdef MYOKIT_DEBUG_PROFILING
-        benchmarker_print("CP Entered sim_clean.");
-        #elif defined MYOKIT_DEBUG_MESSAGES
-        printf("CM Cleaning up.\n");
-        #endif
+    return BlockDiag_PSetup(sundense_solver, cvode_mem, rhs, t, y, fy, jok, jcurPtr, gamma, user_data);
+}
 
-        /* CVode arrays */
-        if (y != NULL) { N_VDestroy_Serial(y); y = NULL; }
-        if (ylast != NULL) { N_VDestroy_Serial(ylast); ylast = NULL; }
-        if (sy != NULL) { N_VDestroyVectorArray(sy, model->ns_independents); sy = NULL; }
-        if (model != NULL && model->is_ode && !dynamic_logging) {
-            if (z != NULL) { N_VDestroy_Serial(z); z = NULL; }
-            if (sz != NULL) { N_VDestroyVectorArray(sz, model->ns_independents); sz = NULL; }
-        }
+static int
+block_psolve(realtype t, N_Vector y, N_Vector fy, N_Vector r, N_Vector z, realtype gamma, realtype delta, int lr, void *user_data)
+{
+    return BlockDiag_PSolve(sundense_solver, r, z, gamma);
+}
 
-        /* Root finding results */
-        free(rf_direction); rf_direction = NULL;
+/*
+ * Preconditioner setup and solve functions, used to drive the network linear
+ * solver when simulating a coupled population.
+ */
+static int
+network_psetup(realtype t, N_Vector y, N_Vector fy, booleantype jok, booleantype *jcurPtr, realtype gamma, void *user_data)
+{
+    return Network_PSetup(sundense_solver, cvode_mem, rhs, t, y, fy, jok, jcurPtr, gamma, user_data);
+}
 
-        /* Sundials objects */
-        CVodeFree(&cvode_mem); cvode_mem = NULL;
-        #if SUNDIALS_VERSION_MAJOR >= 3
-        SUNLinSolFree(sundense_solver); sundense_solver = NULL;
-        SUNMatDestroy(sundense_matrix); sundense_matrix = NULL;
-        #endif
-        #if SUNDIALS_VERSION_MAJOR >= 6
-        SUNContext_Free(&sundials_context); sundials_context = NULL;
-        #endif
+static int
+network_psolve(realtype t, N_Vector y, N_Vector fy, N_Vector r, N_Vector z, realtype gamma, realtype delta, int lr, void *user_data)
+{
+    return Network_PSolve(sundense_solver, r, z, gamma);
+}
+#endif
 
-        /* User data and parameter scale array*/
-        free(pbar);
+/*
+ * Resolves variable names in logged expressions, for the model passed in as
+ * context.
+ */
+static const double*
+expr_lookup(void* context, const char* name)
+{
+    return (const double*)Model_GetVariable((Model)context, name);
+}
+
+/*
+ * Logs the current state of every cell in the population, at the given time.
+ * Logged expressions are evaluated first.
+ */
+static Model_Flag
+log_population(double time)
+{
+    int c;
+    Model_Flag flag;
+    for (c=0; c<n_exprs; c++) {
+        expr_values[c] = (realtype)Expr_Evaluate(exprs[c]);
+    }
+    for (c=0; c<n_cells; c++) {
+        flag = Model_Log(models[c], (realtype)time);
+        if (flag != Model_OK) return flag;
+    }
+    if (monitor != NULL) {
+        Monitor_AppendRow(monitor, monitor_vars);
+    }
+    log_rows++;
+    return Model_OK;
+}
+
+/*
+ * Adds a beat starting at the given time to the beat index, with the number of
+ * rows logged so far as its offset. If snapshots are enabled, the current
+ * state (which must be the state at the start of the beat) is stored too.
+ *
+ * Returns 0 on success, or -1 if an exception was set.
+ */
+static int
+beat_record(double start)
+{
+    PyObject *val, *state;
+    int i, flag;
+    if (beat_list != Py_None) {
+        val = Py_BuildValue("(dn)", start, log_rows);
+        if (val == NULL) return -1;
+        flag = PyList_Append(beat_list, val);
+        Py_DECREF(val);
+        if (flag) return flag;
+    }
+    if (snapshot_list != Py_None) {
+        state = PyList_New(n_y);
+        if (state == NULL) return -1;
+        for (i=0; i<n_y; i++) {
+            PyList_SetItem(state, i, PyFloat_FromDouble(NV_Ith_S(y, i))); /* Steals reference */
+        }
+        val = Py_BuildValue("(dN)", start, state);  /* Steals reference to state */
+        if (val == NULL) return -1;
+        flag = PyList_Append(snapshot_list, val);
+        Py_DECREF(val);
+        if (flag) return flag;
+    }
+    return 0;
+}
+
+/*
+ * Right-hand side of the quadratures, as used by CVODES: updates the model to
+ * (t, y) and then evaluates every integrand.
+ *
+ * CVODES calls this once per step, at the corrected state, which the model
+ * right-hand side has not been evaluated at. The model is updated without
+ * counting an evaluation, so that the number of evaluations (and the bound
+ * variable that reports it) does not depend on the quadratures.
+ */
+static int
+quad_rhs(realtype t, N_Vector y, N_Vector yqdot, void *user_data)
+{
+    int i;
+    realtype* q = N_VGetArrayPointer(yqdot);
+    if (rhs_update(t, N_VGetArrayPointer(y), NULL, user_data)) return -1;
+    for (i=0; i<n_quads; i++) {
+        q[i] = (realtype)Expr_Evaluate(quads[i]);
+    }
+    return 0;
+}
+
+/*
+ * Stores the integrals since the last reset as a tuple (start, end, values)
+ * in the quadrature list, and resets them to zero. Called at the start of
+ * every beat, and at the end of a run. Nothing is stored if no time has
+ * passed since the last reset.
+ *
+ * The integrals are interpolated at t, as CVODES may have stepped past it.
+ * Instead of reinitialising the quadratures (which would lose the part
+ * already integrated past t), the values at t are stored in yq_start and
+ * subtracted at the next reset.
+ *
+ * Returns 0 on success, or -1 if an exception was set.
+ */
+static int
+quad_record(void)
+{
+    PyObject *val, *values;
+    int i, flag;
+
+    if (n_quads == 0 || !(t > quad_start)) return 0;
+
+    flag = CVodeGetQuadDky(cvode_mem, t, 0, yq);
+    if (check_cvode_flag(&flag, "CVodeGetQuadDky", 1)) return -1;
+    values = PyList_New(n_quads);
+    if (values == NULL) return -1;
+    for (i=0; i<n_quads; i++) {
+        PyList_SetItem(values, i, PyFloat_FromDouble(NV_Ith_S(yq, i) - NV_Ith_S(yq_start, i))); /* Steals reference */
+    }
+    val = Py_BuildValue("(ddN)", quad_start, t, values);  /* Steals reference to values */
+    if (val == NULL) return -1;
+    flag = PyList_Append(quad_list, val);
+    Py_DECREF(val);
+    if (flag) return flag;
+
+    /* Reset */
+    N_VScale(RCONST(1.0), yq, yq_start);
+    quad_start = t;
+    return 0;
+}
+
+/*
+ * Creates a shared memory segment to publish the logged variables of every
+ * cell in the population, along with the full state.
+ *
+ * Column names are taken from the keys in the log dict that map to each cell's
+ * log lists, or, for logged expressions, from the names in the entries of
+ * log_exprs (a list of tuples (cell, list, program, name), or None).
+ *
+ * Returns 0 on success, or -1 if an exception was set.
+ */
+static int
+monitor_init(const char* name, int capacity, PyObject* log_exprs)
+{
+    int c, i, k, n_columns;
+    Py_ssize_t pos;
+    PyObject *key, *val, *entry, *names, *sep, *joined;
+    const char* names_str;
+    Monitor_Flag flag;
+
+    /* Gather pointers to the logged values */
+    n_columns = 0;
+    for (c=0; c<n_cells; c++) n_columns += models[c]->n_logged_variables;
+    monitor_vars = (double**)malloc((size_t)(n_columns > 0 ? n_columns : 1) * sizeof(double*));
+    if (monitor_vars == NULL) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate space for monitor.");
+        return -1;
+    }
+    names = PyList_New(n_columns);
+    if (names == NULL) return -1;
+    k = 0;
+    for (c=0; c<n_cells; c++) {
+        for (i=0; i<models[c]->n_logged_variables; i++) {
+            monitor_vars[k] = models[c]->_log_vars[i];
+
+            /* Find the log key or expression name for this list */
+            key = NULL;
+            pos = 0;
+            while (PyDict_Next(log_dict, &pos, &key, &val)) {
+                if (val == models[c]->_log_lists[i]) break;
+                key = NULL;
+            }
+            if (key == NULL && log_exprs != Py_None) {
+                for (pos=0; pos<PyList_GET_SIZE(log_exprs); pos++) {
+                    entry = PyList_GET_ITEM(log_exprs, pos);
+                    if (PyTuple_GET_ITEM(entry, 1) == models[c]->_log_lists[i]) {
+                        key = PyTuple_GET_ITEM(entry, 3);
+                        break;
+                    }
+                }
+            }
+            if (key == NULL) {
+                key = PyUnicode_FromString("?");
+                if (key == NULL) { Py_DECREF(names); return -1; }
+            } else {
+                Py_INCREF(key);
+            }
+            PyList_SET_ITEM(names, k, key);  /* Steals reference */
+            k++;
+        }
+    }
+
+    /* Join names with newlines */
+    sep = PyUnicode_FromString("\n");
+    joined = (sep == NULL) ? NULL : PyUnicode_Join(sep, names);
+    Py_XDECREF(sep);
+    Py_DECREF(names);
+    if (joined == NULL) return -1;
+    names_str = PyUnicode_AsUTF8(joined);
+    if (names_str == NULL) { Py_DECREF(joined); return -1; }
+
+    monitor = Monitor_Create(name, (size_t)n_y, (size_t)n_columns, (size_t)capacity, names_str, &flag);
+    Py_DECREF(joined);
+    if (flag != Monitor_OK) {
+        Monitor_SetPyErr(flag);
+        return -1;
+    }
+    Monitor_SetState(monitor, t, N_VGetArrayPointer(y));
+    return 0;
+}
+
+/*
+ * Returns the approximate number of bytes used by the Python objects in a log
+ * list: the list itself and the float objects it holds. Objects that are not
+ * lists are counted as holding floats only.
+ */
+static size_t
+log_list_memory(PyObject* list)
+{
+    Py_ssize_t n;
+    if (PyList_Check(list)) {
+        return sizeof(PyListObject) + (size_t)((PyListObject*)list)->allocated * sizeof(PyObject*)
+            + (size_t)PyList_GET_SIZE(list) * sizeof(PyFloatObject);
+    }
+    n = PyObject_Length(list);
+    if (n < 0) {
+        PyErr_Clear();
+        return 0;
+    }
+    return (size_t)n * sizeof(PyFloatObject);
+}
+
+/*
+ * Measures the memory used by the current simulation, storing the number of
+ * bytes per category in `usage`. Quantities that are not known exactly (e.g.
+ * the contents of log lists) are estimated.
+ */
+static void
+memory_measure(size_t* usage)
+{
+    int c, i;
+    size_t variables, sensitivities;
+    long lenrw, leniw;
+    Py_ssize_t n;
+
+    for (i=0; i<MEM_N; i++) usage[i] = 0;
+
+    /* Models and logs */
+    if (models != NULL) {
+        usage[MEM_MODEL] += (size_t)n_cells * sizeof(Model);
+        for (c=0; c<n_cells; c++) {
+            if (models[c] == NULL) continue;
+            Model_GetMemoryUsage(models[c], &variables, &sensitivities);
+            usage[MEM_MODEL] += variables;
+            usage[MEM_SENSITIVITIES] += sensitivities;
+            if (models[c]->logging_initialized) {
+                for (i=0; i<models[c]->n_logged_variables; i++) {
+                    usage[MEM_LOGS] += log_list_memory(models[c]->_log_lists[i]);
+                    if (models[c]->_log_time_lists != NULL && models[c]->_log_time_lists[i] != NULL) {
+                        usage[MEM_LOGS] += log_list_memory(models[c]->_log_time_lists[i]);
+                    }
+                }
+            }
+        }
+    }
+    if (exprs != NULL) {
+        usage[MEM_MODEL] += (size_t)n_exprs * (sizeof(Expr) + sizeof(realtype));
+        for (i=0; i<n_exprs; i++) usage[MEM_MODEL] += Expr_GetMemoryUsage(exprs[i]);
+    }
+    if (quads != NULL) {
+        usage[MEM_SOLVER] += (size_t)n_quads * (sizeof(Expr) + 2 * sizeof(realtype));
+        for (i=0; i<n_quads; i++) usage[MEM_SOLVER] += Expr_GetMemoryUsage(quads[i]);
+    }
+    if (sens_list != NULL && sens_list != Py_None && model != NULL && PyList_Check(sens_list)) {
+        /* Each entry is a list of ns_dependents lists of ns_independents floats */
+        n = PyList_GET_SIZE(sens_list);
+        usage[MEM_LOGS] += log_list_memory(sens_list) + (size_t)n * (size_t)model->ns_dependents
+            * (sizeof(PyListObject) + (size_t)model->ns_independents * (sizeof(PyObject*) + sizeof(PyFloatObject)));
+    }
+
+    /* Coupling */
+    usage[MEM_MODEL] += (size_t)n_edges * (2 * sizeof(int) + sizeof(double));
+    if (diffusion != NULL) usage[MEM_MODEL] += (size_t)n_cells * sizeof(double);
+
+    /* Pacing */
+    for (i=0; i<n_pace; i++) {
+        if (pacing_systems == NULL || pacing_types == NULL) break;
+        if (pacing_types[i] == FIXED) {
+            usage[MEM_PACING] += FSys_GetMemoryUsage(pacing_systems[i].fixed);
+        } else if (pacing_types[i] == ANALYTIC) {
+            usage[MEM_PACING] += ASys_GetMemoryUsage(pacing_systems[i].analytic);
+        } else {
+            usage[MEM_PACING] += ESys_GetMemoryUsage(pacing_systems[i].event);
+        }
+    }
+    usage[MEM_PACING] += (size_t)n_pace * (sizeof(union PSys) + sizeof(enum PSysType) + 2 * sizeof(double));
+    if (merged_pacing != NULL) usage[MEM_PACING] += MSys_GetMemoryUsage(merged_pacing);
+
+    /* State vectors */
+    if (y != NULL) usage[MEM_SOLVER] += (size_t)n_y * sizeof(realtype);
+    if (ylast != NULL) usage[MEM_SOLVER] += (size_t)n_y * sizeof(realtype);
+    if (z != NULL && z != y) usage[MEM_SOLVER] += (size_t)n_y * sizeof(realtype);
+    if (model != NULL) {
+        if (sy != NULL) usage[MEM_SENSITIVITIES] += (size_t)model->ns_independents * (size_t)n_y * sizeof(realtype);
+        if (sz != NULL && sz != sy) usage[MEM_SENSITIVITIES] += (size_t)model->ns_independents * (size_t)n_y * sizeof(realtype);
+        if (pbar != NULL) usage[MEM_SENSITIVITIES] += 2 * (size_t)model->ns_independents * sizeof(realtype);
+    }
+
+    /* Solvers */
+    usage[MEM_SOLVER] += ERK_GetMemoryUsage(erk) + ROS_GetMemoryUsage(ros);
+    if (cvode_mem != NULL) {
+        if (CVodeGetWorkSpace(cvode_mem, &lenrw, &leniw) == CV_SUCCESS) {
+            usage[MEM_SOLVER] += (size_t)lenrw * sizeof(realtype) + (size_t)leniw * sizeof(long);
+        }
+        #if SUNDIALS_VERSION_MAJOR >= 4
+        if (CVodeGetLinWorkSpace(cvode_mem, &lenrw, &leniw) == CV_SUCCESS) {
+        #else
+        if (CVDlsGetWorkSpace(cvode_mem, &lenrw, &leniw) == CV_SUCCESS) {
+        #endif
+            usage[MEM_LINEAR_SOLVER] += (size_t)lenrw * sizeof(realtype) + (size_t)leniw * sizeof(long);
+        }
+    }
+}
+
+/*
+ * Utility function to set the state sensitivities and evaluate the sensitivity
+ * outputs.
+ *
+ * Assumes the RHS has been evaluated.
+ */
+static void
+shs(N_Vector* sy)
+{
+    int i, j;
+
+    /* Unpack state sensitivities */
+    for (i=0; i<model->ns_independents; i++) {
+        for (j=0; j<model->n_states; j++) {
+            model->s_states[i * model->n_states + j] = NV_Ith_S(sy[i], j);
+        }
+    }
+
+    /* Calculate intermediary variable sensitivities */
+    Model_EvaluateSensitivityOutputs(model);
+}
+
+/*
+ * Root finding function. Can contain several functions for which a root is to
+ * be found, but we only use one.
+ */
+static int
+rf_function(realtype t, N_Vector y, realtype *gout, void *user_data)
+{
+    gout[0] = NV_Ith_S(y, rf_index) - rf_threshold;
+    return 0;
+}
+
+/*
+ * One-step solvers
+ *
+ * The explicit Runge-Kutta and Rosenbrock solvers share an interface: they
+ * never step beyond a given stopping time, provide dense output over the last
+ * step, and must be restarted after each discontinuity. The methods below
+ * dispatch to whichever one is selected, returning 0 on success or setting a
+ * Python exception and returning 1 on failure.
+ */
+static int
+ostep_init(double t0, realtype* y0)
+{
+    int flag;
+    if (solver_type == SOLVER_DOPRI5) {
+        flag = ERK_Init(erk, t0, y0);
+        if (flag != ERK_OK) { ERK_SetPyErr(flag); return 1; }
+    } else {
+        flag = ROS_Init(ros, t0, y0);
+        if (flag != ROS_OK) { ROS_SetPyErr(flag); return 1; }
+    }
+    return 0;
+}
+
+static int
+ostep_step(double tstop, double* tret, realtype* yret)
+{
+    int flag;
+    if (solver_type == SOLVER_DOPRI5) {
+        sim_release_gil();
+        flag = ERK_Step(erk, tstop, tret, yret);
+        sim_acquire_gil();
+        if (flag != ERK_OK) { ERK_SetPyErr(flag); return 1; }
+    } else {
+        sim_release_gil();
+        flag = ROS_Step(ros, tstop, tret, yret);
+        sim_acquire_gil();
+        if (flag != ROS_OK) { ROS_SetPyErr(flag); return 1; }
+    }
+    return 0;
+}
+
+static int
+ostep_interpolate(double tint, realtype* yret)
+{
+    int flag;
+    if (solver_type == SOLVER_DOPRI5) {
+        flag = ERK_Interpolate(erk, tint, yret);
+        if (flag != ERK_OK) { ERK_SetPyErr(flag); return 1; }
+    } else {
+        flag = ROS_Interpolate(ros, tint, yret);
+        if (flag != ROS_OK) { ROS_SetPyErr(flag); return 1; }
+    }
+    return 0;
+}
+
+/*
+ * Root finding for the one-step solvers, which (unlike CVODES) don't have
+ * built-in root finding.
+ *
+ * Checks if the root finding function changed sign between the previous
+ * point (tlast, ylast) and the current point (t, y), and if so locates the
+ * crossing using the solver's continuous extension (using the Illinois
+ * variant of regula falsi). If a crossing is found, t and y are moved back to
+ * the first point found after the crossing, and the direction of the crossing
+ * is stored in rf_direction[0].
+ *
+ * Returns 1 if a root was found, 0 if not.
+ */
+static int
+rf_dense(double tlast, N_Vector ylast, double* t, N_Vector y)
+{
+    double ta, tb, tc, ga, gb, gc, ttol;
+    int side, i;
+
+    ga = NV_Ith_S(ylast, rf_index) - rf_threshold;
+    gb = NV_Ith_S(y, rf_index) - rf_threshold;
+    if (ga < 0 && gb >= 0) {
+        rf_direction[0] = 1;
+    } else if (ga > 0 && gb <= 0) {
+        rf_direction[0] = -1;
+    } else {
+        return 0;
+    }
+
+    /* Bracket the crossing to within rounding-error distance */
+    ta = tlast;
+    tb = *t;
+    ttol = 100 * DBL_EPSILON * (fabs(tb) + fabs(tb - ta));
+    side = 0;
+    for (i=0; i<100 && tb - ta > ttol; i++) {
+        tc = tb - gb * (tb - ta) / (gb - ga);
+        if (!(tc > ta && tc < tb)) tc = ta + 0.5 * (tb - ta);
+        ostep_interpolate(tc, N_VGetArrayPointer(y));
+        gc = NV_Ith_S(y, rf_index) - rf_threshold;
+        if ((gc < 0) == (ga < 0) && gc != 0) {
+            ta = tc; ga = gc;
+            if (side == -1) gb *= 0.5;
+            side = -1;
+        } else {
+            tb = tc; gb = gc;
+            if (side == 1) ga *= 0.5;
+            side = 1;
+        }
+    }
+
+    /* Return the first point after the crossing */
+    ostep_interpolate(tb, N_VGetArrayPointer(y));
+    *t = tb;
+    return 1;
+}
+
+/*
+ * Cleans up after a simulation
+ */
+static PyObject*
+sim_clean(void)
+{
+    if (initialized) {
+        #ifdef MYOKIT_DEBUG_PROFILING
+        benchmarker_print("CP Entered sim_clean.");
+        #elif defined MYOKIT_DEBUG_MESSAGES
+        printf("CM Cleaning up.\n");
+        #endif
+
+        /* Store memory usage before freeing */
+        memory_measure(memory_last);
+
+        /* CVode arrays */
+        if (y != NULL) { N_VDestroy_Serial(y); y = NULL; }
+        if (ylast != NULL) { N_VDestroy_Serial(ylast); ylast = NULL; }
+        if (sy != NULL) { N_VDestroyVectorArray(sy, model->ns_independents); sy = NULL; }
+        if (model != NULL && model->is_ode && !dynamic_logging) {
+            if (z != NULL) { N_VDestroy_Serial(z); z = NULL; }
+            if (sz != NULL) { N_VDestroyVectorArray(sz, model->ns_independents); sz = NULL; }
+        }
+
+        /* Root finding results */
+        free(rf_direction); rf_direction = NULL;
+
+        /* Explicit Runge-Kutta solver */
+        if (erk != NULL) { ERK_Destroy(erk); erk = NULL; }
+
+        /* Rosenbrock solver */
+        if (ros != NULL) { ROS_Destroy(ros); ros = NULL; }
+
+        /* Sundials objects */
+        CVodeFree(&cvode_mem); cvode_mem = NULL;
+        #if SUNDIALS_VERSION_MAJOR >= 3
+        SUNLinSolFree(sundense_solver); sundense_solver = NULL;
+        SUNMatDestroy(sundense_matrix); sundense_matrix = NULL;
+        #endif
+        #if SUNDIALS_VERSION_MAJOR >= 6
+        SUNContext_Free(&sundials_context); sundials_context = NULL;
+        #endif
+
+        /* User data and parameter scale array*/
+        free(pbar);
         if (udata != NULL) {
             free(udata->p);
             free(udata); udata = NULL;
         }
 
         /* Pacing systems */
+        if (merged_pacing != NULL) { MSys_Destroy(merged_pacing); merged_pacing = NULL; }
         for (int i = 0; i < n_pace; i++) {
             if (pacing_types[i] == FIXED) {
                 FSys_Destroy(pacing_systems[i].fixed);
             } else if (pacing_types[i] == EVENT) {
                 ESys_Destroy(pacing_systems[i].event);
+            } else if (pacing_types[i] == ANALYTIC) {
+                ASys_Destroy(pacing_systems[i].analytic);
             }
         }
         free(pacing_systems); pacing_systems = NULL;
         free(pacing_types); pacing_types = NULL;
         free(pacing); pacing = NULL;
+        free(pacing_next); pacing_next = NULL;
+
+        /* CModels */
+        if (models != NULL) {
+            for (int i = 0; i < n_cells; i++) {
+                Model_Destroy(models[i]);
+            }
+            free(models); models = NULL;
+        }
+        model = NULL;
+
+        /* Coupling */
+        free(edge_i); edge_i = NULL;
+        free(edge_j); edge_j = NULL;
+        free(edge_g); edge_g = NULL;
+        free(diffusion); diffusion = NULL;
+        n_edges = 0;
+
+        /* Shared memory output */
+        Monitor_Destroy(monitor); monitor = NULL;
+        free(monitor_vars); monitor_vars = NULL;
+
+        /* Logged expressions */
+        if (exprs != NULL) {
+            for (int i = 0; i < n_exprs; i++) Expr_Destroy(exprs[i]);
+            free(exprs); exprs = NULL;
+        }
+        free(expr_values); expr_values = NULL;
+        n_exprs = 0;
 
-        /* CModel */
-        Model_Destroy(model); model = NULL;
+        /* Quadratures */
+        if (quads != NULL) {
+            for (int i = 0; i < n_quads; i++) Expr_Destroy(quads[i]);
+            free(quads); quads = NULL;
+        }
+        if (yq != NULL) { N_VDestroy_Serial(yq); yq = NULL; }
+        if (yq_start != NULL) { N_VDestroy_Serial(yq_start); yq_start = NULL; }
+        n_quads = 0;
 
         /* Benchmarking and profiling */
         #ifdef MYOKIT_DEBUG_PROFILING
@@ -1897,6 +2870,25 @@ py_sim_clean(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/*
+ * Opens a fine logging window starting at time ts, or extends the current
+ * window if ts falls inside it. Must only be called once everything before ts
+ * has been logged.
+ */
+static void
+fine_open(double ts)
+{
+    if (fine_interval <= 0) return;
+    if (ts < fine_end) {
+        fine_end = fmax(fine_end, ts + fine_duration);
+        return;
+    }
+    fine_start = ts;
+    fine_end = ts + fine_duration;
+    fine_index = 0;
+    if (tlog > ts) tlog = ts;
+}
+
 /*
  * Initialize a run.
  * Called by the Python code's run(), followed by several calls to sim_step().
@@ -1913,18 +2905,52 @@ sim_init(PyObject *self, PyObject *args)
     Model_Flag flag_model;
     ESys_Flag flag_epacing;
     FSys_Flag flag_fpacing;
-
+    ASys_Flag flag_apacing;
+    ERK_Flag flag_erk;
+    ROS_Flag flag_ros;
 
     /* Pacing systems */
     ESys epacing;
     FSys fpacing;
 
     /* General purpose ints for iterating */
-    int i, j;
+    int i, j, c;
+
+    /* Coupling edges, and the bandwidth of a coupled population's Jacobian */
+    PyObject *coupling;
+    int bandwidth;
+
+    /* Shared memory output name (or None), and number of rows to keep */
+    PyObject *monitor_name;
+    int monitor_capacity;
+
+    /* Interpolation method, simplification tolerance, period, and number of
+       repeats for each fixed-form protocol, or None */
+    PyObject *interpolations;
 
     /* Log the first point? Only happens if not continuing from a log */
     int log_first_point;
 
+    /* Fine logging windows, as a tuple (interval, duration, on_beat, state,
+       threshold), or None */
+    PyObject *fine_logging;
+    int beat_at_tmin;
+
+    /* Per-variable logging intervals, as a list of tuples (cell, list,
+       interval, time list), or None */
+    PyObject *log_intervals;
+    double interval;
+
+    /* Logged expressions, as a list of tuples (cell, list, program), or None */
+    PyObject *log_expressions;
+    Expr_Flag flag_expr;
+
+    /* Quadratures, as a tuple (integrands, list, error_control), where
+       integrands is a list of tuples (cell, program), or None */
+    PyObject *quadratures;
+    PyObject *integrands;
+    int quad_error_control;
+
     /* Proposed next logging or pacing point */
     double t_proposed;
 
@@ -1932,6 +2958,7 @@ sim_init(PyObject *self, PyObject *args)
     Py_ssize_t pos;
     PyObject *val;
     PyObject *ret;
+    PyObject *key;
 
     /* Check if already initialized */
     if (initialized) {
@@ -1949,9 +2976,39 @@ sim_init(PyObject *self, PyObject *args)
     /* Set all global pointers to null */
     /* Model and pacing */
     model = NULL;
+    models = NULL;
+    n_cells = 0;
+    /* Coupling */
+    n_edges = 0;
+    edge_i = NULL;
+    edge_j = NULL;
+    edge_g = NULL;
+    diffusion = NULL;
+    /* Shared memory output */
+    monitor = NULL;
+    monitor_vars = NULL;
+    /* Logged expressions */
+    n_exprs = 0;
+    exprs = NULL;
+    expr_values = NULL;
+    /* Quadratures */
+    n_quads = 0;
+    quads = NULL;
+    yq = NULL;
+    yq_start = NULL;
+    /* Beat index */
+    beat_system = -1;
+    beat_count = 0;
+    log_rows = 0;
+    beat_at_tmin = 0;
+    /* Fine logging windows */
+    fine_interval = 0;
+    fine_end = -HUGE_VAL;
     pacing_types = NULL;
     pacing_systems = NULL;
+    merged_pacing = NULL;
     pacing = NULL;
+    pacing_next = NULL;
     /* User data and parameter scaling */
     udata = NULL;
     pbar = NULL;
@@ -1969,7 +3026,9 @@ sim_init(PyObject *self, PyObject *args)
     benchmarker_print_str = NULL;
     #endif
 
-    /* CVode objects */
+    /* Solver objects */
+    erk = NULL;
+    ros = NULL;
     cvode_mem = NULL;
     #if SUNDIALS_VERSION_MAJOR >= 3
     sundense_matrix = NULL;
@@ -1980,8 +3039,8 @@ sim_init(PyObject *self, PyObject *args)
     #endif
 
 
-    /* Check input arguments     01234567890123456 */
-    if (!PyArg_ParseTuple(args, "ddOOOOOOOdOOidOOi",
+    /* Check input arguments     0123456789012345678901234567890 */
+    if (!PyArg_ParseTuple(args, "ddOOOOOOOdOOidOOiiOOiiOiOOOOOOO",
             &tmin,              /*  0. Float: initial time */
             &tmax,              /*  1. Float: final time */
             &state_py,          /*  2. List: initial and final state */
@@ -1998,7 +3057,21 @@ sim_init(PyObject *self, PyObject *args)
             &rf_threshold,      /* 13. Float: root-finding threshold */
             &rf_list,           /* 14. List to store roots in or None */
             &benchmarker,       /* 15. myokit.tools.Benchmarker object */
-            &log_realtime       /* 16. Int: 1 if logging real time */
+            &log_realtime,      /* 16. Int: 1 if logging real time */
+            &n_cells,           /* 17. Int: the number of cells in the population */
+            &cell_logs,         /* 18. List of per-cell log dicts, or None */
+            &coupling,          /* 19. List of (i, j, g) coupling edges, or None */
+            &coupling_state,    /* 20. Int: index of the membrane potential state */
+            &coupling_literal,  /* 21. Int: index of the diffusion current literal */
+            &monitor_name,      /* 22. String: shared memory output name, or None */
+            &monitor_capacity,  /* 23. Int: number of rows in shared memory output */
+            &beat_list,         /* 24. List to store beat starts in, or None */
+            &interpolations,    /* 25. List of (method, tolerance, period, repeats), or None */
+            &snapshot_list,     /* 26. List to store beat start states in, or None */
+            &fine_logging,      /* 27. Tuple of fine logging window settings, or None */
+            &log_intervals,     /* 28. List of per-variable logging intervals, or None */
+            &log_expressions,   /* 29. List of logged expressions, or None */
+            &quadratures        /* 30. Tuple of quadrature settings, or None */
     )) {
         PyErr_SetString(PyExc_Exception, "Incorrect input arguments.");
         return 0;
@@ -2082,14 +3155,70 @@ sim_init(PyObject *self, PyObject *args)
     #endif
 
     /*
-     * Create model
+     * Create models, one per cell
      */
-    model = Model_Create(&flag_model);
-    if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+    if (n_cells < 1) {
+        n_cells = 0;
+        return sim_cleanx(PyExc_ValueError, "The number of cells must be at least 1.");
+    }
+    models = (Model*)calloc((size_t)n_cells, sizeof(Model));
+    if (models == NULL) {
+        n_cells = 0;
+        return sim_cleanx(PyExc_Exception, "Unable to allocate space to store model objects.");
+    }
+    for (c=0; c<n_cells; c++) {
+        models[c] = Model_Create(&flag_model);
+        if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+    }
+    model = models[0];
+    n_y = n_cells * model->n_states;
     #ifdef MYOKIT_DEBUG_PROFILING
-    benchmarker_print("CP Created C model struct.");
+    benchmarker_print("CP Created C model structs.");
     #endif
 
+    /* Sensitivities are only supported for single cells */
+    if (model->has_sensitivities && n_cells > 1) {
+        return sim_cleanx(PyExc_ValueError, "Sensitivity calculations are not supported for populations.");
+    }
+
+    /*
+     * Set up coupling between cells
+     */
+    bandwidth = model->n_states - 1;
+    if (coupling != Py_None) {
+        if (!PyList_Check(coupling)) {
+            return sim_cleanx(PyExc_TypeError, "'coupling' must be a list or None.");
+        }
+        if (coupling_state < 0 || coupling_state >= model->n_states) {
+            return sim_cleanx(PyExc_ValueError, "Invalid coupling state index.");
+        }
+        if (coupling_literal < 0 || coupling_literal >= model->n_literals) {
+            return sim_cleanx(PyExc_ValueError, "Invalid coupling literal index.");
+        }
+        i = (int)PyList_Size(coupling);
+        edge_i = (int*)malloc((size_t)i * sizeof(int));
+        edge_j = (int*)malloc((size_t)i * sizeof(int));
+        edge_g = (double*)malloc((size_t)i * sizeof(double));
+        diffusion = (double*)malloc((size_t)n_cells * sizeof(double));
+        if (edge_i == NULL || edge_j == NULL || edge_g == NULL || diffusion == NULL) {
+            return sim_cleanx(PyExc_Exception, "Unable to allocate space to store coupling edges.");
+        }
+        for (n_edges=0; n_edges<i; n_edges++) {
+            val = PyList_GetItem(coupling, n_edges);    /* Don't decref */
+            if (!PyArg_ParseTuple(val, "iid", edge_i + n_edges, edge_j + n_edges, edge_g + n_edges)) {
+                return sim_cleanx(PyExc_ValueError, "Item %d in coupling list is not a tuple (i, j, g).", n_edges);
+            }
+            if (edge_i[n_edges] < 0 || edge_i[n_edges] >= n_cells || edge_j[n_edges] < 0
+                    || edge_j[n_edges] >= n_cells || edge_i[n_edges] == edge_j[n_edges]) {
+                return sim_cleanx(PyExc_ValueError, "Item %d in coupling list has invalid cell indices.", n_edges);
+            }
+            j = abs(edge_i[n_edges] - edge_j[n_edges]);
+            if (model->n_states * (j + 1) - 1 > bandwidth) {
+                bandwidth = model->n_states * (j + 1) - 1;
+            }
+        }
+    }
+
     /*
      * Create sundials context
      */
@@ -2109,9 +3238,9 @@ sim_init(PyObject *self, PyObject *args)
 
     /* Create state vector */
     #if SUNDIALS_VERSION_MAJOR >= 6
-    y = N_VNew_Serial(model->n_states, sundials_context);
+    y = N_VNew_Serial(n_y, sundials_context);
     #else
-    y = N_VNew_Serial(model->n_states);
+    y = N_VNew_Serial(n_y);
     #endif
     if (check_cvode_flag((void*)y, "N_VNew_Serial", 0)) {
         return sim_cleanx(PyExc_Exception, "Failed to create state vector.");
@@ -2119,9 +3248,9 @@ sim_init(PyObject *self, PyObject *args)
 
     /* Create state vector copy for error handling */
     #if SUNDIALS_VERSION_MAJOR >= 6
-    ylast = N_VNew_Serial(model->n_states, sundials_context);
+    ylast = N_VNew_Serial(n_y, sundials_context);
     #else
-    ylast = N_VNew_Serial(model->n_states);
+    ylast = N_VNew_Serial(n_y);
     #endif
     if (check_cvode_flag((void*)ylast, "N_VNew_Serial", 0)) {
         return sim_cleanx(PyExc_Exception, "Failed to create last-state vector.");
@@ -2151,9 +3280,9 @@ sim_init(PyObject *self, PyObject *args)
         sz = sy;
     } else {
         #if SUNDIALS_VERSION_MAJOR >= 6
-        z = N_VNew_Serial(model->n_states, sundials_context);
+        z = N_VNew_Serial(n_y, sundials_context);
         #else
-        z = N_VNew_Serial(model->n_states);
+        z = N_VNew_Serial(n_y);
         #endif
         if (check_cvode_flag((void*)z, "N_VNew_Serial", 0)) {
             return sim_cleanx(PyExc_Exception, "Failed to create state vector for logging.");
@@ -2178,19 +3307,22 @@ sim_init(PyObject *self, PyObject *args)
     if (!PyList_Check(state_py)) {
         return sim_cleanx(PyExc_TypeError, "'state_py' must be a list.");
     }
-    for (i=0; i<model->n_states; i++) {
+    if (PyList_Size(state_py) != n_y) {
+        return sim_cleanx(PyExc_ValueError, "'state_py' must have length %d.", n_y);
+    }
+    for (i=0; i<n_y; i++) {
         val = PyList_GetItem(state_py, i);    /* Don't decref! */
         if (!PyFloat_Check(val)) {
             return sim_cleanx(PyExc_ValueError, "Item %d in state vector is not a float.", i);
         }
-        model->states[i] = PyFloat_AsDouble(val);
-        NV_Ith_S(y, i) = model->states[i];
+        NV_Ith_S(y, i) = PyFloat_AsDouble(val);
+        models[i / model->n_states]->states[i % model->n_states] = NV_Ith_S(y, i);
     }
 
     /* Print initial state */
     #ifdef MYOKIT_DEBUG_MESSAGES
     printf("CM Initial state vector (CVODES):\n");
-    for (i=0; i<model->n_states; i++) {
+    for (i=0; i<n_y; i++) {
         printf("CM   %g\n", NV_Ith_S(y, i));
     }
     #endif
@@ -2235,16 +3367,20 @@ sim_init(PyObject *self, PyObject *args)
 
     /*
      * Set values of constants (literals and parameters)
+     * Literals are given for each cell in turn.
      */
     if (!PyList_Check(literals)) {
         return sim_cleanx(PyExc_TypeError, "'literals' must be a list.");
     }
-    for (i=0; i<model->n_literals; i++) {
+    if (PyList_Size(literals) != n_cells * model->n_literals) {
+        return sim_cleanx(PyExc_ValueError, "'literals' must have length %d.", n_cells * model->n_literals);
+    }
+    for (i=0; i<n_cells * model->n_literals; i++) {
         val = PyList_GetItem(literals, i);    /* Don't decref */
         if (!PyFloat_Check(val)) {
             return sim_cleanx(PyExc_ValueError, "Item %d in literal vector is not a float.", i);
         }
-        model->literals[i] = PyFloat_AsDouble(val);
+        models[i / model->n_literals]->literals[i % model->n_literals] = PyFloat_AsDouble(val);
     }
 
     /* Print initial sensitivities */
@@ -2260,7 +3396,9 @@ sim_init(PyObject *self, PyObject *args)
     #endif
 
     /* Evaluate calculated constants */
-    Model_EvaluateLiteralDerivedVariables(model);
+    for (c=0; c<n_cells; c++) {
+        Model_EvaluateLiteralDerivedVariables(models[c]);
+    }
 
     #ifdef MYOKIT_DEBUG_PROFILING
     benchmarker_print("CP Set values of calculated constants.");
@@ -2344,7 +3482,15 @@ sim_init(PyObject *self, PyObject *args)
     if (pacing == NULL) {
         return sim_cleanx(PyExc_Exception, "Unable to allocate space to store pacing values.");
     }
-    Model_SetupPacing(model, n_pace);
+    pacing_next = (double*)malloc((size_t)n_pace * sizeof(double));
+    if (pacing_next == NULL) {
+        return sim_cleanx(PyExc_Exception, "Unable to allocate space to store pacing times.");
+    }
+    for (i=0; i<n_pace; i++) pacing_next[i] = HUGE_VAL;
+    tnext_pacing = HUGE_VAL;
+    for (c=0; c<n_cells; c++) {
+        Model_SetupPacing(models[c], n_pace);
+    }
 
     /*
      *  Unless set by pacing, tnext is set to tmax
@@ -2367,6 +3513,17 @@ sim_init(PyObject *self, PyObject *args)
                 if (flag_epacing != ESys_OK) { ESys_SetPyErr(flag_epacing); return sim_clean(); }
                 flag_epacing = ESys_AdvanceTime(epacing, tmin);
                 if (flag_epacing != ESys_OK) { ESys_SetPyErr(flag_epacing); return sim_clean(); }
+
+                /* Index beats of the first event-based pacing system,
+                   starting with any that start exactly at tmin */
+                if (beat_system < 0) {
+                    beat_system = i;
+                    if (ESys_GetFiredCount(epacing, NULL) > 0 && ESys_eq(ESys_GetFiredTime(epacing, NULL), tmin)) {
+                        if (beat_record(tmin)) return sim_clean();
+                        beat_at_tmin = 1;
+                    }
+                }
+
                 t_proposed = ESys_GetNextTime(epacing, &flag_epacing);
                 pacing[i] = ESys_GetLevel(epacing, &flag_epacing);
                 tnext = fmin(t_proposed, tnext);
@@ -2374,29 +3531,145 @@ sim_init(PyObject *self, PyObject *args)
                 #ifdef MYOKIT_DEBUG_PROFILING
                 benchmarker_print("CP Created event-based pacing system.");
                 #endif
-            } else if (strcmp(protocol_type_name, "TimeSeriesProtocol") == 0) {
+            } else if (strcmp(protocol_type_name, "TimeSeriesProtocol") == 0 || strcmp(protocol_type_name, "MappedTimeSeriesProtocol") == 0) {
                 pacing_systems[i].fixed = FSys_Create(&flag_fpacing);
                 pacing_types[i] = FIXED;
                 fpacing = pacing_systems[i].fixed;
                 if (flag_fpacing != FSys_OK) { FSys_SetPyErr(flag_fpacing); return sim_clean(); }
-                flag_fpacing = FSys_Populate(fpacing, protocol);
+                if (interpolations != Py_None) {
+                    val = PyList_GetItem(interpolations, i); /* Borrowed reference */
+                    flag_fpacing = FSys_SetInterpolation(fpacing, (int)PyLong_AsLong(PyTuple_GetItem(val, 0)));
+                    if (flag_fpacing != FSys_OK) { FSys_SetPyErr(flag_fpacing); return sim_clean(); }
+                    flag_fpacing = FSys_SetTolerance(fpacing, PyFloat_AsDouble(PyTuple_GetItem(val, 1)));
+                    if (flag_fpacing != FSys_OK) { FSys_SetPyErr(flag_fpacing); return sim_clean(); }
+                    flag_fpacing = FSys_SetPeriod(fpacing, PyFloat_AsDouble(PyTuple_GetItem(val, 2)), PyLong_AsLong(PyTuple_GetItem(val, 3)));
+                    if (flag_fpacing != FSys_OK) { FSys_SetPyErr(flag_fpacing); return sim_clean(); }
+                    val = NULL;
+                }
+                if (strcmp(protocol_type_name, "MappedTimeSeriesProtocol") == 0) {
+                    /* Map binary time-series file, instead of copying lists */
+                    val = PyObject_CallMethod(protocol, "path", NULL); /* New reference */
+                    if (val == NULL || !PyUnicode_Check(val)) {
+                        Py_XDECREF(val); val = NULL;
+                        return sim_cleanx(PyExc_TypeError, "Item %d in 'protocols' does not return a valid path.", i);
+                    }
+                    flag_fpacing = FSys_PopulateFromFile(fpacing, PyUnicode_AsUTF8(val));
+                    Py_DECREF(val); val = NULL;
+                } else {
+                    flag_fpacing = FSys_Populate(fpacing, protocol);
+                }
                 if (flag_fpacing != FSys_OK) { FSys_SetPyErr(flag_fpacing); return sim_clean(); }
 
+                /* Stop at every jump in the level (zero-order hold, repeats) */
+                t_proposed = FSys_GetNextTime(fpacing, tmin, NULL);
+                pacing_next[i] = t_proposed;
+                tnext_pacing = fmin(t_proposed, tnext_pacing);
+                tnext = fmin(t_proposed, tnext);
+
 
                 #ifdef MYOKIT_DEBUG_PROFILING
                 benchmarker_print("CP Created fixed-form pacing system.");
                 #endif
+            } else if (strcmp(protocol_type_name, "AnalyticProtocol") == 0) {
+                pacing_systems[i].analytic = ASys_Create(&flag_apacing);
+                pacing_types[i] = ANALYTIC;
+                if (flag_apacing != ASys_OK) { ASys_SetPyErr(flag_apacing); return sim_clean(); }
+                flag_apacing = ASys_Populate(pacing_systems[i].analytic, protocol);
+                if (flag_apacing != ASys_OK) { ASys_SetPyErr(flag_apacing); return sim_clean(); }
+
+                /* Stop where components start or end */
+                t_proposed = ASys_GetNextTime(pacing_systems[i].analytic, tmin, NULL);
+                pacing_next[i] = t_proposed;
+                tnext_pacing = fmin(t_proposed, tnext_pacing);
+                tnext = fmin(t_proposed, tnext);
             } else {
                 printf("protocol_type_name: %s", protocol_type_name);
-                return sim_cleanx(PyExc_TypeError, "Item %d in 'protocols' is not a myokit.Protocol or myokit.TimeSeriesProtocol object.", i);
+                return sim_cleanx(PyExc_TypeError, "Item %d in 'protocols' is not a myokit.Protocol, myokit.TimeSeriesProtocol, MappedTimeSeriesProtocol, or AnalyticProtocol object.", i);
             }
         }
     }
 
+    /* Merge all event-based systems into a single timeline */
+    j = 0;
+    for (i=0; i<n_pace; i++) {
+        if (pacing_types[i] == EVENT) j++;
+    }
+    if (j > 0) {
+        ESys* esystems = (ESys*)malloc((size_t)n_pace * sizeof(ESys));
+        if (esystems == NULL) {
+            return sim_cleanx(PyExc_Exception, "Unable to allocate space to merge pacing systems.");
+        }
+        for (i=0; i<n_pace; i++) {
+            esystems[i] = (pacing_types[i] == EVENT) ? pacing_systems[i].event : NULL;
+        }
+        merged_pacing = MSys_Create(n_pace, esystems, tmax, &flag_epacing);
+        free(esystems);
+        if (flag_epacing != ESys_OK) { ESys_SetPyErr(flag_epacing); return sim_clean(); }
+    }
+
+    /* Sensitivities are only supported with CVODES */
+    if (model->is_ode && model->has_sensitivities && solver_type != SOLVER_CVODES) {
+        return sim_cleanx(PyExc_ValueError, "Sensitivity calculations are only supported when using CVODES.");
+    }
+
     /*
-     * Create solver
+     * Create explicit Runge-Kutta solver
      */
-    if (model->is_ode) {
+    if (model->is_ode && solver_type == SOLVER_DOPRI5) {
+
+        /* Create solver */
+        erk = ERK_Create(n_y, rhs_eval, udata, &flag_erk);
+        if (flag_erk != ERK_OK) { ERK_SetPyErr(flag_erk); return sim_clean(); }
+        flag_erk = ERK_SetThreadState(erk, &sim_thread_state);
+        if (flag_erk != ERK_OK) { ERK_SetPyErr(flag_erk); return sim_clean(); }
+
+        /* Set tolerances and step size bounds */
+        flag_erk = ERK_SetTolerances(erk, rel_tol, abs_tol);
+        if (flag_erk != ERK_OK) { ERK_SetPyErr(flag_erk); return sim_clean(); }
+        flag_erk = ERK_SetStepSizeBounds(erk, dt_min < 0 ? 0.0 : dt_min, dt_max < 0 ? 0.0 : dt_max);
+        if (flag_erk != ERK_OK) { ERK_SetPyErr(flag_erk); return sim_clean(); }
+
+        /* Set initial time and state */
+        flag_erk = ERK_Init(erk, t, N_VGetArrayPointer(y));
+        if (flag_erk != ERK_OK) { ERK_SetPyErr(flag_erk); return sim_clean(); }
+
+        #ifdef MYOKIT_DEBUG_PROFILING
+        benchmarker_print("CP Explicit Runge-Kutta solver initialized.");
+        #endif
+    }
+
+    /*
+     * Create Rosenbrock solver
+     */
+    if (model->is_ode && solver_type == SOLVER_ROSENBROCK) {
+
+        /* Create solver. The generated model code doesn't provide an analytic
+           Jacobian, so the solver's finite-difference approximation is used
+           (a Jacobian function can be set with ROS_SetJacobian). */
+        ros = ROS_Create(n_y, rhs_eval, udata, &flag_ros);
+        if (flag_ros != ROS_OK) { ROS_SetPyErr(flag_ros); return sim_clean(); }
+        flag_ros = ROS_SetThreadState(ros, &sim_thread_state);
+        if (flag_ros != ROS_OK) { ROS_SetPyErr(flag_ros); return sim_clean(); }
+
+        /* Set tolerances and step size bounds */
+        flag_ros = ROS_SetTolerances(ros, rel_tol, abs_tol);
+        if (flag_ros != ROS_OK) { ROS_SetPyErr(flag_ros); return sim_clean(); }
+        flag_ros = ROS_SetStepSizeBounds(ros, dt_min < 0 ? 0.0 : dt_min, dt_max < 0 ? 0.0 : dt_max);
+        if (flag_ros != ROS_OK) { ROS_SetPyErr(flag_ros); return sim_clean(); }
+
+        /* Set initial time and state */
+        flag_ros = ROS_Init(ros, t, N_VGetArrayPointer(y));
+        if (flag_ros != ROS_OK) { ROS_SetPyErr(flag_ros); return sim_clean(); }
+
+        #ifdef MYOKIT_DEBUG_PROFILING
+        benchmarker_print("CP Rosenbrock solver initialized.");
+        #endif
+    }
+
+    /*
+     * Create CVODES solver
+     */
+    if (model->is_ode && solver_type == SOLVER_CVODES) {
 
         /* Create, using backwards differentiation and newton iterations */
         #if SUNDIALS_VERSION_MAJOR >= 6
@@ -2428,6 +3701,59 @@ sim_init(PyObject *self, PyObject *args)
         flag_cvode = CVodeSetMinStep(cvode_mem, dt_min < 0 ? 0.0 : dt_min);
         if (check_cvode_flag(&flag_cvode, "CVodeSetminStep", 1)) return sim_clean();
 
+        if (n_cells > 1) {
+            /* Populations: the Jacobian is block-diagonal, with one block per
+               cell. With SUNDIALS 5 or newer a dedicated block-diagonal solver
+               is used. For older versions, a band solver (with bandwidth
+               equal to the block size) captures the same structure.
+               Coupled populations add off-diagonal blocks for every edge,
+               and use the network solver or a wider band. */
+            #if SUNDIALS_VERSION_MAJOR >= 6
+            if (n_edges > 0) {
+                sundense_solver = Network_Create(y, n_cells, model->n_states, n_edges, edge_i, edge_j, sundials_context);
+            } else {
+                sundense_solver = BlockDiag_Create(y, n_cells, model->n_states, sundials_context);
+            }
+            #elif SUNDIALS_VERSION_MAJOR >= 5
+            if (n_edges > 0) {
+                sundense_solver = Network_Create(y, n_cells, model->n_states, n_edges, edge_i, edge_j);
+            } else {
+                sundense_solver = BlockDiag_Create(y, n_cells, model->n_states);
+            }
+            #elif SUNDIALS_VERSION_MAJOR >= 4
+            sundense_matrix = SUNBandMatrix(n_y, bandwidth, bandwidth);
+            if (check_cvode_flag((void *)sundense_matrix, "SUNBandMatrix", 0)) return sim_clean();
+            sundense_solver = SUNLinSol_Band(y, sundense_matrix);
+            #elif SUNDIALS_VERSION_MAJOR >= 3
+            sundense_matrix = SUNBandMatrix(n_y, bandwidth, bandwidth);
+            if (check_cvode_flag((void *)sundense_matrix, "SUNBandMatrix", 0)) return sim_clean();
+            sundense_solver = SUNBandLinearSolver(y, sundense_matrix);
+            #endif
+            #if SUNDIALS_VERSION_MAJOR >= 3
+            if (check_cvode_flag((void *)sundense_solver, "Population linear solver", 0)) return sim_clean();
+            #endif
+
+            /* Attach the solver to cvode */
+            #if SUNDIALS_VERSION_MAJOR >= 5
+            flag_cvode = CVodeSetLinearSolver(cvode_mem, sundense_solver, NULL);
+            if (check_cvode_flag(&flag_cvode, "CVodeSetLinearSolver", 1)) return sim_clean();
+            if (n_edges > 0) {
+                flag_cvode = CVodeSetPreconditioner(cvode_mem, network_psetup, network_psolve);
+            } else {
+                flag_cvode = CVodeSetPreconditioner(cvode_mem, block_psetup, block_psolve);
+            }
+            if (check_cvode_flag(&flag_cvode, "CVodeSetPreconditioner", 1)) return sim_clean();
+            #elif SUNDIALS_VERSION_MAJOR >= 4
+            flag_cvode = CVodeSetLinearSolver(cvode_mem, sundense_solver, sundense_matrix);
+            if (check_cvode_flag(&flag_cvode, "CVodeSetLinearSolver", 1)) return sim_clean();
+            #elif SUNDIALS_VERSION_MAJOR >= 3
+            flag_cvode = CVDlsSetLinearSolver(cvode_mem, sundense_solver, sundense_matrix);
+            if (check_cvode_flag(&flag_cvode, "CVDlsSetLinearSolver", 1)) return sim_clean();
+            #else
+            flag_cvode = CVBand(cvode_mem, n_y, bandwidth, bandwidth);
+            if (check_cvode_flag(&flag_cvode, "CVBand", 1)) return sim_clean();
+            #endif
+        } else {
         #if SUNDIALS_VERSION_MAJOR >= 6
             /* Create dense matrix for use in linear solves */
             sundense_matrix = SUNDenseMatrix(model->n_states, model->n_states, sundials_context);
@@ -2469,6 +3795,7 @@ sim_init(PyObject *self, PyObject *args)
             flag_cvode = CVDense(cvode_mem, model->n_states);
             if (check_cvode_flag(&flag_cvode, "CVDense", 1)) return sim_clean();
         #endif
+        }
 
         #ifdef MYOKIT_DEBUG_PROFILING
         benchmarker_print("CP CVODES solver initialized.");
@@ -2500,6 +3827,68 @@ sim_init(PyObject *self, PyObject *args)
         }
     }
 
+    /*
+     * Quadratures
+     * Enabled if quadratures is a tuple
+     */
+    quad_start = tmin;
+    if (quadratures != Py_None) {
+        if (!PyArg_ParseTuple(quadratures, "OOi", &integrands, &quad_list, &quad_error_control)) {
+            return sim_cleanx(PyExc_TypeError, "'quadratures' must be a tuple (integrands, list, error_control).");
+        }
+        if (!PyList_Check(integrands) || !PyList_Check(quad_list)) {
+            return sim_cleanx(PyExc_TypeError, "Quadrature integrands and results must be lists.");
+        }
+        if (!model->is_ode || solver_type != SOLVER_CVODES) {
+            return sim_cleanx(PyExc_ValueError, "Quadratures are only supported when using CVODES to solve an ODE model.");
+        }
+
+        /* Compile integrands */
+        n_quads = (int)PyList_Size(integrands);
+        quads = (Expr*)calloc((size_t)(n_quads > 0 ? n_quads : 1), sizeof(Expr));
+        if (quads == NULL) {
+            return sim_cleanx(PyExc_MemoryError, "Unable to allocate space for quadratures.");
+        }
+        for (i=0; i<n_quads; i++) {
+            if (!PyArg_ParseTuple(PyList_GetItem(integrands, i), "iO", &c, &val)) {
+                return sim_cleanx(PyExc_TypeError, "Quadrature integrands must be tuples (cell, program).");
+            }
+            if (c < 0 || c >= n_cells) {
+                return sim_cleanx(PyExc_ValueError, "Invalid cell index in quadrature integrands.");
+            }
+            quads[i] = Expr_Create(val, expr_lookup, models[c], &flag_expr);
+            if (flag_expr != Expr_OK) { Expr_SetPyErr(flag_expr); return sim_clean(); }
+        }
+        val = NULL;
+
+        /* Initialise integrals to zero, and attach to CVODES */
+        if (n_quads > 0) {
+            #if SUNDIALS_VERSION_MAJOR >= 6
+            yq = N_VNew_Serial(n_quads, sundials_context);
+            yq_start = N_VNew_Serial(n_quads, sundials_context);
+            #else
+            yq = N_VNew_Serial(n_quads);
+            yq_start = N_VNew_Serial(n_quads);
+            #endif
+            if (check_cvode_flag((void*)yq, "N_VNew_Serial", 0) ||
+                check_cvode_flag((void*)yq_start, "N_VNew_Serial", 0)) {
+                return sim_cleanx(PyExc_Exception, "Failed to create quadrature vector.");
+            }
+            N_VConst(RCONST(0.0), yq);
+            N_VConst(RCONST(0.0), yq_start);
+            flag_cvode = CVodeQuadInit(cvode_mem, quad_rhs, yq);
+            if (check_cvode_flag(&flag_cvode, "CVodeQuadInit", 1)) return sim_clean();
+
+            /* Integrals only affect the step size if requested */
+            if (quad_error_control) {
+                flag_cvode = CVodeSetQuadErrCon(cvode_mem, SUNTRUE);
+                if (check_cvode_flag(&flag_cvode, "CVodeSetQuadErrCon", 1)) return sim_clean();
+                flag_cvode = CVodeQuadSStolerances(cvode_mem, RCONST(rel_tol), RCONST(abs_tol));
+                if (check_cvode_flag(&flag_cvode, "CVodeQuadSStolerances", 1)) return sim_clean();
+            }
+        }
+    }
+
     /*
      * Root finding
      * Enabled if rf_list is a PyList
@@ -2507,12 +3896,18 @@ sim_init(PyObject *self, PyObject *args)
     rf_direction = NULL;
 
     if (model->is_ode && PyList_Check(rf_list)) {
-        /* Initialize root function with 1 component */
-        flag_cvode = CVodeRootInit(cvode_mem, 1, rf_function);
-        if (check_cvode_flag(&flag_cvode, "CVodeRootInit", 1)) return sim_clean();
+        /* Initialize root function with 1 component (the one-step solvers
+           use rf_dense instead) */
+        if (solver_type == SOLVER_CVODES) {
+            flag_cvode = CVodeRootInit(cvode_mem, 1, rf_function);
+            if (check_cvode_flag(&flag_cvode, "CVodeRootInit", 1)) return sim_clean();
+        }
 
         /* Direction of root crossings, one entry per root function, but we only use 1. */
         rf_direction = (int*)malloc(sizeof(int));
+        if (rf_direction == NULL) {
+            return sim_cleanx(PyExc_Exception, "Unable to allocate space to store root crossing directions.");
+        }
 
         #ifdef MYOKIT_DEBUG_PROFILING
         benchmarker_print("CP CVODES root-finding initialized.");
@@ -2530,13 +3925,86 @@ sim_init(PyObject *self, PyObject *args)
         }
     }
 
-    /* Set up logging */
-    flag_model = Model_InitializeLogging(model, log_dict);
-    if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+    /* Set up logging, using a separate log dict for each cell in a population */
+    if (n_cells == 1) {
+        flag_model = Model_InitializeLogging(model, log_dict);
+        if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+    } else {
+        if (!PyList_Check(cell_logs) || PyList_Size(cell_logs) != n_cells) {
+            return sim_cleanx(PyExc_TypeError, "'cell_logs' must be a list with one dict per cell.");
+        }
+        for (c=0; c<n_cells; c++) {
+            val = PyList_GetItem(cell_logs, c); /* Don't decref */
+            if (!PyDict_Check(val)) {
+                return sim_cleanx(PyExc_TypeError, "Item %d in 'cell_logs' is not a dict.", c);
+            }
+            flag_model = Model_InitializeLogging(models[c], val);
+            if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+        }
+    }
+
+    /* Compile logged expressions, and add them to the logged variables */
+    if (log_expressions != Py_None) {
+        if (!PyList_Check(log_expressions)) {
+            return sim_cleanx(PyExc_TypeError, "'log_expressions' must be a list or None.");
+        }
+        n_exprs = (int)PyList_Size(log_expressions);
+        exprs = (Expr*)calloc((size_t)(n_exprs > 0 ? n_exprs : 1), sizeof(Expr));
+        expr_values = (realtype*)calloc((size_t)(n_exprs > 0 ? n_exprs : 1), sizeof(realtype));
+        if (exprs == NULL || expr_values == NULL) {
+            return sim_cleanx(PyExc_MemoryError, "Unable to allocate space for logged expressions.");
+        }
+        for (i=0; i<n_exprs; i++) {
+            if (!PyArg_ParseTuple(PyList_GetItem(log_expressions, i), "iOOU", &c, &val, &ret, &key)) {
+                return sim_cleanx(PyExc_TypeError, "Entries in 'log_expressions' must be tuples (cell, list, program, name).");
+            }
+            if (c < 0 || c >= n_cells) {
+                return sim_cleanx(PyExc_ValueError, "Invalid cell index in 'log_expressions'.");
+            }
+            exprs[i] = Expr_Create(ret, expr_lookup, models[c], &flag_expr);
+            if (flag_expr != Expr_OK) { Expr_SetPyErr(flag_expr); return sim_clean(); }
+            flag_model = Model_AddLoggedOutput(models[c], val, expr_values + i);
+            if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+        }
+        val = ret = key = NULL;
+    }
+
+    /* Set per-variable logging intervals */
+    if (log_intervals != Py_None) {
+        if (!PyList_Check(log_intervals)) {
+            return sim_cleanx(PyExc_TypeError, "'log_intervals' must be a list or None.");
+        }
+        for (i=0; i<PyList_Size(log_intervals); i++) {
+            if (!PyArg_ParseTuple(PyList_GetItem(log_intervals, i), "iOdO", &c, &val, &interval, &ret)) {
+                return sim_cleanx(PyExc_TypeError, "Entries in 'log_intervals' must be tuples (cell, list, interval, time list).");
+            }
+            if (c < 0 || c >= n_cells) {
+                return sim_cleanx(PyExc_ValueError, "Invalid cell index in 'log_intervals'.");
+            }
+            flag_model = Model_SetLogInterval(models[c], val, (realtype)interval, ret, (realtype)tmin);
+            if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
+        }
+        val = ret = NULL;
+    }
+    logging_rhs = 0;
+    logging_bound = 0;
+    for (c=0; c<n_cells; c++) {
+        logging_rhs = logging_rhs || models[c]->logging_derivatives || models[c]->logging_intermediary;
+        logging_bound = logging_bound || models[c]->logging_bound;
+    }
+    logging_rhs = logging_rhs || (n_exprs > 0);  /* Expressions can use any variable */
     #ifdef MYOKIT_DEBUG_PROFILING
     benchmarker_print("CP Logging initialized.");
     #endif
 
+    /* Set up shared memory output */
+    if (monitor_name != Py_None) {
+        if (!PyUnicode_Check(monitor_name)) {
+            return sim_cleanx(PyExc_TypeError, "'monitor_name' must be a string or None.");
+        }
+        if (monitor_init(PyUnicode_AsUTF8(monitor_name), monitor_capacity, log_expressions)) return sim_clean();
+    }
+
     /* Check logging list for sensitivities */
     if (model->has_sensitivities) {
         if (!PyList_Check(sens_list)) {
@@ -2551,6 +4019,17 @@ sim_init(PyObject *self, PyObject *args)
         ilog = 0;
         tlog = tmin;
 
+        /* Fine logging windows */
+        if (fine_logging != Py_None) {
+            if (!PyArg_ParseTuple(fine_logging, "ddiid", &fine_interval, &fine_duration, &fine_on_beat, &fine_state, &fine_threshold)) {
+                return sim_cleanx(PyExc_TypeError, "'fine_logging' must be a tuple (interval, duration, on_beat, state, threshold).");
+            }
+            if (fine_state >= model->n_states) {
+                return sim_cleanx(PyExc_ValueError, "Invalid state index for fine logging.");
+            }
+            if (beat_at_tmin && fine_on_beat) fine_open(tmin);
+        }
+
     } else if (log_times != Py_None) {
 
         /* Point-list logging */
@@ -2615,7 +4094,7 @@ sim_init(PyObject *self, PyObject *args)
             /* At this point, we have y(t), inter(t) and dy(t) */
             /* We've also loaded time(t) and pace(t) */
 
-            flag_model = Model_Log(model);
+            flag_model = log_population(t);
             if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
 
             if (model->has_sensitivities) {
@@ -2657,6 +4136,8 @@ sim_step(PyObject *self, PyObject *args)
     int flag_cvode;         /* CVode flag */
     int flag_root;          /* Root finding flag */
     int flag_reinit = 0;    /* Set if CVODE needs to be reset during a simulation step */
+    int failed;             /* Set if the solver failed to take a step */
+    long fired;             /* Number of events started in the first pacing system */
 
     /* Multi-purpose ints for iterating */
     int i, j;
@@ -2687,7 +4168,7 @@ sim_step(PyObject *self, PyObject *args)
     while(1) {
 
         /* Back-up current y */
-        for (i=0; i<model->n_states; i++) {
+        for (i=0; i<n_y; i++) {
             NV_Ith_S(ylast, i) = NV_Ith_S(y, i);
         }
 
@@ -2697,15 +4178,41 @@ sim_step(PyObject *self, PyObject *args)
         if (model->is_ode) {
 
             /* Take a single ODE step */
-            #ifdef MYOKIT_DEBUG_MESSAGES
-            printf("\nCM Taking CVODE step from time %g to %g.\n", t, tnext);
-            #endif
-            flag_cvode = CVode(cvode_mem, tnext, y, &t, CV_ONE_STEP);
+            if (solver_type == SOLVER_CVODES) {
+                #ifdef MYOKIT_DEBUG_MESSAGES
+                printf("\nCM Taking CVODE step from time %g to %g.\n", t, tnext);
+                #endif
+                sim_release_gil();
+                flag_cvode = CVode(cvode_mem, tnext, y, &t, CV_ONE_STEP);
+                sim_acquire_gil();
+                failed = check_cvode_flag(&flag_cvode, "CVode", 1);
+            } else {
+                /* One-step solvers never step beyond tnext, so no
+                   rewinding is needed. Instead they are restarted whenever
+                   they land on tnext, as the rhs may be discontinuous there. */
+                #ifdef MYOKIT_DEBUG_MESSAGES
+                printf("\nCM Taking one-step solver step from time %g to at most %g.\n", t, tnext);
+                #endif
+                failed = ostep_step(tnext, &t, N_VGetArrayPointer(y));
+                if (!failed && t >= tnext) {
+                    flag_reinit = (t < tmax);
+                }
+                flag_cvode = CV_SUCCESS;
+
+                /* Check for root crossings, using the dense output */
+                if (!failed && rf_direction != NULL && rf_dense(tlast, ylast, &t, y)) {
+                    for (i=0; i<n_cells; i++) {
+                        Model_SetStates(models[i], N_VGetArrayPointer(y) + i * model->n_states);
+                    }
+                    flag_cvode = CV_ROOT_RETURN;
+                    flag_reinit = 1;
+                }
+            }
 
             /* Check for errors */
-            if (check_cvode_flag(&flag_cvode, "CVode", 1)) {
+            if (failed) {
                 /* Something went wrong... Set outputs and return */
-                for (i=0; i<model->n_states; i++) {
+                for (i=0; i<n_y; i++) {
                     PyList_SetItem(state_py, i, PyFloat_FromDouble(NV_Ith_S(ylast, i)));
                     /* PyList_SetItem steals a reference: no need to decref the double! */
                 }
@@ -2778,8 +4285,11 @@ sim_step(PyObject *self, PyObject *args)
                     if (flag_cvode == CV_ROOT_RETURN) {
 
                         /* Get directions of root crossings (1 per root function) */
-                        flag_root = CVodeGetRootInfo(cvode_mem, rf_direction);
-                        if (check_cvode_flag(&flag_root, "CVodeGetRootInfo", 1)) return sim_clean();
+                        /* (Already set by rf_dense for one-step solvers) */
+                        if (solver_type == SOLVER_CVODES) {
+                            flag_root = CVodeGetRootInfo(cvode_mem, rf_direction);
+                            if (check_cvode_flag(&flag_root, "CVodeGetRootInfo", 1)) return sim_clean();
+                        }
                         /* We only have one root function, so we know that rf_direction[0] is non-zero at this point. */
 
                         /* Store tuple (time, direction) for the found root */
@@ -2795,6 +4305,21 @@ sim_step(PyObject *self, PyObject *args)
                 }
             }
 
+            /*
+             * Open a fine logging window if the absolute rate of change of
+             * the selected state exceeds the threshold in any cell. The window starts at
+             * the start of the step, so that the fast change is fully covered.
+             */
+            if (fine_interval > 0 && fine_state >= 0 && t > tlast && tlast >= fine_end) {
+                for (j=0; j<n_cells; j++) {
+                    i = j * model->n_states + fine_state;
+                    if (fabs(NV_Ith_S(y, i) - NV_Ith_S(ylast, i)) / (t - tlast) > fine_threshold) {
+                        fine_open(tlast);
+                        break;
+                    }
+                }
+            }
+
             /*
              * Logging interpolated points (periodic logging or point-list logging)
              */
@@ -2817,7 +4342,9 @@ sim_step(PyObject *self, PyObject *args)
                     }
 
                     /* Get interpolated y(tlog) */
-                    if (model->is_ode) {
+                    if (model->is_ode && solver_type != SOLVER_CVODES) {
+                        if (ostep_interpolate(tlog, N_VGetArrayPointer(z))) return sim_clean();
+                    } else if (model->is_ode) {
                         flag_cvode = CVodeGetDky(cvode_mem, tlog, 0, z);
                         if (check_cvode_flag(&flag_cvode, "CVodeGetDky", 1)) return sim_clean();
                         if (model->has_sensitivities) {
@@ -2832,7 +4359,7 @@ sim_step(PyObject *self, PyObject *args)
                     rhs(tlog, z, NULL, udata);
 
                     /* Write to log */
-                    flag_model = Model_Log(model);
+                    flag_model = log_population(tlog);
                     if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
 
                     if (model->has_sensitivities) {
@@ -2845,7 +4372,21 @@ sim_step(PyObject *self, PyObject *args)
                     }
 
                     /* Get next logging point */
-                    if (log_interval > 0) {
+                    if (log_interval > 0 && tlog < fine_end) {
+                        /* Periodic logging, inside a fine logging window */
+                        fine_index++;
+                        tlog = fine_start + (double)fine_index * fine_interval;
+                        if (tlog >= fine_end) {
+                            /* Window closed: continue at the first regular
+                               logging point at or after its end */
+                            ilog = (Py_ssize_t)ceil((fine_end - tmin) / log_interval);
+                            tlog = tmin + (double)ilog * log_interval;
+                            if (tlog < fine_end) {
+                                ilog++;
+                                tlog = tmin + (double)ilog * log_interval;
+                            }
+                        }
+                    } else if (log_interval > 0) {
                         /* Periodic logging */
                         ilog++;
                         tlog = tmin + (double)ilog * log_interval;
@@ -2891,21 +4432,51 @@ sim_step(PyObject *self, PyObject *args)
              * Event-based pacing
              *
              * At this point we have logged everything _before_ time t, so it
-             * is safe to update the pacing mechanism to time t.
+             * is safe to update the pacing mechanism to time t. All event-based
+             * systems are merged into a single timeline, so this only needs to
+             * apply the changes up to t.
              */
             tnext = tmax;
-            for (int i = 0; i < n_pace; i++) {
-                if (pacing_types[i] == EVENT) {
-                    ESys epacing = pacing_systems[i].event;
-                    flag_epacing = ESys_AdvanceTime(epacing, t);
-                    if (flag_epacing != ESys_OK) {
-                        ESys_SetPyErr(flag_epacing); return sim_clean();
+            if (merged_pacing != NULL) {
+                flag_epacing = MSys_AdvanceTime(merged_pacing, t, pacing);
+                if (flag_epacing != ESys_OK) {
+                    ESys_SetPyErr(flag_epacing); return sim_clean();
+                }
+
+                /* New beat? Then everything before it has been logged */
+                fired = MSys_GetFiredCount(merged_pacing, beat_system);
+                if (fired != beat_count) {
+                    beat_count = fired;
+                    if (beat_record(MSys_GetFiredTime(merged_pacing, beat_system))) return sim_clean();
+                    if (quad_record()) return sim_clean();
+                    if (fine_on_beat) fine_open(t);
+                }
+
+                t_proposed = MSys_GetNextTime(merged_pacing, &flag_epacing);
+                if (flag_epacing != ESys_OK) {
+                    ESys_SetPyErr(flag_epacing); return sim_clean();
+                }
+                tnext = fmin(tnext, t_proposed);
+            }
+
+            /* Fixed-form and analytic pacing: stop at every jump in the
+               level or its derivatives. The next stop of each system is
+               cached, and only systems whose stop has been reached are
+               searched again. */
+            if (t >= tnext_pacing) {
+                tnext_pacing = HUGE_VAL;
+                for (i=0; i<n_pace; i++) {
+                    if (pacing_next[i] <= t) {
+                        if (pacing_types[i] == FIXED) {
+                            pacing_next[i] = FSys_GetNextTime(pacing_systems[i].fixed, t, NULL);
+                        } else if (pacing_types[i] == ANALYTIC) {
+                            pacing_next[i] = ASys_GetNextTime(pacing_systems[i].analytic, t, NULL);
+                        }
                     }
-                    t_proposed = ESys_GetNextTime(epacing, NULL);
-                    tnext = fmin(tnext, t_proposed);
-                    pacing[i] = ESys_GetLevel(epacing, NULL);
+                    tnext_pacing = fmin(tnext_pacing, pacing_next[i]);
                 }
             }
+            tnext = fmin(tnext, tnext_pacing);
 
             /* Dynamic logging: Log every visited point */
             if (dynamic_logging) {
@@ -2917,7 +4488,7 @@ sim_step(PyObject *self, PyObject *args)
                 }
 
                 /* Ensure the logged values are correct for the new time t */
-                if (model->logging_derivatives || model->logging_intermediary || model->has_sensitivities) {
+                if (logging_rhs || model->has_sensitivities) {
                     /* If logging derivatives or intermediaries, calculate the
                        values for the current time. Similarly, if calculating
                        sensitivities this is needed. */
@@ -2925,14 +4496,16 @@ sim_step(PyObject *self, PyObject *args)
                     printf("CM Calling RHS to log derivs/inter/sens at time %g.\n", t);
                     #endif
                     rhs(t, y, NULL, udata);
-                } else if (model->logging_bound) {
+                } else if (logging_bound) {
                     /* Logging bounds but not derivs or inters: No need to run
                        full rhs, just update bound variables */
-                    Model_SetBoundVariables(model, (realtype)t, (realtype*)pacing, (realtype)realtime, (realtype)evaluations);
+                    for (i=0; i<n_cells; i++) {
+                        Model_SetBoundVariables(models[i], (realtype)t, (realtype*)pacing, (realtype)realtime, (realtype)evaluations);
+                    }
                 }
 
                 /* Write to log */
-                flag_model = Model_Log(model);
+                flag_model = log_population(t);
                 if (flag_model != Model_OK) { Model_SetPyErr(flag_model); return sim_clean(); }
 
                 if (model->has_sensitivities) {
@@ -2946,11 +4519,23 @@ sim_step(PyObject *self, PyObject *args)
             }
 
             /*
-             * Reinitialize CVODE if needed
+             * Reinitialize solver if needed
              */
-            if (model->is_ode && flag_reinit) {
+            if (model->is_ode && flag_reinit && solver_type != SOLVER_CVODES) {
+                if (ostep_init(t, N_VGetArrayPointer(y))) return sim_clean();
+                flag_reinit = 0;
+            } else if (model->is_ode && flag_reinit) {
+                if (n_quads > 0) {
+                    /* Continue integrating from the values at t */
+                    flag_cvode = CVodeGetQuadDky(cvode_mem, t, 0, yq);
+                    if (check_cvode_flag(&flag_cvode, "CVodeGetQuadDky", 1)) return sim_clean();
+                }
                 flag_cvode = CVodeReInit(cvode_mem, t, y);
                 if (check_cvode_flag(&flag_cvode, "CVodeReInit", 1)) return sim_clean();
+                if (n_quads > 0) {
+                    flag_cvode = CVodeQuadReInit(cvode_mem, yq);
+                    if (check_cvode_flag(&flag_cvode, "CVodeQuadReInit", 1)) return sim_clean();
+                }
                 if (model->has_sensitivities) {
                     flag_cvode = CVodeSensReInit(cvode_mem, CV_SIMULTANEOUS, sy);
                     if (check_cvode_flag(&flag_cvode, "CVodeSensReInit", 1)) return sim_clean();
@@ -2979,6 +4564,9 @@ sim_step(PyObject *self, PyObject *args)
          */
         steps_taken++;
         if (steps_taken >= 100) {
+            if (monitor != NULL) {
+                Monitor_SetState(monitor, t, N_VGetArrayPointer(y));
+            }
             #ifdef MYOKIT_DEBUG_PROFILING
             benchmarker_print("CP Completed 100 steps, passing control back to Python.");
             #endif
@@ -2995,7 +4583,7 @@ sim_step(PyObject *self, PyObject *args)
      */
 
     /* Set final state */
-    for (i=0; i<model->n_states; i++) {
+    for (i=0; i<n_y; i++) {
         PyList_SetItem(state_py, i, PyFloat_FromDouble(NV_Ith_S(y, i)));
         /* PyList_SetItem steals a reference: no need to decref the PyFloat */
     }
@@ -3010,6 +4598,14 @@ sim_step(PyObject *self, PyObject *args)
         }
     }
 
+    /* Store integrals for the last (partial) beat */
+    if (quad_record()) return sim_clean();
+
+    /* Publish final state */
+    if (monitor != NULL) {
+        Monitor_SetState(monitor, t, N_VGetArrayPointer(y));
+    }
+
     /* Set bound variable values */
     PyList_SetItem(bound_py, 0, PyFloat_FromDouble(t));
     PyList_SetItem(bound_py, 1, PyFloat_FromDouble(realtime));
@@ -3233,6 +4829,26 @@ sim_set_min_step_size(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/*
+ * Change the solver (see enum SolverType)
+ */
+static PyObject*
+sim_set_solver(PyObject *self, PyObject *args)
+{
+    /* Check input arguments */
+    int solver;
+    if (!PyArg_ParseTuple(args, "i", &solver)) {
+        PyErr_SetString(PyExc_Exception, "Expected input argument: solver(int).");
+        return 0;
+    }
+    if (solver != SOLVER_CVODES && solver != SOLVER_DOPRI5 && solver != SOLVER_ROSENBROCK) {
+        PyErr_Format(PyExc_ValueError, "Unknown solver type %d.", solver);
+        return 0;
+    }
+    solver_type = (enum SolverType)solver;
+    Py_RETURN_NONE;
+}
+
 /*
  * Returns the number of steps taken in the last simulation
  */
@@ -3242,6 +4858,41 @@ sim_steps(PyObject *self, PyObject *args)
     return PyLong_FromLong(steps);
 }
 
+/*
+ * Returns a dict with the number of bytes used by the running simulation (or
+ * at the end of the last simulation) per category, and in total.
+ */
+static PyObject*
+sim_memory_usage(PyObject *self, PyObject *args)
+{
+    int i;
+    size_t usage[MEM_N];
+    size_t total;
+    PyObject* d;
+    PyObject* val;
+
+    if (initialized) {
+        memory_measure(usage);
+    } else {
+        for (i=0; i<MEM_N; i++) usage[i] = memory_last[i];
+    }
+
+    d = PyDict_New();
+    if (d == NULL) return NULL;
+    total = 0;
+    for (i=0; i<=MEM_N; i++) {
+        if (i < MEM_N) total += usage[i];
+        val = PyLong_FromSize_t(i < MEM_N ? usage[i] : total);
+        if (val == NULL || PyDict_SetItemString(d, i < MEM_N ? memory_names[i] : "total", val)) {
+            Py_XDECREF(val);
+            Py_DECREF(d);
+            return NULL;
+        }
+        Py_DECREF(val);
+    }
+    return d;
+}
+
 /*
  * Returns the number of rhs evaluations performed during the last simulation
  */
@@ -3251,6 +4902,86 @@ sim_evals(PyObject *self, PyObject *args)
     return PyLong_FromLong(evaluations);
 }
 
+/*
+ * Encodes a buffer of doubles for compression (see codec.h), and returns the
+ * result as a bytes object of the same size.
+ */
+static PyObject*
+codec_encode(PyObject *self, PyObject *args)
+{
+    Py_buffer data;
+    double tol;
+    size_t n;
+    PyObject* out;
+    Codec_Flag flag;
+
+    /* Check input arguments */
+    if (!PyArg_ParseTuple(args, "y*d", &data, &tol)) {
+        PyErr_SetString(PyExc_Exception, "Expected input arguments: data (buffer of doubles), tol (float).");
+        return 0;
+    }
+    if (data.len % sizeof(double)) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "Buffer size must be a multiple of the size of a double.");
+        return 0;
+    }
+    n = (size_t)data.len / sizeof(double);
+
+    out = PyBytes_FromStringAndSize(NULL, data.len);
+    if (out == NULL) {
+        PyBuffer_Release(&data);
+        return 0;
+    }
+    flag = Codec_Encode((const double*)data.buf, n, tol, (unsigned char*)PyBytes_AS_STRING(out));
+    PyBuffer_Release(&data);
+    if (flag != Codec_OK) {
+        Py_DECREF(out);
+        Codec_SetPyErr(flag);
+        return 0;
+    }
+    return out;
+}
+
+/*
+ * Decodes a buffer created with codec_encode, and returns the doubles as a
+ * bytes object of the same size.
+ */
+static PyObject*
+codec_decode(PyObject *self, PyObject *args)
+{
+    Py_buffer data;
+    double tol;
+    size_t n;
+    PyObject* out;
+    Codec_Flag flag;
+
+    /* Check input arguments */
+    if (!PyArg_ParseTuple(args, "y*d", &data, &tol)) {
+        PyErr_SetString(PyExc_Exception, "Expected input arguments: data (bytes), tol (float).");
+        return 0;
+    }
+    if (data.len % sizeof(double)) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "Buffer size must be a multiple of the size of a double.");
+        return 0;
+    }
+    n = (size_t)data.len / sizeof(double);
+
+    out = PyBytes_FromStringAndSize(NULL, data.len);
+    if (out == NULL) {
+        PyBuffer_Release(&data);
+        return 0;
+    }
+    flag = Codec_Decode((const unsigned char*)data.buf, n, tol, (double*)PyBytes_AS_STRING(out));
+    PyBuffer_Release(&data);
+    if (flag != Codec_OK) {
+        Py_DECREF(out);
+        Codec_SetPyErr(flag);
+        return 0;
+    }
+    return out;
+}
+
 
 
 
@@ -3299,24 +5030,44 @@ static PyMethodDef CVODESSimMethods[] = {
     {"set_tolerance", sim_set_tolerance, METH_VARARGS, "Set the absolute and relative solver tolerance."},
     {"set_max_step_size", sim_set_max_step_size, METH_VARARGS, "Set the maximum solver step size (0 for none)."},
     {"set_min_step_size", sim_set_min_step_size, METH_VARARGS, "Set the minimum solver step size (0 for none)."},
+    {"set_solver", sim_set_solver, METH_VARARGS, "Set the solver to use (0 for CVODES, 1 for Dormand-Prince, 2 for Rosenbrock)."},
+    {"memory_usage", sim_memory_usage, METH_VARARGS, "Returns a dict with the memory used by the current or last simulation, in bytes."},
     {"number_of_steps", sim_steps, METH_VARARGS, "Returns the number of steps taken in the last simulation."},
     {"number_of_evaluations", sim_evals, METH_VARARGS, "Returns the number of rhs evaluations performed during the last simulation."},
+    {"codec_encode", codec_encode, METH_VARARGS, "Encode a buffer of doubles for compression, with an absolute tolerance (0 for lossless)."},
+    {"codec_decode", codec_decode, METH_VARARGS, "Decode a buffer created with codec_encode."},
     {NULL},
 };
 
 
+/*
+ * Module slots. The module uses multi-phase initialisation, and can be loaded
+ * in several (sub)interpreters at once: all simulation state is thread-local,
+ * so no per-module state is needed.
+ */
+static PyModuleDef_Slot cvodessim_slots[] = {
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
 static struct PyModuleDef cvodessim_module = {
     PyModuleDef_HEAD_INIT,
     "_cvodessim_ext",   /* name of module */
     "Performs a sumulation", /* module documentation, may be NULL */
-    -1,       /* size of per-interpreter state of the module,
-                 or -1 if the module keeps state in global variables. */
-    CVODESSimMethods
+    0,        /* size of per-interpreter state of the module (state is
+                 thread-local instead) */
+    CVODESSimMethods,
+    cvodessim_slots
 };
 
 
 PyMODINIT_FUNC
 PyInit__cvodessim_ext(void)
 {
-    return PyModule_Create(&cvodessim_module);
+    return PyModuleDef_Init(&cvodessim_module);
 }
@@ -11,10 +11,19 @@ import tempfile
 
 from collections import OrderedDict
 
+import numpy as np
+
 import myokit
 
 import myokit_beta
 
+from ._analytic import AnalyticProtocol
+from ._beats import BeatIndex
+from ._expr import compile_expression
+from ._logspill import LogSpill
+from ._pyramid import LogPyramids
+from ._timeseries import MappedTimeSeriesProtocol
+
 
 class Simulation:
     """
@@ -70,6 +79,45 @@ class Simulation:
     :class:`myokit.Name` or :class:`myokit.InitialValue` expressions, or as
     strings e.g. ``"ikr.gKr"`` or ``"init(membrane.V)"``.
 
+    **Solvers**
+
+    By default, CVODES is used to solve the model ODEs. Two alternative
+    one-step solvers can be selected using :meth:`set_solver`:
+
+    - For non-stiff models, where an implicit method spends most of its time
+      on Newton iterations and Jacobian updates it doesn't need, an explicit
+      adaptive Runge-Kutta method using the Dormand-Prince 5(4) pair (see
+      [2]).
+    - For small stiff models, the linearly implicit Rosenbrock-W method
+      ROS34PW2 (see [3]), which needs a single Jacobian evaluation and LU
+      factorisation per step and no Newton iterations.
+
+    Both use dense output for logging and root finding, and are restarted at
+    every pacing event. Neither supports sensitivities.
+
+    **Populations**
+
+    A population of cells that share a single pacing protocol can be simulated
+    by calling :meth:`set_population_size`. The cells are integrated as a
+    single ODE system, where the Jacobian is block-diagonal (one block per
+    cell), so that CVODES' step size selection, Jacobian evaluations, and
+    linear solves are shared by all cells. Cells can be given different
+    parameter values using :meth:`set_population_constant`.
+
+    For populations, states are stored as a single list containing the states
+    of each cell in turn, and logged variables use the prefix ``i.`` for the
+    ``i``-th cell, e.g. ``0.membrane.V``. Bound variables (e.g.
+    ``engine.time``) are logged without a prefix. APD calculations use the
+    first cell. Sensitivities are not supported for populations.
+
+    Cells in a population can be coupled (e.g. to simulate pairs, strands, or
+    small clusters of cells connected by gap junctions) using
+    :meth:`set_population_coupling`. Each cell ``i`` then receives a diffusion
+    current ``sum_j g_ij * (V_i - V_j)``, where ``V`` is the variable labelled
+    ``membrane_potential`` and ``g_ij`` is the conductance between cells ``i``
+    and ``j``. Coupled cells are still integrated as a single system, with a
+    linear solver that exploits the sparsity of the coupling graph.
+
     **Bound variables and labels**
 
     The simulation provides four inputs a model variable can be bound to:
@@ -84,8 +132,45 @@ class Simulation:
         time and can be used to gain some insight into the solver's behavior.
     ``realtime``
         This input provides the elapsed system time at each logged point.
-
-    No variable labels are required for this simulation type.
+    ``diffusion_current``
+        This input provides the current flowing into a cell from its
+        neighbours, in coupled populations. It must be bound to a literal
+        constant that is not used by any other constants.
+
+    The label ``membrane_potential`` is required for coupled populations, but
+    no variable labels are required otherwise.
+
+    **Logging large amounts of data**
+
+    Long simulations (or large populations) can log more data than fits in
+    memory. A memory budget for logs can be set with :meth:`set_log_budget`,
+    after which logged data is moved to temporary files whenever the budget is
+    exceeded, and returned as memory-mapped arrays. Data can also be
+    compressed as it is written, either losslessly or with a bounded error.
+    Logs containing such arrays can be passed back into :meth:`run` to
+    continue logging. To quickly plot long logs at any zoom level, min/max
+    pyramids can be created as data is logged, see :meth:`set_log_pyramids`.
+    The amount of data logged can be reduced by logging slowly varying
+    variables less often (see :meth:`set_log_intervals`), or by logging
+    derived quantities directly instead of the variables they depend on (see
+    the ``expressions`` argument to :meth:`run`).
+    To watch the output of a long run from another process, it can be
+    published in shared memory using :meth:`set_monitor`. Single beats can be
+    selected from a log using the index returned by :meth:`last_beat_index`.
+    To check if a long pre-pacing run has converged without logging any
+    traces, the state at the start of every beat can be stored, see
+    :meth:`set_beat_states`. Similarly, integrals of currents over every beat
+    can be computed without logging the currents, see
+    :meth:`set_beat_integrals`.
+
+    **Parallel simulations**
+
+    The C extension stores the state of a running simulation separately for
+    each thread, so that simulations can be run in parallel from different
+    threads or subinterpreters (including subinterpreters with their own GIL).
+    A single simulation object should not be run from two threads at once.
+    To run a batch of simulations in parallel, with results that do not
+    depend on the number of threads used, see :meth:`myokit_beta.run_batch`.
 
     **Storing and loading simulation objects**
 
@@ -118,7 +203,8 @@ class Simulation:
     ``model``
         The model to simulate
     ``protocol``
-        A :class:`myokit.Protocol` or :class:`myokit.TimeSeriesProtocol` to use
+        A :class:`myokit.Protocol`, :class:`myokit.TimeSeriesProtocol`,
+        :class:`MappedTimeSeriesProtocol`, or :class:`AnalyticProtocol` to use
         for the variable with binding ``pace``. Atlernatively, a dictionary
         mapping binding labels to :class:`myokit.Protocol` objects can be used
         to run with multiple protocols. Finally, can be ``None`` to run without
@@ -144,9 +230,21 @@ class Simulation:
     solvers. Hindmarsh, Brown, Woodward, et al. (2005) ACM Transactions on
     Mathematical Software.
 
+    [2] A family of embedded Runge-Kutta formulae. Dormand, Prince (1980)
+    Journal of Computational and Applied Mathematics.
+
+    [3] Improved Rosenbrock methods for stiff ordinary differential equations.
+    Rang, Angermann (2005) BIT Numerical Mathematics.
+
     """
     _index = 0  # Simulation id
 
+    # Available solvers, and their codes in the C extension
+    _solvers = {'cvodes': 0, 'dopri5': 1, 'rosenbrock': 2}
+
+    # Interpolation methods for fixed-form protocols, and their codes
+    _interpolations = {'linear': 0, 'hold': 1, 'cubic': 2}
+
     def __init__(self, protocol=None, sensitivities=None, path=None):
         super().__init__()
         self._sim = myokit_beta._sim._cvodessim_ext
@@ -157,7 +255,8 @@ class Simulation:
         # Set protocol
         self._protocols = []
         self._pacing_labels = []
-        if isinstance(protocol, (myokit.Protocol, myokit.TimeSeriesProtocol)):
+        if isinstance(protocol, (myokit.Protocol, myokit.TimeSeriesProtocol,
+                                 MappedTimeSeriesProtocol, AnalyticProtocol)):
             protocol = {'pace': protocol}
         elif protocol is None:
             # TODO: This can be an empty dict once #320 is resolved
@@ -191,6 +290,9 @@ class Simulation:
         }
         for i, label in enumerate(self._pacing_labels):
             labels[label] = 'pace_values[' + str(i) + ']'
+
+        # Get diffusion current variable (before its binding is removed)
+        self._diffusion_current = self._model.binding('diffusion_current')
         bound_variables = myokit._prepare_bindings(self._model, labels)
 
 
@@ -227,6 +329,142 @@ class Simulation:
         self._tolerance = None
         self.set_tolerance()
 
+        # Set default solver
+        self._solver = None
+        self.set_solver()
+
+        # Number of cells, and per-cell literal values (mapping literal qnames
+        # to lists of values), for population simulations
+        self._n_cells = 1
+        self._cell_literals = {}
+
+        # Coupling between cells, as a list of tuples (i, j, g)
+        self._coupling = []
+
+        # Memory budget for logged data (in bytes), and directory to spill to
+        self._log_budget = None
+        self._log_spill_path = None
+        self._log_compress = False
+        self._log_tolerance = 0
+
+        # Min/max pyramid factor, and a tuple (log, pyramids) for the last run
+        self._pyramid_factor = None
+        self._pyramids = None
+
+        # Tuple (log, beat index) for the last run
+        self._beats = None
+
+        # Store the state at the start of each beat, and a tuple (starts,
+        # states) for the last run
+        self._store_beat_states = False
+        self._beat_states = None
+
+        # Fine logging windows, as a tuple (interval, duration, on_beat,
+        # state index, threshold), or None
+        self._fine_logging = None
+
+        # Logging intervals for individual variables, as a dict mapping log
+        # keys (without cell index) to intervals
+        self._log_intervals = {}
+
+        # Integrands for per-beat integrals (as a dict mapping names to
+        # expression code), error control, and the integrals for the last run
+        self._integrands = {}
+        self._integral_error_control = False
+        self._beat_integrals = None
+
+        # Shared memory output name, and number of logged rows to publish
+        self._monitor_name = None
+        self._monitor_capacity = 1000
+
+        # Interpolation method and simplification tolerance for each
+        # fixed-form protocol
+        self._interpolation = ['linear'] * len(self._pacing_labels)
+        self._interpolation_tolerance = [0] * len(self._pacing_labels)
+
+        # Period and number of repeats for each fixed-form protocol
+        self._protocol_period = [(0, 0)] * len(self._pacing_labels)
+
+    def _monitor_log(self, log, spill, pyramids):
+        """
+        Called after every call to ``sim_step`` in :meth:`run`, to update the
+        min/max pyramids and to spill logged data to disk if the log memory
+        budget is exceeded.
+        """
+        if pyramids is not None:
+            pyramids.track(log)
+        if spill is not None and self._log_budget is not None:
+            if spill.check(self._sim.memory_usage()['logs']):
+                if pyramids is not None:
+                    pyramids.rewind()
+
+    def _prepare_population_log(self, log):
+        """
+        Prepares a :class:`myokit.DataLog` for a population simulation, and
+        returns a tuple ``(log, cell_logs)`` where ``cell_logs`` is a list of
+        dicts (one per cell) mapping unprefixed variable names to the lists in
+        ``log``.
+
+        If ``log`` is a :class:`myokit.DataLog`, it is assumed to contain
+        prefixed names (e.g. ``0.membrane.V``) and new data will be appended to
+        it. Otherwise, ``log`` is passed to :meth:`myokit.prepare_log` and the
+        selected variables are logged for every cell.
+        """
+        if not isinstance(log, myokit.DataLog):
+            cell = myokit.prepare_log(
+                log, self._model, if_empty=myokit.LOG_ALL)
+            bound = set(v.qname() for _, v in self._model.bindings())
+            log = myokit.DataLog()
+            log.set_time_key(cell.time_key())
+            for key in cell:
+                if key in bound:
+                    log[key] = []
+                else:
+                    for i in range(self._n_cells):
+                        log[str(i) + '.' + key] = []
+
+        cell_logs = [{} for i in range(self._n_cells)]
+        for key, data in log.items():
+            index, _, name = key.partition('.')
+            if index.isdigit():
+                index = int(index)
+                if index >= self._n_cells:
+                    raise ValueError(
+                        'Log entry <' + key + '> refers to a cell outside of'
+                        ' the population.')
+                cell_logs[index][name] = data
+            else:
+                # Bound variables are logged only once
+                cell_logs[0][key] = data
+        return log, cell_logs
+
+    def _constant(self, var, cell):
+        """
+        Returns the value of the constant ``var`` in the given ``cell``, for
+        use in logged expressions.
+        """
+        values = self._cell_literals.get(var.qname())
+        if values is not None:
+            return values[cell]
+        if var in self._literals:
+            return self._literals[var]
+        if var in self._parameters:
+            return self._parameters[var]
+        return var.eval()
+
+    def _split_log_key(self, key):
+        """
+        Returns a tuple ``(cell, name)`` for the log entry ``key``, where
+        ``cell`` is the index of the cell it belongs to (``0`` for single cell
+        simulations and bound variables), and ``name`` is the key without its
+        cell prefix.
+        """
+        if self._n_cells > 1:
+            index, _, name = key.partition('.')
+            if index.isdigit():
+                return int(index), name
+        return 0, key
+
     def _store_build(self, path, d_build, name):
         """
         Stores this simulation to ``path``, including all information from the
@@ -335,6 +573,54 @@ class Simulation:
             return [list(x) for x in self._s_default_state]
         return None
 
+    def last_beat_index(self):
+        """
+        Returns a :class:`myokit_beta.BeatIndex` for the log from the last
+        call to :meth:`run`, or ``None`` if no simulation was run.
+
+        Beats are indexed using the start times of the events in the first
+        event-based protocol (in the order the protocols were given when
+        creating the simulation). If none of the protocols are event-based,
+        the index is empty. If the same log was passed to several runs, the
+        index covers all of them.
+        """
+        return None if self._beats is None else self._beats[1]
+
+    def last_beat_integrals(self):
+        """
+        Returns a :class:`myokit.DataLog` with the integrals per beat computed
+        in the last call to :meth:`run` or :meth:`pre`, or ``None`` if no
+        integrands were set (see :meth:`set_beat_integrals`).
+
+        The log contains an entry ``start`` and ``duration`` for each
+        integration period, and an entry with the integral of each integrand
+        (using the prefix ``i.`` for the ``i``-th cell in a population).
+        """
+        return self._beat_integrals
+
+    def last_beat_states(self):
+        """
+        Returns a tuple ``(starts, states)`` for the last call to :meth:`run`
+        or :meth:`pre`, where ``starts`` is a numpy array with the start time
+        of each beat, and ``states`` is a numpy array of shape
+        ``(n_beats, n_states)`` with the state at the start of each beat.
+
+        For population simulations, each row contains the states of all cells,
+        in the same order as :meth:`state`.
+
+        Returns ``None`` if beat states were not stored (see
+        :meth:`set_beat_states`).
+        """
+        return self._beat_states
+
+    def last_pyramids(self):
+        """
+        Returns a dict mapping the keys in the log from the last call to
+        :meth:`run` to :class:`myokit_beta.Pyramid` objects, or ``None`` if no
+        pyramids were created (see :meth:`set_log_pyramids`).
+        """
+        return None if self._pyramids is None else self._pyramids[1]
+
     def last_state(self):
         """
         If the last call to :meth:`Simulation.pre()` or
@@ -399,6 +685,35 @@ class Simulation:
         """
         return self._sim.number_of_evaluations()
 
+    def memory_usage(self):
+        """
+        Returns a dict with the number of bytes used by the simulation.
+
+        If called during a run (e.g. from a progress reporter) the current
+        usage is returned, otherwise the usage at the end of the last run. The
+        returned dict has the following entries:
+
+        ``model``
+            Model variables, for every cell.
+        ``solver``
+            The solver's internal memory, including state vectors.
+        ``linear_solver``
+            The linear solver and its matrices (CVODES only).
+        ``pacing``
+            The pacing systems.
+        ``sensitivities``
+            Sensitivity arrays, outside of the solver's own memory.
+        ``logs``
+            An estimate of the memory used by the Python lists and float
+            objects in the logs.
+        ``total``
+            The sum of the above.
+
+        Like :meth:`last_number_of_steps`, this refers to the last simulation
+        run in the current thread.
+        """
+        return self._sim.memory_usage()
+
     def last_number_of_steps(self):
         """
         Returns the number of steps taken by the solver during the last
@@ -487,6 +802,26 @@ class Simulation:
                 self._tolerance,
                 self._dtmin,
                 self._dtmax,
+                {
+                    'solver': self._solver,
+                    'population': (self._n_cells, self._cell_literals),
+                    'coupling': self._coupling,
+                    'log_budget': (
+                        self._log_budget, self._log_spill_path,
+                        self._log_compress, self._log_tolerance),
+                    'pyramids': self._pyramid_factor,
+                    # The shared memory name is not stored, so that copies
+                    # don't publish to the same segment
+                    'monitor': (None, self._monitor_capacity),
+                    'interpolation': (
+                        self._interpolation, self._interpolation_tolerance),
+                    'protocol_period': self._protocol_period,
+                    'beat_states': self._store_beat_states,
+                    'fine_logging': self._fine_logging,
+                    'log_intervals': self._log_intervals,
+                    'beat_integrals': (
+                        self._integrands, self._integral_error_control),
+                },
             ),
         )
 
@@ -506,7 +841,7 @@ class Simulation:
 
     def run(self, duration, log=None, log_interval=None, log_times=None,
             sensitivities=None, apd_variable=None, apd_threshold=None,
-            progress=None, msg='Running simulation'):
+            progress=None, msg='Running simulation', expressions=None):
         """
         Runs a simulation and returns the logged results. Running a simulation
         has the following effects:
@@ -566,6 +901,9 @@ class Simulation:
         ``log_interval``
             An optional fixed size log interval. Must be ``None`` if
             ``log_times`` is used. If both are ``None`` every step is logged.
+            A finer interval can be used around fast events, see
+            :meth:`set_fine_logging`, and individual variables can be logged
+            less often, see :meth:`set_log_intervals`.
         ``log_times``
             An optional set of pre-determined logging times. Must be ``None``
             if ``log_interval`` is used. If both are ``None`` every step is
@@ -585,6 +923,17 @@ class Simulation:
             feedback about simulation progress.
         ``msg``
             An optional message to pass to any progress reporter.
+        ``expressions``
+            An optional dict mapping names to expressions in terms of model
+            variables (as :class:`myokit.Expression` objects or strings, e.g.
+            ``"ina.INa + ica.ICa"``), to log alongside the variables in
+            ``log``. The expressions are compiled and evaluated at every logged
+            point, so that derived quantities can be logged without logging
+            all the variables they depend on. For populations, each expression
+            is evaluated for every cell, and logged with the cell's prefix.
+            Constants are evaluated when the run starts; per-cell values set
+            with :meth:`set_population_constant` are used for literal
+            constants only.
 
         By default, this method returns a :class:`myokit.DataLog` containing
         the logged variables.
@@ -603,12 +952,12 @@ class Simulation:
         duration = float(duration)
         output = self._run(
             duration, log, log_interval, log_times, sensitivities,
-            apd_variable, apd_threshold, progress, msg)
+            apd_variable, apd_threshold, progress, msg, expressions)
         self._time += duration
         return output
 
     def _run(self, duration, log, log_interval, log_times, sensitivities,
-             apd_variable, apd_threshold, progress, msg):
+             apd_variable, apd_threshold, progress, msg, expressions=None):
 
         # Create benchmarker for profiling and realtime logging
         # Note: When adding profiling messages, write them in past tense so
@@ -647,6 +996,17 @@ class Simulation:
             if len(log_times) == 0:
                 log_times = None
 
+        # Parse logged expressions, using this simulation's model to resolve
+        # variable names
+        parsed = {}
+        if expressions is not None:
+            for name, expression in expressions.items():
+                if isinstance(expression, myokit.Expression):
+                    expression = expression.code()
+                parsed[str(name)] = myokit.parse_expression(
+                    str(expression), context=self._model)
+        expressions = parsed
+
         # List of sensitivity matrices
         if self._sensitivities:
             if sensitivities is None:
@@ -692,11 +1052,110 @@ class Simulation:
         if myokit.DEBUG_SP:
             b.print('PP Checked arguments.')
 
+        # Number of points in the log before this run, and a list to store
+        # (start time, row) tuples of beats in
+        n_before = 0
+        if isinstance(log, myokit.DataLog) and len(log):
+            n_before = max(len(x) for x in log.values())
+        beats = []
+
+        # A list to store (start time, state) tuples in, if enabled
+        beat_states = [] if self._store_beat_states else None
+
+        # Integrands to integrate over every beat, compiled for every cell,
+        # and a list to store (start, end, integrals) tuples in
+        quadratures = None
+        if self._integrands:
+            integrands = []
+            for code in self._integrands.values():
+                expression = myokit.parse_expression(code, context=self._model)
+                for i in range(self._n_cells):
+                    integrands.append((i, compile_expression(
+                        expression, lambda var: self._constant(var, i))))
+            quadratures = (
+                integrands, [], int(self._integral_error_control))
+
+        # Select min/max pyramids to update: continue with the pyramids from
+        # the last run if the same log is passed in, or create new ones and add
+        # any data already in the log.
+        pyramids = None
+        if self._pyramid_factor is not None:
+            if self._pyramids is not None and self._pyramids[0] is log:
+                pyramids = self._pyramids[1]
+            else:
+                pyramids = LogPyramids(self._pyramid_factor)
+            if isinstance(log, myokit.DataLog):
+                pyramids.track(log)
+
+        # Move any previously spilled data back into a temporary file, so that
+        # new data can be appended to the log's lists.
+        spill = None
+        spill_args = (self._log_budget, self._log_spill_path,
+                      self._log_compress, self._log_tolerance)
+        if isinstance(log, myokit.DataLog):
+            if (self._log_budget is not None or self._log_compress
+                    or not all(isinstance(x, list) for x in log.values())):
+                spill = LogSpill(log, *spill_args)
+
+        # Remove the time columns of variables with their own log interval,
+        # and the entries of logged expressions, which do not correspond to
+        # model variables
+        extra = {}
+        if isinstance(log, myokit.DataLog):
+            for key in list(log.keys()):
+                if (key.startswith('time(')
+                        or self._split_log_key(key)[1] in expressions):
+                    extra[key] = log.pop(key)
+
         # Parse log argument
-        log = myokit.prepare_log(log, self._model, if_empty=myokit.LOG_ALL)
+        cell_logs = None
+        if self._n_cells == 1:
+            log = myokit.prepare_log(
+                log, self._model, if_empty=myokit.LOG_ALL)
+        else:
+            log, cell_logs = self._prepare_population_log(log)
+
+        # Compile logged expressions for every cell, set up variables with
+        # their own log interval, and (re)add the extra entries to the log.
+        # The C extension is passed a log without these entries.
+        log_dict = log
+        log_expressions = log_intervals = None
+        if extra or expressions or self._log_intervals:
+            log_dict = dict(log)
+            log_expressions = []
+            for name, expression in expressions.items():
+                for i in range(self._n_cells):
+                    key = name if self._n_cells == 1 else str(i) + '.' + name
+                    if key in log_dict:
+                        raise ValueError(
+                            'The logged expression <' + name + '> has the'
+                            ' same name as a logged variable.')
+                    program = compile_expression(
+                        expression, lambda var: self._constant(var, i))
+                    log_expressions.append(
+                        (i, extra.setdefault(key, []), program, key))
+            log_intervals = []
+            for key, data in log_dict.items():
+                index, name = self._split_log_key(key)
+                interval = self._log_intervals.get(name)
+                if interval is not None:
+                    tkey = 'time(' + key + ')'
+                    column = extra.setdefault(tkey, [])
+                    log_intervals.append((index, data, interval, column))
+            for key, data in extra.items():
+                log[key] = data
+        if spill is None and (
+                self._log_budget is not None or self._log_compress):
+            spill = LogSpill(log, *spill_args)
+        if pyramids is not None:
+            pyramids.sync(log)
         if myokit.DEBUG_SP:
             b.print('PP Called prepare_log.')
 
+        # Monitor the logs after every step, if pyramids or a budget are set
+        monitor = pyramids is not None or (
+            spill is not None and self._log_budget is not None)
+
         # Run simulation
         # The simulation is run only if (tmin + duration > tmin). This is a
         # stronger check than (duration == 0), which will return true even for
@@ -713,6 +1172,30 @@ class Simulation:
             # List to store final bound variables in (for debugging)
             bound = [0, 0, 0] + [0] * len(self._pacing_labels)
 
+            # Coupling, with indices of the membrane potential and diffusion
+            # current variables
+            coupling = coupling_state = coupling_literal = None
+            if self._coupling:
+                coupling = list(self._coupling)
+                coupling_state = self._model.label('membrane_potential')
+                coupling_state = coupling_state.index()
+                coupling_literal = list(self._literals.keys()).index(
+                    self._diffusion_current)
+
+            # Literal values, for each cell in turn
+            literals = []
+            for i in range(self._n_cells):
+                for var, value in self._literals.items():
+                    values = self._cell_literals.get(var.qname())
+                    literals.append(value if values is None else values[i])
+
+            # Send solver settings: the C extension keeps a separate state for
+            # every thread, which is shared by all simulations in that thread
+            self._sim.set_tolerance(*self._tolerance)
+            self._sim.set_min_step_size(self._dtmin)
+            self._sim.set_max_step_size(self._dtmax)
+            self._sim.set_solver(self._solvers[self._solver])
+
             # Initialize
             if myokit.DEBUG_SP:
                 b.print('PP Ready to call sim_init.')
@@ -728,13 +1211,13 @@ class Simulation:
                 # 4. Space to store the bound variable values
                 bound,
                 # 5. Literal values
-                list(self._literals.values()),
+                literals,
                 # 6. Parameter values
                 list(self._parameters.values()),
                 # 7. Pacing protocols
                 self._protocols,
-                # 8. A DataLog
-                log,
+                # 8. A DataLog, without any per-variable time columns
+                log_dict,
                 # 9. The log interval, or 0
                 log_interval,
                 # 10. A list of predetermind logging times, or None
@@ -754,6 +1237,42 @@ class Simulation:
                 b,
                 # 16. Boolean/int: 1 if we are logging realtime
                 int(self._model.binding('realtime') is not None),
+                # 17. The number of cells in the population
+                self._n_cells,
+                # 18. A list of per-cell log dicts, or None
+                cell_logs,
+                # 19. A list of coupling edges (i, j, g), or None
+                coupling,
+                # 20. The index of the membrane potential state (if coupled)
+                -1 if coupling_state is None else coupling_state,
+                # 21. The index of the diffusion current literal (if coupled)
+                -1 if coupling_literal is None else coupling_literal,
+                # 22. The name of the shared memory output, or None
+                self._monitor_name,
+                # 23. The number of logged rows to keep in shared memory
+                self._monitor_capacity,
+                # 24. A list to store (start time, row) tuples of beats in
+                beats,
+                # 25. The interpolation method, simplification tolerance,
+                #     period, and number of repeats for each fixed-form
+                #     protocol
+                [(self._interpolations[x], float(y), float(p), int(r))
+                 for x, y, (p, r) in zip(
+                    self._interpolation, self._interpolation_tolerance,
+                    self._protocol_period)],
+                # 26. A list to store (start time, state) tuples in, or None
+                beat_states,
+                # 27. Fine logging window settings, or None
+                self._fine_logging,
+                # 28. A list of tuples (cell, list, interval, time list) for
+                #     variables with their own log interval, or None
+                log_intervals,
+                # 29. A list of tuples (cell, list, program) for logged
+                #     expressions, or None
+                log_expressions,
+                # 30. A tuple (integrands, list, error_control) for per-beat
+                #     integrals, or None
+                quadratures,
             )
             t = tmin
 
@@ -765,12 +1284,16 @@ class Simulation:
                         r = 1.0 / duration if duration != 0 else 1
                         while t < tmax:
                             t = self._sim.sim_step()
+                            if monitor:
+                                self._monitor_log(log, spill, pyramids)
                             if not progress.update(min((t - tmin) * r, 1)):
                                 raise myokit.SimulationCancelledError()
                 else:
                     # Loop without feedback
                     while t < tmax:
                         t = self._sim.sim_step()
+                        if monitor:
+                            self._monitor_log(log, spill, pyramids)
 
             except ArithmeticError as e:
                 # Some CVODE(S) errors are set to raise an ArithmeticError,
@@ -784,8 +1307,11 @@ class Simulation:
                 # Create long error message
                 txt = ['A numerical error occurred during simulation at'
                        ' t = ' + str(t) + '.', 'Last reached state: ']
-                txt.extend(['  ' + x for x
-                            in self._model.format_state(state).splitlines()])
+                n = self._model.count_states()
+                if self._n_cells > 1:
+                    txt.append('  (First cell in population)')
+                txt.extend(['  ' + x for x in self._model.format_state(
+                    state[:n]).splitlines()])
                 txt.append('Inputs for binding:')
                 txt.append('  time        = ' + myokit.float.str(bound[0]))
                 txt.append('  realtime    = ' + myokit.float.str(bound[1]))
@@ -799,7 +1325,7 @@ class Simulation:
                 # Check if state derivatives can be evaluated in Python, if
                 # not, add the error to the error message.
                 try:
-                    self._model.evaluate_derivatives(state)
+                    self._model.evaluate_derivatives(state[:n])
                 except Exception as en:
                     txt.append(str(en))
 
@@ -823,14 +1349,64 @@ class Simulation:
                 # Clean even after KeyboardInterrupt or other Exception
                 self._sim.sim_clean()
 
+                # Update pyramids and expose spilled data, even if the run did
+                # not complete
+                if pyramids is not None:
+                    pyramids.track(log)
+                if spill is not None:
+                    spill.finish()
+
             # Update internal state
             # Both lists were newly created, so this is OK.
             self._state = state
             self._s_state = s_state
 
+        # Expose data adopted for spilling, if no simulation was run
+        if spill is not None:
+            spill.finish()
+        if pyramids is not None:
+            pyramids.sync(log)
+            self._pyramids = (log, pyramids)
+
+        # Update the beat index, extending the last one if the same log was
+        # passed in
+        if self._beats is not None and self._beats[0] is log:
+            beat_index = self._beats[1]
+        else:
+            beat_index = BeatIndex()
+        n_after = max(len(x) for x in log.values()) if len(log) else 0
+        beat_index.extend(beats, n_before, n_after)
+        self._beats = (log, beat_index)
+
+        # Store states at the start of each beat
+        self._beat_states = None
+        if beat_states is not None:
+            n = len(self._state)
+            self._beat_states = (
+                np.array([x[0] for x in beat_states], dtype=float),
+                np.array([x[1] for x in beat_states], dtype=float).reshape(
+                    (len(beat_states), n)),
+            )
+
+        # Store integrals per beat
+        self._beat_integrals = None
+        if quadratures is not None:
+            rows = quadratures[1]
+            d = myokit.DataLog()
+            d['start'] = [x[0] for x in rows]
+            d['duration'] = [x[1] - x[0] for x in rows]
+            k = 0
+            for name in self._integrands:
+                for i in range(self._n_cells):
+                    key = name if self._n_cells == 1 else str(i) + '.' + name
+                    d[key] = [x[2][k] for x in rows]
+                    k += 1
+            self._beat_integrals = d
+
         # Simulation complete
         if myokit.DEBUG_SP:
             b.print('PP Simulation complete.')
+            b.print('PP Memory used: ' + str(self._sim.memory_usage()))
 
         # Calculate apds
         if root_list is not None:
@@ -864,6 +1440,59 @@ class Simulation:
             return log, apds
         return log
 
+    def set_beat_integrals(self, integrands=None, error_control=False):
+        """
+        Sets expressions to integrate over every beat, for example to obtain
+        the charge carried by a current (as used in the qNet metric) without
+        logging the current at a high rate.
+
+        ``integrands``
+            A dict mapping names to expressions in terms of model variables
+            (as :class:`myokit.Expression` objects or strings, e.g.
+            ``"ina.INa + ica.ICa"``), or ``None`` to disable.
+        ``error_control``
+            Set to ``True`` to include the integrals in CVODES' error test, so
+            that the step size is reduced if needed to integrate them
+            accurately. By default, the integrals do not affect the step size.
+
+        The integrals are computed by CVODES as quadrature variables, so that
+        they are as accurate as the solution itself. They are reset at the
+        start of every beat (the events in the first event-based protocol, as
+        used by :meth:`last_beat_index`), and at the start of every run. The
+        results can be obtained with :meth:`last_beat_integrals`: if a run
+        ends during a beat, its last entry covers the part of the beat
+        simulated so far. For populations, every expression is integrated for
+        every cell.
+
+        Integrals can only be computed with the CVODES solver.
+        """
+        self._integral_error_control = bool(error_control)
+        if not integrands:
+            self._integrands = {}
+            return
+        checked = {}
+        for name, expression in integrands.items():
+            if isinstance(expression, myokit.Expression):
+                expression = expression.code()
+            expression = myokit.parse_expression(
+                str(expression), context=self._model)
+            compile_expression(expression, lambda var: 0)
+            checked[str(name)] = expression.code()
+        self._integrands = checked
+
+    def set_beat_states(self, enabled=False):
+        """
+        Enables or disables storing the state at the start of every beat.
+
+        Beats are the events in the first event-based protocol, as used by
+        :meth:`last_beat_index`. When enabled, each call to :meth:`run` or
+        :meth:`pre` stores the full state at the start of each beat, without
+        needing to log any variables, so that convergence can be checked after
+        a single long pre-pacing run. The stored states are returned by
+        :meth:`last_beat_states`.
+        """
+        self._store_beat_states = bool(enabled)
+
     def set_constant(self, var, value):
         """
         Changes a model constant. Only literal constants (constants not
@@ -881,6 +1510,7 @@ class Simulation:
         # Update value in literal or parameter map
         if var in self._literals:
             self._literals[var] = value
+            self._cell_literals.pop(var.qname(), None)
         elif var in self._parameters:
             self._parameters[var] = value
         else:
@@ -895,8 +1525,251 @@ class Simulation:
     def set_default_state(self, state):
         """
         Change the default state to ``state``.
+
+        For populations, ``state`` can be either a single cell state (which
+        will be used for every cell), or a list containing the states of each
+        cell in turn.
+        """
+        self._default_state = self._map_to_population_state(state)
+
+    def set_fine_logging(self, interval=None, duration=None, beats=True,
+                         variable=None, threshold=None):
         """
-        self._default_state = self._model.map_to_state(state)
+        Enables logging with a finer interval during short windows, for
+        example to resolve action potential upstrokes without logging the
+        whole diastolic interval at a high resolution.
+
+        ``interval``
+            The logging interval to use inside each window, or ``None`` to
+            disable fine logging.
+        ``duration``
+            The duration of each window.
+        ``beats``
+            Set to ``True`` to open a window at the start of every beat (the
+            events in the first event-based protocol).
+        ``variable``
+            An optional state variable (a :class:`myokit.Variable` or a
+            qname), to open a window whenever its rate of change exceeds
+            ``threshold``, in any cell.
+        ``threshold``
+            The rate of change that opens a window, if ``variable`` is set.
+            Rising and falling rates are both counted, i.e. a window opens
+            when the absolute rate of change exceeds ``threshold``.
+
+        Windows are only used with periodic logging, i.e. when a
+        ``log_interval`` is passed to :meth:`run`: outside windows this
+        interval is used, and inside windows points are logged every
+        ``interval`` time units from the start of the window. A window opened
+        by ``variable`` starts at the beginning of the solver step in which
+        the threshold was exceeded. A window opened inside another window
+        extends it.
+        """
+        if interval is None:
+            self._fine_logging = None
+            return
+        interval = float(interval)
+        if interval <= 0:
+            raise ValueError('The fine logging interval must be positive.')
+        if duration is None or float(duration) <= 0:
+            raise ValueError('The window duration must be positive.')
+        index = -1
+        if variable is not None:
+            if isinstance(variable, myokit.Variable):
+                variable = variable.qname()
+            variable = self._model.get(variable)
+            if not variable.is_state():
+                raise ValueError(
+                    'The variable <' + variable.qname() + '> is not a state.')
+            if threshold is None:
+                raise ValueError(
+                    'A threshold must be set if a variable is given.')
+            if float(threshold) < 0:
+                raise ValueError('The threshold cannot be negative.')
+            index = variable.index()
+        elif not beats:
+            raise ValueError(
+                'Fine logging windows must be opened by beats, a variable, or'
+                ' both.')
+        self._fine_logging = (
+            interval, float(duration), int(bool(beats)), index,
+            0.0 if threshold is None else float(threshold))
+
+    def interpolation(self, label='pace'):
+        """
+        Returns the interpolation method used for a fixed-form protocol (see
+        :meth:`set_interpolation`).
+        """
+        try:
+            index = self._pacing_labels.index(label)
+        except ValueError:
+            raise ValueError('Unknown pacing label: ' + str(label))
+        return self._interpolation[index]
+
+    def set_interpolation(self, method='linear', label='pace', tolerance=0):
+        """
+        Selects how the values of a :class:`myokit.TimeSeriesProtocol` are
+        interpolated.
+
+        ``method``
+            The interpolation method to use: ``'linear'`` (default) for linear
+            interpolation, ``'hold'`` for a zero-order hold in which each value
+            is used until the next time point, or ``'cubic'`` for monotone
+            piecewise cubic (Fritsch-Butland, or "PCHIP") interpolation.
+        ``label``
+            The pacing label the protocol is set for.
+        ``tolerance``
+            With linear interpolation, a positive ``tolerance`` can be given to
+            simplify the protocol before simulating: points are removed (using
+            the Ramer-Douglas-Peucker algorithm) as long as the interpolated
+            value changes by no more than ``tolerance`` at any time. This can
+            greatly reduce the size of recorded waveforms, and the number of
+            kinks the solver has to step through. Protocols stored in a file
+            (see :class:`MappedTimeSeriesProtocol`) are never simplified. A
+            ``ValueError`` is raised if a tolerance is set for any other
+            method.
+
+        Linear interpolation creates a kink at every data point, which the
+        solver can only resolve by taking very small steps. Cubic interpolation
+        has a continuous derivative, so that fewer steps are rejected, while
+        still never overshooting the data. With a zero-order hold the solver is
+        stopped and restarted at every time point, exactly as for the steps in
+        an event-based :class:`myokit.Protocol`.
+
+        The method is ignored for labels with an event-based protocol.
+        """
+        try:
+            index = self._pacing_labels.index(label)
+        except ValueError:
+            raise ValueError('Unknown pacing label: ' + str(label))
+        if method not in self._interpolations:
+            raise ValueError(
+                'Unknown interpolation method: ' + str(method)
+                + '. Expecting one of: ' + ', '.join(self._interpolations)
+                + '.')
+        tolerance = float(tolerance)
+        if tolerance < 0:
+            raise ValueError('The tolerance cannot be negative.')
+        if tolerance > 0 and method != 'linear':
+            raise ValueError(
+                'A tolerance can only be used with linear interpolation.')
+        self._interpolation[index] = method
+        self._interpolation_tolerance[index] = tolerance
+
+    def log_budget(self):
+        """
+        Returns the memory budget for logged data, in bytes, or ``None`` if no
+        budget is set (see :meth:`set_log_budget`).
+        """
+        return self._log_budget
+
+    def set_log_budget(self, budget=None, path=None, compress=False,
+                       tolerance=0):
+        """
+        Sets a maximum number of bytes that logged data can take up in memory.
+
+        When the logs grow beyond ``budget`` bytes during a run, their contents
+        are moved to temporary files, created in the directory ``path`` (or in
+        the system's default temporary directory if ``path`` is ``None``).
+        At the end of the run, the entries in the returned
+        :class:`myokit.DataLog` are replaced by memory-mapped numpy arrays that
+        read from these files. The files are deleted automatically when the
+        arrays are no longer used.
+
+        With ``compress=True``, data is compressed as it is written (see
+        :meth:`myokit_beta.compress`) and the log entries are replaced by
+        :class:`myokit_beta.CompressedArray` objects instead. Compression is
+        lossless if ``tolerance=0``. For any positive ``tolerance`` values are
+        stored with an absolute error of at most ``tolerance``, which usually
+        compresses much better. The time variable is always stored exactly.
+
+        Data is compressed when it is moved out of the log lists: whenever the
+        budget is exceeded, and at the end of each run. The lists filled by
+        the simulation itself are not compressed, so ``budget`` still limits
+        the memory used during a run.
+
+        To keep all logged data in memory, use ``budget=None``. If
+        ``compress=True`` is used without a budget, the logs are kept in
+        memory during the run and compressed at the end.
+        """
+        if budget is not None:
+            budget = int(budget)
+            if budget < 0:
+                raise ValueError('The log budget cannot be negative.')
+        if path is not None:
+            path = os.path.abspath(path)
+            if not os.path.isdir(path):
+                raise ValueError('Directory not found: ' + str(path))
+        tolerance = float(tolerance)
+        if tolerance < 0:
+            raise ValueError('The compression tolerance cannot be negative.')
+        self._log_budget = budget
+        self._log_spill_path = path
+        self._log_compress = bool(compress)
+        self._log_tolerance = tolerance
+
+    def set_log_intervals(self, intervals=None):
+        """
+        Sets separate logging intervals for individual variables, so that
+        slowly varying variables (e.g. concentrations) can be logged less
+        often than fast ones (e.g. the membrane potential).
+
+        ``intervals``
+            A dict mapping variables (as :class:`myokit.Variable` objects or
+            qnames, or as ``"dot(qname)"`` for derivatives) to their logging
+            intervals, or ``None`` to log all variables at every point.
+
+        Each variable in ``intervals`` is logged at the first logging point on
+        or after every multiple of its interval, counted from the start of
+        each run, while all other variables are logged at every point. For
+        regularly spaced points, use intervals that are multiples of the
+        ``log_interval`` passed to :meth:`run`.
+
+        Because these variables are logged at different times, the log stores
+        the times at which each one was logged in a separate entry
+        ``time(key)``, where ``key`` is the variable's own entry (e.g.
+        ``time(ica.Ca_i)``, or ``time(0.ica.Ca_i)`` in a population). Note
+        that the log entries will no longer have equal lengths.
+        """
+        if intervals is None:
+            self._log_intervals = {}
+            return
+        checked = {}
+        for var, interval in intervals.items():
+            if isinstance(var, myokit.Variable):
+                var = var.qname()
+            if var.startswith('dot(') and var.endswith(')'):
+                key = 'dot(' + self._model.get(var[4:-1]).qname() + ')'
+            else:
+                key = self._model.get(var).qname()
+            interval = float(interval)
+            if interval <= 0:
+                raise ValueError(
+                    'The log interval for <' + key + '> must be positive.')
+            checked[key] = interval
+        self._log_intervals = checked
+
+    def set_log_pyramids(self, factor=None):
+        """
+        Enables or disables min/max pyramids for logged variables.
+
+        With a ``factor`` set, every run maintains a
+        :class:`myokit_beta.Pyramid` for each logged variable, updated as data
+        is logged. Level ``k`` of a pyramid contains the minimum and maximum
+        of every block of ``factor**(k + 1)`` logged values, so that plots at
+        any zoom level can read a level with roughly as many entries as there
+        are pixels (see :meth:`Pyramid.view`). The pyramids for the last run
+        can be obtained with :meth:`last_pyramids`. If the same log is passed
+        to the next run, its pyramids are extended.
+
+        To disable pyramids, use ``factor=None``.
+        """
+        if factor is not None:
+            factor = int(factor)
+            if factor < 2:
+                raise ValueError('The pyramid factor must be at least 2.')
+        self._pyramid_factor = factor
+        if factor is None:
+            self._pyramids = None
 
     def set_max_step_size(self, dtmax=None):
         """
@@ -913,6 +1786,35 @@ class Simulation:
         # Set in simulation
         self._sim.set_max_step_size(dtmax)
 
+    def set_monitor(self, name=None, capacity=1000):
+        """
+        Publishes the output of every run in a named shared memory segment, so
+        that it can be watched from another process using
+        :class:`myokit_beta.Monitor`.
+
+        While a simulation runs, the segment ``name`` contains the current
+        state (updated every 100 solver steps) and the last ``capacity`` rows
+        of logged values (updated whenever a point is logged). Publishing is
+        done by the C extension, without any interaction with Python. The
+        segment is removed when the run ends.
+
+        Only one simulation can use a given ``name`` at a time: if a segment
+        with the same name exists when a run starts, a ``FileExistsError`` is
+        raised. Shared memory output is supported on POSIX systems only. The
+        name is not stored when pickling.
+
+        To disable shared memory output, use ``name=None``.
+        """
+        if name is not None:
+            name = str(name)
+            if not name or '/' in name:
+                raise ValueError('Invalid shared memory name: ' + repr(name))
+        capacity = int(capacity)
+        if capacity < 1:
+            raise ValueError('The monitor capacity must be at least 1.')
+        self._monitor_name = name
+        self._monitor_capacity = capacity
+
     def set_min_step_size(self, dtmin=None):
         """
         Sets a minimum step size. To let the solver pick any step size it likes
@@ -954,11 +1856,56 @@ class Simulation:
 
         self.set_protocol(myokit.TimeSeriesProtocol(times, values))
 
+    def set_protocol_period(self, period=None, repeats=None, label='pace'):
+        """
+        Repeats the fixed-form protocol for the given ``label`` periodically.
+
+        ``period``
+            The period, starting from the protocol's first time point, or
+            ``None`` to disable repeating.
+        ``repeats``
+            The number of times the protocol is used, or ``None`` to repeat it
+            indefinitely. After the last repeat, the level at the end of the
+            period is used.
+        ``label``
+            The pacing label the protocol is set for.
+
+        This allows a single beat (e.g. a recorded action potential) to be used
+        for any number of beats, without storing a copy for each beat. Points
+        after the end of the first period are only used to interpolate up to
+        its end. The solver is restarted at the start of every repeat, as the
+        level may jump there.
+
+        The period is ignored for labels with an event-based protocol.
+        """
+        try:
+            index = self._pacing_labels.index(label)
+        except ValueError:
+            raise ValueError('Unknown pacing label: ' + str(label))
+        if period is None:
+            self._protocol_period[index] = (0, 0)
+            return
+        period = float(period)
+        if period <= 0:
+            raise ValueError('The period must be positive.')
+        if repeats is None:
+            repeats = 0
+        else:
+            repeats = int(repeats)
+            if repeats < 1:
+                raise ValueError('The number of repeats must be at least 1.')
+        self._protocol_period[index] = (period, repeats)
+
     def set_protocol(self, protocol, label='pace'):
         """
         Set an event-based pacing :class:`Protocol` or a :class:`FixedProtocol`
         for the given ``label``.
 
+        Long time-series can be stored in a file and used without loading them
+        into memory, by passing in a :class:`MappedTimeSeriesProtocol`. Sine
+        waves, ramps, and other analytic waveforms can be set with an
+        :class:`AnalyticProtocol`.
+
         To remove a previously set binding call this method with ``protocol =
         None``. In this case, the value of any variables bound to ``label``
         will be set to 0.
@@ -995,11 +1942,196 @@ class Simulation:
         self.set_min_step_size(state[6])
         self.set_max_step_size(state[7])
 
+        # Further settings are stored in a dict, so that entries can be added
+        # without changing the meaning of any others. Settings missing from
+        # the dict keep their default values.
+        settings = state[8] if len(state) > 8 else {}
+        if 'solver' in settings:
+            self.set_solver(settings['solver'])
+        if 'population' in settings:
+            self._n_cells, self._cell_literals = settings['population']
+        if 'coupling' in settings:
+            self._coupling = settings['coupling']
+        if 'log_budget' in settings:
+            self.set_log_budget(*settings['log_budget'])
+        if 'pyramids' in settings:
+            self.set_log_pyramids(settings['pyramids'])
+        if 'monitor' in settings:
+            self.set_monitor(*settings['monitor'])
+        if 'interpolation' in settings:
+            methods, tolerances = settings['interpolation']
+            self._interpolation = list(methods)
+            self._interpolation_tolerance = list(tolerances)
+        if 'protocol_period' in settings:
+            self._protocol_period = list(settings['protocol_period'])
+        if 'beat_states' in settings:
+            self.set_beat_states(settings['beat_states'])
+        if 'fine_logging' in settings:
+            self._fine_logging = settings['fine_logging']
+        if 'log_intervals' in settings:
+            self._log_intervals = dict(settings['log_intervals'])
+        if 'beat_integrals' in settings:
+            self.set_beat_integrals(*settings['beat_integrals'])
+
+    def set_solver(self, solver='cvodes'):
+        """
+        Selects the ODE solver to use.
+
+        ``solver``
+            The solver to use, either ``'cvodes'`` (default) for the implicit
+            multi-step CVODES solver, ``'dopri5'`` for the explicit
+            Dormand-Prince 5(4) Runge-Kutta method, or ``'rosenbrock'`` for the
+            linearly implicit ROS34PW2 method. The explicit method can be
+            considerably faster for non-stiff models, but will take very small
+            steps (or fail) on stiff ones. The Rosenbrock method is aimed at
+            stiff models with a small number of states (as it uses a dense
+            finite-difference Jacobian). Neither supports sensitivities.
+
+        The tolerances and step size bounds set with :meth:`set_tolerance`,
+        :meth:`set_min_step_size` and :meth:`set_max_step_size` are used by
+        both solvers.
+        """
+        try:
+            code = self._solvers[solver]
+        except KeyError:
+            raise ValueError(
+                'Unknown solver: ' + str(solver) + '. Expecting one of: '
+                + ', '.join(self._solvers) + '.')
+        if code != 0 and self._sensitivities:
+            raise ValueError(
+                'Sensitivities are only supported by the CVODES solver.')
+
+        # Store solver in Python (for pickling)
+        self._solver = solver
+
+        # Set solver in simulation
+        self._sim.set_solver(code)
+
     def set_state(self, state):
         """
         Sets the current state.
+
+        For populations, ``state`` can be either a single cell state (which
+        will be used for every cell), or a list containing the states of each
+        cell in turn.
+        """
+        self._state = self._map_to_population_state(state)
+
+    def _map_to_population_state(self, state):
+        """
+        Converts a single-cell or population state to a population state.
+        """
+        n = self._model.count_states()
+        if self._n_cells > 1 and len(state) == n * self._n_cells:
+            state = [float(x) for x in state]
+            for i in range(self._n_cells):
+                self._model.map_to_state(state[i * n:(i + 1) * n])
+            return state
+        return self._model.map_to_state(state) * self._n_cells
+
+    def population_coupling(self):
+        """
+        Returns the coupling between cells in a population, as a list of tuples
+        ``(i, j, g)`` (see :meth:`set_population_coupling`).
+        """
+        return list(self._coupling)
+
+    def population_size(self):
+        """
+        Returns the number of cells simulated (see :meth:`set_population_size`).
+        """
+        return self._n_cells
+
+    def set_population_constant(self, var, values):
+        """
+        Sets a different value of a literal constant for each cell in a
+        population.
+
+        The constant ``var`` can be given as a :class:`Variable` or a string
+        containing a variable qname, and ``values`` should be a sequence
+        containing a value for every cell. To revert to using a single value
+        for all cells, use :meth:`set_constant`.
+        """
+        if isinstance(var, myokit.Variable):
+            var = var.qname()
+        var = self._model.get(var)
+        if var not in self._literals:
+            raise ValueError(
+                'The given variable <' + var.qname() + '> is not a literal.')
+        values = [float(x) for x in values]
+        if len(values) != self._n_cells:
+            raise ValueError(
+                'Expecting ' + str(self._n_cells) + ' values, one per cell.')
+        self._cell_literals[var.qname()] = values
+
+    def set_population_coupling(self, edges=None):
         """
-        self._state = self._model.map_to_state(state)
+        Couples the cells in a population.
+
+        The coupling is given as a sequence of tuples ``(i, j, g)``, each
+        indicating that cells ``i`` and ``j`` are connected with a conductance
+        ``g``. Each cell then receives a diffusion current
+        ``I_i = sum_j g_ij * (V_i - V_j)``, so that ``g`` should be given in
+        units such that ``g * V`` has the units of the variable bound to
+        ``diffusion_current``.
+
+        Use ``edges=None`` to remove all coupling.
+        """
+        if not edges:
+            self._coupling = []
+            return
+
+        # Check variables
+        if self._model.label('membrane_potential') is None:
+            raise ValueError(
+                'Coupled populations require a variable labelled as'
+                ' membrane_potential.')
+        var = self._diffusion_current
+        if var is None:
+            raise ValueError(
+                'Coupled populations require a variable bound to'
+                ' diffusion_current.')
+        if var not in self._literals:
+            raise ValueError(
+                'The variable bound to diffusion_current must be a literal.')
+        if any(x.is_constant() for x in var.refs_by()):
+            raise ValueError(
+                'The variable bound to diffusion_current cannot be used by'
+                ' other constants.')
+
+        # Check edges
+        coupling = []
+        for i, j, g in edges:
+            i, j, g = int(i), int(j), float(g)
+            if i == j:
+                raise ValueError('Cells cannot be coupled to themselves.')
+            if not (0 <= i < self._n_cells and 0 <= j < self._n_cells):
+                raise ValueError(
+                    'Coupling refers to a cell outside of the population.')
+            coupling.append((i, j, g))
+        self._coupling = coupling
+
+    def set_population_size(self, n=1):
+        """
+        Sets the number of cells to simulate, all sharing the same pacing
+        protocol(s).
+
+        The current and default state of the first cell are copied to every
+        cell, and any values set with :meth:`set_population_constant` or
+        :meth:`set_population_coupling` are discarded.
+        """
+        n = int(n)
+        if n < 1:
+            raise ValueError('Population size must be at least 1.')
+        if n > 1 and self._sensitivities:
+            raise ValueError(
+                'Sensitivities are not supported for populations.')
+        m = self._model.count_states()
+        self._state = self._state[:m] * n
+        self._default_state = self._default_state[:m] * n
+        self._n_cells = n
+        self._cell_literals = {}
+        self._coupling = []
 
     def set_time(self, time=0):
         """
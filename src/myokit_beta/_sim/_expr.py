@@ -0,0 +1,92 @@
+#
+# Compiles myokit expressions to programs for the small expression evaluator
+# in the C extension (see expr.h).
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import myokit
+
+# Operation codes, must match the Expr_ constants in expr.h
+_NUMBER = 0
+_VARIABLE = 1
+_BINARY = {
+    myokit.Plus: 2,
+    myokit.Minus: 3,
+    myokit.Multiply: 4,
+    myokit.Divide: 5,
+    myokit.Power: 6,
+}
+_NEGATE = 7
+_UNARY = {
+    myokit.Exp: 8,
+    myokit.Log: 9,
+    myokit.Log10: 10,
+    myokit.Sqrt: 11,
+    myokit.Abs: 12,
+    myokit.Sin: 13,
+    myokit.Cos: 14,
+    myokit.Tan: 15,
+    myokit.ASin: 16,
+    myokit.ACos: 17,
+    myokit.ATan: 18,
+    myokit.Floor: 19,
+    myokit.Ceil: 20,
+}
+_LOG = 9
+_DIVIDE = 5
+
+
+def compile_expression(expression, constant):
+    """
+    Compiles a :class:`myokit.Expression` to a list of tuples ``(op, arg)``
+    in postfix order, that can be evaluated by the C extension.
+
+    References to states, derivatives, bound variables, and intermediary
+    variables are compiled to variable lookups, so that they are evaluated
+    using the values at each logged point. Constants are replaced by their
+    value, as returned by ``constant(variable)``.
+
+    Only arithmetic operators and the functions in ``_UNARY`` are supported:
+    for any other expression type a ``ValueError`` is raised.
+    """
+    program = []
+
+    def add(e):
+        if isinstance(e, myokit.Number):
+            program.append((_NUMBER, float(e.eval())))
+        elif isinstance(e, myokit.Derivative):
+            program.append((_VARIABLE, 'dot(' + e.var().qname() + ')'))
+        elif isinstance(e, myokit.Name):
+            var = e.var()
+            if (var.is_state() or var.binding() is not None
+                    or not var.is_constant()):
+                program.append((_VARIABLE, var.qname()))
+            else:
+                program.append((_NUMBER, float(constant(var))))
+        elif isinstance(e, myokit.PrefixPlus):
+            add(e[0])
+        elif isinstance(e, myokit.PrefixMinus):
+            add(e[0])
+            program.append((_NEGATE, None))
+        elif type(e) in _BINARY:
+            add(e[0])
+            add(e[1])
+            program.append((_BINARY[type(e)], None))
+        elif isinstance(e, myokit.Log) and len(e) == 2:
+            # Logarithm with a base: log(a) / log(b)
+            add(e[0])
+            program.append((_LOG, None))
+            add(e[1])
+            program.append((_LOG, None))
+            program.append((_DIVIDE, None))
+        elif type(e) in _UNARY:
+            add(e[0])
+            program.append((_UNARY[type(e)], None))
+        else:
+            raise ValueError(
+                'Unsupported expression type in logged expression: '
+                + type(e).__name__ + '.')
+
+    add(expression)
+    return program
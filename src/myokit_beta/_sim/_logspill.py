@@ -0,0 +1,122 @@
+#
+# Spilling of logged data to temporary files, for simulations with a memory
+# budget for their logs.
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import array
+import tempfile
+
+import numpy as np
+
+from ._codec import CompressedArray, write_chunks
+
+
+class LogSpill(object):
+    """
+    Moves logged data from the lists in a :class:`myokit.DataLog` to temporary
+    files whenever the in-memory logs exceed a budget, and re-exposes the data
+    as memory-mapped (or compressed) arrays once the simulation is done.
+
+    Each logged variable is stored in its own anonymous temporary file, which
+    is removed automatically when the last array referring to it is deleted.
+
+    ``log``
+        The :class:`myokit.DataLog` that will be logged to. Any entries that
+        are not lists (e.g. memory-mapped arrays from an earlier run) are
+        moved to a temporary file, and replaced by lists so that new data can
+        be appended. The last value is kept in the list, so that the
+        simulation can still tell the log is not empty.
+    ``budget``
+        The maximum number of bytes of logged data to keep in memory, or
+        ``None`` to spill only when :meth:`finish` is called.
+    ``path``
+        An optional directory to create the temporary files in.
+    ``compress``
+        Set to ``True`` to compress data as it is written to disk (see
+        :meth:`myokit_beta.compress`). Compressed entries are returned as
+        :class:`myokit_beta.CompressedArray` objects.
+    ``tolerance``
+        The maximum absolute error for compressed data, or ``0`` for lossless
+        compression. The log's time variable is always stored exactly.
+
+    The lists in ``log`` are emptied in place (not replaced) while the
+    simulation runs, so that references held by the C extension stay valid.
+    """
+    def __init__(self, log, budget, path=None, compress=False, tolerance=0):
+        self._log = log
+        self._budget = budget
+        self._path = path
+        self._compress = bool(compress)
+        self._tolerance = float(tolerance)
+        self._time_key = log.time_key() if hasattr(log, 'time_key') else None
+        self._files = {}
+        self._counts = {}
+
+        for key, data in log.items():
+            if not isinstance(data, list):
+                data = np.asarray(data, dtype=float)
+                if len(data) > 1:
+                    self._write(key, data[:-1])
+                log[key] = [float(x) for x in data[-1:]]
+
+    def _file(self, key):
+        """ Returns the temporary file for ``key``, creating it if needed. """
+        try:
+            return self._files[key]
+        except KeyError:
+            f = self._files[key] = tempfile.TemporaryFile(dir=self._path)
+            self._counts[key] = 0
+            return f
+
+    def _write(self, key, data):
+        """ Appends the values in ``data`` to the file for ``key``. """
+        f = self._file(key)
+        if self._compress:
+            tol = 0 if key == self._time_key else self._tolerance
+            write_chunks(f, data, tol)
+        else:
+            data.tofile(f)
+        self._counts[key] += len(data)
+
+    def check(self, usage):
+        """
+        Spills all in-memory log data if ``usage`` (the number of bytes used by
+        the logs) exceeds the budget, and returns ``True`` if it did.
+        """
+        if self._budget is not None and usage > self._budget:
+            self.spill()
+            return True
+        return False
+
+    def spill(self):
+        """ Moves all data currently held in the log lists to disk. """
+        for key, data in self._log.items():
+            if data:
+                self._write(key, array.array('d', data))
+                del data[:]
+
+    def finish(self):
+        """
+        Spills any remaining data, and replaces every spilled entry in the log
+        by a (copy-on-write) memory-mapped array, or by a compressed array.
+
+        If compression is enabled, all data is spilled and compressed, even if
+        the budget was never exceeded.
+        """
+        if not (self._files or self._compress):
+            return
+        self.spill()
+        for key, f in self._files.items():
+            f.flush()
+            n = self._counts[key]
+            if n and self._compress:
+                # Keep the file open: it is read from on access
+                self._log[key] = CompressedArray(f)
+                continue
+            if n:
+                self._log[key] = np.memmap(f, dtype='d', mode='c', shape=(n, ))
+            f.close()
+        self._files = {}
+        self._counts = {}
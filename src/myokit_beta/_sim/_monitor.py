@@ -0,0 +1,128 @@
+#
+# Reads the live output of a running simulation from shared memory (see
+# monitor.h).
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import struct
+import time
+
+import numpy as np
+
+# Header layout, must match Monitor_Header in monitor.h
+_HEADER = struct.Struct('=8s7Qd')
+_MAGIC = b'MYOKMON1'
+
+
+class Monitor(object):
+    """
+    Attaches to the shared memory output of a running simulation, see
+    :meth:`Simulation.set_monitor`.
+
+    ``name``
+        The name of the shared memory segment.
+
+    The segment is only available while the simulation runs. Once attached, a
+    monitor can still read the final data after the run has finished. Reading
+    never blocks or slows down the simulation: if the simulation updates the
+    data while it is being read, the read is simply repeated.
+
+    Monitors can be used as context managers, to ensure :meth:`close` is
+    called.
+    """
+    def __init__(self, name):
+        from multiprocessing import shared_memory
+
+        # Attach without registering with the resource tracker, which would
+        # otherwise unlink the segment when this process exits.
+        try:
+            self._shm = shared_memory.SharedMemory(name=name, track=False)
+        except TypeError:   # pragma: no cover (Python < 3.13)
+            from multiprocessing import resource_tracker
+            self._shm = shared_memory.SharedMemory(name=name)
+            try:
+                resource_tracker.unregister(
+                    self._shm._name, 'shared_memory')
+            except Exception:
+                pass
+
+        header = self._header(bytes(self._shm.buf[:_HEADER.size]))
+        if header[0] != _MAGIC:
+            self.close()
+            raise ValueError(
+                'Shared memory segment <' + str(name) + '> does not contain'
+                ' simulation output.')
+        (_, _, _, self._n_states, self._n_columns, self._capacity,
+         names_size, _, _) = header
+
+        # Read column names
+        o = _HEADER.size + 8 * (self._n_states
+                                + self._n_columns * self._capacity)
+        names = bytes(self._shm.buf[o:o + names_size]).decode('utf-8')
+        self._names = names.split('\n') if names else []
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        """ Detaches from the shared memory segment. """
+        if self._shm is not None:
+            self._shm.close()
+            self._shm = None
+
+    def _header(self, data):
+        return _HEADER.unpack(data[:_HEADER.size])
+
+    def names(self):
+        """ Returns the names of the logged variables. """
+        return list(self._names)
+
+    def read(self, timeout=1):
+        """
+        Returns a consistent snapshot of the simulation output, as a tuple
+        ``(time, state, log, running)``.
+
+        Here ``time`` is the simulation time of ``state``, which is a numpy
+        array containing the full state (of every cell in a population).
+        The dict ``log`` maps the name of each logged variable to a numpy array
+        with its most recently logged values (oldest first), and ``running``
+        is ``False`` once the simulation has finished.
+
+        The state is updated every 100 solver steps, while new logged values
+        are added as soon as they are logged.
+
+        If no consistent snapshot can be made within ``timeout`` seconds, a
+        ``TimeoutError`` is raised.
+        """
+        buf = self._shm.buf
+        size = _HEADER.size + 8 * (
+            self._n_states + self._n_columns * self._capacity)
+        deadline = time.monotonic() + timeout
+        while True:
+            seq1 = self._header(bytes(buf[:_HEADER.size]))[1]
+            if seq1 % 2 == 0:
+                data = bytes(buf[:size])
+                header = self._header(data)
+                if header[1] == seq1 == self._header(
+                        bytes(buf[:_HEADER.size]))[1]:
+                    break
+            if time.monotonic() > deadline:
+                raise TimeoutError('Unable to read consistent output.')
+
+        running, n_rows, t = header[2], header[7], header[8]
+        values = np.frombuffer(data, dtype=float, offset=_HEADER.size)
+        state = np.array(values[:self._n_states])
+        rows = values[self._n_states:].reshape(
+            self._capacity, self._n_columns)
+
+        # Put rows in order, oldest first
+        n = min(n_rows, self._capacity)
+        i = n_rows % self._capacity
+        rows = np.concatenate((rows[i:], rows[:i]))[self._capacity - n:]
+        log = {
+            name: np.array(rows[:, k]) for k, name in enumerate(self._names)}
+        return t, state, log, bool(running)
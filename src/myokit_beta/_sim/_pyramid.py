@@ -0,0 +1,155 @@
+#
+# Multi-resolution min/max summaries of logged data, for fast plotting of long
+# simulations.
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import array
+
+import numpy as np
+
+
+class Pyramid(object):
+    """
+    Maintains a min/max pyramid for a single series of values.
+
+    Level ``0`` contains the minimum and maximum of every block of ``factor``
+    values, level ``1`` of every block of ``factor**2`` values, and so on. New
+    levels are added as data arrives, and each value is processed only once.
+
+    ``factor``
+        The number of entries in each level combined into a single entry in the
+        next level.
+    """
+    def __init__(self, factor=4):
+        factor = int(factor)
+        if factor < 2:
+            raise ValueError('The pyramid factor must be at least 2.')
+        self._factor = factor
+        self._n = 0
+
+        # Complete entries per level, as arrays of (mins, maxs)
+        self._levels = []
+
+        # Entries not yet combined into the next level, as numpy (mins, maxs)
+        self._tails = []
+
+    def extend(self, values):
+        """ Adds new values to the pyramid. """
+        lo = hi = np.asarray(values, dtype=float)
+        self._n += len(lo)
+        f = self._factor
+        k = 0
+        while len(lo):
+            if k == len(self._levels):
+                self._levels.append((array.array('d'), array.array('d')))
+                self._tails.append((lo[:0], hi[:0]))
+            tlo, thi = self._tails[k]
+            lo = np.concatenate((tlo, lo))
+            hi = np.concatenate((thi, hi))
+            m = len(lo) - len(lo) % f
+            self._tails[k] = (lo[m:], hi[m:])
+            lo = lo[:m].reshape(-1, f).min(axis=1)
+            hi = hi[:m].reshape(-1, f).max(axis=1)
+            self._levels[k][0].frombytes(lo.tobytes())
+            self._levels[k][1].frombytes(hi.tobytes())
+            k += 1
+
+    def factor(self):
+        """ Returns the number of entries combined in each step. """
+        return self._factor
+
+    def __len__(self):
+        """ Returns the number of values added to this pyramid. """
+        return self._n
+
+    def level(self, k):
+        """
+        Returns a tuple ``(mins, maxs)`` of numpy arrays for level ``k``, where
+        each entry covers ``factor**(k + 1)`` values.
+
+        If the number of values is not a multiple of the block size, the last
+        entry covers the remaining values.
+        """
+        if k < 0 or k >= len(self._levels):
+            raise IndexError('Pyramid level out of range.')
+        lo = np.frombuffer(self._levels[k][0])
+        hi = np.frombuffer(self._levels[k][1])
+
+        # Add a partial entry for everything not yet in a complete block
+        tails = [t for t in self._tails[:k + 1] if len(t[0])]
+        if tails:
+            lo = np.append(lo, min(t[0].min() for t in tails))
+            hi = np.append(hi, max(t[1].max() for t in tails))
+        return np.array(lo), np.array(hi)
+
+    def levels(self):
+        """ Returns the number of levels in this pyramid. """
+        return len(self._levels)
+
+    def view(self, start, stop, points):
+        """
+        Selects the finest level that covers the values in ``start:stop`` in no
+        more than ``points`` entries (or the coarsest level available), and
+        returns a tuple ``(block, mins, maxs)``.
+
+        Entry ``i`` in ``mins`` and ``maxs`` covers the values from
+        ``(start // block + i) * block`` up to (but not including) the next
+        block.
+
+        If ``start:stop`` contains no more than ``points`` values, or if no
+        levels are available yet, ``None`` is returned, and the raw data should
+        be used instead.
+        """
+        start, stop, _ = slice(start, stop).indices(self._n)
+        if stop - start <= points or not self._levels:
+            return None
+        block = self._factor
+        k = 0
+        while k + 1 < len(self._levels) and (stop - start) > points * block:
+            block *= self._factor
+            k += 1
+        lo, hi = self.level(k)
+        i, j = start // block, -(-stop // block)
+        return block, lo[i:j], hi[i:j]
+
+
+class LogPyramids(dict):
+    """
+    A dict mapping the keys in a :class:`myokit.DataLog` to :class:`Pyramid`
+    objects, that are updated with new data as it is logged.
+
+    Because log lists can be emptied during a run (see :class:`LogSpill`), the
+    number of entries already seen in each list is tracked separately.
+    """
+    def __init__(self, factor=4):
+        super(LogPyramids, self).__init__()
+        self._factor = factor
+        self._seen = {}
+
+    def factor(self):
+        """ Returns the factor used in each pyramid. """
+        return self._factor
+
+    def rewind(self):
+        """ Indicates that all lists in the log were emptied. """
+        for key in self._seen:
+            self._seen[key] = 0
+
+    def sync(self, log):
+        """ Marks all data currently in ``log`` as seen, without adding it. """
+        for key, data in log.items():
+            if key not in self:
+                self[key] = Pyramid(self._factor)
+            self._seen[key] = len(data)
+
+    def track(self, log):
+        """ Adds any data in ``log`` that has not been seen before. """
+        for key, data in log.items():
+            if key not in self:
+                self[key] = Pyramid(self._factor)
+            seen = self._seen.get(key, 0)
+            if len(data) > seen:
+                self[key].extend(data[seen:])
+                self._seen[key] = len(data)
@@ -0,0 +1,101 @@
+#
+# Time-series protocols stored in binary files, that are memory-mapped during
+# simulations (see FSys_PopulateFromFile in pacing.h).
+#
+# This file is part of Myokit.
+# See http://myokit.org for copyright, sharing, and licensing details.
+#
+import os
+import struct
+
+import numpy as np
+
+# File header, must match the format described in pacing.h
+_HEADER = struct.Struct('=8sQ')
+_MAGIC = b'MYOKTS01'
+
+# Number of values written at once
+_CHUNK_SIZE = 65536
+
+
+class MappedTimeSeriesProtocol(object):
+    """
+    A time-series protocol stored in a binary file, for inputs too large to
+    hold in memory (e.g. long dynamic-clamp or AP-clamp recordings).
+
+    ``path``
+        The path to a file created with :meth:`write`.
+
+    Unlike a :class:`myokit.TimeSeriesProtocol`, the data is not loaded when
+    a simulation starts. Instead, the file is memory-mapped, so that only the
+    parts needed are paged in as the simulation progresses. The interpolation
+    method can be set with :meth:`Simulation.set_interpolation`, but note that
+    ``'cubic'`` interpolation stores coefficients for every point in memory.
+
+    Memory-mapped protocols are only supported on POSIX systems.
+    """
+    def __init__(self, path):
+        self._path = os.path.abspath(path)
+        with open(self._path, 'rb') as f:
+            header = f.read(_HEADER.size)
+            f.seek(0, os.SEEK_END)
+            size = f.tell()
+        if len(header) < _HEADER.size or header[:8] != _MAGIC:
+            raise ValueError(
+                'File <' + self._path + '> is not a time-series file.')
+        self._n = _HEADER.unpack(header)[1]
+        if size != _HEADER.size + 16 * self._n:
+            raise ValueError(
+                'File <' + self._path + '> has an unexpected size.')
+
+    def clone(self):
+        """ Returns a copy of this protocol (using the same file). """
+        return MappedTimeSeriesProtocol(self._path)
+
+    def __len__(self):
+        return self._n
+
+    def path(self):
+        """ Returns the absolute path to this protocol's file. """
+        return self._path
+
+    def times(self):
+        """ Returns a read-only memory-mapped array with the times. """
+        return np.memmap(
+            self._path, dtype=float, mode='r', offset=_HEADER.size,
+            shape=(self._n, ))
+
+    def values(self):
+        """ Returns a read-only memory-mapped array with the values. """
+        return np.memmap(
+            self._path, dtype=float, mode='r',
+            offset=_HEADER.size + 8 * self._n, shape=(self._n, ))
+
+    @staticmethod
+    def write(path, times, values):
+        """
+        Writes a time-series to a binary file at ``path``, and returns a
+        :class:`MappedTimeSeriesProtocol` for it.
+
+        The ``times`` must be non-decreasing, and ``values`` must have the same
+        length. Both can be any sequence that supports slicing, including
+        memory-mapped arrays, and are written in chunks so that they need not
+        fit in memory.
+        """
+        n = len(times)
+        if len(values) != n:
+            raise ValueError('Times and values must have the same length.')
+
+        with open(path, 'wb') as f:
+            f.write(_HEADER.pack(_MAGIC, n))
+            last = -np.inf
+            for i in range(0, n, _CHUNK_SIZE):
+                x = np.ascontiguousarray(times[i:i + _CHUNK_SIZE], dtype=float)
+                if x[0] < last or np.any(x[1:] < x[:-1]):
+                    raise ValueError('Times must be non-decreasing.')
+                last = x[-1]
+                f.write(x.tobytes())
+            for i in range(0, n, _CHUNK_SIZE):
+                f.write(np.ascontiguousarray(
+                    values[i:i + _CHUNK_SIZE], dtype=float).tobytes())
+        return MappedTimeSeriesProtocol(path)
@@ -0,0 +1,461 @@
+/*
+ * blocksolver.h
+ *
+ * A custom SUNDIALS linear solver for CVODES, for systems with a
+ * block-diagonal Jacobian, such as populations of independent cells that are
+ * integrated as one large ODE system.
+ *
+ * Each block is a dense matrix of size block_size, and the blocks are stored
+ * contiguously. The Jacobian is approximated with finite differences, but
+ * since the blocks are independent all blocks can be perturbed at once, so
+ * that only block_size evaluations of the full right-hand side are needed
+ * (instead of n_blocks * block_size for a dense Jacobian). The iteration
+ * matrix is factored and solved block-by-block, in O(n_blocks * block_size^3)
+ * and O(n_blocks * block_size^2) time respectively.
+ *
+ * CVODES' linear solver interface only provides the information needed to
+ * build the iteration matrix (t, y, f(t, y), gamma, and whether the Jacobian
+ * can be reused) to preconditioner setup functions. The solver is therefore
+ * registered as an "iterative" solver whose preconditioner is exact: setting
+ * up calls the preconditioner setup (which evaluates the Jacobian if needed and
+ * factors I - gamma * J), and solving applies the preconditioner once. As with
+ * CVODES' own matrix-based solvers, solutions are scaled to correct for changes
+ * in gamma since the last factorisation.
+ *
+ * How to use:
+ *
+ *  1. Create a linear solver using BlockDiag_Create
+ *  2. Attach it to CVODES with CVodeSetLinearSolver (passing NULL as matrix)
+ *  3. Call CVodeSetPreconditioner with two functions that forward to
+ *     BlockDiag_PSetup and BlockDiag_PSolve
+ *  4. Tidy up using SUNLinSolFree
+ *
+ * Requires SUNDIALS 5.0 or newer.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitBlockSolver
+#define MyokitBlockSolver
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <cvodes/cvodes.h>
+#include <nvector/nvector_serial.h>
+#include <sundials/sundials_linearsolver.h>
+
+#if SUNDIALS_VERSION_MAJOR >= 6
+    #define BlockDiag_ATimesFn SUNATimesFn
+    #define BlockDiag_PSetupFn SUNPSetupFn
+    #define BlockDiag_PSolveFn SUNPSolveFn
+    #define BlockDiag_PREC_LEFT SUN_PREC_LEFT
+#else
+    #define BlockDiag_ATimesFn ATimesFn
+    #define BlockDiag_PSetupFn PSetupFn
+    #define BlockDiag_PSolveFn PSolveFn
+    #define BlockDiag_PREC_LEFT PREC_LEFT
+#endif
+
+/*
+ * Block-diagonal solver content
+ */
+struct BlockDiag_Content {
+    int n_blocks;           // The number of blocks
+    int block_size;         // The size of each (square) block
+
+    double* jac;            // Jacobian blocks, each stored row-major, contiguously
+    double* lu;             // LU factorisations of the iteration matrix blocks
+    sunindextype* pivots;   // Row pivots for each LU factorisation
+    double gamma;           // The gamma used in the last factorisation
+
+    N_Vector ytmp;          // Perturbed state, for finite differences
+    N_Vector ftmp;          // Perturbed derivatives, for finite differences
+    N_Vector ewt;           // Error weights, for finite differences
+
+    void* P_data;           // Preconditioner data, passed in by CVODES
+    BlockDiag_PSetupFn Psetup;  // Preconditioner setup, passed in by CVODES
+    BlockDiag_PSolveFn Psolve;  // Preconditioner solve, passed in by CVODES
+
+    long n_jacobians;       // Number of Jacobian evaluations
+    long n_rhs_evaluations; // Number of rhs evaluations used for Jacobians
+    sunindextype last_flag; // Last error flag
+};
+typedef struct BlockDiag_Content* BlockDiag;
+
+#define BlockDiag_CONTENT(S) ((BlockDiag)(S->content))
+
+/*
+ * Linear solver operations
+ */
+static SUNLinearSolver_Type
+BlockDiag_GetType(SUNLinearSolver S)
+{
+    return SUNLINEARSOLVER_ITERATIVE;
+}
+
+static SUNLinearSolver_ID
+BlockDiag_GetID(SUNLinearSolver S)
+{
+    return SUNLINEARSOLVER_CUSTOM;
+}
+
+static int
+BlockDiag_SetATimes(SUNLinearSolver S, void* A_data, BlockDiag_ATimesFn ATimes)
+{
+    // Required by CVODES for iterative solvers, but not used
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_SetPreconditioner(SUNLinearSolver S, void* P_data, BlockDiag_PSetupFn Psetup, BlockDiag_PSolveFn Psolve)
+{
+    BlockDiag_CONTENT(S)->P_data = P_data;
+    BlockDiag_CONTENT(S)->Psetup = Psetup;
+    BlockDiag_CONTENT(S)->Psolve = Psolve;
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_Initialize(SUNLinearSolver S)
+{
+    BlockDiag_CONTENT(S)->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_Setup(SUNLinearSolver S, SUNMatrix A)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    int flag;
+    if (content->Psetup == NULL) {
+        content->last_flag = SUNLS_PSET_FAIL_UNREC;
+        return SUNLS_PSET_FAIL_UNREC;
+    }
+    flag = content->Psetup(content->P_data);
+    if (flag != 0) {
+        content->last_flag = (flag < 0) ? SUNLS_PSET_FAIL_UNREC : SUNLS_PSET_FAIL_REC;
+        return content->last_flag;
+    }
+    content->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_Solve(SUNLinearSolver S, SUNMatrix A, N_Vector x, N_Vector b, realtype tol)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    int flag;
+    if (content->Psolve == NULL) {
+        content->last_flag = SUNLS_PSOLVE_FAIL_UNREC;
+        return SUNLS_PSOLVE_FAIL_UNREC;
+    }
+    flag = content->Psolve(content->P_data, b, x, tol, BlockDiag_PREC_LEFT);
+    if (flag != 0) {
+        content->last_flag = (flag < 0) ? SUNLS_PSOLVE_FAIL_UNREC : SUNLS_PSOLVE_FAIL_REC;
+        return content->last_flag;
+    }
+    content->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_NumIters(SUNLinearSolver S)
+{
+    return 0;
+}
+
+static sunindextype
+BlockDiag_LastFlag(SUNLinearSolver S)
+{
+    return BlockDiag_CONTENT(S)->last_flag;
+}
+
+static int
+BlockDiag_Space(SUNLinearSolver S, long int* lenrw, long int* leniw)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    long n = (long)content->n_blocks * content->block_size;
+    *lenrw = 2 * n * content->block_size + 3 * n;
+    *leniw = n;
+    return SUNLS_SUCCESS;
+}
+
+static int
+BlockDiag_Free(SUNLinearSolver S)
+{
+    BlockDiag content;
+    if (S == NULL) return SUNLS_SUCCESS;
+    content = BlockDiag_CONTENT(S);
+    if (content != NULL) {
+        free(content->jac);
+        free(content->lu);
+        free(content->pivots);
+        if (content->ytmp != NULL) N_VDestroy(content->ytmp);
+        if (content->ftmp != NULL) N_VDestroy(content->ftmp);
+        if (content->ewt != NULL) N_VDestroy(content->ewt);
+        free(content);
+        S->content = NULL;
+    }
+    SUNLinSolFreeEmpty(S);
+    return SUNLS_SUCCESS;
+}
+
+/*
+ * Creates a block-diagonal linear solver.
+ *
+ * Arguments
+ *  y : A template state vector (of length n_blocks * block_size)
+ *  n_blocks : The number of blocks
+ *  block_size : The size of each block
+ *  sunctx : A sundials context (SUNDIALS 6 and newer only)
+ *
+ * Returns the new solver, or NULL if memory allocation failed.
+ */
+#if SUNDIALS_VERSION_MAJOR >= 6
+SUNLinearSolver
+BlockDiag_Create(N_Vector y, int n_blocks, int block_size, SUNContext sunctx)
+#else
+SUNLinearSolver
+BlockDiag_Create(N_Vector y, int n_blocks, int block_size)
+#endif
+{
+    SUNLinearSolver S;
+    BlockDiag content;
+    size_t n = (size_t)n_blocks * (size_t)block_size;
+
+    #if SUNDIALS_VERSION_MAJOR >= 6
+    S = SUNLinSolNewEmpty(sunctx);
+    #else
+    S = SUNLinSolNewEmpty();
+    #endif
+    if (S == NULL) return NULL;
+
+    S->ops->gettype = BlockDiag_GetType;
+    S->ops->getid = BlockDiag_GetID;
+    S->ops->setatimes = BlockDiag_SetATimes;
+    S->ops->setpreconditioner = BlockDiag_SetPreconditioner;
+    S->ops->initialize = BlockDiag_Initialize;
+    S->ops->setup = BlockDiag_Setup;
+    S->ops->solve = BlockDiag_Solve;
+    S->ops->numiters = BlockDiag_NumIters;
+    S->ops->lastflag = BlockDiag_LastFlag;
+    S->ops->space = BlockDiag_Space;
+    S->ops->free = BlockDiag_Free;
+
+    content = (BlockDiag)calloc(1, sizeof(struct BlockDiag_Content));
+    if (content == NULL) {
+        SUNLinSolFreeEmpty(S);
+        return NULL;
+    }
+    S->content = content;
+
+    content->n_blocks = n_blocks;
+    content->block_size = block_size;
+    content->gamma = 0;
+    content->jac = (double*)malloc(n * (size_t)block_size * sizeof(double));
+    content->lu = (double*)malloc(n * (size_t)block_size * sizeof(double));
+    content->pivots = (sunindextype*)malloc(n * sizeof(sunindextype));
+    content->ytmp = N_VClone(y);
+    content->ftmp = N_VClone(y);
+    content->ewt = N_VClone(y);
+    if (content->jac == NULL || content->lu == NULL || content->pivots == NULL
+            || content->ytmp == NULL || content->ftmp == NULL || content->ewt == NULL) {
+        BlockDiag_Free(S);
+        return NULL;
+    }
+    return S;
+}
+
+/*
+ * Evaluates the Jacobian blocks using finite differences, perturbing the j-th
+ * state of every block simultaneously. Increments are chosen as in CVODES'
+ * own difference-quotient Jacobians.
+ *
+ * Arguments
+ *  S : The block-diagonal solver
+ *  cvode_mem : The CVODES memory (used to obtain error weights and step size)
+ *  f : The rhs function
+ *  t : The current time
+ *  y : The current state
+ *  fy : The rhs evaluated at (t, y)
+ *  user_data : User data to pass to the rhs function
+ *
+ * Returns 0 on success, a positive value for recoverable errors, or a
+ * negative value for unrecoverable errors.
+ */
+int
+BlockDiag_Jacobian(SUNLinearSolver S, void* cvode_mem, CVRhsFn f, realtype t,
+                   N_Vector y, N_Vector fy, void* user_data)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    int b, i, j, m, n_blocks, flag;
+    realtype h, srur, fnorm, min_inc, inc;
+    realtype *y_data, *ytmp_data, *fy_data, *ftmp_data, *ewt_data, *jac;
+
+    n_blocks = content->n_blocks;
+    m = content->block_size;
+
+    if (CVodeGetErrWeights(cvode_mem, content->ewt) != CV_SUCCESS) return -1;
+    if (CVodeGetCurrentStep(cvode_mem, &h) != CV_SUCCESS) return -1;
+
+    y_data = N_VGetArrayPointer(y);
+    fy_data = N_VGetArrayPointer(fy);
+    ytmp_data = N_VGetArrayPointer(content->ytmp);
+    ftmp_data = N_VGetArrayPointer(content->ftmp);
+    ewt_data = N_VGetArrayPointer(content->ewt);
+
+    srur = sqrt(DBL_EPSILON);
+    fnorm = N_VWrmsNorm(fy, content->ewt);
+    min_inc = (fnorm != 0) ? (1000 * fabs(h) * DBL_EPSILON * (double)(n_blocks * m) * fnorm) : 1;
+
+    N_VScale(1, y, content->ytmp);
+    for (j=0; j<m; j++) {
+        // Perturb state j in every block
+        for (b=0; b<n_blocks; b++) {
+            i = b * m + j;
+            inc = fmax(srur * fabs(y_data[i]), min_inc / ewt_data[i]);
+            ytmp_data[i] = y_data[i] + inc;
+        }
+        flag = f(t, content->ytmp, content->ftmp, user_data);
+        content->n_rhs_evaluations++;
+        if (flag != 0) return flag;
+
+        // Store column j of every block, and restore state
+        for (b=0; b<n_blocks; b++) {
+            i = b * m + j;
+            inc = ytmp_data[i] - y_data[i];
+            jac = content->jac + (size_t)b * m * m;
+            for (i=0; i<m; i++) {
+                jac[i * m + j] = (ftmp_data[b * m + i] - fy_data[b * m + i]) / inc;
+            }
+            ytmp_data[b * m + j] = y_data[b * m + j];
+        }
+    }
+
+    content->n_jacobians++;
+    return 0;
+}
+
+/*
+ * Forms the iteration matrix blocks I - gamma * J and calculates their LU
+ * factorisations, using partial pivoting.
+ *
+ * Returns 0 on success, or 1 (a recoverable error) if any block is singular.
+ */
+int
+BlockDiag_Factor(SUNLinearSolver S, realtype gamma)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    int b, i, j, k, p, m;
+    double *lu, *jac, d, big;
+    sunindextype* piv;
+
+    m = content->block_size;
+    for (b=0; b<content->n_blocks; b++) {
+        lu = content->lu + (size_t)b * m * m;
+        jac = content->jac + (size_t)b * m * m;
+        piv = content->pivots + (size_t)b * m;
+
+        for (i=0; i<m*m; i++) lu[i] = -gamma * jac[i];
+        for (i=0; i<m; i++) lu[i * m + i] += 1;
+
+        for (k=0; k<m; k++) {
+            p = k;
+            big = fabs(lu[k * m + k]);
+            for (i=k+1; i<m; i++) {
+                if (fabs(lu[i * m + k]) > big) {
+                    big = fabs(lu[i * m + k]);
+                    p = i;
+                }
+            }
+            if (big == 0) return 1;
+            piv[k] = p;
+            if (p != k) {
+                for (j=0; j<m; j++) {
+                    d = lu[k * m + j]; lu[k * m + j] = lu[p * m + j]; lu[p * m + j] = d;
+                }
+            }
+            for (i=k+1; i<m; i++) {
+                d = lu[i * m + k] /= lu[k * m + k];
+                if (d != 0) {
+                    for (j=k+1; j<m; j++) lu[i * m + j] -= d * lu[k * m + j];
+                }
+            }
+        }
+    }
+    content->gamma = gamma;
+    return 0;
+}
+
+/*
+ * Preconditioner setup, to be called from a CVLsPrecSetupFn: re-evaluates the
+ * Jacobian unless CVODES indicates it can be reused (jok), then factors the
+ * iteration matrix.
+ *
+ * Returns 0 on success, a positive value for recoverable errors, or a
+ * negative value for unrecoverable errors.
+ */
+int
+BlockDiag_PSetup(SUNLinearSolver S, void* cvode_mem, CVRhsFn f, realtype t,
+                 N_Vector y, N_Vector fy, booleantype jok, booleantype* jcurPtr,
+                 realtype gamma, void* user_data)
+{
+    int flag;
+    if (jok) {
+        *jcurPtr = SUNFALSE;
+    } else {
+        flag = BlockDiag_Jacobian(S, cvode_mem, f, t, y, fy, user_data);
+        if (flag != 0) return flag;
+        *jcurPtr = SUNTRUE;
+    }
+    return BlockDiag_Factor(S, gamma);
+}
+
+/*
+ * Preconditioner solve, to be called from a CVLsPrecSolveFn: solves
+ * (I - gamma * J) z = r using the last factorisation, and scales the result to
+ * account for changes in gamma since that factorisation.
+ *
+ * Returns 0.
+ */
+int
+BlockDiag_PSolve(SUNLinearSolver S, N_Vector r, N_Vector z, realtype gamma)
+{
+    BlockDiag content = BlockDiag_CONTENT(S);
+    int b, i, j, m;
+    double *lu, *x, s;
+    sunindextype* piv;
+
+    m = content->block_size;
+    N_VScale(1, r, z);
+    for (b=0; b<content->n_blocks; b++) {
+        lu = content->lu + (size_t)b * m * m;
+        piv = content->pivots + (size_t)b * m;
+        x = N_VGetArrayPointer(z) + (size_t)b * m;
+
+        for (i=0; i<m; i++) {
+            j = (int)piv[i];
+            if (j != i) { s = x[i]; x[i] = x[j]; x[j] = s; }
+        }
+        for (i=1; i<m; i++) {
+            s = x[i];
+            for (j=0; j<i; j++) s -= lu[i * m + j] * x[j];
+            x[i] = s;
+        }
+        for (i=m-1; i>=0; i--) {
+            s = x[i];
+            for (j=i+1; j<m; j++) s -= lu[i * m + j] * x[j];
+            x[i] = s / lu[i * m + i];
+        }
+    }
+
+    if (gamma != content->gamma && content->gamma != 0) {
+        N_VScale(2.0 / (1.0 + gamma / content->gamma), z, z);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * codec.h
+ *
+ * Ansi-C implementation of a transform that prepares series of doubles for
+ * general purpose compression (e.g. with zlib).
+ *
+ * Simulation outputs are mostly smooth, so that consecutive values differ by
+ * small amounts. The transform exploits this in three steps:
+ *
+ *  1. Each value is mapped to a 64-bit integer. In lossless mode this is the
+ *     IEEE-754 bit pattern of the double, so that values are restored exactly.
+ *     In lossy mode, values are quantised to the nearest multiple of 2 * tol,
+ *     so that the absolute error after decoding is at most tol.
+ *  2. Each integer is replaced by its difference with the previous one (delta
+ *     coding), and the differences are zig-zag encoded so that small negative
+ *     and positive differences both become small unsigned integers.
+ *  3. The bytes are shuffled, so that all most-significant bytes are stored
+ *     first, followed by all second bytes, etc. As most high bytes are zero,
+ *     this creates long runs that compress very well.
+ *
+ * The output has the same size as the input (8 bytes per value). Each buffer
+ * is coded independently, so that data can be split into chunks that can be
+ * decoded separately.
+ *
+ * How to use:
+ *
+ *  1. Encode n values with Codec_Encode, into a buffer of 8 * n bytes
+ *  2. Compress the buffer, and store it with n and tol
+ *  3. To restore, decompress and call Codec_Decode with the same n and tol
+ *
+ * Flags are used to indicate errors. If a flag other than Codec_OK is set, a
+ * call to Codec_SetPyErr(flag) can be made to set a Python exception.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitCodec
+#define MyokitCodec
+
+#include <Python.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Codec error flags
+ */
+typedef int Codec_Flag;
+#define Codec_OK                            0
+#define Codec_INVALID_TOLERANCE            -1
+#define Codec_VALUE_OUT_OF_RANGE           -2
+
+/*
+ * Sets a python exception based on a codec error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+Codec_SetPyErr(Codec_Flag flag)
+{
+    switch(flag) {
+    case Codec_OK:
+        break;
+    case Codec_INVALID_TOLERANCE:
+        PyErr_SetString(PyExc_ValueError, "Codec error: Tolerance must be zero (lossless) or positive.");
+        break;
+    case Codec_VALUE_OUT_OF_RANGE:
+        PyErr_SetString(PyExc_ValueError, "Codec error: Lossy coding requires finite values, no larger than 2^62 times the tolerance.");
+        break;
+    default:
+        PyErr_Format(PyExc_Exception, "Codec error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/* Largest quantised value that can be delta coded without overflow */
+#define Codec_QMAX 4611686018427387904.0
+
+/*
+ * Encodes n doubles from x into 8 * n bytes in out.
+ *
+ * Arguments
+ *  x : The values to encode.
+ *  n : The number of values.
+ *  tol : The maximum absolute error, or 0 for lossless coding.
+ *  out : A buffer of at least 8 * n bytes.
+ *
+ * Returns a Codec_Flag.
+ */
+static Codec_Flag
+Codec_Encode(const double* x, size_t n, double tol, unsigned char* out)
+{
+    size_t i;
+    int b;
+    uint64_t q, d, prev;
+    double s;
+
+    if (!(tol >= 0)) return Codec_INVALID_TOLERANCE;
+    s = (tol > 0) ? 0.5 / tol : 0;
+
+    prev = 0;
+    for (i=0; i<n; i++) {
+        if (tol > 0) {
+            double r = floor(x[i] * s + 0.5);
+            if (!(fabs(r) < Codec_QMAX)) return Codec_VALUE_OUT_OF_RANGE;
+            q = (uint64_t)(int64_t)r;
+        } else {
+            memcpy(&q, x + i, 8);
+        }
+
+        /* Delta and zig-zag, using unsigned (wrapping) arithmetic */
+        d = q - prev;
+        prev = q;
+        d = (d << 1) ^ (0 - (d >> 63));
+
+        /* Shuffle, most significant byte first */
+        for (b=0; b<8; b++) {
+            out[b * n + i] = (unsigned char)(d >> (8 * (7 - b)));
+        }
+    }
+    return Codec_OK;
+}
+
+/*
+ * Decodes 8 * n bytes from data into n doubles in x.
+ *
+ * Arguments
+ *  data : The encoded bytes, as created by Codec_Encode.
+ *  n : The number of values.
+ *  tol : The tolerance used when encoding.
+ *  x : A buffer of at least n doubles.
+ *
+ * Returns a Codec_Flag.
+ */
+static Codec_Flag
+Codec_Decode(const unsigned char* data, size_t n, double tol, double* x)
+{
+    size_t i;
+    int b;
+    uint64_t q, d;
+
+    if (!(tol >= 0)) return Codec_INVALID_TOLERANCE;
+
+    q = 0;
+    for (i=0; i<n; i++) {
+        d = 0;
+        for (b=0; b<8; b++) {
+            d = (d << 8) | data[b * n + i];
+        }
+        d = (d >> 1) ^ (0 - (d & 1));
+        q += d;
+
+        if (tol > 0) {
+            x[i] = (double)(int64_t)q * 2 * tol;
+        } else {
+            memcpy(x + i, &q, 8);
+        }
+    }
+    return Codec_OK;
+}
+
+#undef Codec_QMAX
+
+#endif
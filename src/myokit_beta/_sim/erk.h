@@ -0,0 +1,622 @@
+/*
+ * erk.h
+ *
+ * Ansi-C implementation of an adaptive explicit Runge-Kutta solver, using the
+ * embedded 5(4) pair by Dormand and Prince [1] with the 4th order continuous
+ * extension described in [2] for dense output.
+ *
+ * This solver is intended for non-stiff models, where it can be considerably
+ * cheaper than CVODES' BDF method (which requires Newton iterations and linear
+ * solves).
+ *
+ * How to use:
+ *
+ *  1. Create a solver using ERK_Create
+ *  2. Set tolerances and step size bounds with ERK_SetTolerances and
+ *     ERK_SetStepSizeBounds
+ *  3. Set the initial time and state with ERK_Init
+ *  4. Now repeatedly
+ *    - Take a step with ERK_Step. This will never step beyond the given
+ *      stopping time, so that discontinuities (e.g. pacing events) can be
+ *      handled by stopping exactly at them.
+ *    - Use ERK_Interpolate to obtain the state at any time within the last
+ *      step (e.g. for logging or root finding).
+ *    - After any discontinuity (or any change to the state), call ERK_Init
+ *      again to restart the integration.
+ *  5. Tidy up using ERK_Destroy
+ *
+ * ERK_Step can be called without holding the GIL. In that case, the thread
+ * state returned by PyEval_SaveThread should be stored at an address passed
+ * to ERK_SetThreadState, so that the solver can re-acquire the GIL when it
+ * checks for signals (e.g. Ctrl-C).
+ *
+ * Flags are used to indicate errors. If a flag other than ERK_OK is set, a
+ * call to ERK_SetPyErr(flag) can be made to set a Python exception.
+ *
+ * [1] A family of embedded Runge-Kutta formulae. Dormand, Prince (1980)
+ *     Journal of Computational and Applied Mathematics.
+ * [2] Solving Ordinary Differential Equations I. Hairer, Norsett, Wanner
+ *     (1993) Springer.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitERK
+#define MyokitERK
+
+#include <Python.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Explicit Runge-Kutta error flags
+ */
+typedef int ERK_Flag;
+#define ERK_OK                              0
+#define ERK_OUT_OF_MEMORY                  -1
+// General
+#define ERK_INVALID_SOLVER                 -10
+#define ERK_UNINITIALISED_SOLVER           -11
+// ERK_SetTolerances, ERK_SetStepSizeBounds
+#define ERK_INVALID_TOLERANCE              -20
+#define ERK_INVALID_STEP_SIZE_BOUNDS       -21
+// ERK_Step
+#define ERK_RHS_FAIL                       -30
+#define ERK_STEP_SIZE_TOO_SMALL            -31
+#define ERK_INVALID_STOPPING_TIME          -32
+#define ERK_INTERRUPTED                    -33
+
+/*
+ * Sets a python exception based on an explicit Runge-Kutta error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+ERK_SetPyErr(ERK_Flag flag)
+{
+    switch(flag) {
+    case ERK_OK:
+        break;
+    case ERK_OUT_OF_MEMORY:
+        PyErr_SetString(PyExc_Exception, "ERK error: Memory allocation failed.");
+        break;
+    // General
+    case ERK_INVALID_SOLVER:
+        PyErr_SetString(PyExc_Exception, "ERK error: Invalid solver provided.");
+        break;
+    case ERK_UNINITIALISED_SOLVER:
+        PyErr_SetString(PyExc_Exception, "ERK error: Solver must be initialised with ERK_Init before stepping.");
+        break;
+    // Settings
+    case ERK_INVALID_TOLERANCE:
+        PyErr_SetString(PyExc_Exception, "ERK error: Tolerances must be positive.");
+        break;
+    case ERK_INVALID_STEP_SIZE_BOUNDS:
+        PyErr_SetString(PyExc_Exception, "ERK error: Step size bounds must be non-negative, and the minimum must not exceed the maximum.");
+        break;
+    // Stepping: Raised as arithmetic errors, which the user may be able to
+    // debug (same as CVODE's convergence and error test failures).
+    case ERK_RHS_FAIL:
+        /* Keep any exception set by the right-hand side function */
+        if (PyErr_Occurred() == NULL) {
+            PyErr_SetString(PyExc_ArithmeticError, "ERK error: The right-hand side function failed.");
+        }
+        break;
+    case ERK_STEP_SIZE_TOO_SMALL:
+        PyErr_SetString(PyExc_ArithmeticError, "ERK error: Error test failed with step size at or below the minimum step size.");
+        break;
+    case ERK_INVALID_STOPPING_TIME:
+        PyErr_SetString(PyExc_Exception, "ERK error: Stopping time must be greater than the current time.");
+        break;
+    case ERK_INTERRUPTED:
+        /* Keep the exception set by the signal handler (e.g. a
+           KeyboardInterrupt) */
+        break;
+    // Unknown
+    default:
+        PyErr_Format(PyExc_Exception, "ERK error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/*
+ * Right-hand side function used by the solver. Should calculate the
+ * derivatives at time t and state y, store them in ydot, and return 0 on
+ * success or a non-zero value on failure. If the function sets a Python
+ * exception before failing, this exception is kept by ERK_SetPyErr.
+ */
+typedef int (*ERK_RhsFn)(double t, double* y, double* ydot, void* user_data);
+
+/*
+ * Dormand-Prince 5(4) coefficients
+ */
+#define ERK_C2 (1.0 / 5.0)
+#define ERK_C3 (3.0 / 10.0)
+#define ERK_C4 (4.0 / 5.0)
+#define ERK_C5 (8.0 / 9.0)
+#define ERK_A21 (1.0 / 5.0)
+#define ERK_A31 (3.0 / 40.0)
+#define ERK_A32 (9.0 / 40.0)
+#define ERK_A41 (44.0 / 45.0)
+#define ERK_A42 (-56.0 / 15.0)
+#define ERK_A43 (32.0 / 9.0)
+#define ERK_A51 (19372.0 / 6561.0)
+#define ERK_A52 (-25360.0 / 2187.0)
+#define ERK_A53 (64448.0 / 6561.0)
+#define ERK_A54 (-212.0 / 729.0)
+#define ERK_A61 (9017.0 / 3168.0)
+#define ERK_A62 (-355.0 / 33.0)
+#define ERK_A63 (46732.0 / 5247.0)
+#define ERK_A64 (49.0 / 176.0)
+#define ERK_A65 (-5103.0 / 18656.0)
+#define ERK_A71 (35.0 / 384.0)
+#define ERK_A73 (500.0 / 1113.0)
+#define ERK_A74 (125.0 / 192.0)
+#define ERK_A75 (-2187.0 / 6784.0)
+#define ERK_A76 (11.0 / 84.0)
+// Error estimate: difference between 5th and 4th order solutions
+#define ERK_E1 (71.0 / 57600.0)
+#define ERK_E3 (-71.0 / 16695.0)
+#define ERK_E4 (71.0 / 1920.0)
+#define ERK_E5 (-17253.0 / 339200.0)
+#define ERK_E6 (22.0 / 525.0)
+#define ERK_E7 (-1.0 / 40.0)
+// Dense output
+#define ERK_D1 (-12715105075.0 / 11282082432.0)
+#define ERK_D3 (87487479700.0 / 32700410799.0)
+#define ERK_D4 (-10690763975.0 / 1880347072.0)
+#define ERK_D5 (701980252875.0 / 199316789632.0)
+#define ERK_D6 (-1453857185.0 / 822651844.0)
+#define ERK_D7 (69997945.0 / 29380423.0)
+
+/*
+ * Step size control
+ */
+#define ERK_SAFETY 0.9      // Safety factor for new step size
+#define ERK_FAC_MIN 0.2     // Minimum step size reduction factor
+#define ERK_FAC_MAX 10.0    // Maximum step size increase factor
+
+/*
+ * Explicit Runge-Kutta solver
+ */
+struct ERK_Mem {
+    int n;                  // The number of states
+    ERK_RhsFn f;            // The right-hand side function
+    void* user_data;        // User data passed to the rhs function
+    PyThreadState** thread_state;   // Saved thread state while the GIL is released, or NULL
+
+    double rtol;            // Relative tolerance
+    double atol;            // Absolute tolerance
+    double hmin;            // Minimum step size (or 0 for none)
+    double hmax;            // Maximum step size (or 0 for none)
+
+    int initialised;        // 1 if ERK_Init has been called
+    double t;               // The current time
+    double h;               // The proposed size of the next step
+    double* y;              // The current state
+    double* k;              // Stages k1 to k7, stored as a single 7*n array
+    double* ytmp;           // Temporary state for stage evaluations
+    double* ynew;           // Candidate state for the current step
+
+    double tprev;           // Start time of the last accepted step
+    double hprev;           // Size of the last accepted step
+    double* cont;           // Dense output coefficients, stored as a 5*n array
+
+    long n_steps;           // Number of accepted steps since creation
+    long n_rejected;        // Number of rejected steps since creation
+};
+typedef struct ERK_Mem* ERK;
+
+/*
+ * Creates an explicit Runge-Kutta solver.
+ *
+ * Arguments
+ *  n : The number of states
+ *  f : The right-hand side function
+ *  user_data : Extra data to pass to the rhs function, or NULL
+ *  flag : The address of an ERK error flag or NULL
+ *
+ * Returns the newly created solver
+ */
+ERK
+ERK_Create(int n, ERK_RhsFn f, void* user_data, ERK_Flag* flag)
+{
+    ERK erk = (ERK)malloc(sizeof(struct ERK_Mem));
+    if (erk == NULL) {
+        if (flag != 0) *flag = ERK_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    erk->n = n;
+    erk->f = f;
+    erk->user_data = user_data;
+    erk->thread_state = NULL;
+
+    erk->rtol = 1e-4;
+    erk->atol = 1e-6;
+    erk->hmin = 0;
+    erk->hmax = 0;
+
+    erk->initialised = 0;
+    erk->t = 0;
+    erk->h = 0;
+    erk->tprev = 0;
+    erk->hprev = 0;
+    erk->n_steps = 0;
+    erk->n_rejected = 0;
+
+    erk->y = (double*)malloc((size_t)n * sizeof(double));
+    erk->k = (double*)malloc(7 * (size_t)n * sizeof(double));
+    erk->ytmp = (double*)malloc((size_t)n * sizeof(double));
+    erk->ynew = (double*)malloc((size_t)n * sizeof(double));
+    erk->cont = (double*)malloc(5 * (size_t)n * sizeof(double));
+    if (erk->y == NULL || erk->k == NULL || erk->ytmp == NULL || erk->ynew == NULL || erk->cont == NULL) {
+        free(erk->y); free(erk->k); free(erk->ytmp); free(erk->ynew); free(erk->cont);
+        free(erk);
+        if (flag != 0) *flag = ERK_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    if (flag != 0) *flag = ERK_OK;
+    return erk;
+}
+
+/*
+ * Destroys an explicit Runge-Kutta solver and frees the memory it occupies.
+ *
+ * Arguments
+ *  erk : The solver to destroy
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_Destroy(ERK erk)
+{
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    free(erk->y);
+    free(erk->k);
+    free(erk->ytmp);
+    free(erk->ynew);
+    free(erk->cont);
+    free(erk);
+    return ERK_OK;
+}
+
+/*
+ * Returns the number of bytes allocated by a solver.
+ *
+ * Arguments
+ *  erk : The solver to check
+ */
+size_t
+ERK_GetMemoryUsage(ERK erk)
+{
+    if (erk == NULL) return 0;
+    return sizeof(struct ERK_Mem) + 15 * (size_t)erk->n * sizeof(double);
+}
+
+/*
+ * Sets the relative and absolute tolerance used in error control.
+ *
+ * Arguments
+ *  erk : The solver to update
+ *  rtol : The relative tolerance
+ *  atol : The absolute tolerance
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_SetTolerances(ERK erk, double rtol, double atol)
+{
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    if (rtol <= 0 || atol <= 0) return ERK_INVALID_TOLERANCE;
+    erk->rtol = rtol;
+    erk->atol = atol;
+    return ERK_OK;
+}
+
+/*
+ * Sets the minimum and maximum step size (use 0 for no bound).
+ *
+ * Arguments
+ *  erk : The solver to update
+ *  hmin : The minimum step size, or 0
+ *  hmax : The maximum step size, or 0
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_SetStepSizeBounds(ERK erk, double hmin, double hmax)
+{
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    if (hmin < 0 || hmax < 0) return ERK_INVALID_STEP_SIZE_BOUNDS;
+    if (hmax > 0 && hmin > hmax) return ERK_INVALID_STEP_SIZE_BOUNDS;
+    erk->hmin = hmin;
+    erk->hmax = hmax;
+    return ERK_OK;
+}
+
+/*
+ * Tells the solver where the caller stores its thread state while it has
+ * released the GIL (or NULL if the GIL is always held while stepping). When the
+ * solver needs the GIL, it re-acquires it if the stored thread state is not
+ * NULL, and releases it again afterwards.
+ *
+ * Arguments
+ *  erk : The solver to update
+ *  thread_state : The address of a thread state pointer, or NULL
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_SetThreadState(ERK erk, PyThreadState** thread_state)
+{
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    erk->thread_state = thread_state;
+    return ERK_OK;
+}
+
+/*
+ * Checks for signals, re-acquiring the GIL first if the caller released it.
+ * Returns non-zero if a signal handler raised an exception.
+ */
+static int
+ERK__CheckSignals(ERK erk)
+{
+    int flag;
+    PyThreadState* saved = (erk->thread_state == NULL) ? NULL : *(erk->thread_state);
+    if (saved != NULL) PyEval_RestoreThread(saved);
+    flag = PyErr_CheckSignals();
+    if (saved != NULL) *(erk->thread_state) = PyEval_SaveThread();
+    return flag;
+}
+
+/*
+ * Calculates the weighted root-mean-square norm of `v`, using the tolerances
+ * and the magnitudes of the states `y1` and `y2`.
+ */
+static double
+ERK__Norm(ERK erk, const double* v, const double* y1, const double* y2)
+{
+    int i;
+    double sk, r, sum = 0;
+    for (i=0; i<erk->n; i++) {
+        sk = erk->atol + erk->rtol * fmax(fabs(y1[i]), fabs(y2[i]));
+        r = v[i] / sk;
+        sum += r * r;
+    }
+    return sqrt(sum / (double)erk->n);
+}
+
+/*
+ * (Re)starts the integration at time `t0` and state `y0`.
+ *
+ * This evaluates the derivatives at the initial point, and (if no previous
+ * step size is known) estimates an initial step size. Must be called before
+ * the first step, and after any discontinuity in the rhs or the state.
+ *
+ * Arguments
+ *  erk : The solver to (re)initialise
+ *  t0 : The time to start at
+ *  y0 : The state to start at
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_Init(ERK erk, double t0, const double* y0)
+{
+    int i, n;
+    double d0, d1, d2, h0, h1;
+    double *k1, *k2;
+
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    n = erk->n;
+    k1 = erk->k;
+    k2 = erk->k + n;
+
+    erk->t = t0;
+    for (i=0; i<n; i++) erk->y[i] = y0[i];
+    if (erk->f(t0, erk->y, k1, erk->user_data) != 0) return ERK_RHS_FAIL;
+
+    // Last step is now the point t0
+    erk->tprev = t0;
+    erk->hprev = 0;
+    for (i=0; i<n; i++) {
+        erk->cont[i] = erk->y[i];
+        erk->cont[n + i] = 0;
+        erk->cont[2 * n + i] = 0;
+        erk->cont[3 * n + i] = 0;
+        erk->cont[4 * n + i] = 0;
+    }
+
+    // Estimate an initial step size, using the algorithm from [2], but only
+    // on the first call: when restarting after a discontinuity the previous
+    // proposed step size is a better guess.
+    if (erk->h <= 0) {
+        d0 = ERK__Norm(erk, erk->y, erk->y, erk->y);
+        d1 = ERK__Norm(erk, k1, erk->y, erk->y);
+        h0 = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+        if (erk->hmax > 0 && h0 > erk->hmax) h0 = erk->hmax;
+
+        // Explicit Euler step, to estimate second derivative
+        for (i=0; i<n; i++) erk->ytmp[i] = erk->y[i] + h0 * k1[i];
+        if (erk->f(t0 + h0, erk->ytmp, k2, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) erk->ynew[i] = k2[i] - k1[i];
+        d2 = ERK__Norm(erk, erk->ynew, erk->y, erk->y) / h0;
+
+        d1 = fmax(d1, d2);
+        h1 = (d1 <= 1e-15) ? fmax(1e-6, h0 * 1e-3) : pow(0.01 / d1, 0.2);
+        erk->h = fmin(100 * h0, h1);
+    }
+    if (erk->hmax > 0 && erk->h > erk->hmax) erk->h = erk->hmax;
+    if (erk->h < erk->hmin) erk->h = erk->hmin;
+
+    erk->initialised = 1;
+    return ERK_OK;
+}
+
+/*
+ * Takes a single (accepted) step, without stepping beyond `tstop`.
+ *
+ * Rejected steps are retried internally with a smaller step size, until a
+ * step is accepted or the step size drops below the minimum.
+ *
+ * Arguments
+ *  erk : The solver to step with
+ *  tstop : The time not to step beyond. Steps that would end very close to
+ *          tstop are stretched to end exactly at tstop.
+ *  tret : The address of a double to store the new time in
+ *  yret : An array to store the new state in, or NULL
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_Step(ERK erk, double tstop, double* tret, double* yret)
+{
+    int i, n, last;
+    double t, h, err, fac;
+    double *y, *yt, *yn, *k1, *k2, *k3, *k4, *k5, *k6, *k7;
+
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    if (!erk->initialised) return ERK_UNINITIALISED_SOLVER;
+    if (!(tstop > erk->t)) return ERK_INVALID_STOPPING_TIME;
+
+    n = erk->n;
+    t = erk->t;
+    y = erk->y;
+    yt = erk->ytmp;
+    yn = erk->ynew;
+    k1 = erk->k;
+    k2 = k1 + n;
+    k3 = k2 + n;
+    k4 = k3 + n;
+    k5 = k4 + n;
+    k6 = k5 + n;
+    k7 = k6 + n;
+
+    while (1) {
+
+        // Choose step size, stretching or shrinking it to hit tstop exactly
+        h = erk->h;
+        last = 0;
+        if (t + 1.01 * h >= tstop) {
+            h = tstop - t;
+            last = 1;
+        }
+        if (t + h == t) return ERK_STEP_SIZE_TOO_SMALL;
+
+        // Stages (k1 is known from the previous step or ERK_Init)
+        for (i=0; i<n; i++) yt[i] = y[i] + h * ERK_A21 * k1[i];
+        if (erk->f(t + ERK_C2 * h, yt, k2, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) yt[i] = y[i] + h * (ERK_A31 * k1[i] + ERK_A32 * k2[i]);
+        if (erk->f(t + ERK_C3 * h, yt, k3, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) yt[i] = y[i] + h * (ERK_A41 * k1[i] + ERK_A42 * k2[i] + ERK_A43 * k3[i]);
+        if (erk->f(t + ERK_C4 * h, yt, k4, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) yt[i] = y[i] + h * (ERK_A51 * k1[i] + ERK_A52 * k2[i] + ERK_A53 * k3[i] + ERK_A54 * k4[i]);
+        if (erk->f(t + ERK_C5 * h, yt, k5, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) yt[i] = y[i] + h * (ERK_A61 * k1[i] + ERK_A62 * k2[i] + ERK_A63 * k3[i] + ERK_A64 * k4[i] + ERK_A65 * k5[i]);
+        if (erk->f(t + h, yt, k6, erk->user_data) != 0) return ERK_RHS_FAIL;
+        for (i=0; i<n; i++) yn[i] = y[i] + h * (ERK_A71 * k1[i] + ERK_A73 * k3[i] + ERK_A74 * k4[i] + ERK_A75 * k5[i] + ERK_A76 * k6[i]);
+        if (erk->f(t + h, yn, k7, erk->user_data) != 0) return ERK_RHS_FAIL;
+
+        // Error estimate
+        for (i=0; i<n; i++) {
+            yt[i] = h * (ERK_E1 * k1[i] + ERK_E3 * k3[i] + ERK_E4 * k4[i] + ERK_E5 * k5[i] + ERK_E6 * k6[i] + ERK_E7 * k7[i]);
+        }
+        err = ERK__Norm(erk, yt, y, yn);
+
+        // New step size
+        fac = (err == 0) ? ERK_FAC_MAX : ERK_SAFETY * pow(err, -0.2);
+        fac = fmin(ERK_FAC_MAX, fmax(ERK_FAC_MIN, fac));
+
+        if (err <= 1.0 || (erk->hmin > 0 && h <= erk->hmin)) {
+            if (err > 1.0) {
+                // Error test failed at minimum step size
+                return ERK_STEP_SIZE_TOO_SMALL;
+            }
+
+            // Accepted: store dense output coefficients
+            for (i=0; i<n; i++) {
+                erk->cont[i] = y[i];
+                erk->cont[n + i] = yn[i] - y[i];
+                erk->cont[2 * n + i] = h * k1[i] - erk->cont[n + i];
+                erk->cont[3 * n + i] = erk->cont[n + i] - h * k7[i] - erk->cont[2 * n + i];
+                erk->cont[4 * n + i] = h * (ERK_D1 * k1[i] + ERK_D3 * k3[i] + ERK_D4 * k4[i] + ERK_D5 * k5[i] + ERK_D6 * k6[i] + ERK_D7 * k7[i]);
+            }
+            erk->tprev = t;
+            erk->hprev = h;
+
+            // Update time and state, re-use last stage as first (FSAL)
+            erk->t = last ? tstop : t + h;
+            for (i=0; i<n; i++) {
+                y[i] = yn[i];
+            }
+            for (i=0; i<n; i++) k1[i] = k7[i];
+
+            // Propose next step size (but don't let a shortened last step
+            // limit the next one)
+            if (!last || fac < 1) erk->h = h * fac;
+            if (erk->hmax > 0 && erk->h > erk->hmax) erk->h = erk->hmax;
+            if (erk->h < erk->hmin) erk->h = erk->hmin;
+            erk->n_steps++;
+            break;
+        }
+
+        // Rejected: retry with smaller step
+        erk->n_rejected++;
+        erk->h = h * fmin(1.0, fac);
+        if (erk->hmin > 0 && erk->h < erk->hmin) erk->h = erk->hmin;
+
+        // Allow interrupting if something goes wrong
+        if (ERK__CheckSignals(erk) != 0) {
+            return ERK_INTERRUPTED;
+        }
+    }
+
+    *tret = erk->t;
+    if (yret != NULL) {
+        for (i=0; i<n; i++) yret[i] = y[i];
+    }
+    return ERK_OK;
+}
+
+/*
+ * Evaluates the continuous extension of the last accepted step at time `t`.
+ *
+ * Accurate results are obtained for times within the last step; outside of
+ * this interval the interpolating polynomial is extrapolated.
+ *
+ * Arguments
+ *  erk : The solver to query
+ *  t : The time to evaluate the state at
+ *  yret : An array to store the interpolated state in
+ *
+ * Returns an ERK error flag.
+ */
+ERK_Flag
+ERK_Interpolate(ERK erk, double t, double* yret)
+{
+    int i, n;
+    double s, s1;
+
+    if (erk == NULL) return ERK_INVALID_SOLVER;
+    if (!erk->initialised) return ERK_UNINITIALISED_SOLVER;
+
+    n = erk->n;
+    if (erk->hprev == 0) {
+        for (i=0; i<n; i++) yret[i] = erk->cont[i];
+        return ERK_OK;
+    }
+
+    s = (t - erk->tprev) / erk->hprev;
+    s1 = 1.0 - s;
+    for (i=0; i<n; i++) {
+        yret[i] = erk->cont[i] + s * (erk->cont[n + i] + s1 * (erk->cont[2 * n + i] + s * (erk->cont[3 * n + i] + s1 * erk->cont[4 * n + i])));
+    }
+    return ERK_OK;
+}
+
+#endif
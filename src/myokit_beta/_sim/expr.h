@@ -0,0 +1,291 @@
+/*
+ * expr.h
+ *
+ * Ansi-C implementation of small compiled expressions, used to log quantities
+ * derived from model variables (e.g. a total current) without logging every
+ * variable they depend on.
+ *
+ * Expressions are compiled (in Python) to a program in postfix order, that is
+ * evaluated on a small stack. The program is a list of tuples (op, arg), where
+ * op is one of the Expr_ operation codes below and arg is
+ *
+ *   - a float, for Expr_NUMBER,
+ *   - a variable name, for Expr_VARIABLE,
+ *   - None for all other operations.
+ *
+ * Variable names are resolved once, when the expression is created, into
+ * pointers to the values they refer to. Evaluating an expression then only
+ * reads through these pointers.
+ *
+ * How to use:
+ *
+ *  1. Create an expression with Expr_Create, passing in a function that maps
+ *     variable names to pointers
+ *  2. Evaluate it with Expr_Evaluate whenever the variables have been updated
+ *  3. Tidy up using Expr_Destroy
+ *
+ * Flags are used to indicate errors. If a flag other than Expr_OK is set, a
+ * call to Expr_SetPyErr(flag) can be made to set a Python exception.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitExpr
+#define MyokitExpr
+
+#include <Python.h>
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Expression error flags
+ */
+typedef int Expr_Flag;
+#define Expr_OK                             0
+#define Expr_OUT_OF_MEMORY                 -1
+#define Expr_INVALID_PROGRAM               -2
+#define Expr_UNKNOWN_VARIABLE              -3
+
+/*
+ * Operation codes, must match those in _expr.py
+ */
+#define Expr_NUMBER         0   /* Push a number */
+#define Expr_VARIABLE       1   /* Push the value of a variable */
+#define Expr_PLUS           2   /* Binary operations: pop b, pop a, push a @ b */
+#define Expr_MINUS          3
+#define Expr_MULTIPLY       4
+#define Expr_DIVIDE         5
+#define Expr_POWER          6
+#define Expr_NEGATE         7   /* Unary operations: pop a, push f(a) */
+#define Expr_EXP            8
+#define Expr_LOG            9
+#define Expr_LOG10          10
+#define Expr_SQRT           11
+#define Expr_ABS            12
+#define Expr_SIN            13
+#define Expr_COS            14
+#define Expr_TAN            15
+#define Expr_ASIN           16
+#define Expr_ACOS           17
+#define Expr_ATAN           18
+#define Expr_FLOOR          19
+#define Expr_CEIL           20
+#define Expr_N_OPS          21
+
+/*
+ * Sets a python exception based on an expression error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+Expr_SetPyErr(Expr_Flag flag)
+{
+    switch(flag) {
+    case Expr_OK:
+        break;
+    case Expr_OUT_OF_MEMORY:
+        PyErr_SetString(PyExc_Exception, "Expr error: Memory allocation failed.");
+        break;
+    case Expr_INVALID_PROGRAM:
+        PyErr_SetString(PyExc_ValueError, "Expr error: Invalid expression program.");
+        break;
+    case Expr_UNKNOWN_VARIABLE:
+        PyErr_SetString(PyExc_ValueError, "Expr error: Unknown variable in expression.");
+        break;
+    default:
+        PyErr_Format(PyExc_Exception, "Expr error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/*
+ * Function used to resolve variable names: returns a pointer to the value of
+ * the named variable, or NULL if not found.
+ */
+typedef const double* (*Expr_Lookup)(void* context, const char* name);
+
+/*
+ * A single instruction.
+ */
+typedef struct Expr_Instruction {
+    int op;
+    double number;              /* The number, for Expr_NUMBER */
+    const double* variable;     /* The variable, for Expr_VARIABLE */
+} Expr_Instruction;
+
+/*
+ * Expression memory
+ */
+typedef struct Expr_Mem {
+    Py_ssize_t n;               /* The number of instructions */
+    Expr_Instruction* program;  /* The instructions */
+    Py_ssize_t depth;           /* The maximum stack depth */
+    double* stack;              /* The stack */
+} *Expr;
+
+/*
+ * Frees the memory used by an expression.
+ */
+static void
+Expr_Destroy(Expr expr)
+{
+    if (expr == NULL) return;
+    free(expr->program);
+    free(expr->stack);
+    free(expr);
+}
+
+/*
+ * Creates an expression from a program.
+ *
+ * Arguments
+ *  program : A Python sequence of tuples (op, arg), in postfix order.
+ *  lookup : A function to resolve variable names with.
+ *  context : A pointer passed to lookup.
+ *  flag : Address to store an expression flag in (or NULL).
+ *
+ * Returns an Expr, or NULL on failure.
+ */
+static Expr
+Expr_Create(PyObject* program, Expr_Lookup lookup, void* context, Expr_Flag* flag)
+{
+    Expr expr;
+    Expr_Instruction* ins;
+    PyObject *item, *arg;
+    Py_ssize_t i, depth;
+    int op;
+
+    if (flag != NULL) *flag = Expr_OK;
+    if (!PySequence_Check(program) || PySequence_Size(program) < 1) {
+        if (flag != NULL) *flag = Expr_INVALID_PROGRAM;
+        return NULL;
+    }
+
+    expr = (Expr)malloc(sizeof(struct Expr_Mem));
+    if (expr == NULL) {
+        if (flag != NULL) *flag = Expr_OUT_OF_MEMORY;
+        return NULL;
+    }
+    expr->n = PySequence_Size(program);
+    expr->depth = 0;
+    expr->stack = NULL;
+    expr->program = (Expr_Instruction*)malloc((size_t)expr->n * sizeof(Expr_Instruction));
+    if (expr->program == NULL) {
+        Expr_Destroy(expr);
+        if (flag != NULL) *flag = Expr_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    /* Read instructions, and check the stack never underflows */
+    depth = 0;
+    for (i=0; i<expr->n; i++) {
+        ins = expr->program + i;
+        item = PySequence_GetItem(program, i); /* New reference */
+        if (item == NULL || !PyTuple_Check(item) || PyTuple_Size(item) != 2) {
+            Py_XDECREF(item);
+            PyErr_Clear();
+            Expr_Destroy(expr);
+            if (flag != NULL) *flag = Expr_INVALID_PROGRAM;
+            return NULL;
+        }
+        op = (int)PyLong_AsLong(PyTuple_GetItem(item, 0));
+        arg = PyTuple_GetItem(item, 1);
+        ins->op = op;
+        ins->number = 0;
+        ins->variable = NULL;
+
+        if (op == Expr_NUMBER && PyFloat_Check(arg)) {
+            ins->number = PyFloat_AsDouble(arg);
+            depth++;
+        } else if (op == Expr_VARIABLE && PyUnicode_Check(arg)) {
+            ins->variable = lookup(context, PyUnicode_AsUTF8(arg));
+            if (ins->variable == NULL) {
+                Py_DECREF(item);
+                Expr_Destroy(expr);
+                if (flag != NULL) *flag = Expr_UNKNOWN_VARIABLE;
+                return NULL;
+            }
+            depth++;
+        } else if (op >= Expr_PLUS && op <= Expr_POWER && depth >= 2) {
+            depth--;
+        } else if (op >= Expr_NEGATE && op < Expr_N_OPS && depth >= 1) {
+            /* Depth unchanged */
+        } else {
+            Py_DECREF(item);
+            PyErr_Clear();
+            Expr_Destroy(expr);
+            if (flag != NULL) *flag = Expr_INVALID_PROGRAM;
+            return NULL;
+        }
+        Py_DECREF(item);
+        if (depth > expr->depth) expr->depth = depth;
+    }
+
+    /* A complete program leaves a single value */
+    if (depth != 1) {
+        Expr_Destroy(expr);
+        if (flag != NULL) *flag = Expr_INVALID_PROGRAM;
+        return NULL;
+    }
+
+    expr->stack = (double*)malloc((size_t)expr->depth * sizeof(double));
+    if (expr->stack == NULL) {
+        Expr_Destroy(expr);
+        if (flag != NULL) *flag = Expr_OUT_OF_MEMORY;
+        return NULL;
+    }
+    return expr;
+}
+
+/*
+ * Evaluates an expression, using the current values of its variables.
+ */
+static double
+Expr_Evaluate(Expr expr)
+{
+    Py_ssize_t i;
+    double* s = expr->stack - 1;    /* Points to the top of the stack */
+    const Expr_Instruction* ins = expr->program;
+
+    for (i=0; i<expr->n; i++, ins++) {
+        switch(ins->op) {
+        case Expr_NUMBER:   *(++s) = ins->number; break;
+        case Expr_VARIABLE: *(++s) = *(ins->variable); break;
+        case Expr_PLUS:     s--; *s += s[1]; break;
+        case Expr_MINUS:    s--; *s -= s[1]; break;
+        case Expr_MULTIPLY: s--; *s *= s[1]; break;
+        case Expr_DIVIDE:   s--; *s /= s[1]; break;
+        case Expr_POWER:    s--; *s = pow(*s, s[1]); break;
+        case Expr_NEGATE:   *s = -*s; break;
+        case Expr_EXP:      *s = exp(*s); break;
+        case Expr_LOG:      *s = log(*s); break;
+        case Expr_LOG10:    *s = log10(*s); break;
+        case Expr_SQRT:     *s = sqrt(*s); break;
+        case Expr_ABS:      *s = fabs(*s); break;
+        case Expr_SIN:      *s = sin(*s); break;
+        case Expr_COS:      *s = cos(*s); break;
+        case Expr_TAN:      *s = tan(*s); break;
+        case Expr_ASIN:     *s = asin(*s); break;
+        case Expr_ACOS:     *s = acos(*s); break;
+        case Expr_ATAN:     *s = atan(*s); break;
+        case Expr_FLOOR:    *s = floor(*s); break;
+        case Expr_CEIL:     *s = ceil(*s); break;
+        }
+    }
+    return *s;
+}
+
+/*
+ * Returns the number of bytes used by an expression.
+ */
+static size_t
+Expr_GetMemoryUsage(Expr expr)
+{
+    if (expr == NULL) return 0;
+    return sizeof(struct Expr_Mem) + (size_t)expr->n * sizeof(Expr_Instruction)
+        + (size_t)expr->depth * sizeof(double);
+}
+
+#endif
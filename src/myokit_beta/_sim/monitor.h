@@ -0,0 +1,310 @@
+/*
+ * monitor.h
+ *
+ * Publishes the output of a running simulation in a named POSIX shared memory
+ * segment, so that it can be watched from another process.
+ *
+ * The segment contains a fixed-size header, followed by the current state, a
+ * ring buffer with the most recently logged rows, and a list of column names:
+ *
+ *   Header         Monitor_Header (see below)
+ *   State          n_states doubles
+ *   Ring buffer    capacity rows of n_columns doubles
+ *   Names          names_size bytes: column names, separated by newlines
+ *
+ * All integers and doubles are stored in the native byte order.
+ *
+ * Updates are protected by a sequence lock: the writer increments the `seq`
+ * field before and after every update, so that it is odd while an update is
+ * in progress. Readers copy what they need, and retry if `seq` was odd or
+ * changed while reading. The writer never waits for readers.
+ *
+ * How to use:
+ *
+ *  1. Create a monitor with Monitor_Create
+ *  2. Add logged rows with Monitor_AppendRow, and update the state with
+ *     Monitor_SetState
+ *  3. Tidy up using Monitor_Destroy. This marks the output as finished and
+ *     unlinks the segment: readers that are attached can still read the final
+ *     data, but no new readers can attach.
+ *
+ * Shared memory is only supported on POSIX systems, and requires GCC or
+ * Clang (for atomic operations). On other platforms Monitor_Create returns
+ * Monitor_UNSUPPORTED.
+ *
+ * Flags are used to indicate errors. If a flag other than Monitor_OK is set,
+ * a call to Monitor_SetPyErr(flag) can be made to set a Python exception.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitMonitor
+#define MyokitMonitor
+
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__unix__) || defined(__APPLE__)) && (defined(__GNUC__) || defined(__clang__))
+    #define Monitor_SUPPORTED
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+/*
+ * Monitor error flags
+ */
+typedef int Monitor_Flag;
+#define Monitor_OK                          0
+#define Monitor_OUT_OF_MEMORY              -1
+#define Monitor_UNSUPPORTED                -2
+#define Monitor_INVALID_NAME               -3
+#define Monitor_SHM_FAILED                 -4
+#define Monitor_NAME_IN_USE                -5
+
+/*
+ * Sets a python exception based on a monitor error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+Monitor_SetPyErr(Monitor_Flag flag)
+{
+    switch(flag) {
+    case Monitor_OK:
+        break;
+    case Monitor_OUT_OF_MEMORY:
+        PyErr_SetString(PyExc_Exception, "Monitor error: Memory allocation failed.");
+        break;
+    case Monitor_UNSUPPORTED:
+        PyErr_SetString(PyExc_Exception, "Monitor error: Shared memory output is not supported on this platform.");
+        break;
+    case Monitor_INVALID_NAME:
+        PyErr_SetString(PyExc_ValueError, "Monitor error: Invalid shared memory name.");
+        break;
+    case Monitor_SHM_FAILED:
+        PyErr_SetString(PyExc_OSError, "Monitor error: Unable to create shared memory segment.");
+        break;
+    case Monitor_NAME_IN_USE:
+        PyErr_SetString(PyExc_FileExistsError, "Monitor error: A shared memory segment with this name already exists (it may be in use by another simulation).");
+        break;
+    default:
+        PyErr_Format(PyExc_Exception, "Monitor error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/* Magic bytes at the start of the segment, including a format version */
+#define Monitor_MAGIC "MYOKMON1"
+
+/*
+ * Header of the shared memory segment. Every field is 8 bytes, so that the
+ * layout is the same on all 64-bit platforms.
+ */
+typedef struct Monitor_Header {
+    char magic[8];          /* Monitor_MAGIC */
+    uint64_t seq;           /* Sequence lock, odd while an update is written */
+    uint64_t running;       /* 1 while the simulation is running, 0 after */
+    uint64_t n_states;      /* The number of doubles in the state block */
+    uint64_t n_columns;     /* The number of doubles per logged row */
+    uint64_t capacity;      /* The number of rows in the ring buffer */
+    uint64_t names_size;    /* The number of bytes in the names block */
+    uint64_t n_rows;        /* The total number of rows appended so far */
+    double time;            /* The simulation time of the current state */
+} Monitor_Header;
+
+/*
+ * Monitor memory
+ */
+typedef struct Monitor_Mem {
+    char* name;             /* The segment name, including a leading slash */
+    size_t size;            /* The size of the segment in bytes */
+    Monitor_Header* header; /* The mapped segment */
+    double* state;          /* The state block */
+    double* rows;           /* The ring buffer */
+} *Monitor;
+
+#ifdef Monitor_SUPPORTED
+
+/* Marks the start of an update */
+static void
+Monitor__Begin(Monitor m)
+{
+    __atomic_store_n(&m->header->seq, m->header->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* Marks the end of an update */
+static void
+Monitor__End(Monitor m)
+{
+    __atomic_store_n(&m->header->seq, m->header->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+/*
+ * Returns the number of bytes needed for a segment.
+ */
+static size_t
+Monitor__Size(size_t n_states, size_t n_columns, size_t capacity, size_t names_size)
+{
+    return sizeof(struct Monitor_Header) + sizeof(double) * (n_states + n_columns * capacity) + names_size;
+}
+
+/*
+ * Creates and maps a new shared memory segment. Fails with
+ * Monitor_NAME_IN_USE if a segment with the same name already exists, so that
+ * a segment that is still being published or read is never detached.
+ *
+ * Arguments
+ *  name : The segment name, without a leading slash (as used by Python's
+ *         multiprocessing.shared_memory module).
+ *  n_states : The number of state values to publish.
+ *  n_columns : The number of values in each logged row.
+ *  capacity : The number of rows to keep in the ring buffer.
+ *  names : A newline-separated list of column names (may be NULL).
+ *  flag : Address to store a monitor flag in (or NULL).
+ *
+ * Returns a Monitor, or NULL on failure.
+ */
+static Monitor
+Monitor_Create(const char* name, size_t n_states, size_t n_columns, size_t capacity, const char* names, Monitor_Flag* flag)
+{
+#ifdef Monitor_SUPPORTED
+    Monitor m;
+    size_t names_size;
+    int fd;
+    void* p;
+
+    if (name == NULL || name[0] == '\0' || name[0] == '/' || strchr(name, '/') != NULL) {
+        if (flag != NULL) *flag = Monitor_INVALID_NAME;
+        return NULL;
+    }
+    if (capacity < 1) capacity = 1;
+    names_size = (names == NULL) ? 0 : strlen(names);
+
+    m = (Monitor)malloc(sizeof(struct Monitor_Mem));
+    if (m == NULL) {
+        if (flag != NULL) *flag = Monitor_OUT_OF_MEMORY;
+        return NULL;
+    }
+    m->name = (char*)malloc(strlen(name) + 2);
+    if (m->name == NULL) {
+        free(m);
+        if (flag != NULL) *flag = Monitor_OUT_OF_MEMORY;
+        return NULL;
+    }
+    m->name[0] = '/';
+    strcpy(m->name + 1, name);
+    m->size = Monitor__Size(n_states, n_columns, capacity, names_size);
+
+    /* Create segment */
+    fd = shm_open(m->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        if (flag != NULL) *flag = (errno == EEXIST) ? Monitor_NAME_IN_USE : Monitor_SHM_FAILED;
+        free(m->name); free(m);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)m->size) != 0) {
+        close(fd);
+        shm_unlink(m->name);
+        free(m->name); free(m);
+        if (flag != NULL) *flag = Monitor_SHM_FAILED;
+        return NULL;
+    }
+    p = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(m->name);
+        free(m->name); free(m);
+        if (flag != NULL) *flag = Monitor_SHM_FAILED;
+        return NULL;
+    }
+
+    /* Set up header (the segment is zero-filled by ftruncate) */
+    m->header = (Monitor_Header*)p;
+    m->state = (double*)(m->header + 1);
+    m->rows = m->state + n_states;
+    m->header->running = 1;
+    m->header->n_states = n_states;
+    m->header->n_columns = n_columns;
+    m->header->capacity = capacity;
+    m->header->names_size = names_size;
+    if (names_size) memcpy(m->rows + n_columns * capacity, names, names_size);
+
+    /* Write magic last, so readers don't see a half-initialised header */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(m->header->magic, Monitor_MAGIC, 8);
+
+    if (flag != NULL) *flag = Monitor_OK;
+    return m;
+#else
+    if (flag != NULL) *flag = Monitor_UNSUPPORTED;
+    return NULL;
+#endif
+}
+
+/*
+ * Marks the output as finished, unmaps and unlinks the segment, and frees
+ * the monitor's memory.
+ */
+static void
+Monitor_Destroy(Monitor m)
+{
+    if (m == NULL) return;
+#ifdef Monitor_SUPPORTED
+    Monitor__Begin(m);
+    m->header->running = 0;
+    Monitor__End(m);
+    munmap((void*)m->header, m->size);
+    shm_unlink(m->name);
+#endif
+    free(m->name);
+    free(m);
+}
+
+/*
+ * Appends a row of logged values to the ring buffer.
+ *
+ * Arguments
+ *  m : The monitor.
+ *  values : An array of n_columns pointers to the values to publish.
+ */
+static void
+Monitor_AppendRow(Monitor m, double* const* values)
+{
+#ifdef Monitor_SUPPORTED
+    size_t i, n;
+    double* row;
+    n = m->header->n_columns;
+    row = m->rows + n * (m->header->n_rows % m->header->capacity);
+    Monitor__Begin(m);
+    for (i=0; i<n; i++) row[i] = *values[i];
+    m->header->n_rows++;
+    Monitor__End(m);
+#endif
+}
+
+/*
+ * Updates the published state and time.
+ */
+static void
+Monitor_SetState(Monitor m, double time, const double* state)
+{
+#ifdef Monitor_SUPPORTED
+    Monitor__Begin(m);
+    memcpy(m->state, state, sizeof(double) * m->header->n_states);
+    m->header->time = time;
+    Monitor__End(m);
+#endif
+}
+
+#undef Monitor_MAGIC
+
+#endif
@@ -0,0 +1,659 @@
+/*
+ * networksolver.h
+ *
+ * A custom SUNDIALS linear solver for CVODES, for small networks of coupled
+ * cells (pairs, strands, or small clusters) that are integrated as one large
+ * ODE system.
+ *
+ * The state vector consists of each cell's states in turn, and cells are
+ * coupled by a graph of edges (e.g. gap junctions). The sparsity of the
+ * Jacobian follows from this: each cell has a dense block, and each edge (i, j)
+ * adds a block coupling cell i to cell j and vice versa.
+ *
+ * To keep fill-in small, the cells are first renumbered using the reverse
+ * Cuthill-McKee ordering of the coupling graph. In this ordering the Jacobian
+ * is a band matrix, with a half-bandwidth of cell_size * (w + 1) - 1, where w
+ * is the largest distance between two coupled cells in the new ordering. For
+ * a strand of cells w = 1, whatever way the cells are numbered by the user.
+ * The iteration matrix is then factored with a banded LU decomposition with
+ * partial pivoting.
+ *
+ * The Jacobian is approximated with finite differences. Cells are coloured so
+ * that no two cells of the same colour share a neighbour, after which the j-th
+ * state of every cell in a colour can be perturbed at once. As a result only
+ * cell_size * n_colours evaluations of the full right-hand side are needed.
+ *
+ * As with the block-diagonal solver (see blocksolver.h) the solver registers
+ * itself with CVODES as an "iterative" solver with an exact preconditioner.
+ *
+ * How to use:
+ *
+ *  1. Create a linear solver using Network_Create
+ *  2. Attach it to CVODES with CVodeSetLinearSolver (passing NULL as matrix)
+ *  3. Call CVodeSetPreconditioner with two functions that forward to
+ *     Network_PSetup and Network_PSolve
+ *  4. Tidy up using SUNLinSolFree
+ *
+ * Requires SUNDIALS 5.0 or newer.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitNetworkSolver
+#define MyokitNetworkSolver
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <cvodes/cvodes.h>
+#include <nvector/nvector_serial.h>
+#include <sundials/sundials_linearsolver.h>
+
+#if SUNDIALS_VERSION_MAJOR >= 6
+    #define Network_ATimesFn SUNATimesFn
+    #define Network_PSetupFn SUNPSetupFn
+    #define Network_PSolveFn SUNPSolveFn
+    #define Network_PREC_LEFT SUN_PREC_LEFT
+#else
+    #define Network_ATimesFn ATimesFn
+    #define Network_PSetupFn PSetupFn
+    #define Network_PSolveFn PSolveFn
+    #define Network_PREC_LEFT PREC_LEFT
+#endif
+
+/*
+ * Network solver content
+ */
+struct Network_Content {
+    int n_cells;            // The number of cells
+    int cell_size;          // The number of states per cell
+    int n;                  // The size of the system
+
+    int* adj_start;         // Neighbours of cell i are adj[adj_start[i]:adj_start[i + 1]]
+    int* adj;               // Neighbour lists for every cell
+    int* order;             // order[k] is the cell placed at position k
+    int* position;          // position[i] is the position of cell i
+    int* colours;           // The colour of each cell
+    int n_colours;          // The number of colours
+
+    int ml;                 // Lower half-bandwidth
+    int mu;                 // Upper half-bandwidth
+    int smu;                // Upper half-bandwidth of the factorisation (mu + ml)
+    int ldim;               // Length of each stored column (smu + ml + 1)
+
+    double* jac;            // Jacobian in band storage, in the permuted ordering
+    double* lu;             // LU factorisation of the iteration matrix
+    sunindextype* pivots;   // Row pivots for the LU factorisation
+    double* work;           // Permuted vector, used when solving
+    double gamma;           // The gamma used in the last factorisation
+
+    N_Vector ytmp;          // Perturbed state, for finite differences
+    N_Vector ftmp;          // Perturbed derivatives, for finite differences
+    N_Vector ewt;           // Error weights, for finite differences
+
+    void* P_data;           // Preconditioner data, passed in by CVODES
+    Network_PSetupFn Psetup;    // Preconditioner setup, passed in by CVODES
+    Network_PSolveFn Psolve;    // Preconditioner solve, passed in by CVODES
+
+    long n_jacobians;       // Number of Jacobian evaluations
+    long n_rhs_evaluations; // Number of rhs evaluations used for Jacobians
+    sunindextype last_flag; // Last error flag
+};
+typedef struct Network_Content* Network;
+
+#define Network_CONTENT(S) ((Network)(S->content))
+
+/* Entry (i, j) of a matrix in band storage, where i and j are permuted indices */
+#define Network_ELEM(content, a, i, j) a[(size_t)(j) * (content)->ldim + (i) - (j) + (content)->smu]
+
+/* Permuted index of state s of cell c */
+#define Network_INDEX(content, c, s) ((content)->position[c] * (content)->cell_size + (s))
+
+/*
+ * Linear solver operations
+ */
+static SUNLinearSolver_Type
+Network_GetType(SUNLinearSolver S)
+{
+    return SUNLINEARSOLVER_ITERATIVE;
+}
+
+static SUNLinearSolver_ID
+Network_GetID(SUNLinearSolver S)
+{
+    return SUNLINEARSOLVER_CUSTOM;
+}
+
+static int
+Network_SetATimes(SUNLinearSolver S, void* A_data, Network_ATimesFn ATimes)
+{
+    // Required by CVODES for iterative solvers, but not used
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_SetPreconditioner(SUNLinearSolver S, void* P_data, Network_PSetupFn Psetup, Network_PSolveFn Psolve)
+{
+    Network_CONTENT(S)->P_data = P_data;
+    Network_CONTENT(S)->Psetup = Psetup;
+    Network_CONTENT(S)->Psolve = Psolve;
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_Initialize(SUNLinearSolver S)
+{
+    Network_CONTENT(S)->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_Setup(SUNLinearSolver S, SUNMatrix A)
+{
+    Network content = Network_CONTENT(S);
+    int flag;
+    if (content->Psetup == NULL) {
+        content->last_flag = SUNLS_PSET_FAIL_UNREC;
+        return SUNLS_PSET_FAIL_UNREC;
+    }
+    flag = content->Psetup(content->P_data);
+    if (flag != 0) {
+        content->last_flag = (flag < 0) ? SUNLS_PSET_FAIL_UNREC : SUNLS_PSET_FAIL_REC;
+        return content->last_flag;
+    }
+    content->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_Solve(SUNLinearSolver S, SUNMatrix A, N_Vector x, N_Vector b, realtype tol)
+{
+    Network content = Network_CONTENT(S);
+    int flag;
+    if (content->Psolve == NULL) {
+        content->last_flag = SUNLS_PSOLVE_FAIL_UNREC;
+        return SUNLS_PSOLVE_FAIL_UNREC;
+    }
+    flag = content->Psolve(content->P_data, b, x, tol, Network_PREC_LEFT);
+    if (flag != 0) {
+        content->last_flag = (flag < 0) ? SUNLS_PSOLVE_FAIL_UNREC : SUNLS_PSOLVE_FAIL_REC;
+        return content->last_flag;
+    }
+    content->last_flag = SUNLS_SUCCESS;
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_NumIters(SUNLinearSolver S)
+{
+    return 0;
+}
+
+static sunindextype
+Network_LastFlag(SUNLinearSolver S)
+{
+    return Network_CONTENT(S)->last_flag;
+}
+
+static int
+Network_Space(SUNLinearSolver S, long int* lenrw, long int* leniw)
+{
+    Network content = Network_CONTENT(S);
+    *lenrw = 2 * (long)content->n * content->ldim + 4 * (long)content->n;
+    *leniw = (long)content->n + 5 * (long)content->n_cells + content->adj_start[content->n_cells];
+    return SUNLS_SUCCESS;
+}
+
+static int
+Network_Free(SUNLinearSolver S)
+{
+    Network content;
+    if (S == NULL) return SUNLS_SUCCESS;
+    content = Network_CONTENT(S);
+    if (content != NULL) {
+        free(content->adj_start);
+        free(content->adj);
+        free(content->order);
+        free(content->position);
+        free(content->colours);
+        free(content->jac);
+        free(content->lu);
+        free(content->pivots);
+        free(content->work);
+        if (content->ytmp != NULL) N_VDestroy(content->ytmp);
+        if (content->ftmp != NULL) N_VDestroy(content->ftmp);
+        if (content->ewt != NULL) N_VDestroy(content->ewt);
+        free(content);
+        S->content = NULL;
+    }
+    SUNLinSolFreeEmpty(S);
+    return SUNLS_SUCCESS;
+}
+
+/*
+ * Degree of cell i in the coupling graph.
+ */
+static int
+Network__Degree(Network content, int i)
+{
+    return content->adj_start[i + 1] - content->adj_start[i];
+}
+
+/*
+ * Calculates a reverse Cuthill-McKee ordering of the cells, storing it in
+ * content->order and content->position.
+ */
+static void
+Network__Order(Network content)
+{
+    int n_cells = content->n_cells;
+    int head, tail, i, j, k, a, b, start;
+    int* visited = content->position;   // Used as scratch space until the end
+
+    for (i=0; i<n_cells; i++) visited[i] = 0;
+
+    head = tail = 0;
+    while (tail < n_cells) {
+        // Start each connected component at an unvisited cell of minimal degree
+        start = -1;
+        for (i=0; i<n_cells; i++) {
+            if (!visited[i] && (start < 0 || Network__Degree(content, i) < Network__Degree(content, start))) {
+                start = i;
+            }
+        }
+        visited[start] = 1;
+        content->order[tail++] = start;
+
+        // Breadth-first search, adding neighbours in order of increasing degree
+        while (head < tail) {
+            i = content->order[head++];
+            a = tail;
+            for (k=content->adj_start[i]; k<content->adj_start[i + 1]; k++) {
+                j = content->adj[k];
+                if (!visited[j]) {
+                    visited[j] = 1;
+                    // Insertion sort on degree
+                    for (b=tail; b>a && Network__Degree(content, content->order[b - 1]) > Network__Degree(content, j); b--) {
+                        content->order[b] = content->order[b - 1];
+                    }
+                    content->order[b] = j;
+                    tail++;
+                }
+            }
+        }
+    }
+
+    // Reverse
+    for (i=0; i<n_cells/2; i++) {
+        j = content->order[i];
+        content->order[i] = content->order[n_cells - 1 - i];
+        content->order[n_cells - 1 - i] = j;
+    }
+    for (i=0; i<n_cells; i++) content->position[content->order[i]] = i;
+}
+
+/*
+ * Colours the cells so that cells with the same colour are never neighbours,
+ * and never have a neighbour in common. Cells are visited in the order set by
+ * Network__Order, which for strands and grids gives near-optimal colourings.
+ *
+ * Returns 0 on success, or 1 if memory allocation failed.
+ */
+static int
+Network__Colour(Network content)
+{
+    int q, i, j, k, l, c;
+    int* used = (int*)calloc((size_t)content->n_cells + 1, sizeof(int));
+    if (used == NULL) return 1;
+
+    content->n_colours = 0;
+    for (i=0; i<content->n_cells; i++) content->colours[i] = -1;
+    for (q=0; q<content->n_cells; q++) {
+        i = content->order[q];
+        // Mark colours used within a distance of 2 (using i + 1 as marker)
+        for (k=content->adj_start[i]; k<content->adj_start[i + 1]; k++) {
+            j = content->adj[k];
+            if (content->colours[j] >= 0) used[content->colours[j]] = i + 1;
+            for (l=content->adj_start[j]; l<content->adj_start[j + 1]; l++) {
+                c = content->colours[content->adj[l]];
+                if (c >= 0) used[c] = i + 1;
+            }
+        }
+        for (c=0; used[c] == i + 1; c++);
+        content->colours[i] = c;
+        if (c >= content->n_colours) content->n_colours = c + 1;
+    }
+    free(used);
+    return 0;
+}
+
+/*
+ * Creates a network linear solver.
+ *
+ * Arguments
+ *  y : A template state vector (of length n_cells * cell_size)
+ *  n_cells : The number of cells
+ *  cell_size : The number of states in each cell
+ *  n_edges : The number of edges in the coupling graph
+ *  edge_i : The first cell of each edge
+ *  edge_j : The second cell of each edge
+ *  sunctx : A sundials context (SUNDIALS 6 and newer only)
+ *
+ * Edges are undirected, and all cell indices must be valid.
+ *
+ * Returns the new solver, or NULL if memory allocation failed.
+ */
+#if SUNDIALS_VERSION_MAJOR >= 6
+SUNLinearSolver
+Network_Create(N_Vector y, int n_cells, int cell_size, int n_edges, const int* edge_i, const int* edge_j, SUNContext sunctx)
+#else
+SUNLinearSolver
+Network_Create(N_Vector y, int n_cells, int cell_size, int n_edges, const int* edge_i, const int* edge_j)
+#endif
+{
+    SUNLinearSolver S;
+    Network content;
+    int i, k, w;
+
+    #if SUNDIALS_VERSION_MAJOR >= 6
+    S = SUNLinSolNewEmpty(sunctx);
+    #else
+    S = SUNLinSolNewEmpty();
+    #endif
+    if (S == NULL) return NULL;
+
+    S->ops->gettype = Network_GetType;
+    S->ops->getid = Network_GetID;
+    S->ops->setatimes = Network_SetATimes;
+    S->ops->setpreconditioner = Network_SetPreconditioner;
+    S->ops->initialize = Network_Initialize;
+    S->ops->setup = Network_Setup;
+    S->ops->solve = Network_Solve;
+    S->ops->numiters = Network_NumIters;
+    S->ops->lastflag = Network_LastFlag;
+    S->ops->space = Network_Space;
+    S->ops->free = Network_Free;
+
+    content = (Network)calloc(1, sizeof(struct Network_Content));
+    if (content == NULL) {
+        SUNLinSolFreeEmpty(S);
+        return NULL;
+    }
+    S->content = content;
+
+    content->n_cells = n_cells;
+    content->cell_size = cell_size;
+    content->n = n_cells * cell_size;
+    content->gamma = 0;
+
+    // Create adjacency lists
+    content->adj_start = (int*)calloc((size_t)n_cells + 1, sizeof(int));
+    content->adj = (int*)malloc((size_t)(2 * n_edges + 1) * sizeof(int));
+    content->order = (int*)malloc((size_t)n_cells * sizeof(int));
+    content->position = (int*)malloc((size_t)n_cells * sizeof(int));
+    content->colours = (int*)malloc((size_t)n_cells * sizeof(int));
+    if (content->adj_start == NULL || content->adj == NULL || content->order == NULL
+            || content->position == NULL || content->colours == NULL) {
+        Network_Free(S);
+        return NULL;
+    }
+    for (k=0; k<n_edges; k++) {
+        content->adj_start[edge_i[k] + 1]++;
+        content->adj_start[edge_j[k] + 1]++;
+    }
+    for (i=0; i<n_cells; i++) content->adj_start[i + 1] += content->adj_start[i];
+    for (i=0; i<n_cells; i++) content->position[i] = content->adj_start[i];
+    for (k=0; k<n_edges; k++) {
+        content->adj[content->position[edge_i[k]]++] = edge_j[k];
+        content->adj[content->position[edge_j[k]]++] = edge_i[k];
+    }
+
+    // Reorder and colour
+    Network__Order(content);
+    if (Network__Colour(content)) {
+        Network_Free(S);
+        return NULL;
+    }
+
+    // Determine bandwidth
+    w = 0;
+    for (k=0; k<n_edges; k++) {
+        i = abs(content->position[edge_i[k]] - content->position[edge_j[k]]);
+        if (i > w) w = i;
+    }
+    content->ml = content->mu = cell_size * (w + 1) - 1;
+    content->smu = content->mu + content->ml;
+    content->ldim = content->smu + content->ml + 1;
+
+    content->jac = (double*)malloc((size_t)content->n * (size_t)content->ldim * sizeof(double));
+    content->lu = (double*)malloc((size_t)content->n * (size_t)content->ldim * sizeof(double));
+    content->pivots = (sunindextype*)malloc((size_t)content->n * sizeof(sunindextype));
+    content->work = (double*)malloc((size_t)content->n * sizeof(double));
+    content->ytmp = N_VClone(y);
+    content->ftmp = N_VClone(y);
+    content->ewt = N_VClone(y);
+    if (content->jac == NULL || content->lu == NULL || content->pivots == NULL || content->work == NULL
+            || content->ytmp == NULL || content->ftmp == NULL || content->ewt == NULL) {
+        Network_Free(S);
+        return NULL;
+    }
+    return S;
+}
+
+/*
+ * Evaluates the Jacobian using finite differences, perturbing the j-th state
+ * of every cell of the same colour simultaneously. Increments are chosen as in
+ * CVODES' own difference-quotient Jacobians.
+ *
+ * Arguments
+ *  S : The network solver
+ *  cvode_mem : The CVODES memory (used to obtain error weights and step size)
+ *  f : The rhs function
+ *  t : The current time
+ *  y : The current state
+ *  fy : The rhs evaluated at (t, y)
+ *  user_data : User data to pass to the rhs function
+ *
+ * Returns 0 on success, a positive value for recoverable errors, or a
+ * negative value for unrecoverable errors.
+ */
+int
+Network_Jacobian(SUNLinearSolver S, void* cvode_mem, CVRhsFn f, realtype t,
+                 N_Vector y, N_Vector fy, void* user_data)
+{
+    Network content = Network_CONTENT(S);
+    int c, d, i, j, k, m, colour, flag;
+    sunindextype col;
+    realtype h, srur, fnorm, min_inc, inc;
+    realtype *y_data, *ytmp_data, *fy_data, *ftmp_data, *ewt_data;
+
+    m = content->cell_size;
+
+    if (CVodeGetErrWeights(cvode_mem, content->ewt) != CV_SUCCESS) return -1;
+    if (CVodeGetCurrentStep(cvode_mem, &h) != CV_SUCCESS) return -1;
+
+    y_data = N_VGetArrayPointer(y);
+    fy_data = N_VGetArrayPointer(fy);
+    ytmp_data = N_VGetArrayPointer(content->ytmp);
+    ftmp_data = N_VGetArrayPointer(content->ftmp);
+    ewt_data = N_VGetArrayPointer(content->ewt);
+
+    srur = sqrt(DBL_EPSILON);
+    fnorm = N_VWrmsNorm(fy, content->ewt);
+    min_inc = (fnorm != 0) ? (1000 * fabs(h) * DBL_EPSILON * (double)content->n * fnorm) : 1;
+
+    for (k=0; k<content->n * content->ldim; k++) content->jac[k] = 0;
+
+    N_VScale(1, y, content->ytmp);
+    for (colour=0; colour<content->n_colours; colour++) {
+        for (j=0; j<m; j++) {
+            // Perturb state j in every cell with this colour
+            for (c=0; c<content->n_cells; c++) {
+                if (content->colours[c] != colour) continue;
+                i = c * m + j;
+                inc = fmax(srur * fabs(y_data[i]), min_inc / ewt_data[i]);
+                ytmp_data[i] = y_data[i] + inc;
+            }
+            flag = f(t, content->ytmp, content->ftmp, user_data);
+            content->n_rhs_evaluations++;
+            if (flag != 0) return flag;
+
+            // Store the column for each cell and its neighbours, and restore state
+            for (c=0; c<content->n_cells; c++) {
+                if (content->colours[c] != colour) continue;
+                inc = ytmp_data[c * m + j] - y_data[c * m + j];
+                col = Network_INDEX(content, c, j);
+                for (i=0; i<m; i++) {
+                    Network_ELEM(content, content->jac, Network_INDEX(content, c, i), col) =
+                        (ftmp_data[c * m + i] - fy_data[c * m + i]) / inc;
+                }
+                for (k=content->adj_start[c]; k<content->adj_start[c + 1]; k++) {
+                    d = content->adj[k];
+                    for (i=0; i<m; i++) {
+                        Network_ELEM(content, content->jac, Network_INDEX(content, d, i), col) =
+                            (ftmp_data[d * m + i] - fy_data[d * m + i]) / inc;
+                    }
+                }
+                ytmp_data[c * m + j] = y_data[c * m + j];
+            }
+        }
+    }
+
+    content->n_jacobians++;
+    return 0;
+}
+
+/*
+ * Forms the iteration matrix I - gamma * J and calculates its banded LU
+ * factorisation, using partial pivoting.
+ *
+ * Returns 0 on success, or 1 (a recoverable error) if the matrix is singular.
+ */
+int
+Network_Factor(SUNLinearSolver S, realtype gamma)
+{
+    Network content = Network_CONTENT(S);
+    int i, j, k, p, n, last, jlast;
+    double *lu, d, big;
+
+    n = content->n;
+    lu = content->lu;
+    for (k=0; k<n * content->ldim; k++) lu[k] = -gamma * content->jac[k];
+    for (k=0; k<n; k++) Network_ELEM(content, lu, k, k) += 1;
+
+    for (k=0; k<n; k++) {
+        last = (k + content->ml < n - 1) ? k + content->ml : n - 1;
+        jlast = (k + content->smu < n - 1) ? k + content->smu : n - 1;
+
+        p = k;
+        big = fabs(Network_ELEM(content, lu, k, k));
+        for (i=k+1; i<=last; i++) {
+            if (fabs(Network_ELEM(content, lu, i, k)) > big) {
+                big = fabs(Network_ELEM(content, lu, i, k));
+                p = i;
+            }
+        }
+        if (big == 0) return 1;
+        content->pivots[k] = p;
+        if (p != k) {
+            for (j=k; j<=jlast; j++) {
+                d = Network_ELEM(content, lu, k, j);
+                Network_ELEM(content, lu, k, j) = Network_ELEM(content, lu, p, j);
+                Network_ELEM(content, lu, p, j) = d;
+            }
+        }
+        d = Network_ELEM(content, lu, k, k);
+        for (i=k+1; i<=last; i++) Network_ELEM(content, lu, i, k) /= d;
+        for (j=k+1; j<=jlast; j++) {
+            d = Network_ELEM(content, lu, k, j);
+            if (d != 0) {
+                for (i=k+1; i<=last; i++) {
+                    Network_ELEM(content, lu, i, j) -= Network_ELEM(content, lu, i, k) * d;
+                }
+            }
+        }
+    }
+    content->gamma = gamma;
+    return 0;
+}
+
+/*
+ * Preconditioner setup, to be called from a CVLsPrecSetupFn: re-evaluates the
+ * Jacobian unless CVODES indicates it can be reused (jok), then factors the
+ * iteration matrix.
+ *
+ * Returns 0 on success, a positive value for recoverable errors, or a
+ * negative value for unrecoverable errors.
+ */
+int
+Network_PSetup(SUNLinearSolver S, void* cvode_mem, CVRhsFn f, realtype t,
+               N_Vector y, N_Vector fy, booleantype jok, booleantype* jcurPtr,
+               realtype gamma, void* user_data)
+{
+    int flag;
+    if (jok) {
+        *jcurPtr = SUNFALSE;
+    } else {
+        flag = Network_Jacobian(S, cvode_mem, f, t, y, fy, user_data);
+        if (flag != 0) return flag;
+        *jcurPtr = SUNTRUE;
+    }
+    return Network_Factor(S, gamma);
+}
+
+/*
+ * Preconditioner solve, to be called from a CVLsPrecSolveFn: solves
+ * (I - gamma * J) z = r using the last factorisation, and scales the result to
+ * account for changes in gamma since that factorisation.
+ *
+ * Returns 0.
+ */
+int
+Network_PSolve(SUNLinearSolver S, N_Vector r, N_Vector z, realtype gamma)
+{
+    Network content = Network_CONTENT(S);
+    int c, i, k, p, n, m, first, last;
+    double *x, *lu, s;
+    realtype *r_data, *z_data;
+
+    n = content->n;
+    m = content->cell_size;
+    x = content->work;
+    lu = content->lu;
+    r_data = N_VGetArrayPointer(r);
+    z_data = N_VGetArrayPointer(z);
+
+    // Permute
+    for (c=0; c<content->n_cells; c++) {
+        for (i=0; i<m; i++) x[Network_INDEX(content, c, i)] = r_data[c * m + i];
+    }
+
+    // Solve L y = P x
+    for (k=0; k<n; k++) {
+        p = (int)content->pivots[k];
+        if (p != k) { s = x[k]; x[k] = x[p]; x[p] = s; }
+        last = (k + content->ml < n - 1) ? k + content->ml : n - 1;
+        for (i=k+1; i<=last; i++) x[i] -= Network_ELEM(content, lu, i, k) * x[k];
+    }
+
+    // Solve U x = y
+    for (k=n-1; k>=0; k--) {
+        x[k] /= Network_ELEM(content, lu, k, k);
+        first = (k - content->smu > 0) ? k - content->smu : 0;
+        for (i=first; i<k; i++) x[i] -= Network_ELEM(content, lu, i, k) * x[k];
+    }
+
+    // Undo permutation
+    for (c=0; c<content->n_cells; c++) {
+        for (i=0; i<m; i++) z_data[c * m + i] = x[Network_INDEX(content, c, i)];
+    }
+
+    if (gamma != content->gamma && content->gamma != 0) {
+        N_VScale(2.0 / (1.0 + gamma / content->gamma), z, z);
+    }
+    return 0;
+}
+
+#endif
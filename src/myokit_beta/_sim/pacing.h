@@ -2,7 +2,8 @@
  * pacing.h
  *
  * Ansi-C implementation for event-based pacing (using a Myokit Protocol
- * object) and fixed-form pacing (using a time-series).
+ * object), fixed-form pacing (using a time-series), and analytic pacing
+ * (using a sum of parameterised waveforms).
  *
  * How to use event-based pacing:
  *
@@ -15,10 +16,32 @@
  *    - Advance the system to the simulation time with ESys_AdvanceTime
  *    - Get the time of the next event start or finish with ESys_GetNextTime
  *    - Get the pacing level using ESys_GetLevel
+ *    - Optionally, check if a new event has started by comparing the count
+ *      returned by ESys_GetFiredCount to its previous value, and get the
+ *      start time of the latest event with ESys_GetFiredTime
  *  7. Tidy up using ESys_Destroy
  *
  * Events must always start at t>=0, negative times are not supported.
  *
+ * How to use merged event-based pacing:
+ *
+ * When several event-based systems are used, they can be merged into a single
+ * timeline of changes, so that advancing the pacing at each step only needs
+ * to check a single upcoming change.
+ *
+ *  1. Create, populate, and advance each ESys to the initial time, and get
+ *     the initial levels, as above
+ *  2. Create a merged system using MSys_Create. From this point on, the
+ *     ESys objects are used to generate the timeline, and should not be
+ *     advanced or queried by the caller
+ *  3. Now at each step of a simulation
+ *    - Advance the system with MSys_AdvanceTime, which updates the levels of
+ *      all systems that changed
+ *    - Get the time of the next change with MSys_GetNextTime
+ *    - Optionally, use MSys_GetFiredCount and MSys_GetFiredTime to detect
+ *      events starting in any of the merged systems
+ *  4. Tidy up using MSys_Destroy, and then destroy the ESys objects
+ *
  * Flags are used to indicate errors. If a flag other than ESys_OK is set, a
  * call to ESys_SetPyErr(flag) can be made to set a Python exception.
  *
@@ -26,9 +49,73 @@
  * How to use fixed-form pacing:
  *
  *  1. Create a pacing system using FSys_Create
- *  2. Populate it using two Python lists via FSys_Populate
- *  3. Obtain the pacing value for any time using FSys_GetLevel
- *  4. Tidy up using FSys_Destroy
+ *  2. Optionally, select an interpolation method with FSys_SetInterpolation,
+ *     and a simplification tolerance with FSys_SetTolerance
+ *  3. Optionally, use FSys_SetPeriod to repeat the data periodically
+ *  4. Populate it using two Python lists via FSys_Populate, or from a binary
+ *     file via FSys_PopulateFromFile
+ *  5. Obtain the pacing value for any time using FSys_GetLevel
+ *  6. Use FSys_GetNextTime to find the next point where the level can jump
+ *     (with zero-order hold interpolation, or at the start of a repeat), so
+ *     that the solver can stop there
+ *  7. Tidy up using FSys_Destroy
+ *
+ * Three interpolation methods are supported: linear interpolation (the
+ * default), zero-order hold (each value is used until the next time point),
+ * and monotone piecewise cubic (Fritsch-Butland, or PCHIP) interpolation,
+ * which has a continuous first derivative and does not overshoot the data.
+ * For cubic interpolation, the polynomial coefficients are calculated when the
+ * system is populated.
+ *
+ * Periodic systems repeat the data every `period` time units, starting from
+ * the first time point, either indefinitely or for a fixed number of repeats,
+ * after which the level at the end of the period is held. The data itself is
+ * stored only once, and times are mapped into the first period when looking
+ * up levels. Points after the end of the first period are only used to
+ * interpolate up to its end.
+ *
+ * With linear interpolation, lists can be simplified when the system is
+ * populated, by removing points (using the Ramer-Douglas-Peucker algorithm)
+ * until removing any more would change the interpolated level by more than a
+ * given tolerance. This reduces memory use, lookup cost, and the number of
+ * kinks the solver has to step through.
+ *
+ * Binary time-series files are memory-mapped instead of read, so that only the
+ * parts accessed during a simulation are paged in. This allows inputs larger
+ * than the available memory to be used (except with cubic interpolation,
+ * which stores coefficients for every interval). The file format is:
+ *
+ *   Magic          8 bytes: FSys_FILE_MAGIC
+ *   Size           An unsigned 64-bit integer n
+ *   Times          n doubles, non-decreasing
+ *   Values         n doubles
+ *
+ * All numbers are stored in the native byte order. Memory-mapping is only
+ * supported on POSIX systems.
+ *
+ *
+ * How to use analytic pacing:
+ *
+ *  1. Create a pacing system using ASys_Create
+ *  2. Populate it with components using ASys_Populate
+ *  3. Obtain the pacing value for any time using ASys_GetLevel
+ *  4. Use ASys_GetNextTime to find the next time a component starts or stops,
+ *     so that the solver can stop there
+ *  5. Tidy up using ASys_Destroy
+ *
+ * The level is the sum of all components active at the given time. Each
+ * component is active from its start time up to (but not including) its start
+ * time plus its duration, and has one of the forms below, where tau is the
+ * time since the component started:
+ *
+ *   Constant       a
+ *   Ramp           a + b * tau
+ *   Sine           a * sin(2 * pi * b * tau + c)
+ *   Exponential    a * exp(-tau / b)
+ *   Chirp          a * sin(2 * pi * (b * tau + c * tau^2 / 2) + d)
+ *
+ * Within a component the level is smooth, so the only points where its
+ * derivatives can jump are the start and end times of the components.
  *
  * This file is part of Myokit.
  * See http://myokit.org for copyright, sharing, and licensing details.
@@ -39,8 +126,17 @@
 
 #include <Python.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <float.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+    #define FSys_MMAP_SUPPORTED
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
 /*
  * Event-based pacing error flags
  */
@@ -225,6 +321,8 @@ struct ESys_Mem {
     double tnext;   // The time of the next event start or finish
     double tdown;   // The time the active event is over
     double level;   // The current output value
+    long n_fired;   // The number of events started so far
+    double tfired;  // The start time of the last event to start
 };
 typedef struct ESys_Mem* ESys;
 
@@ -253,6 +351,8 @@ ESys_Create(ESys_Flag* flag)
     sys->tnext = 0;
     sys->tdown = 0;
     sys->level = 0;
+    sys->n_fired = 0;
+    sys->tfired = 0;
 
     if(flag != 0) *flag = ESys_OK;
     return sys;
@@ -278,6 +378,20 @@ ESys_Destroy(ESys sys)
     return ESys_OK;
 }
 
+/*
+ * Returns the number of bytes allocated by a pacing system.
+ *
+ * Arguments
+ *  sys : The event-based pacing system to check
+ */
+size_t
+ESys_GetMemoryUsage(ESys sys)
+{
+    if (sys == NULL) return 0;
+    if (sys->events == NULL) return sizeof(struct ESys_Mem);
+    return sizeof(struct ESys_Mem) + (size_t)sys->n_events * sizeof(struct ESys_Event_mem);
+}
+
 /*
  * Resets this pacing system to time=0.
  *
@@ -321,6 +435,8 @@ ESys_Reset(ESys sys)
     sys->tnext = 0;
     sys->tdown = 0;
     sys->level = 0;
+    sys->n_fired = 0;
+    sys->tfired = 0;
 
     return ESys_OK;
 }
@@ -506,6 +622,8 @@ ESys_AdvanceTime(ESys sys, double new_time)
             sys->head = sys->head->next;
             sys->tdown = sys->fire->start + sys->fire->duration;
             sys->level = sys->fire->level;
+            sys->n_fired++;
+            sys->tfired = sys->fire->start;
 
             /* Reschedule recurring event */
             if (sys->fire->period > 0) {
@@ -594,6 +712,310 @@ ESys_GetLevel(ESys sys, ESys_Flag* flag)
     return sys->level;
 }
 
+/*
+ * Returns the number of events started since the system was created or reset.
+ *
+ * Arguments
+ *  sys : The pacing system to query
+ *  flag : The address of a pacing error flag or NULL
+ *
+ * Returns the number of started events
+ */
+long
+ESys_GetFiredCount(ESys sys, ESys_Flag* flag)
+{
+    if(sys == 0) {
+        if(flag != 0) *flag = ESys_INVALID_SYSTEM;
+        return -1;
+    }
+    if(sys->n_events < 0) {
+        if(flag != 0) *flag = ESys_UNPOPULATED_SYSTEM;
+        return -1;
+    }
+    if(flag != 0) *flag = ESys_OK;
+    return sys->n_fired;
+}
+
+/*
+ * Returns the start time of the most recently started event (or 0 if no
+ * events have started).
+ *
+ * Arguments
+ *  sys : The pacing system to query
+ *  flag : The address of a pacing error flag or NULL
+ *
+ * Returns the start time of the latest event
+ */
+double
+ESys_GetFiredTime(ESys sys, ESys_Flag* flag)
+{
+    if(sys == 0) {
+        if(flag != 0) *flag = ESys_INVALID_SYSTEM;
+        return -1;
+    }
+    if(sys->n_events < 0) {
+        if(flag != 0) *flag = ESys_UNPOPULATED_SYSTEM;
+        return -1;
+    }
+    if(flag != 0) *flag = ESys_OK;
+    return sys->tfired;
+}
+
+/*
+ * A change in the level of a single event-based pacing system.
+ */
+struct MSys_Change {
+    double time;    // The time of the change
+    double level;   // The new pacing level
+    int index;      // The index of the system whose level changes
+    int fired;      // 1 if an event started at this time, 0 if not
+};
+
+/*
+ * Changes are computed in chunks of this size, so that the memory used does
+ * not grow with the simulation duration.
+ */
+#define MSys_CHUNK 1024
+
+/*
+ * Merged event-based pacing system
+ */
+struct MSys_Mem {
+    int n_systems;      // The number of systems (including unmerged ones)
+    ESys* systems;      // The systems to merge (NULL for unmerged ones)
+    double tmax;        // The final time to compute changes for
+    struct MSys_Change* changes;    // The next chunk of changes
+    size_t n_changes;   // The number of changes in the current chunk
+    size_t pos;         // The index of the next change to apply
+    int exhausted;      // 1 if all changes up to tmax have been computed
+    long* n_fired;      // The number of events started in each system
+    double* tfired;     // The start time of the last event in each system
+};
+typedef struct MSys_Mem* MSys;
+
+/*
+ * Destroys a merged pacing system (but not the systems it merged).
+ *
+ * Arguments
+ *  sys : The merged pacing system to destroy
+ *
+ * Returns a pacing error flag.
+ */
+ESys_Flag
+MSys_Destroy(MSys sys)
+{
+    if(sys == NULL) return ESys_INVALID_SYSTEM;
+    free(sys->systems);
+    free(sys->changes);
+    free(sys->n_fired);
+    free(sys->tfired);
+    free(sys);
+    return ESys_OK;
+}
+
+/*
+ * Creates a merged pacing system.
+ *
+ * Arguments
+ *  n : The number of pacing systems
+ *  systems : An array of n event-based pacing systems, all advanced to the
+ *            same initial time. Entries may be NULL, e.g. for indices used by
+ *            fixed-form pacing systems.
+ *  tmax : The final simulation time.
+ *  flag : The address of an event-based pacing error flag or NULL
+ *
+ * Returns the newly created merged pacing system
+ */
+MSys
+MSys_Create(int n, ESys* systems, double tmax, ESys_Flag* flag)
+{
+    int i;
+    MSys sys = (MSys)malloc(sizeof(struct MSys_Mem));
+    if (sys == 0) {
+        if(flag != 0) *flag = ESys_OUT_OF_MEMORY;
+        return 0;
+    }
+    sys->n_systems = n;
+    sys->tmax = tmax;
+    sys->n_changes = 0;
+    sys->pos = 0;
+    sys->exhausted = 0;
+    sys->systems = (ESys*)malloc((size_t)(n > 0 ? n : 1) * sizeof(ESys));
+    sys->changes = (struct MSys_Change*)malloc(MSys_CHUNK * sizeof(struct MSys_Change));
+    sys->n_fired = (long*)malloc((size_t)(n > 0 ? n : 1) * sizeof(long));
+    sys->tfired = (double*)malloc((size_t)(n > 0 ? n : 1) * sizeof(double));
+    if (sys->systems == 0 || sys->changes == 0 || sys->n_fired == 0 || sys->tfired == 0) {
+        MSys_Destroy(sys);
+        if(flag != 0) *flag = ESys_OUT_OF_MEMORY;
+        return 0;
+    }
+    for (i=0; i<n; i++) {
+        if (systems[i] != NULL && systems[i]->n_events < 0) {
+            MSys_Destroy(sys);
+            if(flag != 0) *flag = ESys_UNPOPULATED_SYSTEM;
+            return 0;
+        }
+        sys->systems[i] = systems[i];
+        sys->n_fired[i] = 0;
+        sys->tfired[i] = 0;
+    }
+
+    if(flag != 0) *flag = ESys_OK;
+    return sys;
+}
+
+/*
+ * Returns the number of bytes allocated by a merged pacing system (not
+ * including the systems it merges).
+ *
+ * Arguments
+ *  sys : The merged pacing system to check
+ */
+size_t
+MSys_GetMemoryUsage(MSys sys)
+{
+    if (sys == NULL) return 0;
+    return sizeof(struct MSys_Mem) + MSys_CHUNK * sizeof(struct MSys_Change)
+        + (size_t)sys->n_systems * (sizeof(ESys) + sizeof(long) + sizeof(double));
+}
+
+/*
+ * Computes the next chunk of changes, by repeatedly advancing the system with
+ * the earliest next event start or finish.
+ *
+ * Returns a pacing error flag.
+ */
+static ESys_Flag
+MSys__Fill(MSys sys)
+{
+    int i, best;
+    long fired;
+    double tbest;
+    ESys e;
+    ESys_Flag flag;
+    struct MSys_Change* c;
+
+    sys->n_changes = 0;
+    sys->pos = 0;
+    while (sys->n_changes < MSys_CHUNK) {
+        best = -1;
+        tbest = HUGE_VAL;
+        for (i=0; i<sys->n_systems; i++) {
+            if (sys->systems[i] != NULL && sys->systems[i]->tnext < tbest) {
+                best = i;
+                tbest = sys->systems[i]->tnext;
+            }
+        }
+        if (best < 0 || !ESys_geq(sys->tmax, tbest)) {
+            sys->exhausted = 1;
+            break;
+        }
+
+        e = sys->systems[best];
+        fired = e->n_fired;
+        flag = ESys_AdvanceTime(e, tbest);
+        if (flag != ESys_OK) return flag;
+
+        c = sys->changes + sys->n_changes;
+        c->time = tbest;
+        c->level = e->level;
+        c->index = best;
+        c->fired = (e->n_fired != fired);
+        sys->n_changes++;
+    }
+    return ESys_OK;
+}
+
+/*
+ * Advances a merged pacing system to the given time, and stores the new
+ * levels of any systems that changed.
+ *
+ * Arguments
+ *  sys : The merged pacing system to advance
+ *  new_time : The time to advance to. Must be more than or equal to any time
+ *             the system was previously advanced to.
+ *  levels : An array of pacing levels, one per system. Only the levels of
+ *           systems that changed are updated.
+ *
+ * Returns a pacing error flag.
+ */
+ESys_Flag
+MSys_AdvanceTime(MSys sys, double new_time, double* levels)
+{
+    ESys_Flag flag;
+    struct MSys_Change* c;
+    if(sys == 0) return ESys_INVALID_SYSTEM;
+
+    while (1) {
+        if (sys->pos == sys->n_changes) {
+            if (sys->exhausted) break;
+            flag = MSys__Fill(sys);
+            if (flag != ESys_OK) return flag;
+            if (sys->n_changes == 0) break;
+        }
+        c = sys->changes + sys->pos;
+        if (!ESys_geq(new_time, c->time)) break;
+        levels[c->index] = c->level;
+        if (c->fired) {
+            sys->n_fired[c->index]++;
+            sys->tfired[c->index] = c->time;
+        }
+        sys->pos++;
+    }
+    return ESys_OK;
+}
+
+/*
+ * Returns the time of the next change in any of the merged systems, or
+ * HUGE_VAL if there are no more changes before the final time.
+ *
+ * Arguments
+ *  sys : The merged pacing system to query
+ *  flag : The address of a pacing error flag or NULL
+ */
+double
+MSys_GetNextTime(MSys sys, ESys_Flag* flag)
+{
+    ESys_Flag f;
+    if(sys == 0) {
+        if(flag != 0) *flag = ESys_INVALID_SYSTEM;
+        return -1;
+    }
+    if (sys->pos == sys->n_changes && !sys->exhausted) {
+        f = MSys__Fill(sys);
+        if (f != ESys_OK) {
+            if(flag != 0) *flag = f;
+            return -1;
+        }
+    }
+    if(flag != 0) *flag = ESys_OK;
+    return (sys->pos < sys->n_changes) ? sys->changes[sys->pos].time : HUGE_VAL;
+}
+
+/*
+ * Returns the number of events started in system i since the merged system
+ * was created (or 0 if system i is not merged).
+ */
+long
+MSys_GetFiredCount(MSys sys, int i)
+{
+    if (sys == 0 || i < 0 || i >= sys->n_systems) return 0;
+    return sys->n_fired[i];
+}
+
+/*
+ * Returns the start time of the last event started in system i since the
+ * merged system was created (or 0 if no events have started).
+ */
+double
+MSys_GetFiredTime(MSys sys, int i)
+{
+    if (sys == 0 || i < 0 || i >= sys->n_systems) return 0;
+    return sys->tfired[i];
+}
+
+#undef MSys_CHUNK
+
 /*
  *
  * Fixed-form code starts here
@@ -610,6 +1032,7 @@ typedef int FSys_Flag;
 #define FSys_INVALID_SYSTEM                 -10
 #define FSys_POPULATED_SYSTEM               -11
 #define FSys_UNPOPULATED_SYSTEM             -12
+#define FSys_INVALID_INTERPOLATION          -13
 // Populating the system
 #define FSys_POPULATE_INVALID_TIMES         -20
 #define FSys_POPULATE_INVALID_VALUES        -21
@@ -619,6 +1042,8 @@ typedef int FSys_Flag;
 #define FSys_POPULATE_INVALID_VALUES_DATA   -25
 #define FSys_POPULATE_DECREASING_TIMES_DATA -26
 #define FSys_POPULATE_INVALID_PROTOCOL      -27
+#define FSys_POPULATE_INVALID_FILE          -28
+#define FSys_POPULATE_MMAP_UNSUPPORTED      -29
 
 /*
  * Sets a python exception based on a fixed-form pacing error flag.
@@ -645,6 +1070,9 @@ FSys_SetPyErr(FSys_Flag flag)
     case FSys_UNPOPULATED_SYSTEM:
         PyErr_SetString(PyExc_Exception, "F-Pacing error: Pacing system not populated.");
         break;
+    case FSys_INVALID_INTERPOLATION:
+        PyErr_SetString(PyExc_ValueError, "F-Pacing error: Unknown interpolation method.");
+        break;
     // Populate
     case FSys_POPULATE_INVALID_PROTOCOL:
         PyErr_SetString(PyExc_Exception, "F-Pacing error: Invalid protocol python object passed.");
@@ -670,6 +1098,12 @@ FSys_SetPyErr(FSys_Flag flag)
     case FSys_POPULATE_DECREASING_TIMES_DATA:
         PyErr_SetString(PyExc_Exception, "F-Pacing error: Times array must be non-decreasing.");
         break;
+    case FSys_POPULATE_INVALID_FILE:
+        PyErr_SetString(PyExc_Exception, "F-Pacing error: Unable to map time-series file, or file has an invalid format.");
+        break;
+    case FSys_POPULATE_MMAP_UNSUPPORTED:
+        PyErr_SetString(PyExc_Exception, "F-Pacing error: Memory-mapped time-series files are not supported on this platform.");
+        break;
     // Unknown
     default:
         PyErr_Format(PyExc_Exception, "F-Pacing error: Unlisted error %d", (int)flag);
@@ -677,6 +1111,13 @@ FSys_SetPyErr(FSys_Flag flag)
     };
 }
 
+/*
+ * Fixed-form pacing interpolation methods
+ */
+#define FSys_LINEAR     0
+#define FSys_HOLD       1
+#define FSys_CUBIC      2
+
 /*
  * Fixed-form pacing system
  */
@@ -686,7 +1127,17 @@ struct FSys_Mem {
     double* values; // The values array
     Py_ssize_t last_index; // The index of the most recently returned value
     //double level;   // The current output value
+    int method;     // The interpolation method
+    double* coeffs; // Cubic coefficients c1, c2, c3 for each interval, or NULL
+    void* map;      // The mapped file containing times and values, or NULL
+    size_t map_size;    // The size of the mapped file
+    double tolerance;   // The tolerance for simplification, or 0
+    double period;  // The period to repeat the data with, or 0
+    long repeats;   // The number of times to repeat the data, or 0 for no limit
 };
+
+/* Magic bytes at the start of a time-series file, including a version */
+#define FSys_FILE_MAGIC "MYOKTS01"
 typedef struct FSys_Mem* FSys;
 
 /*
@@ -710,6 +1161,13 @@ FSys_Create(FSys_Flag* flag)
     sys->times = NULL;
     sys->values = NULL;
     sys->last_index = 0;
+    sys->method = FSys_LINEAR;
+    sys->coeffs = NULL;
+    sys->map = NULL;
+    sys->map_size = 0;
+    sys->tolerance = 0;
+    sys->period = 0;
+    sys->repeats = 0;
 
     if(flag != 0) *flag = FSys_OK;
     return sys;
@@ -727,6 +1185,15 @@ FSys_Flag
 FSys_Destroy(FSys sys)
 {
     if(sys == 0) return FSys_INVALID_SYSTEM;
+    if(sys->map != NULL) {
+        // Times and values point into the mapped file
+        #ifdef FSys_MMAP_SUPPORTED
+        munmap(sys->map, sys->map_size);
+        #endif
+        sys->map = NULL;
+        sys->times = NULL;
+        sys->values = NULL;
+    }
     if(sys->times != NULL) {
         free(sys->times);
         sys->times = NULL;
@@ -735,10 +1202,324 @@ FSys_Destroy(FSys sys)
         free(sys->values);
         sys->values = NULL;
     }
+    free(sys->coeffs);
     free(sys);
     return FSys_OK;
 }
 
+/*
+ * Returns the number of bytes allocated by a fixed-form pacing system.
+ *
+ * Arguments
+ *  sys : The fixed-form pacing system to check
+ */
+size_t
+FSys_GetMemoryUsage(FSys sys)
+{
+    if (sys == NULL) return 0;
+    if (sys->times == NULL) return sizeof(struct FSys_Mem);
+    if (sys->map != NULL) {
+        // Mapped pages are backed by the file, so only count coefficients
+        return sizeof(struct FSys_Mem) + (sys->coeffs == NULL ? 0 : 3) * (size_t)sys->n_points * sizeof(double);
+    }
+    return sizeof(struct FSys_Mem) + (sys->coeffs == NULL ? 2 : 5) * (size_t)sys->n_points * sizeof(double);
+}
+
+/*
+ * Calculates the coefficients for monotone piecewise cubic interpolation.
+ *
+ * On each interval [t_i, t_i+1] with h = t_i+1 - t_i, the level is given by
+ *
+ *   v_i + c1 * (t - t_i) + c2 * (t - t_i)^2 + c3 * (t - t_i)^3
+ *
+ * where c1, c2, and c3 follow from Hermite interpolation with slopes chosen
+ * using the Fritsch-Butland weighted harmonic mean, which preserves
+ * monotonicity. Intervals of zero length (jumps in the signal) separate the
+ * data into pieces that are interpolated independently.
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+static FSys_Flag
+FSys__SetCoefficients(FSys sys)
+{
+    Py_ssize_t i, n;
+    double h0, h1, d0, d1, w0, w1, m;
+    double *t, *v, *c, *slopes;
+
+    n = sys->n_points;
+    t = sys->times;
+    v = sys->values;
+    free(sys->coeffs);
+    sys->coeffs = (double*)malloc(3 * (size_t)(n > 0 ? n : 1) * sizeof(double));
+    if (sys->coeffs == NULL) return FSys_OUT_OF_MEMORY;
+    c = sys->coeffs;
+
+    /* Use the first column as temporary storage for the slopes */
+    slopes = c;
+    for (i=0; i<n; i++) {
+        h0 = (i > 0) ? t[i] - t[i - 1] : 0;
+        h1 = (i < n - 1) ? t[i + 1] - t[i] : 0;
+        d0 = (h0 > 0) ? (v[i] - v[i - 1]) / h0 : 0;
+        d1 = (h1 > 0) ? (v[i + 1] - v[i]) / h1 : 0;
+        if (h0 > 0 && h1 > 0) {
+            /* Interior point: weighted harmonic mean, or 0 at extrema */
+            if (d0 * d1 > 0) {
+                w0 = 2 * h1 + h0;
+                w1 = h1 + 2 * h0;
+                m = (w0 + w1) / (w0 / d0 + w1 / d1);
+            } else {
+                m = 0;
+            }
+        } else if (h1 > 0) {
+            /* Left end of a piece: shape-preserving three-point estimate */
+            m = d1;
+            if (i + 2 < n && t[i + 2] > t[i + 1]) {
+                h0 = t[i + 2] - t[i + 1];
+                d0 = (v[i + 2] - v[i + 1]) / h0;
+                m = ((2 * h1 + h0) * d1 - h1 * d0) / (h1 + h0);
+                if (m * d1 <= 0) {
+                    m = 0;
+                } else if (d0 * d1 <= 0 && fabs(m) > 3 * fabs(d1)) {
+                    m = 3 * d1;
+                }
+            }
+        } else if (h0 > 0) {
+            /* Right end of a piece */
+            m = d0;
+            if (i >= 2 && t[i - 1] > t[i - 2]) {
+                h1 = t[i - 1] - t[i - 2];
+                d1 = (v[i - 1] - v[i - 2]) / h1;
+                m = ((2 * h0 + h1) * d0 - h0 * d1) / (h0 + h1);
+                if (m * d0 <= 0) {
+                    m = 0;
+                } else if (d0 * d1 <= 0 && fabs(m) > 3 * fabs(d0)) {
+                    m = 3 * d0;
+                }
+            }
+        } else {
+            m = 0;
+        }
+        slopes[i] = m;
+    }
+
+    /* Convert slopes to polynomial coefficients, working backwards so that
+       slopes[i + 1] is still available when interval i is handled */
+    if (n > 0) {
+        c[3 * (n - 1)] = slopes[n - 1];
+        c[3 * (n - 1) + 1] = 0;
+        c[3 * (n - 1) + 2] = 0;
+    }
+    for (i=n-2; i>=0; i--) {
+        h0 = t[i + 1] - t[i];
+        w0 = slopes[i];
+        w1 = c[3 * (i + 1)];
+        if (h0 > 0) {
+            d0 = (v[i + 1] - v[i]) / h0;
+            c[3 * i] = w0;
+            c[3 * i + 1] = (3 * d0 - 2 * w0 - w1) / h0;
+            c[3 * i + 2] = (w0 + w1 - 2 * d0) / (h0 * h0);
+        } else {
+            c[3 * i] = w0;
+            c[3 * i + 1] = 0;
+            c[3 * i + 2] = 0;
+        }
+    }
+    return FSys_OK;
+}
+
+/*
+ * Sets the tolerance used to simplify the data in a fixed-form pacing system
+ * with linear interpolation. Must be called before populating the system.
+ *
+ * Arguments
+ *  sys : The fixed-form pacing system to update
+ *  tolerance : The maximum change in the interpolated level, or 0 to disable
+ *              simplification
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+FSys_Flag
+FSys_SetTolerance(FSys sys, double tolerance)
+{
+    if(sys == 0) return FSys_INVALID_SYSTEM;
+    if (sys->n_points != -1) return FSys_POPULATED_SYSTEM;
+    sys->tolerance = (tolerance > 0) ? tolerance : 0;
+    return FSys_OK;
+}
+
+/*
+ * Makes a fixed-form pacing system periodic. This can be called before or
+ * after populating the system.
+ *
+ * Arguments
+ *  sys : The fixed-form pacing system to update
+ *  period : The period to repeat the data with, or 0 to disable repeating
+ *  repeats : The number of times the data is used, or 0 to repeat it
+ *            indefinitely
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+FSys_Flag
+FSys_SetPeriod(FSys sys, double period, long repeats)
+{
+    if(sys == 0) return FSys_INVALID_SYSTEM;
+    sys->period = (period > 0) ? period : 0;
+    sys->repeats = (repeats > 0) ? repeats : 0;
+    sys->last_index = 0;
+    return FSys_OK;
+}
+
+/*
+ * Returns the index of the repeat of a periodic system that contains the
+ * given time (or 0 for non-periodic systems). Repeat k starts at
+ * times[0] + k * period.
+ */
+static double
+FSys__Repeat(FSys sys, double time)
+{
+    double t0, k;
+    if (sys->period <= 0 || sys->n_points < 1) return 0;
+    t0 = sys->times[0];
+    if (time < t0) return 0;
+    k = floor((time - t0) / sys->period);
+
+    // Make sure the start of a repeat, as calculated by the caller, is in it
+    if (t0 + (k + 1) * sys->period <= time) k++;
+    if (sys->repeats > 0 && k > sys->repeats - 1) k = (double)(sys->repeats - 1);
+    return k;
+}
+
+/*
+ * Simplifies the piecewise-linear data in a fixed-form pacing system, using
+ * the Ramer-Douglas-Peucker algorithm with the vertical distance to each
+ * segment as error. As the error between two piecewise-linear functions is
+ * largest at a breakpoint, the simplified data is within the tolerance at
+ * every time.
+ *
+ * Points on either side of a jump (repeated times) are always kept. Instead
+ * of recursion, a stack of ranges to check is used.
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+static FSys_Flag
+FSys__Simplify(FSys sys)
+{
+    Py_ssize_t i, j, k, n, imax, top;
+    Py_ssize_t* stack;
+    char* keep;
+    double *t, *v, d, dmax, slope;
+
+    n = sys->n_points;
+    if (n < 3) return FSys_OK;
+    t = sys->times;
+    v = sys->values;
+
+    keep = (char*)calloc((size_t)n, sizeof(char));
+    stack = (Py_ssize_t*)malloc(2 * (size_t)n * sizeof(Py_ssize_t));
+    if (keep == NULL || stack == NULL) {
+        free(keep); free(stack);
+        return FSys_OUT_OF_MEMORY;
+    }
+
+    // Keep end points and jumps, and add ranges in between to the stack
+    top = 0;
+    keep[0] = keep[n - 1] = 1;
+    for (i=1; i<n; i++) {
+        if (t[i] == t[i - 1]) keep[i] = keep[i - 1] = 1;
+    }
+    for (i=0, j=1; j<n; j++) {
+        if (keep[j]) {
+            if (j - i > 1) {
+                stack[top++] = i;
+                stack[top++] = j;
+            }
+            i = j;
+        }
+    }
+
+    // Split ranges at the point furthest from the line between their ends
+    while (top > 0) {
+        j = stack[--top];
+        i = stack[--top];
+        slope = (v[j] - v[i]) / (t[j] - t[i]);
+        dmax = 0;
+        imax = i;
+        for (k=i+1; k<j; k++) {
+            d = fabs(v[i] + slope * (t[k] - t[i]) - v[k]);
+            if (d > dmax) {
+                dmax = d;
+                imax = k;
+            }
+        }
+        if (dmax > sys->tolerance) {
+            keep[imax] = 1;
+            if (imax - i > 1) {
+                stack[top++] = i;
+                stack[top++] = imax;
+            }
+            if (j - imax > 1) {
+                stack[top++] = imax;
+                stack[top++] = j;
+            }
+        }
+    }
+    free(stack);
+
+    // Remove points, and release unused memory
+    for (i=0, j=0; i<n; i++) {
+        if (keep[i]) {
+            t[j] = t[i];
+            v[j] = v[i];
+            j++;
+        }
+    }
+    free(keep);
+    sys->n_points = j;
+    t = (double*)realloc(sys->times, (size_t)j * sizeof(double));
+    if (t != NULL) sys->times = t;
+    v = (double*)realloc(sys->values, (size_t)j * sizeof(double));
+    if (v != NULL) sys->values = v;
+    return FSys_OK;
+}
+
+/*
+ * Returns the interpolation method used by a fixed-form pacing system, or -1
+ * if an invalid system is given.
+ */
+int
+FSys_GetInterpolation(FSys sys)
+{
+    if(sys == 0) return -1;
+    return sys->method;
+}
+
+/*
+ * Sets the interpolation method used by a fixed-form pacing system. This can
+ * be called before or after populating the system.
+ *
+ * Arguments
+ *  sys : The fixed-form pacing system to update
+ *  method : One of FSys_LINEAR, FSys_HOLD, or FSys_CUBIC
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+FSys_Flag
+FSys_SetInterpolation(FSys sys, int method)
+{
+    if(sys == 0) return FSys_INVALID_SYSTEM;
+    if (method != FSys_LINEAR && method != FSys_HOLD && method != FSys_CUBIC) {
+        return FSys_INVALID_INTERPOLATION;
+    }
+    sys->method = method;
+    if (method != FSys_CUBIC) {
+        free(sys->coeffs);
+        sys->coeffs = NULL;
+    } else if (sys->n_points >= 0 && sys->coeffs == NULL) {
+        return FSys__SetCoefficients(sys);
+    }
+    return FSys_OK;
+}
+
 /*
  * Populates a fixed-form pacing system using two Python list objects
  * containing an equal number of floating point numbers.
@@ -818,9 +1599,77 @@ FSys_Populate(FSys sys, PyObject* protocol)
     // Update pacing system and return
     sys->n_points = n;
     sys->last_index = 0;
+    if (sys->method == FSys_LINEAR && sys->tolerance > 0) return FSys__Simplify(sys);
+    if (sys->method == FSys_CUBIC) return FSys__SetCoefficients(sys);
     return FSys_OK;
 }
 
+/*
+ * Populates a fixed-form pacing system by memory-mapping a binary time-series
+ * file (see the format description at the top of this file).
+ * Returns an error if the system already has data.
+ *
+ * The times in the file are not checked, as this would require reading the
+ * whole file: they should be checked when the file is written. For the same
+ * reason, mapped data is never simplified.
+ *
+ * Arguments
+ *  sys  : The fixed-form pacing system to add the data to.
+ *  path : The path to the file.
+ *
+ * Returns a fixed-form pacing error flag.
+ */
+FSys_Flag
+FSys_PopulateFromFile(FSys sys, const char* path)
+{
+#ifdef FSys_MMAP_SUPPORTED
+    int fd;
+    struct stat st;
+    void* p;
+    uint64_t n;
+    size_t header = 8 + sizeof(uint64_t);
+
+    if(sys == 0) return FSys_INVALID_SYSTEM;
+    if (sys->n_points != -1) return FSys_POPULATED_SYSTEM;
+    if (path == NULL) return FSys_POPULATE_INVALID_FILE;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return FSys_POPULATE_INVALID_FILE;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < header) {
+        close(fd);
+        return FSys_POPULATE_INVALID_FILE;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return FSys_POPULATE_INVALID_FILE;
+
+    // Check header and size
+    memcpy(&n, (char*)p + 8, sizeof(uint64_t));
+    if (memcmp(p, FSys_FILE_MAGIC, 8) != 0 || n > ((size_t)st.st_size - header) / (2 * sizeof(double))
+            || header + 2 * n * sizeof(double) != (size_t)st.st_size) {
+        munmap(p, (size_t)st.st_size);
+        return FSys_POPULATE_INVALID_FILE;
+    }
+
+    // Pages are read mostly in order, as the simulation progresses
+    #ifdef MADV_SEQUENTIAL
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    #endif
+
+    // Update pacing system and return
+    sys->map = p;
+    sys->map_size = (size_t)st.st_size;
+    sys->times = (double*)((char*)p + header);
+    sys->values = sys->times + n;
+    sys->n_points = (Py_ssize_t)n;
+    sys->last_index = 0;
+    if (sys->method == FSys_CUBIC) return FSys__SetCoefficients(sys);
+    return FSys_OK;
+#else
+    return FSys_POPULATE_MMAP_UNSUPPORTED;
+#endif
+}
+
 /*
  * Returns the pacing level at the given time.
  *
@@ -840,6 +1689,7 @@ FSys_GetLevel(FSys sys, double time, FSys_Flag* flag)
     Py_ssize_t ileft, imid, iright, iguess;
     double tleft, tmid, tright, tguess;
     double vleft;
+    double* c;
 
     // Check system
     if(sys == 0) {
@@ -851,6 +1701,12 @@ FSys_GetLevel(FSys sys, double time, FSys_Flag* flag)
         return -1;
     }
 
+    // Periodic system? Then map time into the first period
+    if (sys->period > 0 && sys->n_points > 0) {
+        time -= FSys__Repeat(sys, time) * sys->period;
+        time = fmin(time, sys->times[0] + sys->period);
+    }
+
     // Find the highest index `i` of sorted array `times` such that
     // `times[i] <= time`, or `-1` if no such index can be found.
     // A guess can be given, which will be used to speed things up
@@ -911,16 +1767,398 @@ FSys_GetLevel(FSys sys, double time, FSys_Flag* flag)
     // (Because otherwise it can happen that tleft == tright, which would give
     //  a divide-by-zero in the interpolateion)
     if (time == tright) {
+        // With a zero-order hold, use the last value given for this time
+        if (sys->method == FSys_HOLD) {
+            while (iright + 1 < sys->n_points && sys->times[iright + 1] == time) iright++;
+        }
         if(flag != 0) *flag = FSys_OK;
         sys->last_index = iright;
         return sys->values[iright];
     }
 
-    // Find the correct value using linear interpolation
     if(flag != 0) *flag = FSys_OK;
     sys->last_index = ileft;
     vleft = sys->values[ileft];
+
+    // Zero-order hold: use the left value until the next point
+    if (sys->method == FSys_HOLD) return vleft;
+
+    // Evaluate the cubic on this interval, in Horner form
+    if (sys->coeffs != NULL) {
+        c = sys->coeffs + 3 * ileft;
+        tleft = time - tleft;
+        return vleft + tleft * (c[0] + tleft * (c[1] + tleft * c[2]));
+    }
+
+    // Find the correct value using linear interpolation
     return vleft + (sys->values[iright] - vleft) * (time - tleft) / (tright - tleft);
 }
 
+/*
+ * Returns the first time strictly after the given time at which the level can
+ * jump, or HUGE_VAL if there is none. With zero-order hold interpolation,
+ * this is the next time point. For periodic systems, the start of each repeat
+ * is included too.
+ *
+ * Arguments
+ *  sys : The pacing system to query.
+ *  time : The time to search from.
+ *  flag : The address of a pacing error flag or NULL.
+ */
+double
+FSys_GetNextTime(FSys sys, double time, FSys_Flag* flag)
+{
+    Py_ssize_t ileft, iright, imid;
+    double k, offset, tend;
+
+    if(sys == 0) {
+        if(flag != 0) *flag = FSys_INVALID_SYSTEM;
+        return -1;
+    }
+    if(sys->n_points < 0) {
+        if(flag != 0) *flag = FSys_UNPOPULATED_SYSTEM;
+        return -1;
+    }
+    if(flag != 0) *flag = FSys_OK;
+    if (sys->n_points == 0) return HUGE_VAL;
+
+    // Periodic system? Then search in the first period
+    k = FSys__Repeat(sys, time);
+    offset = k * sys->period;
+    tend = (sys->period > 0) ? sys->times[0] + sys->period : HUGE_VAL;
+
+    // Bisect to find the first index with times[i] > time
+    if (sys->method == FSys_HOLD && sys->times[sys->n_points - 1] > time - offset) {
+        ileft = 0;
+        iright = sys->n_points - 1;
+        while (ileft < iright) {
+            imid = ileft + (iright - ileft) / 2;
+            if (sys->times[imid] > time - offset) {
+                iright = imid;
+            } else {
+                ileft = imid + 1;
+            }
+        }
+
+        // Skip points that round to the given time after adding the offset
+        while (ileft < sys->n_points && sys->times[ileft] < tend && sys->times[ileft] + offset <= time) ileft++;
+        if (ileft < sys->n_points && sys->times[ileft] < tend) return sys->times[ileft] + offset;
+    }
+
+    // Next repeat, if any
+    if (sys->period > 0 && (sys->repeats == 0 || k + 1 < sys->repeats)) {
+        return sys->times[0] + (k + 1) * sys->period;
+    }
+    return HUGE_VAL;
+}
+
+#undef FSys_FILE_MAGIC
+
+/*
+ * Analytic pacing error flags
+ */
+typedef int ASys_Flag;
+#define ASys_OK                             0
+#define ASys_OUT_OF_MEMORY                  -1
+// General
+#define ASys_INVALID_SYSTEM                 -10
+#define ASys_POPULATED_SYSTEM               -11
+#define ASys_UNPOPULATED_SYSTEM             -12
+// Populating the system
+#define ASys_POPULATE_INVALID_PROTOCOL      -20
+#define ASys_POPULATE_INVALID_COMPONENT     -21
+#define ASys_POPULATE_INVALID_TYPE          -22
+
+/*
+ * Sets a python exception based on an analytic pacing error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+ASys_SetPyErr(ASys_Flag flag)
+{
+    switch(flag) {
+    case ASys_OK:
+        break;
+    case ASys_OUT_OF_MEMORY:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Memory allocation failed.");
+        break;
+    // General
+    case ASys_INVALID_SYSTEM:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Invalid pacing system provided.");
+        break;
+    case ASys_POPULATED_SYSTEM:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Pacing system already populated.");
+        break;
+    case ASys_UNPOPULATED_SYSTEM:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Pacing system not populated.");
+        break;
+    // Populate
+    case ASys_POPULATE_INVALID_PROTOCOL:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Invalid protocol python object passed.");
+        break;
+    case ASys_POPULATE_INVALID_COMPONENT:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Each component must be a tuple (type, start, duration, a, b, c, d) of numbers.");
+        break;
+    case ASys_POPULATE_INVALID_TYPE:
+        PyErr_SetString(PyExc_Exception, "A-Pacing error: Unknown component type.");
+        break;
+    // Unknown
+    default:
+        PyErr_Format(PyExc_Exception, "A-Pacing error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/*
+ * Analytic pacing component types
+ */
+#define ASys_CONSTANT       0
+#define ASys_RAMP           1
+#define ASys_SINE           2
+#define ASys_EXPONENTIAL    3
+#define ASys_CHIRP          4
+
+/*
+ * A single component of an analytic pacing system.
+ */
+struct ASys_Component {
+    int type;       // The component type
+    double start;   // The time the component starts
+    double end;     // The time the component ends (can be HUGE_VAL)
+    double a;       // Waveform parameters, see top of file
+    double b;
+    double c;
+    double d;
+};
+
+/*
+ * Analytic pacing system
+ */
+struct ASys_Mem {
+    Py_ssize_t n_components;    // The number of components, or -1 if unpopulated
+    struct ASys_Component* components;  // The components
+};
+typedef struct ASys_Mem* ASys;
+
+/*
+ * Creates an analytic pacing system
+ *
+ * Arguments
+ *  flag : The address of an analytic pacing error flag or NULL
+ *
+ * Returns the newly created analytic pacing system
+ */
+ASys
+ASys_Create(ASys_Flag* flag)
+{
+    ASys sys = (ASys)malloc(sizeof(struct ASys_Mem));
+    if (sys == 0) {
+        if(flag != 0) *flag = ASys_OUT_OF_MEMORY;
+        return 0;
+    }
+
+    sys->n_components = -1;
+    sys->components = NULL;
+
+    if(flag != 0) *flag = ASys_OK;
+    return sys;
+}
+
+/*
+ * Destroys an analytic pacing system and frees the memory it occupies.
+ *
+ * Arguments
+ *  sys : The analytic pacing system to destroy
+ *
+ * Returns an analytic pacing error flag.
+ */
+ASys_Flag
+ASys_Destroy(ASys sys)
+{
+    if(sys == 0) return ASys_INVALID_SYSTEM;
+    free(sys->components);
+    free(sys);
+    return ASys_OK;
+}
+
+/*
+ * Returns the number of bytes allocated by an analytic pacing system.
+ *
+ * Arguments
+ *  sys : The analytic pacing system to check
+ */
+size_t
+ASys_GetMemoryUsage(ASys sys)
+{
+    if (sys == NULL) return 0;
+    if (sys->components == NULL) return sizeof(struct ASys_Mem);
+    return sizeof(struct ASys_Mem) + (size_t)sys->n_components * sizeof(struct ASys_Component);
+}
+
+/*
+ * Populates an analytic pacing system, using the list of tuples
+ * (type, start, duration, a, b, c, d) returned by the protocol's
+ * components() method. A duration of 0 or less, or an infinite duration,
+ * indicates a component that never ends.
+ * Returns an error if the system already has data.
+ *
+ * Arguments
+ *  sys      : The analytic pacing system to add the components to.
+ *  protocol : A Python object with a components() method.
+ *
+ * Returns an analytic pacing error flag.
+ */
+ASys_Flag
+ASys_Populate(ASys sys, PyObject* protocol)
+{
+    Py_ssize_t i, n;
+    PyObject *list, *item;
+    struct ASys_Component* c;
+    double duration;
+
+    if(sys == 0) return ASys_INVALID_SYSTEM;
+    if (sys->n_components != -1) return ASys_POPULATED_SYSTEM;
+    if (protocol == Py_None) return ASys_POPULATE_INVALID_PROTOCOL;
+
+    // Get PyList from protocol (will need to decref!)
+    list = PyObject_CallMethod(protocol, "components", NULL); // Returns a new reference
+    if (list == NULL) return ASys_POPULATE_INVALID_PROTOCOL;
+    if (!PyList_Check(list)) {
+        Py_DECREF(list);
+        return ASys_POPULATE_INVALID_PROTOCOL;
+    }
+
+    n = PyList_Size(list);
+    sys->components = (struct ASys_Component*)malloc((size_t)(n > 0 ? n : 1) * sizeof(struct ASys_Component));
+    if (sys->components == NULL) {
+        Py_DECREF(list);
+        return ASys_OUT_OF_MEMORY;
+    }
+    for (i=0; i<n; i++) {
+        // Borrowed references, so ok not to decref
+        item = PyList_GetItem(list, i);
+        if (!PyTuple_Check(item) || PyTuple_Size(item) != 7) {
+            Py_DECREF(list);
+            free(sys->components); sys->components = NULL;
+            return ASys_POPULATE_INVALID_COMPONENT;
+        }
+        c = sys->components + i;
+        c->type = (int)PyLong_AsLong(PyTuple_GetItem(item, 0));
+        c->start = PyFloat_AsDouble(PyTuple_GetItem(item, 1));
+        duration = PyFloat_AsDouble(PyTuple_GetItem(item, 2));
+        c->end = (duration > 0) ? c->start + duration : HUGE_VAL;
+        c->a = PyFloat_AsDouble(PyTuple_GetItem(item, 3));
+        c->b = PyFloat_AsDouble(PyTuple_GetItem(item, 4));
+        c->c = PyFloat_AsDouble(PyTuple_GetItem(item, 5));
+        c->d = PyFloat_AsDouble(PyTuple_GetItem(item, 6));
+        if (PyErr_Occurred()) {
+            Py_DECREF(list);
+            free(sys->components); sys->components = NULL;
+            return ASys_POPULATE_INVALID_COMPONENT;
+        }
+        if (c->type < ASys_CONSTANT || c->type > ASys_CHIRP || (c->type == ASys_EXPONENTIAL && c->b == 0)) {
+            Py_DECREF(list);
+            free(sys->components); sys->components = NULL;
+            return ASys_POPULATE_INVALID_TYPE;
+        }
+    }
+    Py_DECREF(list);
+
+    sys->n_components = n;
+    return ASys_OK;
+}
+
+/*
+ * Returns the pacing level at the given time.
+ *
+ * Arguments
+ *  sys : The pacing system to query for a value.
+ *  time : The time to find a value for.
+ *  flag : The address of a pacing error flag or NULL.
+ *
+ * Returns the value of the pacing level at the given time.
+ * Will return -1 if an error occurs, so errors should always be checked for
+ * using the flag argument!
+ */
+double
+ASys_GetLevel(ASys sys, double time, ASys_Flag* flag)
+{
+    Py_ssize_t i;
+    struct ASys_Component* c;
+    double level, tau;
+    const double two_pi = 6.283185307179586476925286766559;
+
+    if(sys == 0) {
+        if(flag != 0) *flag = ASys_INVALID_SYSTEM;
+        return -1;
+    }
+    if(sys->n_components < 0) {
+        if(flag != 0) *flag = ASys_UNPOPULATED_SYSTEM;
+        return -1;
+    }
+
+    level = 0;
+    for (i=0; i<sys->n_components; i++) {
+        c = sys->components + i;
+        if (time < c->start || time >= c->end) continue;
+        tau = time - c->start;
+        switch (c->type) {
+        case ASys_CONSTANT:
+            level += c->a;
+            break;
+        case ASys_RAMP:
+            level += c->a + c->b * tau;
+            break;
+        case ASys_SINE:
+            level += c->a * sin(two_pi * c->b * tau + c->c);
+            break;
+        case ASys_EXPONENTIAL:
+            level += c->a * exp(-tau / c->b);
+            break;
+        case ASys_CHIRP:
+            level += c->a * sin(two_pi * tau * (c->b + 0.5 * c->c * tau) + c->d);
+            break;
+        }
+    }
+    if(flag != 0) *flag = ASys_OK;
+    return level;
+}
+
+/*
+ * Returns the first time strictly after the given time at which a component
+ * starts or ends, or HUGE_VAL if there is none.
+ *
+ * Arguments
+ *  sys : The pacing system to query.
+ *  time : The time to search from.
+ *  flag : The address of a pacing error flag or NULL.
+ */
+double
+ASys_GetNextTime(ASys sys, double time, ASys_Flag* flag)
+{
+    Py_ssize_t i;
+    struct ASys_Component* c;
+    double tnext;
+
+    if(sys == 0) {
+        if(flag != 0) *flag = ASys_INVALID_SYSTEM;
+        return -1;
+    }
+    if(sys->n_components < 0) {
+        if(flag != 0) *flag = ASys_UNPOPULATED_SYSTEM;
+        return -1;
+    }
+
+    tnext = HUGE_VAL;
+    for (i=0; i<sys->n_components; i++) {
+        c = sys->components + i;
+        if (c->start > time && c->start < tnext) tnext = c->start;
+        if (c->end > time && c->end < tnext) tnext = c->end;
+    }
+    if(flag != 0) *flag = ASys_OK;
+    return tnext;
+}
+
 #endif
@@ -0,0 +1,855 @@
+/*
+ * rosenbrock.h
+ *
+ * Ansi-C implementation of an adaptive linearly implicit (Rosenbrock) solver,
+ * using the 4-stage W-method ROS34PW2 by Rang and Angermann [1], with an
+ * embedded second order method for error control and cubic Hermite
+ * interpolation for dense output.
+ *
+ * Each step requires a single Jacobian evaluation and LU factorisation, and no
+ * Newton iterations, which makes this solver well suited to small stiff
+ * models. Because it is a W-method, it retains its order for inexact
+ * Jacobians, so that a finite-difference approximation can be used if no
+ * analytic Jacobian is available. The Jacobian is re-used when a step is
+ * rejected (only the factorisation is repeated).
+ *
+ * How to use:
+ *
+ *  1. Create a solver using ROS_Create
+ *  2. Set tolerances and step size bounds with ROS_SetTolerances and
+ *     ROS_SetStepSizeBounds
+ *  3. Optionally, set an analytic Jacobian function with ROS_SetJacobian
+ *  4. Set the initial time and state with ROS_Init
+ *  5. Now repeatedly
+ *    - Take a step with ROS_Step. This will never step beyond the given
+ *      stopping time, so that discontinuities (e.g. pacing events) can be
+ *      handled by stopping exactly at them.
+ *    - Use ROS_Interpolate to obtain the state at any time within the last
+ *      step (e.g. for logging or root finding).
+ *    - After any discontinuity (or any change to the state), call ROS_Init
+ *      again to restart the integration.
+ *  6. Tidy up using ROS_Destroy
+ *
+ * ROS_Step can be called without holding the GIL. In that case, the thread
+ * state returned by PyEval_SaveThread should be stored at an address passed
+ * to ROS_SetThreadState, so that the solver can re-acquire the GIL when it
+ * checks for signals (e.g. Ctrl-C).
+ *
+ * Flags are used to indicate errors. If a flag other than ROS_OK is set, a
+ * call to ROS_SetPyErr(flag) can be made to set a Python exception.
+ *
+ * [1] Improved Rosenbrock methods for stiff ordinary differential equations.
+ *     Rang, Angermann (2005) BIT Numerical Mathematics.
+ * [2] Solving Ordinary Differential Equations II. Hairer, Wanner (1996)
+ *     Springer.
+ *
+ * This file is part of Myokit.
+ * See http://myokit.org for copyright, sharing, and licensing details.
+ *
+ */
+#ifndef MyokitRosenbrock
+#define MyokitRosenbrock
+
+#include <Python.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Rosenbrock error flags
+ */
+typedef int ROS_Flag;
+#define ROS_OK                              0
+#define ROS_OUT_OF_MEMORY                  -1
+// General
+#define ROS_INVALID_SOLVER                 -10
+#define ROS_UNINITIALISED_SOLVER           -11
+// ROS_SetTolerances, ROS_SetStepSizeBounds
+#define ROS_INVALID_TOLERANCE              -20
+#define ROS_INVALID_STEP_SIZE_BOUNDS       -21
+// ROS_Step
+#define ROS_RHS_FAIL                       -30
+#define ROS_STEP_SIZE_TOO_SMALL            -31
+#define ROS_INVALID_STOPPING_TIME          -32
+#define ROS_JACOBIAN_FAIL                  -33
+#define ROS_SINGULAR_MATRIX                -34
+#define ROS_INTERRUPTED                    -35
+
+/*
+ * Sets a python exception based on a Rosenbrock error flag.
+ *
+ * Arguments
+ *  flag : The python error flag to base the message on.
+ */
+void
+ROS_SetPyErr(ROS_Flag flag)
+{
+    switch(flag) {
+    case ROS_OK:
+        break;
+    case ROS_OUT_OF_MEMORY:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Memory allocation failed.");
+        break;
+    // General
+    case ROS_INVALID_SOLVER:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Invalid solver provided.");
+        break;
+    case ROS_UNINITIALISED_SOLVER:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Solver must be initialised with ROS_Init before stepping.");
+        break;
+    // Settings
+    case ROS_INVALID_TOLERANCE:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Tolerances must be positive.");
+        break;
+    case ROS_INVALID_STEP_SIZE_BOUNDS:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Step size bounds must be non-negative, and the minimum must not exceed the maximum.");
+        break;
+    // Stepping: Raised as arithmetic errors, which the user may be able to
+    // debug (same as CVODE's convergence and error test failures).
+    case ROS_RHS_FAIL:
+        /* Keep any exception set by the right-hand side function */
+        if (PyErr_Occurred() == NULL) {
+            PyErr_SetString(PyExc_ArithmeticError, "Rosenbrock error: The right-hand side function failed.");
+        }
+        break;
+    case ROS_STEP_SIZE_TOO_SMALL:
+        PyErr_SetString(PyExc_ArithmeticError, "Rosenbrock error: Error test failed with step size at or below the minimum step size.");
+        break;
+    case ROS_INVALID_STOPPING_TIME:
+        PyErr_SetString(PyExc_Exception, "Rosenbrock error: Stopping time must be greater than the current time.");
+        break;
+    case ROS_JACOBIAN_FAIL:
+        /* Keep any exception set by the Jacobian function */
+        if (PyErr_Occurred() == NULL) {
+            PyErr_SetString(PyExc_ArithmeticError, "Rosenbrock error: The Jacobian function failed.");
+        }
+        break;
+    case ROS_SINGULAR_MATRIX:
+        PyErr_SetString(PyExc_ArithmeticError, "Rosenbrock error: Iteration matrix is singular at the minimum step size.");
+        break;
+    case ROS_INTERRUPTED:
+        /* Keep the exception set by the signal handler (e.g. a
+           KeyboardInterrupt) */
+        break;
+    // Unknown
+    default:
+        PyErr_Format(PyExc_Exception, "Rosenbrock error: Unlisted error %d", (int)flag);
+        break;
+    };
+}
+
+/*
+ * Right-hand side function used by the solver. Should calculate the
+ * derivatives at time t and state y, store them in ydot, and return 0 on
+ * success or a non-zero value on failure. If the function sets a Python
+ * exception before failing, this exception is kept by ROS_SetPyErr.
+ */
+typedef int (*ROS_RhsFn)(double t, double* y, double* ydot, void* user_data);
+
+/*
+ * Jacobian function used by the solver. Should calculate the partial
+ * derivatives of the rhs at time t and state y (where the rhs evaluates to
+ * fy), store them in the row-major n*n array jac so that jac[i * n + j]
+ * contains df_i/dy_j, and return 0 on success or a non-zero value on failure.
+ */
+typedef int (*ROS_JacFn)(double t, double* y, double* fy, double* jac, void* user_data);
+
+/*
+ * ROS34PW2 coefficients, in the form given in [1]: the stage coefficients
+ * alpha_ij and gamma_ij (with gamma_ii = gamma), and weights b and bhat for
+ * the 3rd and 2nd order solution.
+ * These are transformed to the form that avoids matrix-vector multiplications
+ * (see [2], Section IV.7) in ROS_Create.
+ */
+#define ROS_STAGES 4
+static const double ROS_GAMMA = 4.3586652150845900e-01;
+static const double ROS_ALPHA[ROS_STAGES][ROS_STAGES] = {
+    {0, 0, 0, 0},
+    {8.7173304301691801e-01, 0, 0, 0},
+    {8.4457060015369423e-01, -1.1299064236484185e-01, 0, 0},
+    {0, 0, 1, 0}
+};
+static const double ROS_GAMMA_IJ[ROS_STAGES][ROS_STAGES] = {
+    {0, 0, 0, 0},
+    {-8.7173304301691801e-01, 0, 0, 0},
+    {-9.0338057013044082e-01, 5.4180672388095326e-02, 0, 0},
+    {2.4212380706095346e-01, -1.2232505839045147e+00, 5.4526025533510214e-01, 0}
+};
+static const double ROS_B[ROS_STAGES] = {
+    2.4212380706095346e-01, -1.2232505839045147e+00, 1.5452602553351020e+00, 4.3586652150845900e-01
+};
+static const double ROS_BHAT[ROS_STAGES] = {
+    3.7810903145819369e-01, -9.6042292212423178e-02, 0.5, 2.1793326075422950e-01
+};
+
+/*
+ * Step size control
+ */
+#define ROS_SAFETY 0.9      // Safety factor for new step size
+#define ROS_FAC_MIN 0.2     // Minimum step size reduction factor
+#define ROS_FAC_MAX 6.0     // Maximum step size increase factor
+
+/*
+ * Rosenbrock solver
+ */
+struct ROS_Mem {
+    int n;                  // The number of states
+    ROS_RhsFn f;            // The right-hand side function
+    ROS_JacFn jac;          // The Jacobian function, or NULL to use finite differences
+    void* user_data;        // User data passed to the rhs and Jacobian functions
+    PyThreadState** thread_state;   // Saved thread state while the GIL is released, or NULL
+
+    double rtol;            // Relative tolerance
+    double atol;            // Absolute tolerance
+    double hmin;            // Minimum step size (or 0 for none)
+    double hmax;            // Maximum step size (or 0 for none)
+
+    // Transformed method coefficients (see ROS_Create)
+    double a[ROS_STAGES][ROS_STAGES];
+    double c[ROS_STAGES][ROS_STAGES];
+    double m[ROS_STAGES];
+    double e[ROS_STAGES];   // Weights for error estimate
+    double alpha[ROS_STAGES];
+    double gamma[ROS_STAGES];
+
+    int initialised;        // 1 if ROS_Init has been called
+    double t;               // The current time
+    double h;               // The proposed size of the next step
+    double* y;              // The current state
+    double* f0;             // The derivatives at the current point
+    double* ft;             // The partial derivative of the rhs to time
+    double* jac_mem;        // The Jacobian, as a row-major n*n array
+    double* lu;             // LU factorisation of the iteration matrix, row-major n*n
+    int* pivots;            // Row pivots for the LU factorisation
+    double* u;              // Stages U1 to U4, stored as a single 4*n array
+    double* ytmp;           // Temporary state for stage evaluations
+    double* ftmp;           // Temporary derivatives for stage evaluations
+    double* ynew;           // Candidate state for the current step
+
+    double tprev;           // Start time of the last accepted step
+    double hprev;           // Size of the last accepted step
+    double* yprev;          // State at the start of the last accepted step
+    double* fprev;          // Derivatives at the start of the last accepted step
+
+    long n_steps;           // Number of accepted steps since creation
+    long n_rejected;        // Number of rejected steps since creation
+    long n_jacobians;       // Number of Jacobian evaluations since creation
+};
+typedef struct ROS_Mem* ROS;
+
+/*
+ * Creates a Rosenbrock solver.
+ *
+ * Arguments
+ *  n : The number of states
+ *  f : The right-hand side function
+ *  user_data : Extra data to pass to the rhs and Jacobian functions, or NULL
+ *  flag : The address of a ROS error flag or NULL
+ *
+ * Returns the newly created solver
+ */
+ROS
+ROS_Create(int n, ROS_RhsFn f, void* user_data, ROS_Flag* flag)
+{
+    int i, j, k;
+    double ginv[ROS_STAGES][ROS_STAGES];
+    double s;
+
+    ROS ros = (ROS)malloc(sizeof(struct ROS_Mem));
+    if (ros == NULL) {
+        if (flag != 0) *flag = ROS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    ros->n = n;
+    ros->f = f;
+    ros->jac = NULL;
+    ros->user_data = user_data;
+    ros->thread_state = NULL;
+
+    ros->rtol = 1e-4;
+    ros->atol = 1e-6;
+    ros->hmin = 0;
+    ros->hmax = 0;
+
+    // Invert the (lower-triangular) matrix Gamma, by forward substitution
+    for (j=0; j<ROS_STAGES; j++) {
+        for (i=0; i<ROS_STAGES; i++) {
+            if (i < j) {
+                ginv[i][j] = 0;
+            } else if (i == j) {
+                ginv[i][j] = 1.0 / ROS_GAMMA;
+            } else {
+                s = 0;
+                for (k=j; k<i; k++) s += ROS_GAMMA_IJ[i][k] * ginv[k][j];
+                ginv[i][j] = -s / ROS_GAMMA;
+            }
+        }
+    }
+
+    // Transformed coefficients: a = alpha Gamma^-1, c = diag(1/gamma) -
+    // Gamma^-1, m = b Gamma^-1
+    for (i=0; i<ROS_STAGES; i++) {
+        ros->alpha[i] = 0;
+        ros->gamma[i] = ROS_GAMMA;
+        for (j=0; j<ROS_STAGES; j++) {
+            ros->alpha[i] += ROS_ALPHA[i][j];
+            ros->gamma[i] += ROS_GAMMA_IJ[i][j];
+            ros->a[i][j] = 0;
+            for (k=0; k<ROS_STAGES; k++) ros->a[i][j] += ROS_ALPHA[i][k] * ginv[k][j];
+            ros->c[i][j] = ((i == j) ? 1.0 / ROS_GAMMA : 0) - ginv[i][j];
+        }
+    }
+    for (j=0; j<ROS_STAGES; j++) {
+        ros->m[j] = 0;
+        ros->e[j] = 0;
+        for (k=0; k<ROS_STAGES; k++) {
+            ros->m[j] += ROS_B[k] * ginv[k][j];
+            ros->e[j] += (ROS_B[k] - ROS_BHAT[k]) * ginv[k][j];
+        }
+    }
+
+    ros->initialised = 0;
+    ros->t = 0;
+    ros->h = 0;
+    ros->tprev = 0;
+    ros->hprev = 0;
+    ros->n_steps = 0;
+    ros->n_rejected = 0;
+    ros->n_jacobians = 0;
+
+    ros->y = (double*)malloc((size_t)n * sizeof(double));
+    ros->f0 = (double*)malloc((size_t)n * sizeof(double));
+    ros->ft = (double*)malloc((size_t)n * sizeof(double));
+    ros->jac_mem = (double*)malloc((size_t)n * (size_t)n * sizeof(double));
+    ros->lu = (double*)malloc((size_t)n * (size_t)n * sizeof(double));
+    ros->pivots = (int*)malloc((size_t)n * sizeof(int));
+    ros->u = (double*)malloc(ROS_STAGES * (size_t)n * sizeof(double));
+    ros->ytmp = (double*)malloc((size_t)n * sizeof(double));
+    ros->ftmp = (double*)malloc((size_t)n * sizeof(double));
+    ros->ynew = (double*)malloc((size_t)n * sizeof(double));
+    ros->yprev = (double*)malloc((size_t)n * sizeof(double));
+    ros->fprev = (double*)malloc((size_t)n * sizeof(double));
+    if (ros->y == NULL || ros->f0 == NULL || ros->ft == NULL || ros->jac_mem == NULL
+            || ros->lu == NULL || ros->pivots == NULL || ros->u == NULL || ros->ytmp == NULL
+            || ros->ftmp == NULL || ros->ynew == NULL || ros->yprev == NULL || ros->fprev == NULL) {
+        free(ros->y); free(ros->f0); free(ros->ft); free(ros->jac_mem);
+        free(ros->lu); free(ros->pivots); free(ros->u); free(ros->ytmp);
+        free(ros->ftmp); free(ros->ynew); free(ros->yprev); free(ros->fprev);
+        free(ros);
+        if (flag != 0) *flag = ROS_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    if (flag != 0) *flag = ROS_OK;
+    return ros;
+}
+
+/*
+ * Destroys a Rosenbrock solver and frees the memory it occupies.
+ *
+ * Arguments
+ *  ros : The solver to destroy
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_Destroy(ROS ros)
+{
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    free(ros->y);
+    free(ros->f0);
+    free(ros->ft);
+    free(ros->jac_mem);
+    free(ros->lu);
+    free(ros->pivots);
+    free(ros->u);
+    free(ros->ytmp);
+    free(ros->ftmp);
+    free(ros->ynew);
+    free(ros->yprev);
+    free(ros->fprev);
+    free(ros);
+    return ROS_OK;
+}
+
+/*
+ * Returns the number of bytes allocated by a solver.
+ *
+ * Arguments
+ *  ros : The solver to check
+ */
+size_t
+ROS_GetMemoryUsage(ROS ros)
+{
+    size_t n;
+    if (ros == NULL) return 0;
+    n = (size_t)ros->n;
+    return sizeof(struct ROS_Mem) + (2 * n * n + (8 + ROS_STAGES) * n) * sizeof(double) + n * sizeof(int);
+}
+
+/*
+ * Sets the relative and absolute tolerance used in error control.
+ *
+ * Arguments
+ *  ros : The solver to update
+ *  rtol : The relative tolerance
+ *  atol : The absolute tolerance
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_SetTolerances(ROS ros, double rtol, double atol)
+{
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    if (rtol <= 0 || atol <= 0) return ROS_INVALID_TOLERANCE;
+    ros->rtol = rtol;
+    ros->atol = atol;
+    return ROS_OK;
+}
+
+/*
+ * Sets the minimum and maximum step size (use 0 for no bound).
+ *
+ * Arguments
+ *  ros : The solver to update
+ *  hmin : The minimum step size, or 0
+ *  hmax : The maximum step size, or 0
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_SetStepSizeBounds(ROS ros, double hmin, double hmax)
+{
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    if (hmin < 0 || hmax < 0) return ROS_INVALID_STEP_SIZE_BOUNDS;
+    if (hmax > 0 && hmin > hmax) return ROS_INVALID_STEP_SIZE_BOUNDS;
+    ros->hmin = hmin;
+    ros->hmax = hmax;
+    return ROS_OK;
+}
+
+/*
+ * Tells the solver where the caller stores its thread state while it has
+ * released the GIL (or NULL if the GIL is always held while stepping). When the
+ * solver needs the GIL, it re-acquires it if the stored thread state is not
+ * NULL, and releases it again afterwards.
+ *
+ * Arguments
+ *  ros : The solver to update
+ *  thread_state : The address of a thread state pointer, or NULL
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_SetThreadState(ROS ros, PyThreadState** thread_state)
+{
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    ros->thread_state = thread_state;
+    return ROS_OK;
+}
+
+/*
+ * Checks for signals, re-acquiring the GIL first if the caller released it.
+ * Returns non-zero if a signal handler raised an exception.
+ */
+static int
+ROS__CheckSignals(ROS ros)
+{
+    int flag;
+    PyThreadState* saved = (ros->thread_state == NULL) ? NULL : *(ros->thread_state);
+    if (saved != NULL) PyEval_RestoreThread(saved);
+    flag = PyErr_CheckSignals();
+    if (saved != NULL) *(ros->thread_state) = PyEval_SaveThread();
+    return flag;
+}
+
+/*
+ * Sets a function to calculate the Jacobian with, or NULL to use finite
+ * differences.
+ *
+ * Arguments
+ *  ros : The solver to update
+ *  jac : The Jacobian function, or NULL
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_SetJacobian(ROS ros, ROS_JacFn jac)
+{
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    ros->jac = jac;
+    return ROS_OK;
+}
+
+/*
+ * Calculates the weighted root-mean-square norm of `v`, using the tolerances
+ * and the magnitudes of the states `y1` and `y2`.
+ */
+static double
+ROS__Norm(ROS ros, const double* v, const double* y1, const double* y2)
+{
+    int i;
+    double sk, r, sum = 0;
+    for (i=0; i<ros->n; i++) {
+        sk = ros->atol + ros->rtol * fmax(fabs(y1[i]), fabs(y2[i]));
+        r = v[i] / sk;
+        sum += r * r;
+    }
+    return sqrt(sum / (double)ros->n);
+}
+
+/*
+ * Evaluates the Jacobian and the partial derivatives to time at the current
+ * point, using the Jacobian function if set or forward finite differences
+ * otherwise. The time derivative is always approximated with finite
+ * differences, taken towards `tstop`.
+ */
+static ROS_Flag
+ROS__Jacobian(ROS ros, double tstop)
+{
+    int i, j, n;
+    double yj, del, delt;
+
+    n = ros->n;
+    ros->n_jacobians++;
+
+    if (ros->jac != NULL) {
+        if (ros->jac(ros->t, ros->y, ros->f0, ros->jac_mem, ros->user_data) != 0) return ROS_JACOBIAN_FAIL;
+    } else {
+        for (j=0; j<n; j++) {
+            yj = ros->y[j];
+            del = sqrt(DBL_EPSILON) * fmax(fabs(yj), ros->atol / ros->rtol);
+            ros->y[j] = yj + del;
+            del = ros->y[j] - yj;   // Exactly representable increment
+            if (ros->f(ros->t, ros->y, ros->ftmp, ros->user_data) != 0) {
+                ros->y[j] = yj;
+                return ROS_RHS_FAIL;
+            }
+            ros->y[j] = yj;
+            for (i=0; i<n; i++) ros->jac_mem[i * n + j] = (ros->ftmp[i] - ros->f0[i]) / del;
+        }
+    }
+
+    delt = sqrt(DBL_EPSILON) * fmax(fabs(ros->t), 1.0);
+    if (ros->t + delt > tstop) delt = -delt;
+    if (ros->f(ros->t + delt, ros->y, ros->ftmp, ros->user_data) != 0) return ROS_RHS_FAIL;
+    for (i=0; i<n; i++) ros->ft[i] = (ros->ftmp[i] - ros->f0[i]) / delt;
+
+    return ROS_OK;
+}
+
+/*
+ * Forms the iteration matrix I / (h * gamma) - J and calculates its LU
+ * factorisation, using partial pivoting.
+ *
+ * Returns 0 on success, or 1 if the matrix is singular.
+ */
+static int
+ROS__Factor(ROS ros, double h)
+{
+    int i, j, k, p, n;
+    double* lu;
+    double d, big;
+
+    n = ros->n;
+    lu = ros->lu;
+    d = 1.0 / (h * ROS_GAMMA);
+    for (i=0; i<n*n; i++) lu[i] = -ros->jac_mem[i];
+    for (i=0; i<n; i++) lu[i * n + i] += d;
+
+    for (k=0; k<n; k++) {
+        // Find pivot
+        p = k;
+        big = fabs(lu[k * n + k]);
+        for (i=k+1; i<n; i++) {
+            if (fabs(lu[i * n + k]) > big) {
+                big = fabs(lu[i * n + k]);
+                p = i;
+            }
+        }
+        if (big == 0) return 1;
+        ros->pivots[k] = p;
+        if (p != k) {
+            for (j=0; j<n; j++) {
+                d = lu[k * n + j]; lu[k * n + j] = lu[p * n + j]; lu[p * n + j] = d;
+            }
+        }
+
+        // Eliminate
+        for (i=k+1; i<n; i++) {
+            d = lu[i * n + k] /= lu[k * n + k];
+            if (d != 0) {
+                for (j=k+1; j<n; j++) lu[i * n + j] -= d * lu[k * n + j];
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Solves (I / (h * gamma) - J) x = b using the LU factorisation, overwriting
+ * b with the solution.
+ */
+static void
+ROS__Solve(ROS ros, double* b)
+{
+    int i, j, n;
+    double* lu;
+    double s;
+
+    n = ros->n;
+    lu = ros->lu;
+    for (i=0; i<n; i++) {
+        j = ros->pivots[i];
+        if (j != i) { s = b[i]; b[i] = b[j]; b[j] = s; }
+    }
+    for (i=1; i<n; i++) {
+        s = b[i];
+        for (j=0; j<i; j++) s -= lu[i * n + j] * b[j];
+        b[i] = s;
+    }
+    for (i=n-1; i>=0; i--) {
+        s = b[i];
+        for (j=i+1; j<n; j++) s -= lu[i * n + j] * b[j];
+        b[i] = s / lu[i * n + i];
+    }
+}
+
+/*
+ * (Re)starts the integration at time `t0` and state `y0`.
+ *
+ * This evaluates the derivatives at the initial point, and (if no previous
+ * step size is known) estimates an initial step size. Must be called before
+ * the first step, and after any discontinuity in the rhs or the state.
+ *
+ * Arguments
+ *  ros : The solver to (re)initialise
+ *  t0 : The time to start at
+ *  y0 : The state to start at
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_Init(ROS ros, double t0, const double* y0)
+{
+    int i, n;
+    double d0, d1;
+
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    n = ros->n;
+
+    ros->t = t0;
+    for (i=0; i<n; i++) ros->y[i] = y0[i];
+    if (ros->f(t0, ros->y, ros->f0, ros->user_data) != 0) return ROS_RHS_FAIL;
+
+    // Last step is now the point t0
+    ros->tprev = t0;
+    ros->hprev = 0;
+    for (i=0; i<n; i++) {
+        ros->yprev[i] = ros->y[i];
+        ros->fprev[i] = ros->f0[i];
+    }
+
+    // Estimate an initial step size, but only on the first call: when
+    // restarting after a discontinuity the previous proposed step size is a
+    // better guess. For stiff problems the estimate is based on the fastest
+    // (explicit) scale, which the step size controller will quickly correct.
+    if (ros->h <= 0) {
+        d0 = ROS__Norm(ros, ros->y, ros->y, ros->y);
+        d1 = ROS__Norm(ros, ros->f0, ros->y, ros->y);
+        ros->h = (d0 < 1e-5 || d1 < 1e-5) ? 1e-6 : 0.01 * d0 / d1;
+    }
+    if (ros->hmax > 0 && ros->h > ros->hmax) ros->h = ros->hmax;
+    if (ros->h < ros->hmin) ros->h = ros->hmin;
+
+    ros->initialised = 1;
+    return ROS_OK;
+}
+
+/*
+ * Takes a single (accepted) step, without stepping beyond `tstop`.
+ *
+ * Rejected steps are retried internally with a smaller step size, until a
+ * step is accepted or the step size drops below the minimum.
+ *
+ * Arguments
+ *  ros : The solver to step with
+ *  tstop : The time not to step beyond. Steps that would end very close to
+ *          tstop are stretched to end exactly at tstop.
+ *  tret : The address of a double to store the new time in
+ *  yret : An array to store the new state in, or NULL
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_Step(ROS ros, double tstop, double* tret, double* yret)
+{
+    int i, j, s, n, last;
+    double t, h, err, fac;
+    double *y, *yt, *ft, *yn, *ui;
+    ROS_Flag flag;
+
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    if (!ros->initialised) return ROS_UNINITIALISED_SOLVER;
+    if (!(tstop > ros->t)) return ROS_INVALID_STOPPING_TIME;
+
+    n = ros->n;
+    t = ros->t;
+    y = ros->y;
+    yt = ros->ytmp;
+    ft = ros->ftmp;
+    yn = ros->ynew;
+
+    // Evaluate Jacobian once per step (re-used for rejected attempts)
+    flag = ROS__Jacobian(ros, tstop);
+    if (flag != ROS_OK) return flag;
+
+    while (1) {
+
+        // Choose step size, stretching or shrinking it to hit tstop exactly
+        h = ros->h;
+        last = 0;
+        if (t + 1.01 * h >= tstop) {
+            h = tstop - t;
+            last = 1;
+        }
+        if (t + h == t) return ROS_STEP_SIZE_TOO_SMALL;
+
+        // Factor iteration matrix. If singular, retry with a smaller step
+        if (ROS__Factor(ros, h) != 0) {
+            if (ros->hmin > 0 && h <= ros->hmin) return ROS_SINGULAR_MATRIX;
+            ros->n_rejected++;
+            ros->h = h * 0.5;
+            if (ros->h < ros->hmin) ros->h = ros->hmin;
+            continue;
+        }
+
+        // Stages
+        for (s=0; s<ROS_STAGES; s++) {
+            ui = ros->u + s * n;
+
+            // Derivatives at stage point (the first is known)
+            if (s == 0) {
+                for (i=0; i<n; i++) ui[i] = ros->f0[i];
+            } else {
+                for (i=0; i<n; i++) {
+                    yt[i] = y[i];
+                    for (j=0; j<s; j++) yt[i] += ros->a[s][j] * ros->u[j * n + i];
+                }
+                if (ros->f(t + ros->alpha[s] * h, yt, ft, ros->user_data) != 0) return ROS_RHS_FAIL;
+                for (i=0; i<n; i++) ui[i] = ft[i];
+            }
+
+            // Add contributions from previous stages and time derivative
+            for (i=0; i<n; i++) {
+                for (j=0; j<s; j++) ui[i] += ros->c[s][j] / h * ros->u[j * n + i];
+                ui[i] += ros->gamma[s] * h * ros->ft[i];
+            }
+
+            // Solve
+            ROS__Solve(ros, ui);
+        }
+
+        // New state and error estimate
+        for (i=0; i<n; i++) {
+            yn[i] = y[i];
+            yt[i] = 0;
+            for (s=0; s<ROS_STAGES; s++) {
+                yn[i] += ros->m[s] * ros->u[s * n + i];
+                yt[i] += ros->e[s] * ros->u[s * n + i];
+            }
+        }
+        err = ROS__Norm(ros, yt, y, yn);
+
+        // New step size (the embedded method is second order)
+        fac = (err == 0) ? ROS_FAC_MAX : ROS_SAFETY * pow(err, -1.0 / 3.0);
+        fac = fmin(ROS_FAC_MAX, fmax(ROS_FAC_MIN, fac));
+
+        if (err <= 1.0 || (ros->hmin > 0 && h <= ros->hmin)) {
+            if (err > 1.0) {
+                // Error test failed at minimum step size
+                return ROS_STEP_SIZE_TOO_SMALL;
+            }
+
+            // Accepted: evaluate derivatives at the new point, which are
+            // needed for dense output and as the first stage of the next step
+            ros->tprev = t;
+            ros->hprev = h;
+            for (i=0; i<n; i++) {
+                ros->yprev[i] = y[i];
+                ros->fprev[i] = ros->f0[i];
+                y[i] = yn[i];
+            }
+            ros->t = last ? tstop : t + h;
+            if (ros->f(ros->t, y, ros->f0, ros->user_data) != 0) return ROS_RHS_FAIL;
+
+            // Propose next step size (but don't let a shortened last step
+            // limit the next one)
+            if (!last || fac < 1) ros->h = h * fac;
+            if (ros->hmax > 0 && ros->h > ros->hmax) ros->h = ros->hmax;
+            if (ros->h < ros->hmin) ros->h = ros->hmin;
+            ros->n_steps++;
+            break;
+        }
+
+        // Rejected: retry with smaller step
+        ros->n_rejected++;
+        ros->h = h * fmin(1.0, fac);
+        if (ros->hmin > 0 && ros->h < ros->hmin) ros->h = ros->hmin;
+
+        // Allow interrupting if something goes wrong
+        if (ROS__CheckSignals(ros) != 0) {
+            return ROS_INTERRUPTED;
+        }
+    }
+
+    *tret = ros->t;
+    if (yret != NULL) {
+        for (i=0; i<n; i++) yret[i] = y[i];
+    }
+    return ROS_OK;
+}
+
+/*
+ * Evaluates the cubic Hermite interpolant of the last accepted step at time
+ * `t`.
+ *
+ * Accurate results are obtained for times within the last step; outside of
+ * this interval the interpolating polynomial is extrapolated.
+ *
+ * Arguments
+ *  ros : The solver to query
+ *  t : The time to evaluate the state at
+ *  yret : An array to store the interpolated state in
+ *
+ * Returns a ROS error flag.
+ */
+ROS_Flag
+ROS_Interpolate(ROS ros, double t, double* yret)
+{
+    int i, n;
+    double s, s1, h00, h10, h01, h11;
+
+    if (ros == NULL) return ROS_INVALID_SOLVER;
+    if (!ros->initialised) return ROS_UNINITIALISED_SOLVER;
+
+    n = ros->n;
+    if (ros->hprev == 0) {
+        for (i=0; i<n; i++) yret[i] = ros->y[i];
+        return ROS_OK;
+    }
+
+    s = (t - ros->tprev) / ros->hprev;
+    s1 = 1.0 - s;
+    h00 = (1 + 2 * s) * s1 * s1;
+    h10 = s * s1 * s1 * ros->hprev;
+    h01 = s * s * (3 - 2 * s);
+    h11 = -s * s * s1 * ros->hprev;
+    for (i=0; i<n; i++) {
+        yret[i] = h00 * ros->yprev[i] + h10 * ros->fprev[i] + h01 * ros->y[i] + h11 * ros->f0[i];
+    }
+    return ROS_OK;
+}
+
+#endif
@@ -1,4 +1,11 @@
 #!/usr/bin/env python3
+import os
+import pickle
+import warnings
+
+import numpy as np
+
+import myokit
 import myokit_beta
 
 print(myokit_beta.hi())
@@ -8,3 +15,727 @@ assert myokit_beta.sum() == 12.345
 
 myokit_beta.sim(False)
 
+
+def test_dopri5():
+    # The explicit solver gives the same result as CVODES
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log_interval=1)
+    s.reset()
+    s.set_solver('dopri5')
+    d2 = s.run(1000, log_interval=1)
+    assert len(d1.time()) == len(d2.time())
+    v1, v2 = np.array(d1['membrane.V']), np.array(d2['membrane.V'])
+    assert abs(np.max(v1) - np.max(v2)) < 1
+    assert np.max(np.abs(v1[-100:] - v2[-100:])) < 0.1
+    assert s.last_number_of_steps() > 0
+
+
+def test_rosenbrock():
+    # The Rosenbrock solver gives the same result as CVODES
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log_interval=1)
+    s.reset()
+    s.set_solver('rosenbrock')
+    d2 = s.run(1000, log_interval=1)
+    assert len(d1.time()) == len(d2.time())
+    v1, v2 = np.array(d1['membrane.V']), np.array(d2['membrane.V'])
+    assert abs(np.max(v1) - np.max(v2)) < 1
+    assert np.max(np.abs(v1[-100:] - v2[-100:])) < 0.1
+
+
+def test_population():
+    # A population of identical cells behaves like a single cell
+    p = myokit.load_protocol('example')
+    log = ['engine.time', 'membrane.V']
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log=log, log_interval=1)
+    s.reset()
+    s.set_population_size(3)
+    assert s.population_size() == 3
+    n = myokit.load_model('example').count_states()
+    assert len(s.state()) == 3 * n
+    d3 = s.run(1000, log=log, log_interval=1)
+    assert 'engine.time' in d3
+    assert '0.engine.time' not in d3
+    v1 = np.array(d1['membrane.V'])
+    for i in range(3):
+        v = np.array(d3[str(i) + '.membrane.V'])
+        assert np.max(np.abs(v1[-100:] - v[-100:])) < 0.1
+        assert abs(np.max(v1) - np.max(v)) < 1
+
+    # Cells can have different values for literal constants
+    s.reset()
+    s.set_population_constant('ina.gNa', [16, 16, 0])
+    d3 = s.run(1000, log=log, log_interval=1)
+    assert np.max(d3['0.membrane.V']) > 0
+    assert np.max(d3['2.membrane.V']) < 0
+
+
+def test_coupling():
+    # Coupling cells makes their potentials more alike
+    p = myokit.load_protocol('example')
+    log = ['engine.time', 'membrane.V']
+    s = myokit_beta.Simulation(p)
+    s.set_population_size(2)
+    s.set_population_constant('ina.gNa', [16, 0])
+    d = s.run(1000, log=log, log_interval=1)
+    uncoupled = np.max(np.abs(
+        np.array(d['0.membrane.V']) - np.array(d['1.membrane.V'])))
+    s.reset()
+    s.set_population_coupling([(0, 1, 1)])
+    assert s.population_coupling() == [(0, 1, 1.0)]
+    d = s.run(1000, log=log, log_interval=1)
+    coupled = np.max(np.abs(
+        np.array(d['0.membrane.V']) - np.array(d['1.membrane.V'])))
+    assert coupled < 0.5 * uncoupled
+
+    # Invalid coupling
+    try:
+        s.set_population_coupling([(0, 0, 1)])
+        assert False
+    except ValueError:
+        pass
+    try:
+        s.set_population_coupling([(0, 2, 1)])
+        assert False
+    except ValueError:
+        pass
+
+
+def test_threads():
+    # Simulations run in other threads give the same results
+    import threading
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log_interval=1)
+    results = {}
+
+    def run(key):
+        t = myokit_beta.Simulation(p)
+        results[key] = t.run(1000, log_interval=1)
+
+    threads = [threading.Thread(target=run, args=(i, )) for i in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    for d in results.values():
+        assert np.array_equal(d1['membrane.V'], d['membrane.V'])
+
+
+def test_memory_usage():
+    # Memory usage is reported per component, and sums to the total
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    s.run(1000)
+    m = s.memory_usage()
+    for key in ('model', 'solver', 'linear_solver', 'pacing',
+                'sensitivities', 'logs'):
+        assert m[key] >= 0
+    assert m['model'] > 0
+    assert m['solver'] > 0
+    assert m['logs'] > 0
+    assert m['total'] == sum(v for k, v in m.items() if k != 'total')
+
+    # Populations use more memory
+    s.set_population_size(10)
+    s.run(1000)
+    assert s.memory_usage()['model'] > m['model']
+
+
+def test_log_budget():
+    # Logs spilled to disk contain the same data as logs kept in memory
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log_interval=0.1)
+    d1 = s.run(1000, log=d1, log_interval=0.1)
+    s.reset()
+    s.set_log_budget(10000)
+    assert s.log_budget() == 10000
+    d2 = s.run(1000, log_interval=0.1)
+    assert isinstance(d2['membrane.V'], np.ndarray)
+
+    # Spilled logs can be continued
+    d2 = s.run(1000, log=d2, log_interval=0.1)
+    for key in d1:
+        assert np.array_equal(d1[key], d2[key])
+
+    s.set_log_budget(None)
+    assert s.log_budget() is None
+
+
+def test_compression():
+    # Lossless and lossy round trips
+    x = np.cumsum(np.random.RandomState(1).normal(size=200000))
+    assert np.array_equal(
+        myokit_beta.decompress(myokit_beta.compress(x)), x)
+    y = myokit_beta.decompress(myokit_beta.compress(x, 1e-3))
+    assert np.max(np.abs(x - y)) <= 1e-3
+
+    # Chunked access
+    c = myokit_beta.CompressedArray(myokit_beta.compress(x))
+    assert len(c) == len(x)
+    assert c[70000] == x[70000]
+    assert c[-1] == x[-1]
+    assert np.array_equal(c[65530:65540], x[65530:65540])
+
+    # Compressed logs, with and without a budget
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d1 = s.run(1000, log_interval=0.1)
+    for budget in (None, 10000):
+        s.reset()
+        s.set_log_budget(budget, compress=True)
+        d2 = s.run(1000, log_interval=0.1)
+        assert isinstance(d2['membrane.V'], myokit_beta.CompressedArray)
+        for key in d1:
+            assert np.array_equal(d1[key], d2[key])
+
+
+def test_pyramids():
+    # Pyramids contain the min and max of every block
+    x = np.random.RandomState(2).normal(size=1000)
+    p = myokit_beta.Pyramid(4)
+    p.extend(x[:333])
+    p.extend(x[333:])
+    assert len(p) == 1000
+    lo, hi = p.level(0)
+    assert np.array_equal(lo, x.reshape(-1, 4).min(axis=1))
+    assert np.array_equal(hi, x.reshape(-1, 4).max(axis=1))
+    lo, hi = p.level(1)
+    assert len(lo) == 63
+    assert lo[0] == np.min(x[:16])
+    assert hi[-1] == np.max(x[992:])
+    block, lo, hi = p.view(0, 1000, 100)
+    assert block == 16
+    assert len(lo) == 63
+    assert p.view(0, 50, 100) is None
+
+    # Pyramids are updated during runs, also when logs are spilled
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    s.set_log_pyramids(4)
+    for budget in (None, 10000):
+        s.reset()
+        s.set_log_budget(budget)
+        d = s.run(1000, log_interval=0.1)
+        d = s.run(1000, log=d, log_interval=0.1)
+        pyramids = s.last_pyramids()
+        for key in d:
+            v = np.asarray(d[key])
+            assert len(pyramids[key]) == len(v)
+            lo, hi = pyramids[key].level(1)
+            assert np.min(lo) == np.min(v)
+            assert np.max(hi) == np.max(v)
+
+
+def test_monitor():
+    # Output can be read from shared memory while a simulation runs
+    name = 'myokit_beta_test_' + str(os.getpid())
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    s.set_monitor(name, capacity=50)
+    monitors = []
+
+    class Reporter(myokit.ProgressReporter):
+        def enter(self, msg=None):
+            pass
+
+        def exit(self):
+            pass
+
+        def update(self, progress):
+            if not monitors:
+                monitors.append(myokit_beta.Monitor(name))
+            t, state, log, running = monitors[0].read()
+            assert running
+            return True
+
+    d = s.run(1000, log_interval=1, progress=Reporter())
+    with monitors[0] as m:
+        assert 'membrane.V' in m.names()
+        t, state, log, running = m.read()
+        assert not running
+        assert np.array_equal(log['membrane.V'], d['membrane.V'][-50:])
+
+    # The segment is removed after the run
+    try:
+        myokit_beta.Monitor(name)
+        assert False
+    except FileNotFoundError:
+        pass
+
+    # Segments that are in use are not replaced, and pickled copies don't
+    # publish to the same segment
+    from multiprocessing import shared_memory
+    shm = shared_memory.SharedMemory(name=name, create=True, size=100)
+    try:
+        try:
+            s.run(10)
+            assert False
+        except FileExistsError:
+            pass
+        pickle.loads(pickle.dumps(s)).run(10)
+    finally:
+        shm.close()
+        shm.unlink()
+
+
+def test_beat_index():
+    # Beats can be selected from a log
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    d = s.run(2000, log_interval=1)
+    d = s.run(1000, log=d, log_interval=1)
+    index = s.last_beat_index()
+    assert len(index) == 3
+    assert np.array_equal(index.starts(), [100, 1100, 2100])
+    for k in range(3):
+        beat = index.beat(d, k)
+        assert beat.time()[0] == 100 + k * 1000
+        assert len(beat.time()) == (1000 if k < 2 else 900)
+    assert index.range(-1) == (2100, 3000)
+
+    # Indices can be stored
+    path = 'beat_index_test.npz'
+    try:
+        index.save(path)
+        loaded = myokit_beta.BeatIndex.load(path)
+        assert np.array_equal(loaded.starts(), index.starts())
+        assert np.array_equal(loaded.offsets(), index.offsets())
+    finally:
+        os.remove(path)
+
+
+def test_fixed_form_stops():
+    # The solver stops at every jump of a zero-order hold protocol, also when
+    # the jumps are found in later runs
+    p = myokit.TimeSeriesProtocol([0, 10, 20, 30], [0, -80, 0, -80])
+    s = myokit_beta.Simulation()
+    s.set_protocol(p)
+    s.set_interpolation('hold')
+    d = s.run(15, log=['engine.time', 'engine.pace'])
+    d = s.run(25, log=d)
+    times = list(d.time())
+    for t in (10, 20, 30):
+        assert float(t) in times
+    pace = np.array(d['engine.pace'])
+    time = np.array(d.time())
+    assert np.all(pace[(time > 10) & (time < 20)] == -80)
+    assert np.all(pace[(time > 20) & (time < 30)] == 0)
+
+
+def test_interpolation():
+    # Linear, zero-order hold, and monotone cubic interpolation
+    p = myokit.TimeSeriesProtocol([0, 10, 20, 30], [0, 10, 10, 0])
+    s = myokit_beta.Simulation()
+    s.set_protocol(p)
+    paces = {}
+    for method in ('linear', 'hold', 'cubic'):
+        s.reset()
+        s.set_interpolation(method)
+        assert s.interpolation() == method
+        d = s.run(30, log=['engine.time', 'engine.pace'], log_interval=1)
+        paces[method] = np.array(d['engine.pace'])
+    assert paces['linear'][5] == 5
+    assert paces['hold'][5] == 0
+    assert 0 < paces['cubic'][5] < 10
+    assert np.all(paces['cubic'][10:21] == 10)
+    assert np.all(np.diff(paces['cubic'][:11]) >= 0)
+
+    # Simplification only works with linear interpolation
+    s.set_interpolation('linear', tolerance=0.1)
+    for method in ('hold', 'cubic'):
+        try:
+            s.set_interpolation(method, tolerance=0.1)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('Expected a ValueError')
+
+
+def test_mapped_protocol():
+    # Memory-mapped protocols give the same results as in-memory ones
+    times = np.linspace(0, 100, 1001)
+    values = -80 + 40 * np.sin(times / 10)
+    s = myokit_beta.Simulation()
+    s.set_protocol(myokit.TimeSeriesProtocol(list(times), list(values)))
+    d1 = s.run(100, log=['engine.time', 'engine.pace'], log_interval=0.5)
+
+    path = 'mapped_protocol_test.bin'
+    try:
+        p = myokit_beta.MappedTimeSeriesProtocol.write(path, times, values)
+        assert len(p) == len(times)
+        assert np.array_equal(p.times(), times)
+        assert np.array_equal(p.values(), values)
+        assert p.clone().path() == p.path() == os.path.abspath(path)
+        s.reset()
+        s.set_protocol(p)
+        d2 = s.run(100, log=['engine.time', 'engine.pace'], log_interval=0.5)
+        assert np.array_equal(d1['engine.pace'], d2['engine.pace'])
+
+        # Decreasing times are rejected
+        try:
+            myokit_beta.MappedTimeSeriesProtocol.write(
+                path, [0, 2, 1], [0, 0, 0])
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('Expected a ValueError')
+    finally:
+        os.remove(path)
+
+
+def test_simplification():
+    # Simplified protocols stay within the tolerance, and use less memory
+    times = np.linspace(0, 100, 10001)
+    values = -80 + times / 10 + 0.001 * np.sin(times)
+    s = myokit_beta.Simulation()
+    s.set_protocol(myokit.TimeSeriesProtocol(list(times), list(values)))
+    d1 = s.run(100, log=['engine.time', 'engine.pace'], log_interval=0.1)
+    m1 = s.memory_usage()['pacing']
+    s.reset()
+    s.set_interpolation('linear', tolerance=0.01)
+    d2 = s.run(100, log=['engine.time', 'engine.pace'], log_interval=0.1)
+    m2 = s.memory_usage()['pacing']
+    assert m2 < m1
+    error = np.abs(np.array(d1['engine.pace']) - np.array(d2['engine.pace']))
+    assert np.max(error) <= 0.01
+
+
+def test_protocol_period():
+    # Periodic protocols repeat the first period, and then hold the level at
+    # its end
+    p = myokit.TimeSeriesProtocol([0, 5, 10], [0, 10, 2])
+    s = myokit_beta.Simulation()
+    s.set_protocol(p)
+    s.set_protocol_period(10, repeats=3)
+    d = s.run(40, log=['engine.time', 'engine.pace'], log_interval=0.5)
+    pace = np.array(d['engine.pace'])
+    assert np.allclose(pace[0:20], pace[20:40])
+    assert np.allclose(pace[0:20], pace[40:60])
+    assert np.all(pace[60:] == 2)
+    assert pace[10] == 10
+
+    # Invalid periods are rejected
+    for period, repeats in ((0, None), (-1, None), (10, 0)):
+        try:
+            s.set_protocol_period(period, repeats)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('Expected a ValueError')
+    s.set_protocol_period(None)
+
+
+def test_analytic_protocol():
+    # Analytic protocols are evaluated in C, as in Python
+    p = myokit_beta.AnalyticProtocol()
+    p.add_constant(-80)
+    p.add_ramp(0, 0.5, start=10, duration=20)
+    p.add_sine(10, 0.05, start=30, duration=40)
+    p.add_exponential(20, 5, start=70)
+    p.add_chirp(5, 0.01, 0.001, start=40, duration=30)
+    assert len(p) == 5
+    q = p.clone()
+    assert q.components() == p.components()
+    q.add_constant(1)
+    assert len(q) == 6 and len(p) == 5
+    s = myokit_beta.Simulation()
+    s.set_protocol(p)
+    d = s.run(100, log=['engine.time', 'engine.pace'], log_interval=0.5)
+    for t, pace in zip(d.time(), d['engine.pace']):
+        assert abs(pace - p.pace(t)) < 1e-9
+
+    # Components must have a positive duration
+    try:
+        p.add_constant(1, duration=0)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError('Expected a ValueError')
+
+
+def test_beat_states():
+    # The state at the start of every beat can be stored without logging
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    assert s.last_beat_states() is None
+    s.set_beat_states(True)
+    s.pre(3000)
+    starts, states = s.last_beat_states()
+    assert np.array_equal(starts, [100, 1100, 2100])
+    assert states.shape == (3, len(s.state()))
+
+    # The stored states match the logged states
+    s.reset()
+    d = s.run(3000, log=myokit.LOG_STATE + myokit.LOG_BOUND, log_interval=1)
+    starts, states = s.last_beat_states()
+    m = myokit.load_model('example')
+    for k, start in enumerate(starts):
+        i = int(start)
+        for j, x in enumerate(m.states()):
+            assert np.isclose(d[x.qname()][i], states[k, j], rtol=1e-9)
+
+
+def test_fine_logging():
+    # Windows opened by beats are logged with a finer interval
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    s.set_fine_logging(0.1, 5)
+    d = s.run(2000, log=['engine.time', 'membrane.V'], log_interval=10)
+    t = np.array(d.time())
+    for start in (100, 1100):
+        window = t[(t >= start) & (t < start + 5)]
+        assert len(window) >= 49
+        assert np.allclose(np.diff(window), 0.1)
+    assert np.sum((t > 200) & (t < 1000)) < 100
+
+    # Windows are also opened by fast decreases, e.g. in sodium inactivation
+    s.reset()
+    s.set_fine_logging(0.1, 5, beats=False, variable='ina.h', threshold=0.1)
+    d = s.run(1000, log=['engine.time', 'ina.h'], log_interval=10)
+    t = np.array(d.time())
+    assert np.sum((t > 100) & (t < 110)) > 10
+
+    # Negative thresholds are rejected
+    try:
+        s.set_fine_logging(0.1, 5, variable='ina.h', threshold=-1)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError('Expected a ValueError')
+
+
+def test_log_intervals():
+    # Variables can be logged at their own interval
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    s.set_log_intervals({'ica.Ca_i': 10})
+    d = s.run(3000, log=['engine.time', 'membrane.V', 'ica.Ca_i'],
+              log_interval=1)
+    assert len(d['membrane.V']) == 3000
+    assert len(d['ica.Ca_i']) == 300
+    assert np.array_equal(d['time(ica.Ca_i)'], np.arange(0, 3000, 10))
+
+    # Beats are selected from these variables using their own times
+    index = s.last_beat_index()
+    times = np.arange(0, 3000, 10)
+    for k in range(3):
+        beat = index.beat(d, k)
+        t = np.array(beat['time(ica.Ca_i)'])
+        assert len(t) == len(beat['ica.Ca_i'])
+        start = 100 + 1000 * k
+        assert np.array_equal(
+            t, times[(times >= start) & (times < start + 1000)])
+        assert beat.time()[0] == t[0]
+    s.set_log_intervals(None)
+
+
+def test_expressions():
+    # Expressions are logged alongside the variables they are made of
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    d = s.run(1000, log=['engine.time', 'ina.INa', 'ica.ICa'],
+              log_interval=1, expressions={'i_in': 'ina.INa + ica.ICa'})
+    assert np.allclose(
+        d['i_in'], np.array(d['ina.INa']) + np.array(d['ica.ICa']))
+
+    # Expressions are published in shared memory by name
+    name = 'myokit_beta_expr_test_' + str(os.getpid())
+    s.set_monitor(name, capacity=10)
+    names = []
+
+    class Reporter(myokit.ProgressReporter):
+        def enter(self, msg=None):
+            pass
+
+        def exit(self):
+            pass
+
+        def update(self, progress):
+            if not names:
+                with myokit_beta.Monitor(name) as m:
+                    names.extend(m.names())
+            return True
+
+    s.run(100, log=['engine.time'], log_interval=1, progress=Reporter(),
+          expressions={'i_in': 'ina.INa + ica.ICa'})
+    s.set_monitor(None)
+    assert names == ['engine.time', 'i_in']
+
+
+def test_beat_integrals():
+    # Integrals per beat match analytic integrals, and trapezoidal integration
+    # of a finely logged current
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    s.run(2000)
+    n = s.last_number_of_evaluations()
+    s.reset()
+    s.set_beat_integrals({'one': '1', 't': 'engine.time', 'q': 'ica.ICa'})
+    d = s.run(2000, log=['engine.time', 'ica.ICa'], log_interval=0.01)
+    assert s.last_number_of_evaluations() == n
+    q = s.last_beat_integrals()
+    assert np.array_equal(q['start'], [0, 100, 1100])
+    assert np.allclose(q['duration'], [100, 1000, 900])
+    assert np.allclose(q['one'], q['duration'])
+    end = np.array(q['start']) + np.array(q['duration'])
+    assert np.allclose(q['t'], (end**2 - np.array(q['start'])**2) / 2)
+    t, i_ca = np.array(d.time()), np.array(d['ica.ICa'])
+    for k, start in enumerate(q['start']):
+        sel = (t >= start) & (t <= end[k] + 1e-9)
+        x, y = t[sel], i_ca[sel]
+        trapz = np.sum((y[1:] + y[:-1]) * np.diff(x)) / 2
+        assert np.isclose(q['q'][k], trapz, rtol=1e-3, atol=1e-3)
+    s.set_beat_integrals(None)
+
+
+def test_run_batch():
+    # Batches give the same results, in job order, for any number of threads
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+
+    def make_job(g):
+        def job(sim):
+            sim.set_constant('ina.gNa', g)
+            return sim.run(500, log=['engine.time', 'membrane.V'],
+                           log_interval=1)
+        return job
+
+    jobs = [make_job(g) for g in (8, 12, 16, 20, 24, 28)]
+    serial = myokit_beta.run_batch(s, jobs, n_threads=1)
+    parallel = myokit_beta.run_batch(s, jobs, n_threads=4, verify=True)
+    assert len(parallel) == len(jobs)
+    for a, b in zip(serial, parallel):
+        for key in a:
+            assert np.array(a[key]).tobytes() == np.array(b[key]).tobytes()
+    assert serial[0]['membrane.V'] != serial[-1]['membrane.V']
+
+    # The original simulation is not changed
+    assert s.time() == 0
+
+    # Results can be combined in job order
+    peaks = myokit_beta.run_batch(
+        s, [lambda sim, j=j: [max(j(sim)['membrane.V'])] for j in jobs],
+        n_threads=3, combine=lambda a, b: a + b)
+    assert peaks == [max(x['membrane.V']) for x in serial]
+
+    # The first failing job's exception is raised
+    def fail(sim):
+        raise KeyError('fail')
+    try:
+        myokit_beta.run_batch(s, jobs[:2] + [fail], n_threads=2)
+    except KeyError:
+        pass
+    else:
+        raise AssertionError('Expected a KeyError')
+
+
+def test_batch_placement():
+    # Every CPU is on exactly one NUMA node
+    nodes = myokit_beta.numa_nodes()
+    cpus = [cpu for node in nodes for cpu in node]
+    assert len(cpus) == len(set(cpus)) > 0
+
+    # Pinned jobs run on the given CPUs, and give the same results
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+
+    def job(sim):
+        d = sim.run(500, log=['engine.time', 'membrane.V'], log_interval=1)
+        return os.sched_getaffinity(0), list(d['membrane.V'])
+
+    before = os.sched_getaffinity(0)
+    free = myokit_beta.run_batch(s, [job] * 4, n_threads=2)
+    for placement in ('compact', 'scatter', 'node', [{cpus[-1]}]):
+        pinned = myokit_beta.run_batch(
+            s, [job] * 4, n_threads=2, placement=placement)
+        for (a, x), (b, y) in zip(free, pinned):
+            assert x == y
+            assert len(b) >= 1 and b <= set(cpus)
+            if placement == 'compact' or placement == 'scatter':
+                assert len(b) == 1
+        if placement == [{cpus[-1]}]:
+            assert all(b == {cpus[-1]} for b, y in pinned)
+    assert os.sched_getaffinity(0) == before
+
+    try:
+        myokit_beta.run_batch(s, [job], placement='spread')
+    except ValueError:
+        pass
+    else:
+        raise AssertionError('Expected a ValueError')
+
+
+def test_pickle():
+    # Settings are kept when pickling
+    p = myokit.pacing.blocktrain(period=1000, duration=2, offset=100)
+    s = myokit_beta.Simulation(p)
+    s.set_tolerance(1e-6, 1e-8)
+    s.set_log_intervals({'ica.Ca_i': 10})
+    s.set_fine_logging(0.1, 5)
+    s.set_beat_states(True)
+    s.set_beat_integrals({'q': 'ica.ICa'})
+    s.run(500)
+    c = pickle.loads(pickle.dumps(s))
+    log = ['engine.time', 'membrane.V', 'ica.Ca_i']
+    d1 = s.run(1500, log=log, log_interval=1)
+    d2 = c.run(1500, log=log, log_interval=1)
+    for key in d1:
+        assert list(d1[key]) == list(d2[key])
+    assert 'time(ica.Ca_i)' in d2
+    assert np.array_equal(s.last_beat_states()[1], c.last_beat_states()[1])
+    assert list(s.last_beat_integrals()['q']) == list(
+        c.last_beat_integrals()['q'])
+
+
+def test_batch_warnings():
+    # CVODES warnings are raised from solver steps run without the GIL. Here
+    # steps are so small compared to t that t + h = t.
+    p = myokit.load_protocol('example')
+    s = myokit_beta.Simulation(p)
+    s.set_time(1e18)
+
+    def job(sim):
+        try:
+            sim.run(10)
+        except (myokit.SimulationError, ArithmeticError):
+            return 'failed'
+        return 'passed'
+
+    with warnings.catch_warnings(record=True) as caught:
+        warnings.simplefilter('always', RuntimeWarning)
+        results = myokit_beta.run_batch(s, [job] * 8, n_threads=4)
+    assert len(results) == 8
+    assert any('CVODES' in str(w.message) for w in caught)
+
+
+test_dopri5()
+test_rosenbrock()
+test_population()
+test_coupling()
+test_threads()
+test_memory_usage()
+test_log_budget()
+test_compression()
+test_pyramids()
+test_monitor()
+test_beat_index()
+test_fixed_form_stops()
+test_interpolation()
+test_mapped_protocol()
+test_simplification()
+test_protocol_period()
+test_analytic_protocol()
+test_beat_states()
+test_fine_logging()
+test_log_intervals()
+test_expressions()
+test_beat_integrals()
+test_run_batch()
+test_batch_placement()
+test_pickle()
+test_batch_warnings()